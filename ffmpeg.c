@@ -61,6 +61,7 @@
 #include "libavutil/bprint.h"
 #include "libavutil/time.h"
 #include "libavutil/threadmessage.h"
+#include "libavutil/threadpool.h"
 #include "libavcodec/mathops.h"
 #include "libavformat/os_support.h"
 
@@ -164,6 +165,7 @@ static int restore_tty;
 
 #if HAVE_PTHREADS
 static void free_input_threads(void);
+static void free_encoder_threads(void);
 #endif
 
 /* sub2video hack:
@@ -498,6 +500,10 @@ static void ffmpeg_cleanup(int ret)
 
     av_freep(&subtitle_out);
 
+#if HAVE_PTHREADS
+    free_encoder_threads();
+#endif
+
     /* close files */
     for (i = 0; i < nb_output_files; i++) {
         OutputFile *of = output_files[i];
@@ -560,6 +566,7 @@ static void ffmpeg_cleanup(int ret)
         av_frame_free(&ist->sub2video.frame);
         av_freep(&ist->filters);
         av_freep(&ist->hwaccel_device);
+        av_fifo_freep(&ist->thread_decoded);
 
         avcodec_free_context(&ist->dec_ctx);
 
@@ -575,6 +582,8 @@ static void ffmpeg_cleanup(int ret)
     av_freep(&output_streams);
     av_freep(&output_files);
 
+    av_thread_pool_uninit();
+
     uninit_opts();
 
     avformat_network_deinit();
@@ -822,6 +831,254 @@ static int check_recording_time(OutputStream *ost)
     return 1;
 }
 
+/*
+ * Mux a packet returned by the encoder of ost, frame_pts is the pts of the
+ * frame it was encoded from if the encoder has no delay.
+ */
+static void output_encoded_packet(OutputStream *ost, AVPacket *pkt, int64_t frame_pts)
+{
+    AVFormatContext *s = output_files[ost->file_index]->ctx;
+    AVCodecContext *enc = ost->enc_ctx;
+    const char *type = av_get_media_type_string(enc->codec_type);
+    int pkt_size;
+
+    if (enc->codec_type == AVMEDIA_TYPE_VIDEO) {
+        if (debug_ts) {
+            av_log(NULL, AV_LOG_INFO, "encoder -> type:video "
+                   "pkt_pts:%s pkt_pts_time:%s pkt_dts:%s pkt_dts_time:%s\n",
+                   av_ts2str(pkt->pts), av_ts2timestr(pkt->pts, &enc->time_base),
+                   av_ts2str(pkt->dts), av_ts2timestr(pkt->dts, &enc->time_base));
+        }
+
+        if (pkt->pts == AV_NOPTS_VALUE && !(enc->codec->capabilities & AV_CODEC_CAP_DELAY))
+            pkt->pts = frame_pts;
+    }
+
+    av_packet_rescale_ts(pkt, enc->time_base, ost->st->time_base);
+
+    if (debug_ts) {
+        av_log(NULL, AV_LOG_INFO, "encoder -> type:%s "
+               "pkt_pts:%s pkt_pts_time:%s pkt_dts:%s pkt_dts_time:%s\n", type,
+               av_ts2str(pkt->pts), av_ts2timestr(pkt->pts, &ost->st->time_base),
+               av_ts2str(pkt->dts), av_ts2timestr(pkt->dts, &ost->st->time_base));
+    }
+
+    pkt_size = pkt->size;
+    write_frame(s, pkt, ost);
+
+    if (enc->codec_type == AVMEDIA_TYPE_VIDEO && vstats_filename && pkt_size)
+        do_video_stats(ost, pkt_size);
+}
+
+#if HAVE_PTHREADS
+/*
+ * Encoder threads: with several output streams to encode, each encoder runs
+ * on a thread of its own. The main thread sends it the frames and muxes the
+ * packets coming back in the order the frames were sent, so the output does
+ * not depend on the speed of the threads. A stream has at most
+ * ENC_QUEUE_SIZE frames in flight, beyond that the oldest frames sent to any
+ * encoder are muxed first.
+ */
+#define ENC_QUEUE_SIZE 8
+
+typedef struct EncoderJob {
+    OutputStream *ost;
+    int flush;                  /* drain the encoder, returns several packets */
+} EncoderJob;
+
+typedef struct EncoderOutput {
+    AVPacket pkt;
+    int got_packet;
+    int ret;
+    int64_t frame_pts;
+} EncoderOutput;
+
+/* jobs sent to the encoder threads and not muxed yet, oldest first */
+static AVFifoBuffer *encoder_jobs;
+
+static void *encoder_thread(void *arg)
+{
+    OutputStream *ost = arg;
+    AVCodecContext *enc = ost->enc_ctx;
+    int (*encode)(AVCodecContext*, AVPacket*, const AVFrame*, int*) =
+        enc->codec_type == AVMEDIA_TYPE_VIDEO ? avcodec_encode_video2 :
+                                                avcodec_encode_audio2;
+    AVFrame *frame;
+    int ret = 0;
+
+    while (ret >= 0 &&
+           av_thread_message_queue_recv(ost->enc_in_queue, &frame, 0) >= 0) {
+        EncoderOutput out;
+
+        do {
+            memset(&out, 0, sizeof(out));
+            av_init_packet(&out.pkt);
+            out.frame_pts = frame ? frame->pts : AV_NOPTS_VALUE;
+            out.ret = ret = encode(enc, &out.pkt, frame, &out.got_packet);
+            if (ret >= 0 && out.got_packet && !out.pkt.buf)
+                out.ret = ret = av_dup_packet(&out.pkt);
+            if (ret >= 0 && ost->logfile && enc->stats_out &&
+                (out.got_packet || !frame))
+                fprintf(ost->logfile, "%s", enc->stats_out);
+            if (av_thread_message_queue_send(ost->enc_out_queue, &out, 0) < 0) {
+                av_free_packet(&out.pkt);
+                ret = AVERROR_EXIT;
+            }
+        } while (!frame && ret >= 0 && out.got_packet);
+        av_frame_free(&frame);
+    }
+    av_thread_message_queue_set_err_recv(ost->enc_out_queue, AVERROR_EOF);
+    return NULL;
+}
+
+/* Mux the packets of the oldest job sent to an encoder thread. */
+static void mux_oldest_encoder_job(void)
+{
+    EncoderJob job;
+    EncoderOutput out;
+    OutputStream *ost;
+    int ret;
+
+    av_fifo_generic_read(encoder_jobs, &job, sizeof(job), NULL);
+    ost = job.ost;
+
+    do {
+        ret = av_thread_message_queue_recv(ost->enc_out_queue, &out, 0);
+        if (ret >= 0)
+            ret = out.ret;
+        if (ret < 0) {
+            av_log(NULL, AV_LOG_FATAL, "%s encoding failed: %s\n",
+                   ost->enc_ctx->codec_type == AVMEDIA_TYPE_VIDEO ? "Video" : "Audio",
+                   av_err2str(ret));
+            exit_program(1);
+        }
+        if (!out.got_packet)
+            break;
+        if (job.flush && (ost->finished & MUXER_FINISHED))
+            av_free_packet(&out.pkt);
+        else
+            output_encoded_packet(ost, &out.pkt, out.frame_pts);
+    } while (job.flush);
+
+    ost->enc_in_flight--;
+}
+
+static void mux_encoder_jobs(void)
+{
+    while (encoder_jobs && av_fifo_size(encoder_jobs))
+        mux_oldest_encoder_job();
+}
+
+/* Send a frame to the encoder thread of ost, NULL to flush the encoder. */
+static void send_to_encoder_thread(OutputStream *ost, AVFrame *frame)
+{
+    EncoderJob job = { ost, !frame };
+    AVFrame *f = NULL;
+    int ret;
+
+    while (ost->enc_in_flight >= ENC_QUEUE_SIZE)
+        mux_oldest_encoder_job();
+
+    if (frame && !(f = av_frame_clone(frame))) {
+        av_log(NULL, AV_LOG_FATAL, "Could not send frame to the encoder thread\n");
+        exit_program(1);
+    }
+    ret = av_thread_message_queue_send(ost->enc_in_queue, &f, 0);
+    if (ret < 0) {
+        av_frame_free(&f);
+        av_log(NULL, AV_LOG_FATAL, "Could not send frame to the encoder thread: %s\n",
+               av_err2str(ret));
+        exit_program(1);
+    }
+    av_fifo_generic_write(encoder_jobs, &job, sizeof(job), NULL);
+    ost->enc_in_flight++;
+    if (frame && frame->pts != AV_NOPTS_VALUE)
+        ost->enc_sent_pts = frame->pts;
+}
+
+static int use_encoder_thread(OutputStream *ost)
+{
+    AVFormatContext *os = output_files[ost->file_index]->ctx;
+    AVCodecContext *enc = ost->enc_ctx;
+
+    if (!ost->encoding_needed)
+        return 0;
+    if (enc->codec_type != AVMEDIA_TYPE_AUDIO &&
+        enc->codec_type != AVMEDIA_TYPE_VIDEO)
+        return 0;
+    /* the raw picture path passes the frame itself to the muxer */
+    if (enc->codec_type == AVMEDIA_TYPE_VIDEO && (os->oformat->flags & AVFMT_RAWPICTURE) &&
+        enc->codec->id == AV_CODEC_ID_RAWVIDEO)
+        return 0;
+    return 1;
+}
+
+static void free_encoder_threads(void)
+{
+    int i;
+
+    for (i = 0; i < nb_output_streams; i++) {
+        OutputStream *ost = output_streams[i];
+        EncoderOutput out;
+        AVFrame *frame;
+
+        if (!ost || !ost->enc_in_queue)
+            continue;
+
+        av_thread_message_queue_set_err_send(ost->enc_out_queue, AVERROR_EOF);
+        av_thread_message_queue_set_err_recv(ost->enc_in_queue, AVERROR_EOF);
+        while (av_thread_message_queue_recv(ost->enc_in_queue, &frame, 0) >= 0)
+            av_frame_free(&frame);
+        pthread_join(ost->enc_thread, NULL);
+        while (av_thread_message_queue_recv(ost->enc_out_queue, &out, 0) >= 0)
+            av_free_packet(&out.pkt);
+
+        av_thread_message_queue_free(&ost->enc_in_queue);
+        av_thread_message_queue_free(&ost->enc_out_queue);
+        ost->enc_in_flight = 0;
+    }
+    av_fifo_freep(&encoder_jobs);
+}
+
+static int init_encoder_threads(void)
+{
+    int i, ret, nb_threads = 0;
+
+    for (i = 0; i < nb_output_streams; i++)
+        nb_threads += use_encoder_thread(output_streams[i]);
+    if (nb_threads < 2)
+        return 0;
+
+    encoder_jobs = av_fifo_alloc_array(nb_threads * ENC_QUEUE_SIZE, sizeof(EncoderJob));
+    if (!encoder_jobs)
+        return AVERROR(ENOMEM);
+
+    for (i = 0; i < nb_output_streams; i++) {
+        OutputStream *ost = output_streams[i];
+
+        if (!use_encoder_thread(ost))
+            continue;
+        ost->enc_sent_pts = AV_NOPTS_VALUE;
+
+        if ((ret = av_thread_message_queue_alloc(&ost->enc_in_queue,
+                                                 ENC_QUEUE_SIZE, sizeof(AVFrame *))) < 0 ||
+            (ret = av_thread_message_queue_alloc(&ost->enc_out_queue,
+                                                 ENC_QUEUE_SIZE, sizeof(EncoderOutput))) < 0) {
+            av_thread_message_queue_free(&ost->enc_in_queue);
+            return ret;
+        }
+
+        if ((ret = pthread_create(&ost->enc_thread, NULL, encoder_thread, ost))) {
+            av_log(NULL, AV_LOG_ERROR, "pthread_create failed: %s. Try to increase `ulimit -v` or decrease `ulimit -s`.\n", strerror(ret));
+            av_thread_message_queue_free(&ost->enc_in_queue);
+            av_thread_message_queue_free(&ost->enc_out_queue);
+            return AVERROR(ret);
+        }
+    }
+    return 0;
+}
+#endif
+
 static void do_audio_out(AVFormatContext *s, OutputStream *ost,
                          AVFrame *frame)
 {
@@ -843,7 +1100,6 @@ static void do_audio_out(AVFormatContext *s, OutputStream *ost,
     ost->frames_encoded++;
 
     av_assert0(pkt.size || !pkt.data);
-    update_benchmark(NULL);
     if (debug_ts) {
         av_log(NULL, AV_LOG_INFO, "encoder <- type:audio "
                "frame_pts:%s frame_pts_time:%s time_base:%d/%d\n",
@@ -851,24 +1107,22 @@ static void do_audio_out(AVFormatContext *s, OutputStream *ost,
                enc->time_base.num, enc->time_base.den);
     }
 
+#if HAVE_PTHREADS
+    if (ost->enc_in_queue) {
+        send_to_encoder_thread(ost, frame);
+        return;
+    }
+#endif
+
+    update_benchmark(NULL);
     if (avcodec_encode_audio2(enc, &pkt, frame, &got_packet) < 0) {
         av_log(NULL, AV_LOG_FATAL, "Audio encoding failed (avcodec_encode_audio2)\n");
         exit_program(1);
     }
     update_benchmark("encode_audio %d.%d", ost->file_index, ost->index);
 
-    if (got_packet) {
-        av_packet_rescale_ts(&pkt, enc->time_base, ost->st->time_base);
-
-        if (debug_ts) {
-            av_log(NULL, AV_LOG_INFO, "encoder -> type:audio "
-                   "pkt_pts:%s pkt_pts_time:%s pkt_dts:%s pkt_dts_time:%s\n",
-                   av_ts2str(pkt.pts), av_ts2timestr(pkt.pts, &ost->st->time_base),
-                   av_ts2str(pkt.dts), av_ts2timestr(pkt.dts, &ost->st->time_base));
-        }
-
-        write_frame(s, &pkt, ost);
-    }
+    if (got_packet)
+        output_encoded_packet(ost, &pkt, frame->pts);
 }
 
 static void do_subtitle_out(AVFormatContext *s,
@@ -967,7 +1221,6 @@ static void do_video_out(AVFormatContext *s,
     int nb_frames, nb0_frames, i;
     double delta, delta0;
     double duration = 0;
-    int frame_size = 0;
     InputStream *ist = NULL;
     AVFilterContext *filter = ost->filter->filter;
 
@@ -1200,39 +1453,26 @@ static void do_video_out(AVFormatContext *s,
 
         ost->frames_encoded++;
 
-        ret = avcodec_encode_video2(enc, &pkt, in_picture, &got_packet);
-        update_benchmark("encode_video %d.%d", ost->file_index, ost->index);
-        if (ret < 0) {
-            av_log(NULL, AV_LOG_FATAL, "Video encoding failed\n");
-            exit_program(1);
-        }
-
-        if (got_packet) {
-            if (debug_ts) {
-                av_log(NULL, AV_LOG_INFO, "encoder -> type:video "
-                       "pkt_pts:%s pkt_pts_time:%s pkt_dts:%s pkt_dts_time:%s\n",
-                       av_ts2str(pkt.pts), av_ts2timestr(pkt.pts, &enc->time_base),
-                       av_ts2str(pkt.dts), av_ts2timestr(pkt.dts, &enc->time_base));
-            }
-
-            if (pkt.pts == AV_NOPTS_VALUE && !(enc->codec->capabilities & AV_CODEC_CAP_DELAY))
-                pkt.pts = ost->sync_opts;
-
-            av_packet_rescale_ts(&pkt, enc->time_base, ost->st->time_base);
-
-            if (debug_ts) {
-                av_log(NULL, AV_LOG_INFO, "encoder -> type:video "
-                    "pkt_pts:%s pkt_pts_time:%s pkt_dts:%s pkt_dts_time:%s\n",
-                    av_ts2str(pkt.pts), av_ts2timestr(pkt.pts, &ost->st->time_base),
-                    av_ts2str(pkt.dts), av_ts2timestr(pkt.dts, &ost->st->time_base));
+#if HAVE_PTHREADS
+        if (ost->enc_in_queue) {
+            send_to_encoder_thread(ost, in_picture);
+        } else
+#endif
+        {
+            ret = avcodec_encode_video2(enc, &pkt, in_picture, &got_packet);
+            update_benchmark("encode_video %d.%d", ost->file_index, ost->index);
+            if (ret < 0) {
+                av_log(NULL, AV_LOG_FATAL, "Video encoding failed\n");
+                exit_program(1);
             }
 
-            frame_size = pkt.size;
-            write_frame(s, &pkt, ost);
+            if (got_packet) {
+                /* if two pass, output log */
+                if (ost->logfile && enc->stats_out) {
+                    fprintf(ost->logfile, "%s", enc->stats_out);
+                }
 
-            /* if two pass, output log */
-            if (ost->logfile && enc->stats_out) {
-                fprintf(ost->logfile, "%s", enc->stats_out);
+                output_encoded_packet(ost, &pkt, ost->sync_opts);
             }
         }
     }
@@ -1243,9 +1483,6 @@ static void do_video_out(AVFormatContext *s,
      * flush, we need to limit them here, before they go into encoder.
      */
     ost->frame_number++;
-
-    if (vstats_filename && frame_size)
-        do_video_stats(ost, frame_size);
   }
 
     if (!ost->last_frame)
@@ -1725,6 +1962,13 @@ static void flush_encoders(void)
         if (enc->codec_type == AVMEDIA_TYPE_VIDEO && (os->oformat->flags & AVFMT_RAWPICTURE) && enc->codec->id == AV_CODEC_ID_RAWVIDEO)
             continue;
 
+#if HAVE_PTHREADS
+        if (ost->enc_in_queue) {
+            send_to_encoder_thread(ost, NULL);
+            continue;
+        }
+#endif
+
         for (;;) {
             int (*encode)(AVCodecContext*, AVPacket*, const AVFrame*, int*) = NULL;
             const char *desc;
@@ -1782,6 +2026,10 @@ static void flush_encoders(void)
                 break;
         }
     }
+
+#if HAVE_PTHREADS
+    mux_encoder_jobs();
+#endif
 }
 
 /*
@@ -1936,11 +2184,158 @@ int guess_input_channel_layout(InputStream *ist)
     return 1;
 }
 
+static void get_decoder_params(DecoderParams *p, const AVCodecContext *avctx)
+{
+    p->width               = avctx->width;
+    p->height              = avctx->height;
+    p->pix_fmt             = avctx->pix_fmt;
+    p->sample_aspect_ratio = avctx->sample_aspect_ratio;
+    p->has_b_frames        = avctx->has_b_frames;
+    p->framerate           = avctx->framerate;
+    p->ticks_per_frame     = avctx->ticks_per_frame;
+}
+
+/* call the decoder, from the thread owning its context */
+static int call_decoder(InputStream *ist, AVFrame *frame, int *got_output,
+                        AVPacket *pkt, DecoderParams *params)
+{
+    AVCodecContext *avctx = ist->dec_ctx;
+    int ret;
+
+    if (avctx->codec_type == AVMEDIA_TYPE_VIDEO) {
+        ret = avcodec_decode_video2(avctx, frame, got_output, pkt);
+    } else {
+        ret = avcodec_decode_audio4(avctx, frame, got_output, pkt);
+        if (ret >= 0 && *got_output && !frame->channel_layout &&
+            guess_input_channel_layout(ist))
+            frame->channel_layout = avctx->channel_layout;
+    }
+    get_decoder_params(params, avctx);
+    return ret;
+}
+
+#if HAVE_PTHREADS
+typedef struct InputThreadMessage {
+    /* the demuxed packet, or for decoder output the stream index and the
+     * timestamps the decoder was called with */
+    AVPacket pkt;
+    int decoded;
+    AVFrame *frame;
+    int ret;
+    int got_output;
+    int64_t nb_packet;
+    DecoderParams params;
+} InputThreadMessage;
+
+/* hand a frame back to the input thread for reuse */
+static void recycle_input_frame(InputFile *f, AVFrame **frame)
+{
+    if (!*frame)
+        return;
+    av_frame_unref(*frame);
+    if (!f->frame_pool ||
+        av_thread_message_queue_send(f->frame_pool, frame,
+                                     AV_THREAD_MESSAGE_NONBLOCK) < 0)
+        av_frame_free(frame);
+    *frame = NULL;
+}
+
+/* drop the decoder output of the current packet not consumed yet */
+static void release_thread_decoded(InputStream *ist)
+{
+    InputFile *f = input_files[ist->file_index];
+    InputThreadMessage msg;
+
+    while (ist->thread_decoded &&
+           av_fifo_size(ist->thread_decoded) >= sizeof(msg)) {
+        av_fifo_generic_read(ist->thread_decoded, &msg, sizeof(msg), NULL);
+        recycle_input_frame(f, &msg.frame);
+    }
+}
+#endif
+
+/* map a timestamp the input thread passed to the decoder for packet
+ * nb_packet to the one process_input() made of it */
+static int64_t map_thread_ts(InputStream *ist, int64_t nb_packet, int64_t ts)
+{
+    PacketTimestamps *t = &ist->ts_map[nb_packet % TS_MAP_SIZE];
+
+    if (ts == AV_NOPTS_VALUE || !ist->thread_cur_packet)
+        return ts;
+    if (t->nb_packet != nb_packet)
+        t = &ist->ts_map[ist->thread_cur_packet % TS_MAP_SIZE];
+
+    if (ts == t->raw_pts)
+        return t->pts;
+    if (t->raw_pts != AV_NOPTS_VALUE && t->pts != AV_NOPTS_VALUE)
+        return t->pts + llrint((ts - t->raw_pts) * ist->ts_scale);
+    if (t->raw_dts != AV_NOPTS_VALUE && t->dts != AV_NOPTS_VALUE)
+        return t->dts + llrint((ts - t->raw_dts) * ist->ts_scale);
+    return AV_NOPTS_VALUE;
+}
+
+/* decode pkt, or take what the input thread already decoded from it */
+static int decode_frame(InputStream *ist, AVFrame *frame, int *got_output,
+                        AVPacket *pkt)
+{
+    int64_t raw_pts, raw_dts, best_effort_timestamp;
+    int ret;
+#if HAVE_PTHREADS
+    InputFile *f = input_files[ist->file_index];
+
+    if (ist->decode_in_thread && !f->thread_done && !f->joined) {
+        InputThreadMessage msg;
+
+        *got_output = 0;
+        if (av_fifo_size(ist->thread_decoded) < sizeof(msg))
+            return pkt->size;
+        av_fifo_generic_read(ist->thread_decoded, &msg, sizeof(msg), NULL);
+
+        if (msg.nb_packet != ist->thread_cur_packet) {
+            PacketTimestamps *t = &ist->ts_map[msg.nb_packet % TS_MAP_SIZE];
+
+            t->nb_packet = msg.nb_packet;
+            t->raw_pts   = msg.pkt.pts;
+            t->raw_dts   = msg.pkt.dts;
+            t->pts       = pkt->pts;
+            t->dts       = pkt->dts;
+            ist->thread_cur_packet = msg.nb_packet;
+        }
+
+        ist->dec_params = msg.params;
+        ret = msg.ret;
+        if (ret >= 0 && msg.got_output) {
+            av_frame_move_ref(frame, msg.frame);
+            *got_output = 1;
+        }
+        recycle_input_frame(f, &msg.frame);
+    } else
+#endif
+    ret = call_decoder(ist, frame, got_output, pkt, &ist->dec_params);
+
+    if (!ist->decode_in_thread || ret < 0 || !*got_output)
+        return ret;
+
+    raw_pts = frame->pkt_pts;
+    raw_dts = frame->pkt_dts;
+    best_effort_timestamp = av_frame_get_best_effort_timestamp(frame);
+
+    frame->pkt_pts = map_thread_ts(ist, frame->reordered_opaque, raw_pts);
+    frame->pkt_dts = pkt->dts;
+    if (best_effort_timestamp == raw_pts)
+        best_effort_timestamp = frame->pkt_pts;
+    else if (best_effort_timestamp == raw_dts)
+        best_effort_timestamp = frame->pkt_dts;
+    av_frame_set_best_effort_timestamp(frame, best_effort_timestamp);
+
+    return ret;
+}
+
 static int decode_audio(InputStream *ist, AVPacket *pkt, int *got_output)
 {
     AVFrame *decoded_frame, *f;
     AVCodecContext *avctx = ist->dec_ctx;
-    int i, ret, err = 0, resample_changed;
+    int i, ret, err = 0, resample_changed, channels;
     AVRational decoded_frame_tb;
 
     if (!ist->decoded_frame && !(ist->decoded_frame = av_frame_alloc()))
@@ -1950,11 +2345,13 @@ static int decode_audio(InputStream *ist, AVPacket *pkt, int *got_output)
     decoded_frame = ist->decoded_frame;
 
     update_benchmark(NULL);
-    ret = avcodec_decode_audio4(avctx, decoded_frame, got_output, pkt);
+    ret = decode_frame(ist, decoded_frame, got_output, pkt);
     update_benchmark("decode_audio %d.%d", ist->file_index, ist->st->index);
 
-    if (ret >= 0 && avctx->sample_rate <= 0) {
-        av_log(avctx, AV_LOG_ERROR, "Sample rate %d invalid\n", avctx->sample_rate);
+    /* The decoder context may be in use by the input thread, the audio
+     * parameters are taken from the frame. */
+    if (ret >= 0 && *got_output && decoded_frame->sample_rate <= 0) {
+        av_log(avctx, AV_LOG_ERROR, "Sample rate %d invalid\n", decoded_frame->sample_rate);
         ret = AVERROR_INVALIDDATA;
     }
 
@@ -1974,29 +2371,30 @@ static int decode_audio(InputStream *ist, AVPacket *pkt, int *got_output)
     /* increment next_dts to use for the case where the input stream does not
        have timestamps or there are multiple frames in the packet */
     ist->next_pts += ((int64_t)AV_TIME_BASE * decoded_frame->nb_samples) /
-                     avctx->sample_rate;
+                     decoded_frame->sample_rate;
     ist->next_dts += ((int64_t)AV_TIME_BASE * decoded_frame->nb_samples) /
-                     avctx->sample_rate;
+                     decoded_frame->sample_rate;
 #endif
 
+    channels = av_frame_get_channels(decoded_frame);
     resample_changed = ist->resample_sample_fmt     != decoded_frame->format         ||
-                       ist->resample_channels       != avctx->channels               ||
+                       ist->resample_channels       != channels                      ||
                        ist->resample_channel_layout != decoded_frame->channel_layout ||
                        ist->resample_sample_rate    != decoded_frame->sample_rate;
     if (resample_changed) {
         char layout1[64], layout2[64];
 
-        if (!guess_input_channel_layout(ist)) {
+        /* call_decoder() has guessed it if it could */
+        if (!decoded_frame->channel_layout) {
             av_log(NULL, AV_LOG_FATAL, "Unable to find default channel "
                    "layout for Input Stream #%d.%d\n", ist->file_index,
                    ist->st->index);
             exit_program(1);
         }
-        decoded_frame->channel_layout = avctx->channel_layout;
 
         av_get_channel_layout_string(layout1, sizeof(layout1), ist->resample_channels,
                                      ist->resample_channel_layout);
-        av_get_channel_layout_string(layout2, sizeof(layout2), avctx->channels,
+        av_get_channel_layout_string(layout2, sizeof(layout2), channels,
                                      decoded_frame->channel_layout);
 
         av_log(NULL, AV_LOG_INFO,
@@ -2005,12 +2403,12 @@ static int decode_audio(InputStream *ist, AVPacket *pkt, int *got_output)
                ist->resample_sample_rate,  av_get_sample_fmt_name(ist->resample_sample_fmt),
                ist->resample_channels, layout1,
                decoded_frame->sample_rate, av_get_sample_fmt_name(decoded_frame->format),
-               avctx->channels, layout2);
+               channels, layout2);
 
         ist->resample_sample_fmt     = decoded_frame->format;
         ist->resample_sample_rate    = decoded_frame->sample_rate;
         ist->resample_channel_layout = decoded_frame->channel_layout;
-        ist->resample_channels       = avctx->channels;
+        ist->resample_channels       = channels;
 
         for (i = 0; i < nb_filtergraphs; i++)
             if (ist_in_filtergraph(filtergraphs[i], ist)) {
@@ -2040,8 +2438,8 @@ static int decode_audio(InputStream *ist, AVPacket *pkt, int *got_output)
     pkt->pts           = AV_NOPTS_VALUE;
     if (decoded_frame->pts != AV_NOPTS_VALUE)
         decoded_frame->pts = av_rescale_delta(decoded_frame_tb, decoded_frame->pts,
-                                              (AVRational){1, avctx->sample_rate}, decoded_frame->nb_samples, &ist->filter_in_rescale_delta_last,
-                                              (AVRational){1, avctx->sample_rate});
+                                              (AVRational){1, decoded_frame->sample_rate}, decoded_frame->nb_samples, &ist->filter_in_rescale_delta_last,
+                                              (AVRational){1, decoded_frame->sample_rate});
     for (i = 0; i < ist->nb_filters; i++) {
         if (i < ist->nb_filters - 1) {
             f = ist->filter_frame;
@@ -2079,22 +2477,21 @@ static int decode_video(InputStream *ist, AVPacket *pkt, int *got_output)
     pkt->dts  = av_rescale_q(ist->dts, AV_TIME_BASE_Q, ist->st->time_base);
 
     update_benchmark(NULL);
-    ret = avcodec_decode_video2(ist->dec_ctx,
-                                decoded_frame, got_output, pkt);
+    ret = decode_frame(ist, decoded_frame, got_output, pkt);
     update_benchmark("decode_video %d.%d", ist->file_index, ist->st->index);
 
     // The following line may be required in some cases where there is no parser
     // or the parser does not has_b_frames correctly
-    if (ist->st->codec->has_b_frames < ist->dec_ctx->has_b_frames) {
+    if (ist->st->codec->has_b_frames < ist->dec_params.has_b_frames) {
         if (ist->dec_ctx->codec_id == AV_CODEC_ID_H264) {
-            ist->st->codec->has_b_frames = ist->dec_ctx->has_b_frames;
+            ist->st->codec->has_b_frames = ist->dec_params.has_b_frames;
         } else
             av_log(ist->dec_ctx, AV_LOG_WARNING,
                    "has_b_frames is larger in decoder than demuxer %d > %d.\n"
                    "If you want to help, upload a sample "
                    "of this file to ftp://upload.ffmpeg.org/incoming/ "
                    "and contact the ffmpeg-devel mailing list. (ffmpeg-devel@ffmpeg.org)",
-                   ist->dec_ctx->has_b_frames,
+                   ist->dec_params.has_b_frames,
                    ist->st->codec->has_b_frames);
     }
 
@@ -2105,16 +2502,16 @@ static int decode_video(InputStream *ist, AVPacket *pkt, int *got_output)
         exit_program(1);
 
     if (*got_output && ret >= 0) {
-        if (ist->dec_ctx->width  != decoded_frame->width ||
-            ist->dec_ctx->height != decoded_frame->height ||
-            ist->dec_ctx->pix_fmt != decoded_frame->format) {
+        if (ist->dec_params.width   != decoded_frame->width  ||
+            ist->dec_params.height  != decoded_frame->height ||
+            ist->dec_params.pix_fmt != decoded_frame->format) {
             av_log(NULL, AV_LOG_DEBUG, "Frame parameters mismatch context %d,%d,%d != %d,%d,%d\n",
                 decoded_frame->width,
                 decoded_frame->height,
                 decoded_frame->format,
-                ist->dec_ctx->width,
-                ist->dec_ctx->height,
-                ist->dec_ctx->pix_fmt);
+                ist->dec_params.width,
+                ist->dec_params.height,
+                ist->dec_params.pix_fmt);
         }
     }
 
@@ -2126,6 +2523,7 @@ static int decode_video(InputStream *ist, AVPacket *pkt, int *got_output)
 
     ist->frames_decoded++;
 
+    /* hwaccel streams are always decoded here, see init_input_threads() */
     if (ist->hwaccel_retrieve_data && decoded_frame->format == ist->hwaccel_pix_fmt) {
         err = ist->hwaccel_retrieve_data(ist->dec_ctx, decoded_frame);
         if (err < 0)
@@ -2286,7 +2684,7 @@ static int process_input_packet(InputStream *ist, const AVPacket *pkt)
 
     AVPacket avpkt;
     if (!ist->saw_first_ts) {
-        ist->dts = ist->st->avg_frame_rate.num ? - ist->dec_ctx->has_b_frames * AV_TIME_BASE / av_q2d(ist->st->avg_frame_rate) : 0;
+        ist->dts = ist->st->avg_frame_rate.num ? - ist->dec_params.has_b_frames * AV_TIME_BASE / av_q2d(ist->st->avg_frame_rate) : 0;
         ist->pts = 0;
         if (pkt && pkt->pts != AV_NOPTS_VALUE && !ist->decoding_needed) {
             ist->dts += av_rescale_q(pkt->pts, ist->st->time_base, AV_TIME_BASE_Q);
@@ -2339,11 +2737,11 @@ static int process_input_packet(InputStream *ist, const AVPacket *pkt)
             ret = decode_video    (ist, &avpkt, &got_output);
             if (avpkt.duration) {
                 duration = av_rescale_q(avpkt.duration, ist->st->time_base, AV_TIME_BASE_Q);
-            } else if(ist->dec_ctx->framerate.num != 0 && ist->dec_ctx->framerate.den != 0) {
-                int ticks= av_stream_get_parser(ist->st) ? av_stream_get_parser(ist->st)->repeat_pict+1 : ist->dec_ctx->ticks_per_frame;
+            } else if(ist->dec_params.framerate.num != 0 && ist->dec_params.framerate.den != 0) {
+                int ticks= av_stream_get_parser(ist->st) ? av_stream_get_parser(ist->st)->repeat_pict+1 : ist->dec_params.ticks_per_frame;
                 duration = ((int64_t)AV_TIME_BASE *
-                                ist->dec_ctx->framerate.den * ticks) /
-                                ist->dec_ctx->framerate.num / ist->dec_ctx->ticks_per_frame;
+                                ist->dec_params.framerate.den * ticks) /
+                                ist->dec_params.framerate.num / ist->dec_params.ticks_per_frame;
             } else
                 duration = 0;
 
@@ -2531,6 +2929,23 @@ static int get_buffer(AVCodecContext *s, AVFrame *frame, int flags)
     return avcodec_default_get_buffer2(s, frame, flags);
 }
 
+/* With -threads_total the codecs split the budget, their slice jobs run on
+ * the shared pool and frame threading gets threads of its own. */
+static void set_codec_threads(AVDictionary **opts)
+{
+    int i, nb_codecs = 0;
+
+    if (!threads_total) {
+        av_dict_set(opts, "threads", "auto", 0);
+        return;
+    }
+    for (i = 0; i < nb_input_streams; i++)
+        nb_codecs += !!input_streams[i]->decoding_needed;
+    for (i = 0; i < nb_output_streams; i++)
+        nb_codecs += !!output_streams[i]->encoding_needed;
+    av_dict_set_int(opts, "threads", FFMAX(1, threads_total / FFMAX(nb_codecs, 1)), 0);
+}
+
 static int init_input_stream(int ist_index, char *error, int error_len)
 {
     int ret;
@@ -2558,7 +2973,7 @@ static int init_input_stream(int ist_index, char *error, int error_len)
         }
 
         if (!av_dict_get(ist->decoder_opts, "threads", NULL, 0))
-            av_dict_set(&ist->decoder_opts, "threads", "auto", 0);
+            set_codec_threads(&ist->decoder_opts);
         if ((ret = avcodec_open2(ist->dec_ctx, codec, &ist->decoder_opts)) < 0) {
             if (ret == AVERROR_EXPERIMENTAL)
                 abort_codec_experimental(codec, 0);
@@ -2571,6 +2986,7 @@ static int init_input_stream(int ist_index, char *error, int error_len)
         }
         assert_avoptions(ist->decoder_opts);
     }
+    get_decoder_params(&ist->dec_params, ist->dec_ctx);
 
     ist->next_pts = AV_NOPTS_VALUE;
     ist->next_dts = AV_NOPTS_VALUE;
@@ -2611,7 +3027,7 @@ static int init_output_stream(OutputStream *ost, char *error, int error_len)
             ost->enc_ctx->subtitle_header_size = dec->subtitle_header_size;
         }
         if (!av_dict_get(ost->encoder_opts, "threads", NULL, 0))
-            av_dict_set(&ost->encoder_opts, "threads", "auto", 0);
+            set_codec_threads(&ost->encoder_opts);
         av_dict_set(&ost->encoder_opts, "side_data_only_packets", "1", 0);
         if (ost->enc->type == AVMEDIA_TYPE_AUDIO &&
             !codec->defaults &&
@@ -3378,6 +3794,14 @@ static OutputStream *choose_output(void)
         OutputStream *ost = output_streams[i];
         int64_t opts = av_rescale_q(ost->st->cur_dts, ost->st->time_base,
                                     AV_TIME_BASE_Q);
+#if HAVE_PTHREADS
+        /* the packets of an encoder thread are muxed late, so that the
+         * choice does not depend on the timing of the threads use the
+         * frames it was sent */
+        if (ost->enc_in_queue && ost->enc_sent_pts != AV_NOPTS_VALUE)
+            opts = av_rescale_q(ost->enc_sent_pts, ost->enc_ctx->time_base,
+                                AV_TIME_BASE_Q);
+#endif
         if (!ost->finished && opts < opts_min) {
             opts_min = opts;
             ost_min  = ost->unavailable ? NULL : ost;
@@ -3493,7 +3917,98 @@ static int check_keyboard_interaction(int64_t cur_time)
     return 0;
 }
 
+/* add the stream-global side data to the first packet of the stream */
+static int add_stream_side_data(InputStream *ist, AVPacket *pkt)
+{
+    int i;
+
+    if (ist->st->nb_side_data)
+        av_packet_split_side_data(pkt);
+    for (i = 0; i < ist->st->nb_side_data; i++) {
+        AVPacketSideData *src_sd = &ist->st->side_data[i];
+        uint8_t *dst_data;
+
+        if (av_packet_get_side_data(pkt, src_sd->type, NULL))
+            continue;
+        if (ist->autorotate && src_sd->type == AV_PKT_DATA_DISPLAYMATRIX)
+            continue;
+
+        dst_data = av_packet_new_side_data(pkt, src_sd->type, src_sd->size);
+        if (!dst_data)
+            return AVERROR(ENOMEM);
+
+        memcpy(dst_data, src_sd->data, src_sd->size);
+    }
+    return 0;
+}
+
 #if HAVE_PTHREADS
+static int send_input_message(InputFile *f, InputThreadMessage *msg,
+                              unsigned *flags)
+{
+    int ret = av_thread_message_queue_send(f->in_thread_queue, msg, *flags);
+
+    if (*flags && ret == AVERROR(EAGAIN)) {
+        *flags = 0;
+        ret = av_thread_message_queue_send(f->in_thread_queue, msg, *flags);
+        av_log(f->ctx, AV_LOG_WARNING,
+               "Thread message queue blocking; consider raising the "
+               "thread_queue_size option (current value: %d)\n",
+               f->thread_queue_size);
+    }
+    return ret;
+}
+
+/*
+ * Decode pkt the way process_input_packet() would and send each decoder
+ * call's result ahead of the packet. The frames carry the packet number in
+ * reordered_opaque, so the main thread can map their timestamps once it has
+ * corrected the packet ones.
+ */
+static int decode_packet_in_thread(InputFile *f, InputStream *ist,
+                                   AVPacket *pkt, unsigned *flags)
+{
+    AVPacket avpkt = *pkt;
+    int ret;
+
+    ist->dec_ctx->reordered_opaque = ++ist->thread_nb_packets;
+
+    while (avpkt.size > 0) {
+        InputThreadMessage msg = { { 0 } };
+
+        if (av_thread_message_queue_recv(f->frame_pool, &msg.frame,
+                                         AV_THREAD_MESSAGE_NONBLOCK) < 0 &&
+            !(msg.frame = av_frame_alloc()))
+            return AVERROR(ENOMEM);
+
+        av_init_packet(&msg.pkt);
+        msg.pkt.stream_index = pkt->stream_index;
+        msg.pkt.pts          = avpkt.pts;
+        msg.pkt.dts          = avpkt.dts;
+        msg.decoded          = 1;
+        msg.nb_packet        = ist->thread_nb_packets;
+
+        msg.ret = call_decoder(ist, msg.frame, &msg.got_output, &avpkt,
+                               &msg.params);
+
+        ret = send_input_message(f, &msg, flags);
+        if (ret < 0) {
+            av_frame_free(&msg.frame);
+            return ret;
+        }
+        if (msg.ret < 0)
+            break;
+
+        avpkt.pts =
+        avpkt.dts = AV_NOPTS_VALUE;
+        if (ist->dec_ctx->codec_type != AVMEDIA_TYPE_AUDIO)
+            msg.ret = avpkt.size;
+        avpkt.data += msg.ret;
+        avpkt.size -= msg.ret;
+    }
+    return 0;
+}
+
 static void *input_thread(void *arg)
 {
     InputFile *f = arg;
@@ -3501,8 +4016,9 @@ static void *input_thread(void *arg)
     int ret = 0;
 
     while (1) {
-        AVPacket pkt;
-        ret = av_read_frame(f->ctx, &pkt);
+        InputThreadMessage msg = { { 0 } };
+        AVPacket *pkt = &msg.pkt;
+        ret = av_read_frame(f->ctx, pkt);
 
         if (ret == AVERROR(EAGAIN)) {
             av_usleep(10000);
@@ -3512,22 +4028,25 @@ static void *input_thread(void *arg)
             av_thread_message_queue_set_err_recv(f->in_thread_queue, ret);
             break;
         }
-        av_dup_packet(&pkt);
-        ret = av_thread_message_queue_send(f->in_thread_queue, &pkt, flags);
-        if (flags && ret == AVERROR(EAGAIN)) {
-            flags = 0;
-            ret = av_thread_message_queue_send(f->in_thread_queue, &pkt, flags);
-            av_log(f->ctx, AV_LOG_WARNING,
-                   "Thread message queue blocking; consider raising the "
-                   "thread_queue_size option (current value: %d)\n",
-                   f->thread_queue_size);
+        av_dup_packet(pkt);
+        if (f->decode_thread && pkt->stream_index < f->nb_streams) {
+            InputStream *ist = input_streams[f->ist_index + pkt->stream_index];
+
+            if (ist->decode_in_thread) {
+                if (!ist->thread_nb_packets)
+                    ret = add_stream_side_data(ist, pkt);
+                if (ret >= 0)
+                    ret = decode_packet_in_thread(f, ist, pkt, &flags);
+            }
         }
+        if (ret >= 0)
+            ret = send_input_message(f, &msg, &flags);
         if (ret < 0) {
             if (ret != AVERROR_EOF)
                 av_log(f->ctx, AV_LOG_ERROR,
                        "Unable to send packet to main thread: %s\n",
                        av_err2str(ret));
-            av_free_packet(&pkt);
+            av_free_packet(pkt);
             av_thread_message_queue_set_err_recv(f->in_thread_queue, ret);
             break;
         }
@@ -3542,25 +4061,40 @@ static void free_input_threads(void)
 
     for (i = 0; i < nb_input_files; i++) {
         InputFile *f = input_files[i];
-        AVPacket pkt;
+        InputThreadMessage msg;
+        AVFrame *frame;
+        int j;
 
         if (!f || !f->in_thread_queue)
             continue;
         av_thread_message_queue_set_err_send(f->in_thread_queue, AVERROR_EOF);
-        while (av_thread_message_queue_recv(f->in_thread_queue, &pkt, 0) >= 0)
-            av_free_packet(&pkt);
+        while (av_thread_message_queue_recv(f->in_thread_queue, &msg, 0) >= 0) {
+            if (msg.decoded)
+                av_frame_free(&msg.frame);
+            else
+                av_free_packet(&msg.pkt);
+        }
 
         pthread_join(f->thread, NULL);
         f->joined = 1;
         av_thread_message_queue_free(&f->in_thread_queue);
+
+        if (!f->frame_pool)
+            continue;
+        for (j = 0; j < f->nb_streams; j++)
+            release_thread_decoded(input_streams[f->ist_index + j]);
+        while (av_thread_message_queue_recv(f->frame_pool, &frame,
+                                            AV_THREAD_MESSAGE_NONBLOCK) >= 0)
+            av_frame_free(&frame);
+        av_thread_message_queue_free(&f->frame_pool);
     }
 }
 
 static int init_input_threads(void)
 {
-    int i, ret;
+    int i, j, ret;
 
-    if (nb_input_files == 1)
+    if (nb_input_files == 1 && !input_files[0]->decode_thread)
         return 0;
 
     for (i = 0; i < nb_input_files; i++) {
@@ -3570,13 +4104,37 @@ static int init_input_threads(void)
             strcmp(f->ctx->iformat->name, "lavfi"))
             f->non_blocking = 1;
         ret = av_thread_message_queue_alloc(&f->in_thread_queue,
-                                            f->thread_queue_size, sizeof(AVPacket));
+                                            f->thread_queue_size,
+                                            sizeof(InputThreadMessage));
         if (ret < 0)
             return ret;
 
+        if (f->decode_thread) {
+            ret = av_thread_message_queue_alloc(&f->frame_pool,
+                                                f->thread_queue_size,
+                                                sizeof(AVFrame *));
+            if (ret < 0)
+                return ret;
+
+            /* hwaccels and subtitles stay on the main thread */
+            for (j = 0; j < f->nb_streams; j++) {
+                InputStream *ist = input_streams[f->ist_index + j];
+
+                if (!ist->decoding_needed || ist->hwaccel_id != HWACCEL_NONE ||
+                    (ist->dec_ctx->codec_type != AVMEDIA_TYPE_VIDEO &&
+                     ist->dec_ctx->codec_type != AVMEDIA_TYPE_AUDIO))
+                    continue;
+                ist->thread_decoded = av_fifo_alloc_array(4, sizeof(InputThreadMessage));
+                if (!ist->thread_decoded)
+                    return AVERROR(ENOMEM);
+                ist->decode_in_thread = 1;
+            }
+        }
+
         if ((ret = pthread_create(&f->thread, NULL, input_thread, f))) {
             av_log(NULL, AV_LOG_ERROR, "pthread_create failed: %s. Try to increase `ulimit -v` or decrease `ulimit -s`.\n", strerror(ret));
             av_thread_message_queue_free(&f->in_thread_queue);
+            av_thread_message_queue_free(&f->frame_pool);
             return AVERROR(ret);
         }
     }
@@ -3585,9 +4143,36 @@ static int init_input_threads(void)
 
 static int get_input_packet_mt(InputFile *f, AVPacket *pkt)
 {
-    return av_thread_message_queue_recv(f->in_thread_queue, pkt,
-                                        f->non_blocking ?
-                                        AV_THREAD_MESSAGE_NONBLOCK : 0);
+    unsigned flags = f->non_blocking ? AV_THREAD_MESSAGE_NONBLOCK : 0;
+    InputThreadMessage msg;
+    int ret, i;
+
+    while ((ret = av_thread_message_queue_recv(f->in_thread_queue, &msg, flags)) >= 0) {
+        InputStream *ist;
+
+        if (!msg.decoded) {
+            *pkt = msg.pkt;
+            return 0;
+        }
+
+        /* the packet follows the output of its decoding */
+        flags = 0;
+        ist   = input_streams[f->ist_index + msg.pkt.stream_index];
+        if (av_fifo_space(ist->thread_decoded) < sizeof(msg) &&
+            av_fifo_grow(ist->thread_decoded, sizeof(msg)) < 0) {
+            av_frame_free(&msg.frame);
+            exit_program(1);
+        }
+        av_fifo_generic_write(ist->thread_decoded, &msg, sizeof(msg), NULL);
+    }
+
+    if (ret != AVERROR(EAGAIN)) {
+        /* the thread is done with the decoders, flushing them is up to us */
+        f->thread_done = 1;
+        for (i = 0; i < f->nb_streams; i++)
+            release_thread_decoded(input_streams[f->ist_index + i]);
+    }
+    return ret;
 }
 #endif
 
@@ -3605,7 +4190,7 @@ static int get_input_packet(InputFile *f, AVPacket *pkt)
     }
 
 #if HAVE_PTHREADS
-    if (nb_input_files > 1)
+    if (f->in_thread_queue)
         return get_input_packet_mt(f, pkt);
 #endif
     return av_read_frame(f->ctx, pkt);
@@ -3749,25 +4334,8 @@ static int process_input(int file_index)
     }
 
     /* add the stream-global side data to the first packet */
-    if (ist->nb_packets == 1) {
-        if (ist->st->nb_side_data)
-            av_packet_split_side_data(&pkt);
-        for (i = 0; i < ist->st->nb_side_data; i++) {
-            AVPacketSideData *src_sd = &ist->st->side_data[i];
-            uint8_t *dst_data;
-
-            if (av_packet_get_side_data(&pkt, src_sd->type, NULL))
-                continue;
-            if (ist->autorotate && src_sd->type == AV_PKT_DATA_DISPLAYMATRIX)
-                continue;
-
-            dst_data = av_packet_new_side_data(&pkt, src_sd->type, src_sd->size);
-            if (!dst_data)
-                exit_program(1);
-
-            memcpy(dst_data, src_sd->data, src_sd->size);
-        }
-    }
+    if (ist->nb_packets == 1 && add_stream_side_data(ist, &pkt) < 0)
+        exit_program(1);
 
     if (pkt.dts != AV_NOPTS_VALUE)
         pkt.dts += av_rescale_q(ifile->ts_offset, AV_TIME_BASE_Q, ist->st->time_base);
@@ -3848,6 +4416,10 @@ static int process_input(int file_index)
     sub2video_heartbeat(ist, pkt.pts);
 
     process_input_packet(ist, &pkt);
+#if HAVE_PTHREADS
+    /* whatever the thread decoded past an error */
+    release_thread_decoded(ist);
+#endif
 
 discard_packet:
     av_free_packet(&pkt);
@@ -3972,6 +4544,8 @@ static int transcode(void)
 #if HAVE_PTHREADS
     if ((ret = init_input_threads()) < 0)
         goto fail;
+    if ((ret = init_encoder_threads()) < 0)
+        goto fail;
 #endif
 
     while (!received_sigterm) {
@@ -4016,6 +4590,9 @@ static int transcode(void)
         }
     }
     flush_encoders();
+#if HAVE_PTHREADS
+    free_encoder_threads();
+#endif
 
     term_exit();
 
@@ -4052,6 +4629,7 @@ static int transcode(void)
  fail:
 #if HAVE_PTHREADS
     free_input_threads();
+    free_encoder_threads();
 #endif
 
     if (output_streams) {
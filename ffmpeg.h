@@ -115,6 +115,7 @@ typedef struct OptionsContext {
     int rate_emu;
     int accurate_seek;
     int thread_queue_size;
+    int decode_thread;
 
     SpecifierOpt *ts_scale;
     int        nb_ts_scale;
@@ -247,6 +248,27 @@ typedef struct FilterGraph {
     int         nb_outputs;
 } FilterGraph;
 
+/* timestamps of a packet decoded in the input thread, as read and as
+ * corrected by process_input() */
+typedef struct PacketTimestamps {
+    int64_t nb_packet;
+    int64_t raw_pts, raw_dts;
+    int64_t pts, dts;
+} PacketTimestamps;
+
+#define TS_MAP_SIZE 32
+
+/* the decoder context fields the main thread reads after decoding, copied
+ * by whichever thread called the decoder */
+typedef struct DecoderParams {
+    int width, height;
+    enum AVPixelFormat pix_fmt;
+    AVRational sample_aspect_ratio;
+    int has_b_frames;
+    AVRational framerate;
+    int ticks_per_frame;
+} DecoderParams;
+
 typedef struct InputStream {
     int file_index;
     AVStream *st;
@@ -327,6 +349,14 @@ typedef struct InputStream {
     enum AVPixelFormat hwaccel_pix_fmt;
     enum AVPixelFormat hwaccel_retrieved_pix_fmt;
 
+    /* decoding in the thread reading the file */
+    int decode_in_thread;
+    int64_t thread_nb_packets;      /* packets decoded by the thread */
+    int64_t thread_cur_packet;      /* the one the main thread is at */
+    AVFifoBuffer *thread_decoded;   /* its output for the current packet */
+    DecoderParams dec_params;       /* as of the last decoder call */
+    PacketTimestamps ts_map[TS_MAP_SIZE];
+
     /* stats */
     // combined size of all the packets read
     uint64_t data_size;
@@ -360,6 +390,10 @@ typedef struct InputFile {
     int non_blocking;           /* reading packets from the thread should not block */
     int joined;                 /* the thread has been joined */
     int thread_queue_size;      /* maximum number of queued packets */
+    int decode_thread;          /* decode the packets in the thread too */
+    int thread_done;            /* the thread stopped sending */
+    AVThreadMessageQueue *frame_pool; /* unreferenced AVFrames returned to the
+                                         thread, their buffers are not kept */
 #endif
 } InputFile;
 
@@ -467,6 +501,14 @@ typedef struct OutputStream {
 
     /* frame encode sum of squared error values */
     int64_t error[4];
+
+#if HAVE_PTHREADS
+    AVThreadMessageQueue *enc_in_queue;  /* frames to the encoder thread */
+    AVThreadMessageQueue *enc_out_queue; /* its packets back to the main thread */
+    pthread_t enc_thread;        /* thread encoding the frames of this stream */
+    int enc_in_flight;           /* frames sent to the thread and not muxed yet */
+    int64_t enc_sent_pts;        /* pts of the last frame sent to the thread */
+#endif
 } OutputStream;
 
 typedef struct OutputFile {
@@ -520,6 +562,7 @@ extern int stdin_interaction;
 extern int frame_bits_per_raw_sample;
 extern AVIOContext *progress_avio;
 extern float max_error_rate;
+extern int threads_total;
 extern int vdpau_api_ver;
 extern char *videotoolbox_pixfmt;
 
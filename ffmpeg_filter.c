@@ -728,7 +728,8 @@ static int configure_input_video_filter(FilterGraph *fg, InputFilter *ifilter,
 
     sar = ist->st->sample_aspect_ratio.num ?
           ist->st->sample_aspect_ratio :
-          ist->dec_ctx->sample_aspect_ratio;
+          ist->decode_in_thread ? ist->dec_params.sample_aspect_ratio :
+                                  ist->dec_ctx->sample_aspect_ratio;
     if(!sar.den)
         sar = (AVRational){0,1};
     av_bprint_init(&args, 0, 1);
@@ -833,22 +834,36 @@ static int configure_input_audio_filter(FilterGraph *fg, InputFilter *ifilter,
     char name[255];
     int ret, pad_idx = 0;
     int64_t tsoffset = 0;
+    int sample_rate, sample_fmt, channels;
+    uint64_t channel_layout;
 
     if (ist->dec_ctx->codec_type != AVMEDIA_TYPE_AUDIO) {
         av_log(NULL, AV_LOG_ERROR, "Cannot connect audio filter to non audio input\n");
         return AVERROR(EINVAL);
     }
 
+    /* The input thread owns the decoder context, the graph is then
+     * reconfigured from the parameters of the last decoded frame. */
+    if (ist->decode_in_thread) {
+        sample_rate    = ist->resample_sample_rate;
+        sample_fmt     = ist->resample_sample_fmt;
+        channels       = ist->resample_channels;
+        channel_layout = ist->resample_channel_layout;
+    } else {
+        sample_rate    = ist->dec_ctx->sample_rate;
+        sample_fmt     = ist->dec_ctx->sample_fmt;
+        channels       = ist->dec_ctx->channels;
+        channel_layout = ist->dec_ctx->channel_layout;
+    }
+
     av_bprint_init(&args, 0, AV_BPRINT_SIZE_AUTOMATIC);
     av_bprintf(&args, "time_base=%d/%d:sample_rate=%d:sample_fmt=%s",
-             1, ist->dec_ctx->sample_rate,
-             ist->dec_ctx->sample_rate,
-             av_get_sample_fmt_name(ist->dec_ctx->sample_fmt));
-    if (ist->dec_ctx->channel_layout)
-        av_bprintf(&args, ":channel_layout=0x%"PRIx64,
-                   ist->dec_ctx->channel_layout);
+             1, sample_rate, sample_rate,
+             av_get_sample_fmt_name(sample_fmt));
+    if (channel_layout)
+        av_bprintf(&args, ":channel_layout=0x%"PRIx64, channel_layout);
     else
-        av_bprintf(&args, ":channels=%d", ist->dec_ctx->channels);
+        av_bprintf(&args, ":channels=%d", channels);
     snprintf(name, sizeof(name), "graph %d input from stream %d:%d", fg->index,
              ist->file_index, ist->st->index);
 
@@ -40,6 +40,7 @@
 #include "libavutil/parseutils.h"
 #include "libavutil/pixdesc.h"
 #include "libavutil/pixfmt.h"
+#include "libavutil/threadpool.h"
 #include "libavutil/time_internal.h"
 
 #define DEFAULT_PASS_LOGFILENAME_PREFIX "ffmpeg2pass"
@@ -108,6 +109,7 @@ int qp_hist           = 0;
 int stdin_interaction = 1;
 int frame_bits_per_raw_sample = 0;
 float max_error_rate  = 2.0/3;
+int threads_total     = 0;
 
 
 static int intra_only         = 0;
@@ -413,6 +415,21 @@ static int opt_map_channel(void *optctx, const char *opt, const char *arg)
     return 0;
 }
 
+static int opt_threads_total(void *optctx, const char *opt, const char *arg)
+{
+    int ret;
+
+    threads_total = parse_number_or_die(opt, arg, OPT_INT, 1, INT_MAX);
+    /* started right away, so that the filtergraphs created while parsing
+     * the options use it too */
+    if ((ret = av_thread_pool_init(threads_total)) < 0) {
+        av_log(NULL, AV_LOG_FATAL, "Could not start %d threads: %s\n",
+               threads_total, av_err2str(ret));
+        exit_program(1);
+    }
+    return 0;
+}
+
 static int opt_sdp_file(void *optctx, const char *opt, const char *arg)
 {
     av_free(sdp_filename);
@@ -1007,6 +1024,7 @@ static int open_input_file(OptionsContext *o, const char *filename)
     f->accurate_seek = o->accurate_seek;
 #if HAVE_PTHREADS
     f->thread_queue_size = o->thread_queue_size > 0 ? o->thread_queue_size : 8;
+    f->decode_thread = o->decode_thread;
 #endif
 
     /* check if all codec options have been used */
@@ -3143,6 +3161,8 @@ const OptionDef options[] = {
         "create a complex filtergraph", "graph_description" },
     { "filter_complex_script", HAS_ARG | OPT_EXPERT,                 { .func_arg = opt_filter_complex_script },
         "read complex filtergraph description from a file", "filename" },
+    { "threads_total",  HAS_ARG | OPT_EXPERT,                        { .func_arg = opt_threads_total },
+        "set the number of threads shared by all the codecs and filtergraphs", "number" },
     { "stats",          OPT_BOOL,                                    { &print_stats },
         "print progress report during encoding", },
     { "attach",         HAS_ARG | OPT_PERFILE | OPT_EXPERT |
@@ -3164,6 +3184,8 @@ const OptionDef options[] = {
     { "thread_queue_size", HAS_ARG | OPT_INT | OPT_OFFSET | OPT_EXPERT | OPT_INPUT,
                                                                      { .off = OFFSET(thread_queue_size) },
         "set the maximum number of queued packets from the demuxer" },
+    { "decode_thread",  OPT_BOOL | OPT_OFFSET | OPT_EXPERT | OPT_INPUT,  { .off = OFFSET(decode_thread) },
+        "decode the packets in the thread reading the input" },
 
     /* video options */
     { "vframes",      OPT_VIDEO | HAS_ARG  | OPT_PERFILE | OPT_OUTPUT,           { .func_arg = opt_video_frames },
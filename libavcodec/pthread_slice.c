@@ -40,6 +40,7 @@
 #include "libavutil/common.h"
 #include "libavutil/cpu.h"
 #include "libavutil/mem.h"
+#include "libavutil/threadpool_internal.h"
 
 typedef int (action_func)(AVCodecContext *c, void *arg);
 typedef int (action_func2)(AVCodecContext *c, void *arg, int jobnr, int threadnr);
@@ -109,25 +110,27 @@ void ff_slice_thread_free(AVCodecContext *avctx)
     SliceThreadContext *c = avctx->internal->thread_ctx;
     int i;
 
-    pthread_mutex_lock(&c->current_job_lock);
-    c->done = 1;
-    pthread_cond_broadcast(&c->current_job_cond);
-    for (i = 0; i < c->thread_count; i++)
-        pthread_cond_broadcast(&c->progress_cond[i]);
-    pthread_mutex_unlock(&c->current_job_lock);
+    if (c->workers) {
+        pthread_mutex_lock(&c->current_job_lock);
+        c->done = 1;
+        pthread_cond_broadcast(&c->current_job_cond);
+        for (i = 0; i < c->thread_count; i++)
+            pthread_cond_broadcast(&c->progress_cond[i]);
+        pthread_mutex_unlock(&c->current_job_lock);
 
-    for (i=0; i<avctx->thread_count; i++)
-         pthread_join(c->workers[i], NULL);
+        for (i=0; i<avctx->thread_count; i++)
+             pthread_join(c->workers[i], NULL);
+
+        pthread_mutex_destroy(&c->current_job_lock);
+        pthread_cond_destroy(&c->current_job_cond);
+        pthread_cond_destroy(&c->last_job_cond);
+    }
 
     for (i = 0; i < c->thread_count; i++) {
         pthread_mutex_destroy(&c->progress_mutex[i]);
         pthread_cond_destroy(&c->progress_cond[i]);
     }
 
-    pthread_mutex_destroy(&c->current_job_lock);
-    pthread_cond_destroy(&c->current_job_cond);
-    pthread_cond_destroy(&c->last_job_cond);
-
     av_freep(&c->entries);
     av_freep(&c->progress_mutex);
     av_freep(&c->progress_cond);
@@ -143,6 +146,19 @@ static av_always_inline void thread_park_workers(SliceThreadContext *c, int thre
     pthread_mutex_unlock(&c->current_job_lock);
 }
 
+typedef struct PoolJobs {
+    AVCodecContext *avctx;
+    action_func *func;
+    char *args;
+    int job_size;
+} PoolJobs;
+
+static int pool_job(void *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    PoolJobs *p = arg;
+    return p->func(p->avctx, p->args + jobnr * p->job_size);
+}
+
 static int thread_execute(AVCodecContext *avctx, action_func* func, void *arg, int *ret, int job_count, int job_size)
 {
     SliceThreadContext *c = avctx->internal->thread_ctx;
@@ -154,6 +170,14 @@ static int thread_execute(AVCodecContext *avctx, action_func* func, void *arg, i
     if (job_count <= 0)
         return 0;
 
+    if (!c->workers) {
+        PoolJobs p = { avctx, func, arg, job_size };
+        return avpriv_thread_pool_execute(av_codec_is_encoder(avctx->codec) ?
+                                          AV_THREAD_POOL_ENCODER : AV_THREAD_POOL_DECODER,
+                                          pool_job, NULL, &p, ret, job_count,
+                                          avctx->thread_count);
+    }
+
     pthread_mutex_lock(&c->current_job_lock);
 
     c->current_job = avctx->thread_count;
@@ -176,25 +200,70 @@ static int thread_execute(AVCodecContext *avctx, action_func* func, void *arg, i
     return 0;
 }
 
+static int start_workers(AVCodecContext *avctx);
+
 static int thread_execute2(AVCodecContext *avctx, action_func2* func2, void *arg, int *ret, int job_count)
 {
     SliceThreadContext *c = avctx->internal->thread_ctx;
+    int err;
+
+    /* The jobs of execute2() may wait for each other, the pool does not
+     * guarantee that they run at the same time. */
+    if (!c->workers && (err = start_workers(avctx)) < 0)
+        return err;
     c->func2 = func2;
     return thread_execute(avctx, NULL, arg, ret, job_count, 0);
 }
 
-int ff_slice_thread_init(AVCodecContext *avctx)
+static int start_workers(AVCodecContext *avctx)
 {
+    SliceThreadContext *c = avctx->internal->thread_ctx;
+    int thread_count = avctx->thread_count;
     int i;
+
+    c->workers = av_mallocz_array(thread_count, sizeof(pthread_t));
+    if (!c->workers)
+        return AVERROR(ENOMEM);
+
+    c->current_job = 0;
+    c->job_count = 0;
+    c->job_size = 0;
+    c->done = 0;
+    pthread_cond_init(&c->current_job_cond, NULL);
+    pthread_cond_init(&c->last_job_cond, NULL);
+    pthread_mutex_init(&c->current_job_lock, NULL);
+    pthread_mutex_lock(&c->current_job_lock);
+    for (i=0; i<thread_count; i++) {
+        if(pthread_create(&c->workers[i], NULL, worker, avctx)) {
+           c->done = 1;
+           pthread_cond_broadcast(&c->current_job_cond);
+           pthread_mutex_unlock(&c->current_job_lock);
+           while (i--)
+               pthread_join(c->workers[i], NULL);
+           pthread_mutex_destroy(&c->current_job_lock);
+           pthread_cond_destroy(&c->current_job_cond);
+           pthread_cond_destroy(&c->last_job_cond);
+           av_freep(&c->workers);
+           return AVERROR(EAGAIN);
+        }
+    }
+
+    thread_park_workers(c, thread_count);
+    return 0;
+}
+
+int ff_slice_thread_init(AVCodecContext *avctx)
+{
     SliceThreadContext *c;
     int thread_count = avctx->thread_count;
+    int pool_size = av_thread_pool_get_size();
 
 #if HAVE_W32THREADS
     w32thread_init();
 #endif
 
     if (!thread_count) {
-        int nb_cpus = av_cpu_count();
+        int nb_cpus = pool_size ? pool_size : av_cpu_count();
         if  (avctx->height)
             nb_cpus = FFMIN(nb_cpus, (avctx->height+15)/16);
         // use number of cores + 1 as thread count if there is more than one
@@ -212,33 +281,15 @@ int ff_slice_thread_init(AVCodecContext *avctx)
     c = av_mallocz(sizeof(SliceThreadContext));
     if (!c)
         return -1;
+    avctx->internal->thread_ctx = c;
 
-    c->workers = av_mallocz_array(thread_count, sizeof(pthread_t));
-    if (!c->workers) {
-        av_free(c);
+    /* with a process-wide pool, threads of our own are only started for
+     * the first execute2() call */
+    if (!pool_size && start_workers(avctx) < 0) {
+        ff_thread_free(avctx);
         return -1;
     }
 
-    avctx->internal->thread_ctx = c;
-    c->current_job = 0;
-    c->job_count = 0;
-    c->job_size = 0;
-    c->done = 0;
-    pthread_cond_init(&c->current_job_cond, NULL);
-    pthread_cond_init(&c->last_job_cond, NULL);
-    pthread_mutex_init(&c->current_job_lock, NULL);
-    pthread_mutex_lock(&c->current_job_lock);
-    for (i=0; i<thread_count; i++) {
-        if(pthread_create(&c->workers[i], NULL, worker, avctx)) {
-           avctx->thread_count = i;
-           pthread_mutex_unlock(&c->current_job_lock);
-           ff_thread_free(avctx);
-           return -1;
-        }
-    }
-
-    thread_park_workers(c, thread_count);
-
     avctx->execute = thread_execute;
     avctx->execute2 = thread_execute2;
     return 0;
@@ -166,7 +166,8 @@ int ff_decklink_set_format(AVFormatContext *avctx,
                                            &support, NULL) != S_OK)
             return -1;
     } else {
-        if (ctx->dlo->DoesSupportVideoMode(ctx->bmd_mode, bmdFormat8BitYUV,
+        if (ctx->dlo->DoesSupportVideoMode(ctx->bmd_mode,
+                                           ctx->raw_format ? ctx->raw_format : bmdFormat8BitYUV,
                                            bmdVideoOutputFlagDefault,
                                            &support, NULL) != S_OK)
         return -1;
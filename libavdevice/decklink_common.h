@@ -23,19 +23,14 @@
 
 #include "decklink_common_c.h"
 
+extern "C" {
+#include "decklink_queue.h"
+#include "decklink_unpack.h"
+}
+
 class decklink_output_callback;
 class decklink_input_callback;
 
-typedef struct AVPacketQueue {
-    AVPacketList *first_pkt, *last_pkt;
-    int nb_packets;
-    unsigned long long size;
-    int abort_request;
-    pthread_mutex_t mutex;
-    pthread_cond_t cond;
-    AVFormatContext *avctx;
-} AVPacketQueue;
-
 struct decklink_ctx {
     /* DeckLink SDK interfaces */
     IDeckLink *dl;
@@ -51,9 +46,16 @@ struct decklink_ctx {
     int bmd_width;
     int bmd_height;
     int bmd_field_dominance;
+    BMDPixelFormat raw_format;
+    int row_bytes;
 
     /* Capture buffer queue */
-    AVPacketQueue queue;
+    DecklinkQueue queue;
+
+    /* Capture conversion */
+    enum AVPixelFormat unpack_fmt;  /* AV_PIX_FMT_NONE to pass frames on as captured */
+    DecklinkUnpackDSPContext unpack;
+    AVBufferRef *bars;              /* no-signal frame, shared by its packets */
 
     /* Streams present */
     int audio;
@@ -65,6 +67,14 @@ struct decklink_ctx {
     int64_t last_pts;
     unsigned long frameCount;
     unsigned int dropped;
+    volatile int held_frames;   /* capture frames referenced by packets */
+    volatile int refs;          /* the demuxer and each held frame */
+    unsigned long frames_referenced;
+    unsigned long frames_copied;
+    volatile int frames_completed; /* output completion results */
+    volatile int frames_late;
+    volatile int frames_dropped;
+    volatile int frames_flushed;
     AVStream *audio_st;
     AVStream *video_st;
 
@@ -72,6 +82,8 @@ struct decklink_ctx {
     int list_devices;
     int list_formats;
     double preroll;
+    int zero_copy_frames;
+    int buffer_ms;
 
     int frames_preroll;
     int frames_buffer;
@@ -30,6 +30,16 @@ struct decklink_cctx {
     double preroll;
     int v210;
     int rgb;
+    enum AVPixelFormat pixel_format;
+    int zero_copy_frames;
+    int queue_frames;
+    int queue_ms;
+    int overrun;
+    int queue_overruns;
+    int queue_high_water;
+    int buffer_ms;
+    int frames_late;
+    int frames_dropped;
 
     int slave; // slaves should wait for master's signal
     int ready; // synchorize many decklink instance
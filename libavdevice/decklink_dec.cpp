@@ -38,6 +38,8 @@ extern "C" {
 #include "libavformat/internal.h"
 #include "libavutil/imgutils.h"
 #include "libavutil/avassert.h"
+#include "libavutil/atomic.h"
+#include "libavutil/pixdesc.h"
 }
 
 #include <vector>
@@ -45,116 +47,120 @@ extern "C" {
 #include "decklink_common.h"
 #include "decklink_dec.h"
 
-static void avpacket_queue_init(AVFormatContext *avctx, AVPacketQueue *q)
-{
-    memset(q, 0, sizeof(AVPacketQueue));
-    pthread_mutex_init(&q->mutex, NULL);
-    pthread_cond_init(&q->cond, NULL);
-    q->avctx = avctx;
-}
+struct decklink_frame_ref {
+    IDeckLinkVideoInputFrame *frame;
+    struct decklink_ctx *ctx;
+};
 
-static void avpacket_queue_flush(AVPacketQueue *q)
+/* The capture context is owned by the demuxer and by every packet still
+ * referencing a capture frame, the last of them to let go frees it. The
+ * DeckLink input goes away with it, as it owns the memory of those frames. */
+static void decklink_ctx_unref(struct decklink_ctx *ctx)
 {
-    AVPacketList *pkt, *pkt1;
-
-    pthread_mutex_lock(&q->mutex);
-    for (pkt = q->first_pkt; pkt != NULL; pkt = pkt1) {
-        pkt1 = pkt->next;
-        av_free_packet(&pkt->pkt);
-        av_freep(&pkt);
-    }
-    q->last_pkt   = NULL;
-    q->first_pkt  = NULL;
-    q->nb_packets = 0;
-    q->size       = 0;
-    pthread_mutex_unlock(&q->mutex);
+    if (avpriv_atomic_int_add_and_fetch(&ctx->refs, -1))
+        return;
+    if (ctx->dli)
+        ctx->dli->Release();
+    if (ctx->dl)
+        ctx->dl->Release();
+    av_free(ctx);
 }
 
-static void avpacket_queue_end(AVPacketQueue *q)
+static void decklink_frame_release(void *opaque, uint8_t *data)
 {
-    avpacket_queue_flush(q);
-    pthread_mutex_destroy(&q->mutex);
-    pthread_cond_destroy(&q->cond);
-}
+    struct decklink_frame_ref *ref = (struct decklink_frame_ref *)opaque;
+    struct decklink_ctx *ctx = ref->ctx;
 
-static unsigned long long avpacket_queue_size(AVPacketQueue *q)
-{
-    unsigned long long size;
-    pthread_mutex_lock(&q->mutex);
-    size = q->size;
-    pthread_mutex_unlock(&q->mutex);
-    return size;
+    ref->frame->Release();
+    av_free(ref);
+    avpriv_atomic_int_add_and_fetch(&ctx->held_frames, -1);
+    decklink_ctx_unref(ctx);
 }
 
-static int avpacket_queue_put(AVPacketQueue *q, AVPacket *pkt)
+/* Make pkt reference the capture frame instead of having it copied. */
+static int decklink_ref_frame(struct decklink_ctx *ctx, AVPacket *pkt,
+                              IDeckLinkVideoInputFrame *frame)
 {
-    AVPacketList *pkt1;
+    struct decklink_frame_ref *ref;
 
-    // Drop Packet if queue size is > 1GB
-    if (avpacket_queue_size(q) >  1024 * 1024 * 1024 ) {
-        av_log(q->avctx, AV_LOG_WARNING,  "Decklink input buffer overrun!\n");
-        return -1;
-    }
-    /* duplicate the packet */
-    if (av_dup_packet(pkt) < 0) {
-        return -1;
-    }
+    if (avpriv_atomic_int_get(&ctx->held_frames) >= ctx->zero_copy_frames)
+        return AVERROR(EAGAIN);
 
-    pkt1 = (AVPacketList *)av_malloc(sizeof(AVPacketList));
-    if (!pkt1) {
-        return -1;
-    }
-    pkt1->pkt  = *pkt;
-    pkt1->next = NULL;
-
-    pthread_mutex_lock(&q->mutex);
+    ref = (struct decklink_frame_ref *)av_malloc(sizeof(*ref));
+    if (!ref)
+        return AVERROR(ENOMEM);
+    ref->frame = frame;
+    ref->ctx   = ctx;
 
-    if (!q->last_pkt) {
-        q->first_pkt = pkt1;
-    } else {
-        q->last_pkt->next = pkt1;
+    pkt->buf = av_buffer_create(pkt->data, pkt->size, decklink_frame_release,
+                                ref, 0);
+    if (!pkt->buf) {
+        av_free(ref);
+        return AVERROR(ENOMEM);
     }
-
-    q->last_pkt = pkt1;
-    q->nb_packets++;
-    q->size += pkt1->pkt.size + sizeof(*pkt1);
-
-    pthread_cond_signal(&q->cond);
-
-    pthread_mutex_unlock(&q->mutex);
+    frame->AddRef();
+    avpriv_atomic_int_add_and_fetch(&ctx->refs, 1);
+    avpriv_atomic_int_add_and_fetch(&ctx->held_frames, 1);
     return 0;
 }
 
-static int avpacket_queue_get(AVPacketQueue *q, AVPacket *pkt, int block)
+/* No-signal frames are all the same, paint the bars once and share them. */
+static int decklink_bars_packet(struct decklink_ctx *ctx, AVPacket *pkt,
+                                IDeckLinkVideoInputFrame *frame, int size)
 {
-    AVPacketList *pkt1;
-    int ret;
-
-    pthread_mutex_lock(&q->mutex);
-
-    for (;; ) {
-        pkt1 = q->first_pkt;
-        if (pkt1) {
-            q->first_pkt = pkt1->next;
-            if (!q->first_pkt) {
-                q->last_pkt = NULL;
+    int width    = frame->GetWidth();
+    int height   = frame->GetHeight();
+    int linesize = frame->GetRowBytes();
+    int v210     = frame->GetPixelFormat() == bmdFormat10BitYUV;
+
+    if (ctx->bars && ctx->bars->size != size + FF_INPUT_BUFFER_PADDING_SIZE)
+        av_buffer_unref(&ctx->bars);
+    if (!ctx->bars) {
+        ctx->bars = av_buffer_alloc(size + FF_INPUT_BUFFER_PADDING_SIZE);
+        if (!ctx->bars)
+            return AVERROR(ENOMEM);
+        if (ctx->unpack_fmt != AV_PIX_FMT_NONE) {
+            uint8_t *native = (uint8_t *)av_malloc(linesize * height);
+            if (!native) {
+                av_buffer_unref(&ctx->bars);
+                return AVERROR(ENOMEM);
             }
-            q->nb_packets--;
-            q->size -= pkt1->pkt.size + sizeof(*pkt1);
-            *pkt     = pkt1->pkt;
-            av_free(pkt1);
-            ret = 1;
-            break;
-        } else if (!block) {
-            ret = 0;
-            break;
+            ff_decklink_fill_bars(native, linesize, width, height, v210);
+            ff_decklink_unpack_frame(&ctx->unpack, ctx->unpack_fmt, ctx->bars->data,
+                                     native, linesize, width, height);
+            av_free(native);
         } else {
-            pthread_cond_wait(&q->cond, &q->mutex);
+            ff_decklink_fill_bars(ctx->bars->data, linesize, width, height, v210);
         }
+        memset(ctx->bars->data + size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
     }
-    pthread_mutex_unlock(&q->mutex);
-    return ret;
+
+    pkt->buf = av_buffer_ref(ctx->bars);
+    if (!pkt->buf)
+        return AVERROR(ENOMEM);
+    pkt->data = pkt->buf->data;
+    pkt->size = size;
+    return 0;
+}
+
+/* Unpack the capture frame to planar into a new packet. */
+static int decklink_unpack_packet(struct decklink_ctx *ctx, AVPacket *pkt,
+                                  IDeckLinkVideoInputFrame *frame,
+                                  const uint8_t *src, int size)
+{
+    pkt->buf = av_buffer_alloc(size + FF_INPUT_BUFFER_PADDING_SIZE);
+    if (!pkt->buf)
+        return AVERROR(ENOMEM);
+    pkt->data = pkt->buf->data;
+    pkt->size = size;
+    memset(pkt->data + size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+
+    ff_decklink_unpack_frame(&ctx->unpack, ctx->unpack_fmt, pkt->data, src,
+                             frame->GetRowBytes(), frame->GetWidth(),
+                             frame->GetHeight());
+    return 0;
 }
+
 #ifndef _WIN32
 static struct decklink_cctx * g_cctx = NULL;
 static void slave_got_signal(int signal) {
@@ -235,15 +241,17 @@ HRESULT decklink_input_callback::VideoInputFrameArrived(
     if (videoFrame) {
         AVPacket pkt;
         AVCodecContext *c;
+        int size, ret;
         av_init_packet(&pkt);
         c = ctx->video_st->codec;
         if (ctx->frameCount % 25 == 0) {
-            unsigned long long qsize = avpacket_queue_size(&ctx->queue);
             av_log(avctx, AV_LOG_DEBUG,
-                    "Frame received (#%lu) - Valid (%liB) - QSize %fMB\n",
+                    "Frame received (#%lu) - Valid (%liB) - Queued %u - "
+                    "Overruns %d - Referenced %lu - Copied %lu\n",
                     ctx->frameCount,
                     videoFrame->GetRowBytes() * videoFrame->GetHeight(),
-                    (double)qsize / 1024 / 1024);
+                    ff_decklink_queue_count(&ctx->queue), ctx->queue.overruns,
+                    ctx->frames_referenced, ctx->frames_copied);
         }
 
         videoFrame->GetBytes(&frameBytes);
@@ -251,20 +259,6 @@ HRESULT decklink_input_callback::VideoInputFrameArrived(
                                   ctx->video_st->time_base.den);
 
         if (videoFrame->GetFlags() & bmdFrameHasNoInputSource) {
-            if (videoFrame->GetPixelFormat() == bmdFormat8BitYUV) {
-            unsigned bars[8] = {
-                0xEA80EA80, 0xD292D210, 0xA910A9A5, 0x90229035,
-                0x6ADD6ACA, 0x51EF515A, 0x286D28EF, 0x10801080 };
-            int width  = videoFrame->GetWidth();
-            int height = videoFrame->GetHeight();
-            unsigned *p = (unsigned *)frameBytes;
-
-            for (int y = 0; y < height; y++) {
-                for (int x = 0; x < width; x += 2)
-                    *p++ = bars[(x * 8) / width];
-            }
-            }
-
             if (!no_video) {
                 av_log(avctx, AV_LOG_WARNING, "Frame received (#%lu) - No input signal detected "
                         "- Frames dropped %u\n", ctx->frameCount, ++ctx->dropped);
@@ -291,12 +285,30 @@ HRESULT decklink_input_callback::VideoInputFrameArrived(
         //To be made sure it still applies
         pkt.flags       |= AV_PKT_FLAG_KEY;
         pkt.stream_index = ctx->video_st->index;
-        pkt.data         = (uint8_t *)frameBytes;
-        pkt.size         = videoFrame->GetRowBytes() *
-                           videoFrame->GetHeight();
         //fprintf(stderr,"Video Frame size %d ts %d\n", pkt.size, pkt.pts);
         c->frame_number++;
-        if (avpacket_queue_put(&ctx->queue, &pkt) < 0) {
+        if (ctx->unpack_fmt != AV_PIX_FMT_NONE)
+            size = av_image_get_buffer_size(ctx->unpack_fmt, videoFrame->GetWidth(),
+                                            videoFrame->GetHeight(), 1);
+        else
+            size = videoFrame->GetRowBytes() * videoFrame->GetHeight();
+        if (no_video && videoFrame->GetPixelFormat() != bmdFormat10BitRGB) {
+            ret = decklink_bars_packet(ctx, &pkt, videoFrame, size);
+        } else if (ctx->unpack_fmt != AV_PIX_FMT_NONE) {
+            ret = decklink_unpack_packet(ctx, &pkt, videoFrame,
+                                         (const uint8_t *)frameBytes, size);
+        } else {
+            pkt.data = (uint8_t *)frameBytes;
+            pkt.size = size;
+            /* once the packets hold too many of the card frames, copy */
+            if (decklink_ref_frame(ctx, &pkt, videoFrame) < 0)
+                ctx->frames_copied++;
+            else
+                ctx->frames_referenced++;
+            ret = 0;
+        }
+        if (ret < 0 || ff_decklink_queue_put(&ctx->queue, &pkt) < 0) {
+            av_free_packet(&pkt);
             ++ctx->dropped;
         }
     }
@@ -328,7 +340,7 @@ HRESULT decklink_input_callback::VideoInputFrameArrived(
         pkt.data         = (uint8_t *)audioFrameBytes;
 
         c->frame_number++;
-        if (avpacket_queue_put(&ctx->queue, &pkt) < 0) {
+        if (ff_decklink_queue_put(&ctx->queue, &pkt) < 0) {
             ++ctx->dropped;
         }
     }
@@ -386,20 +398,28 @@ av_cold int ff_decklink_read_close(AVFormatContext *avctx)
     struct decklink_cctx *cctx = (struct decklink_cctx *) avctx->priv_data;
     struct decklink_ctx *ctx = (struct decklink_ctx *) cctx->ctx;
 
+    /* do not leave the capture callback waiting for room */
+    ff_decklink_queue_abort(&ctx->queue);
+
     if (ctx->capture_started) {
         ctx->dli->StopStreams();
         ctx->dli->DisableVideoInput();
         ctx->dli->DisableAudioInput();
     }
 
-    if (ctx->dli)
-        ctx->dli->Release();
-    if (ctx->dl)
-        ctx->dl->Release();
+    av_log(avctx, AV_LOG_VERBOSE, "%lu video frames referenced, %lu copied\n",
+           ctx->frames_referenced, ctx->frames_copied);
+
+    ff_decklink_queue_end(&ctx->queue);
+    av_buffer_unref(&ctx->bars);
 
-    avpacket_queue_end(&ctx->queue);
+    if (avpriv_atomic_int_get(&ctx->held_frames))
+        av_log(avctx, AV_LOG_VERBOSE, "%d capture frames still referenced, "
+               "the device is released with the last of them\n",
+               avpriv_atomic_int_get(&ctx->held_frames));
 
-    av_freep(&cctx->ctx);
+    decklink_ctx_unref(ctx);
+    cctx->ctx = NULL;
 
     return 0;
 }
@@ -416,6 +436,8 @@ av_cold int ff_decklink_read_header(AVFormatContext *avctx)
     char fname[1024];
     char *tmp;
     int mode_num = 0;
+    int64_t queue_frames;
+    int v210 = cctx->v210;
 
     ctx = (struct decklink_ctx *) av_mallocz(sizeof(struct decklink_ctx));
     if (!ctx)
@@ -423,8 +445,30 @@ av_cold int ff_decklink_read_header(AVFormatContext *avctx)
     ctx->list_devices = cctx->list_devices;
     ctx->list_formats = cctx->list_formats;
     ctx->preroll      = cctx->preroll;
+    ctx->zero_copy_frames = cctx->zero_copy_frames;
+    ctx->refs         = 1;
+    ctx->unpack_fmt   = AV_PIX_FMT_NONE;
     cctx->ctx = ctx;
 
+    if (cctx->pixel_format != AV_PIX_FMT_NONE) {
+        int depth = ff_decklink_unpack_depth(cctx->pixel_format);
+
+        if (cctx->pixel_format == AV_PIX_FMT_UYVY422 ? v210 || cctx->rgb
+                                                      : !depth || cctx->rgb) {
+            av_log(avctx, AV_LOG_ERROR, "Unsupported pixel format %s! Only "
+                   "uyvy422, yuv422p, yuv420p, yuv422p10 and yuv420p10 are "
+                   "supported, without bm_v210 or rgb.\n",
+                   av_get_pix_fmt_name(cctx->pixel_format));
+            return AVERROR(EINVAL);
+        }
+        if (depth) {
+            /* 10-bit formats are unpacked from v210 */
+            v210 = depth == 10;
+            ctx->unpack_fmt = cctx->pixel_format;
+            ff_decklink_unpack_dsp_init(&ctx->unpack);
+        }
+    }
+
     iter = CreateDeckLinkIteratorInstance();
     if (!iter) {
         av_log(avctx, AV_LOG_ERROR, "Could not create DeckLink iterator\n");
@@ -522,8 +566,11 @@ av_cold int ff_decklink_read_header(AVFormatContext *avctx)
     if(cctx->rgb) {
         st->codec->codec_id    = AV_CODEC_ID_R210;
         st->codec->pix_fmt     = AV_PIX_FMT_RGB48;
+    } else if (ctx->unpack_fmt != AV_PIX_FMT_NONE) {
+        st->codec->codec_id    = AV_CODEC_ID_RAWVIDEO;
+        st->codec->pix_fmt     = ctx->unpack_fmt;
     } else {
-        if (cctx->v210) {
+        if (v210) {
             st->codec->codec_id    = AV_CODEC_ID_V210;
             st->codec->codec_tag   = MKTAG('V', '2', '1', '0');
         } else {
@@ -545,7 +592,7 @@ av_cold int ff_decklink_read_header(AVFormatContext *avctx)
     }
 
     result = ctx->dli->EnableVideoInput(ctx->bmd_mode,
-                                        cctx->rgb ? bmdFormat10BitRGB : (cctx->v210 ? bmdFormat10BitYUV : bmdFormat8BitYUV),
+                                        cctx->rgb ? bmdFormat10BitRGB : (v210 ? bmdFormat10BitYUV : bmdFormat8BitYUV),
                                         bmdVideoInputFlagDefault);
 
     if (result != S_OK) {
@@ -553,7 +600,19 @@ av_cold int ff_decklink_read_header(AVFormatContext *avctx)
         goto error;
     }
 
-    avpacket_queue_init (avctx, &ctx->queue);
+    /* a video and an audio packet per frame */
+    if (cctx->queue_frames)
+        queue_frames = cctx->queue_frames;
+    else if (ctx->bmd_tb_num)
+        queue_frames = av_rescale_rnd(cctx->queue_ms, ctx->bmd_tb_den,
+                                      ctx->bmd_tb_num * 1000LL, AV_ROUND_UP);
+    else
+        queue_frames = av_rescale_rnd(cctx->queue_ms, 60, 1000, AV_ROUND_UP);
+    if (ff_decklink_queue_init(&ctx->queue, avctx, 2 * queue_frames,
+                               (enum DecklinkOverrun)cctx->overrun) < 0) {
+        av_log(avctx, AV_LOG_ERROR, "Cannot allocate the capture queue\n");
+        goto error;
+    }
 
     if (decklink_start_input (avctx) != S_OK) {
         av_log(avctx, AV_LOG_ERROR, "Cannot start input stream\n");
@@ -575,8 +634,13 @@ int ff_decklink_read_packet(AVFormatContext *avctx, AVPacket *pkt)
     struct decklink_cctx *cctx = (struct decklink_cctx *) avctx->priv_data;
     struct decklink_ctx *ctx = (struct decklink_ctx *) cctx->ctx;
     AVFrame *frame = ctx->video_st->codec->coded_frame;
+    int ret;
 
-    avpacket_queue_get(&ctx->queue, pkt, 1);
+    ret = ff_decklink_queue_get(&ctx->queue, pkt, 1);
+    cctx->queue_overruns   = avpriv_atomic_int_get(&ctx->queue.overruns);
+    cctx->queue_high_water = ctx->queue.high_water;
+    if (ret < 0)
+        return ret;
     if (frame && (ctx->bmd_field_dominance == bmdUpperFieldFirst || ctx->bmd_field_dominance == bmdLowerFieldFirst)) {
         frame->interlaced_frame = 1;
         if (ctx->bmd_field_dominance == bmdUpperFieldFirst) {
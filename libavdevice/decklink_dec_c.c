@@ -24,6 +24,7 @@
 
 #include "decklink_common_c.h"
 #include "decklink_dec.h"
+#include "decklink_queue.h"
 
 #define OFFSET(x) offsetof(struct decklink_cctx, x)
 #define DEC AV_OPT_FLAG_DECODING_PARAM
@@ -33,6 +34,16 @@ static const AVOption options[] = {
     { "list_formats", "list supported formats"  , OFFSET(list_formats), AV_OPT_TYPE_INT   , { .i64 = 0   }, 0, 1, DEC },
     { "bm_v210",      "v210 10 bit per channel" , OFFSET(v210),         AV_OPT_TYPE_INT   , { .i64 = 0   }, 0, 1, DEC },
     { "rgb",          "use rgb pixel format",     OFFSET(rgb),          AV_OPT_TYPE_INT,    { .i64 = 0   }, 0, 1, DEC },
+    { "pixel_format", "planar format to unpack captured frames to", OFFSET(pixel_format), AV_OPT_TYPE_PIXEL_FMT, { .i64 = AV_PIX_FMT_NONE }, -1, INT_MAX, DEC },
+    { "zero_copy_frames", "captured frames to pass on without copying", OFFSET(zero_copy_frames), AV_OPT_TYPE_INT, { .i64 = 4 }, 0, INT_MAX, DEC },
+    { "queue_frames", "maximum number of queued frames, overrides queue_ms", OFFSET(queue_frames), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, INT_MAX, DEC },
+    { "queue_ms",     "maximum queued duration in milliseconds", OFFSET(queue_ms), AV_OPT_TYPE_INT, { .i64 = 1000 }, 1, INT_MAX, DEC },
+    { "overrun",      "what to do when the queue is full", OFFSET(overrun), AV_OPT_TYPE_INT, { .i64 = DECKLINK_OVERRUN_DROP_NEWEST }, 0, DECKLINK_OVERRUN_BLOCK, DEC, "overrun" },
+    { "drop_newest",  "drop the captured frame", 0, AV_OPT_TYPE_CONST, { .i64 = DECKLINK_OVERRUN_DROP_NEWEST }, 0, 0, DEC, "overrun" },
+    { "drop_oldest",  "drop the oldest queued frames", 0, AV_OPT_TYPE_CONST, { .i64 = DECKLINK_OVERRUN_DROP_OLDEST }, 0, 0, DEC, "overrun" },
+    { "block",        "wait for the queue to drain", 0, AV_OPT_TYPE_CONST, { .i64 = DECKLINK_OVERRUN_BLOCK }, 0, 0, DEC, "overrun" },
+    { "queue_overruns",   "packets dropped because the queue was full", OFFSET(queue_overruns), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, INT_MAX, DEC | AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
+    { "queue_high_water", "most packets queued at once", OFFSET(queue_high_water), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, INT_MAX, DEC | AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
     { "slave",        "wait for master's signal", OFFSET(slave),        AV_OPT_TYPE_INT,    { .i64 = 0   }, 0, 1, DEC },
     { NULL },
 };
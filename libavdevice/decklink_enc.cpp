@@ -29,6 +29,7 @@
 extern "C" {
 #include "libavformat/avformat.h"
 #include "libavformat/internal.h"
+#include "libavutil/atomic.h"
 #include "libavutil/imgutils.h"
 }
 
@@ -40,33 +41,35 @@ extern "C" {
 class decklink_frame : public IDeckLinkVideoFrame
 {
 public:
-    decklink_frame(struct decklink_ctx *ctx, AVFrame *avframe, long width,
-                   long height, void *buffer) :
-                   _ctx(ctx), _avframe(avframe), _width(width),
-                   _height(height), _buffer(buffer), _refs(0) { }
-
-    virtual long           STDMETHODCALLTYPE GetWidth      (void)          { return _width; }
-    virtual long           STDMETHODCALLTYPE GetHeight     (void)          { return _height; }
-    virtual long           STDMETHODCALLTYPE GetRowBytes   (void)          { return _width<<1; }
-    virtual BMDPixelFormat STDMETHODCALLTYPE GetPixelFormat(void)          { return bmdFormat8BitYUV; }
+    decklink_frame(struct decklink_ctx *ctx, AVFrame *avframe) :
+                   _ctx(ctx), _avframe(avframe), _refs(0) { }
+    ~decklink_frame() { av_frame_free(&_avframe); }
+
+    virtual long           STDMETHODCALLTYPE GetWidth      (void)          { return _avframe->width; }
+    virtual long           STDMETHODCALLTYPE GetHeight     (void)          { return _avframe->height; }
+    virtual long           STDMETHODCALLTYPE GetRowBytes   (void)          { return _avframe->linesize[0]; }
+    virtual BMDPixelFormat STDMETHODCALLTYPE GetPixelFormat(void)          { return _ctx->raw_format; }
     virtual BMDFrameFlags  STDMETHODCALLTYPE GetFlags      (void)          { return bmdVideoOutputFlagDefault; }
-    virtual HRESULT        STDMETHODCALLTYPE GetBytes      (void **buffer) { *buffer = _buffer; return S_OK; }
+    virtual HRESULT        STDMETHODCALLTYPE GetBytes      (void **buffer) { *buffer = _avframe->data[0]; return S_OK; }
 
     virtual HRESULT STDMETHODCALLTYPE GetTimecode     (BMDTimecodeFormat format, IDeckLinkTimecode **timecode) { return S_FALSE; }
     virtual HRESULT STDMETHODCALLTYPE GetAncillaryData(IDeckLinkVideoFrameAncillary **ancillary)               { return S_FALSE; }
 
     virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, LPVOID *ppv) { return E_NOINTERFACE; }
-    virtual ULONG   STDMETHODCALLTYPE AddRef(void)                            { return ++_refs; }
-    virtual ULONG   STDMETHODCALLTYPE Release(void)                           { if (!--_refs) delete this; return _refs; }
+    virtual ULONG   STDMETHODCALLTYPE AddRef(void)                            { return avpriv_atomic_int_add_and_fetch(&_refs, 1); }
+    virtual ULONG   STDMETHODCALLTYPE Release(void)
+    {
+        int refs = avpriv_atomic_int_add_and_fetch(&_refs, -1);
+        if (!refs)
+            delete this;
+        return refs;
+    }
 
     struct decklink_ctx *_ctx;
-    AVFrame *_avframe;
 
 private:
-    long  _width;
-    long  _height;
-    void *_buffer;
-    int   _refs;
+    AVFrame *_avframe;          /* owns the buffer the device reads */
+    volatile int _refs;
 };
 
 class decklink_output_callback : public IDeckLinkVideoOutputCallback
@@ -76,9 +79,22 @@ public:
     {
         decklink_frame *frame = static_cast<decklink_frame *>(_frame);
         struct decklink_ctx *ctx = frame->_ctx;
-        AVFrame *avframe = frame->_avframe;
 
-        av_frame_free(&avframe);
+        /* The frame and its buffer go away with the last reference. */
+        switch (result) {
+        case bmdOutputFrameDisplayedLate:
+            avpriv_atomic_int_add_and_fetch(&ctx->frames_late, 1);
+            break;
+        case bmdOutputFrameDropped:
+            avpriv_atomic_int_add_and_fetch(&ctx->frames_dropped, 1);
+            break;
+        case bmdOutputFrameFlushed:
+            avpriv_atomic_int_add_and_fetch(&ctx->frames_flushed, 1);
+            break;
+        default:
+            avpriv_atomic_int_add_and_fetch(&ctx->frames_completed, 1);
+            break;
+        }
 
         sem_post(&ctx->semaphore);
 
@@ -101,9 +117,16 @@ static int decklink_setup_video(AVFormatContext *avctx, AVStream *st)
         return -1;
     }
 
-    if (c->pix_fmt != AV_PIX_FMT_UYVY422) {
+    if (c->codec_id == AV_CODEC_ID_V210) {
+        ctx->raw_format = bmdFormat10BitYUV;
+        ctx->row_bytes  = (c->width + 47) / 48 * 128;
+    } else if (c->codec_id == AV_CODEC_ID_RAWVIDEO &&
+               c->pix_fmt == AV_PIX_FMT_UYVY422) {
+        ctx->raw_format = bmdFormat8BitYUV;
+        ctx->row_bytes  = c->width << 1;
+    } else {
         av_log(avctx, AV_LOG_ERROR, "Unsupported pixel format!"
-               " Only AV_PIX_FMT_UYVY422 is supported.\n");
+               " Only AV_PIX_FMT_UYVY422 and v210 are supported.\n");
         return -1;
     }
     if (ff_decklink_set_format(avctx, c->width, c->height,
@@ -127,9 +150,18 @@ static int decklink_setup_video(AVFormatContext *avctx, AVStream *st)
     if (c->time_base.den > 1000)
         ctx->frames_preroll /= 1000;
 
-    /* Buffer twice as many frames as the preroll. */
-    ctx->frames_buffer = ctx->frames_preroll * 2;
-    ctx->frames_buffer = FFMIN(ctx->frames_buffer, 60);
+    /* Schedule buffer_ms ahead, or twice as many frames as the preroll. */
+    if (ctx->buffer_ms)
+        ctx->frames_buffer = av_rescale(ctx->buffer_ms, c->time_base.den,
+                                        c->time_base.num * 1000LL);
+    else
+        ctx->frames_buffer = FFMIN(ctx->frames_preroll * 2, 60);
+    /* Playback only starts after the preroll is scheduled. */
+    if (ctx->frames_buffer < ctx->frames_preroll + 2) {
+        av_log(avctx, AV_LOG_WARNING, "Scheduling %d frames ahead to cover"
+               " the preroll.\n", ctx->frames_preroll + 2);
+        ctx->frames_buffer = ctx->frames_preroll + 2;
+    }
     sem_init(&ctx->semaphore, 0, ctx->frames_buffer);
 
     /* The device expects the framerate to be fixed. */
@@ -185,6 +217,7 @@ av_cold int ff_decklink_write_trailer(AVFormatContext *avctx)
 {
     struct decklink_cctx *cctx = (struct decklink_cctx *) avctx->priv_data;
     struct decklink_ctx *ctx = (struct decklink_ctx *) cctx->ctx;
+    int late, dropped;
 
     if (ctx->playback_started) {
         BMDTimeValue actual;
@@ -200,6 +233,16 @@ av_cold int ff_decklink_write_trailer(AVFormatContext *avctx)
     if (ctx->dl)
         ctx->dl->Release();
 
+    late    = avpriv_atomic_int_get(&ctx->frames_late);
+    dropped = avpriv_atomic_int_get(&ctx->frames_dropped);
+    if (ctx->video)
+        av_log(avctx, late || dropped ? AV_LOG_WARNING : AV_LOG_VERBOSE,
+               "Video frames: %d completed, %d late, %d dropped, %d flushed;"
+               " %lu scheduled in place, %lu copied.\n",
+               avpriv_atomic_int_get(&ctx->frames_completed), late, dropped,
+               avpriv_atomic_int_get(&ctx->frames_flushed),
+               ctx->frames_referenced, ctx->frames_copied);
+
     if (ctx->output_callback)
         delete ctx->output_callback;
 
@@ -210,70 +253,105 @@ av_cold int ff_decklink_write_trailer(AVFormatContext *avctx)
     return 0;
 }
 
-static int decklink_write_video_packet(AVFormatContext *avctx, AVPacket *pkt)
+/* Copy a picture into a frame laid out the way the device reads it. */
+static AVFrame *decklink_copy_picture(struct decklink_ctx *ctx,
+                                      uint8_t * const data[4],
+                                      const int linesize[4])
+{
+    AVFrame *avframe = av_frame_alloc();
+
+    if (!avframe)
+        return NULL;
+    avframe->format      = AV_PIX_FMT_UYVY422;
+    avframe->width       = ctx->bmd_width;
+    avframe->height      = ctx->bmd_height;
+    avframe->linesize[0] = ctx->row_bytes;
+    if (av_frame_get_buffer(avframe, 32) < 0) {
+        av_frame_free(&avframe);
+        return NULL;
+    }
+    av_image_copy(avframe->data, avframe->linesize, (const uint8_t **) data,
+                  linesize, AV_PIX_FMT_UYVY422, avframe->width, avframe->height);
+    ctx->frames_copied++;
+
+    return avframe;
+}
+
+/* Reference a v210 packet, its rows are padded the way the device reads them. */
+static AVFrame *decklink_wrap_packet(struct decklink_ctx *ctx, AVPacket *pkt)
+{
+    AVFrame *avframe = av_frame_alloc();
+
+    if (!avframe)
+        return NULL;
+    avframe->width       = ctx->bmd_width;
+    avframe->height      = ctx->bmd_height;
+    avframe->linesize[0] = ctx->row_bytes;
+    if (pkt->buf) {
+        avframe->buf[0] = av_buffer_ref(pkt->buf);
+        if (avframe->buf[0]) {
+            avframe->data[0] = pkt->data;
+            ctx->frames_referenced++;
+        }
+    } else {
+        avframe->buf[0] = av_buffer_alloc(pkt->size);
+        if (avframe->buf[0]) {
+            avframe->data[0] = avframe->buf[0]->data;
+            memcpy(avframe->data[0], pkt->data, pkt->size);
+            ctx->frames_copied++;
+        }
+    }
+    if (!avframe->buf[0])
+        av_frame_free(&avframe);
+
+    return avframe;
+}
+
+/* Schedule avframe for playback, taking ownership of it. */
+static int decklink_schedule_frame(AVFormatContext *avctx, AVFrame *avframe,
+                                   int64_t pts)
 {
     struct decklink_cctx *cctx = (struct decklink_cctx *) avctx->priv_data;
     struct decklink_ctx *ctx = (struct decklink_ctx *) cctx->ctx;
-    AVPicture *avpicture = (AVPicture *) pkt->data;
-    AVFrame *avframe, *tmp;
     decklink_frame *frame;
     buffercount_type buffered;
     HRESULT hr;
 
-    /* HACK while av_uncoded_frame() isn't implemented */
-    int ret;
-
-    tmp = av_frame_alloc();
-    if (!tmp)
-        return AVERROR(ENOMEM);
-    tmp->format = AV_PIX_FMT_UYVY422;
-    tmp->width  = ctx->bmd_width;
-    tmp->height = ctx->bmd_height;
-    ret = av_frame_get_buffer(tmp, 32);
-    if (ret < 0) {
-        av_frame_free(&tmp);
-        return ret;
-    }
-    av_image_copy(tmp->data, tmp->linesize, (const uint8_t **) avpicture->data,
-                  avpicture->linesize, (AVPixelFormat) tmp->format, tmp->width,
-                  tmp->height);
-    avframe = av_frame_clone(tmp);
-    av_frame_free(&tmp);
-    if (!avframe) {
-        av_log(avctx, AV_LOG_ERROR, "Could not clone video frame.\n");
-        return AVERROR(EIO);
-    }
-    /* end HACK */
-
-    frame = new decklink_frame(ctx, avframe, ctx->bmd_width, ctx->bmd_height,
-                               (void *) avframe->data[0]);
+    frame = new decklink_frame(ctx, avframe);
     if (!frame) {
         av_log(avctx, AV_LOG_ERROR, "Could not create new frame.\n");
+        av_frame_free(&avframe);
         return AVERROR(EIO);
     }
 
-    /* Always keep at most one second of frames buffered. */
+    /* Keep at most frames_buffer frames scheduled ahead. */
     sem_wait(&ctx->semaphore);
 
     /* Schedule frame for playback. */
+    frame->AddRef();
     hr = ctx->dlo->ScheduleVideoFrame((struct IDeckLinkVideoFrame *) frame,
-                                      pkt->pts * ctx->bmd_tb_num,
+                                      pts * ctx->bmd_tb_num,
                                       ctx->bmd_tb_num, ctx->bmd_tb_den);
+    frame->Release();
     if (hr != S_OK) {
         av_log(avctx, AV_LOG_ERROR, "Could not schedule video frame."
                 " error %08x.\n", (uint32_t) hr);
-        frame->Release();
+        sem_post(&ctx->semaphore);
         return AVERROR(EIO);
     }
 
+    cctx->frames_late    = avpriv_atomic_int_get(&ctx->frames_late);
+    cctx->frames_dropped = avpriv_atomic_int_get(&ctx->frames_dropped);
+
     ctx->dlo->GetBufferedVideoFrameCount(&buffered);
-    av_log(avctx, AV_LOG_DEBUG, "Buffered video frames: %d.\n", (int) buffered);
-    if (pkt->pts > 2 && buffered <= 2)
+    av_log(avctx, AV_LOG_DEBUG, "Buffered video frames: %d, late %d, dropped %d.\n",
+           (int) buffered, cctx->frames_late, cctx->frames_dropped);
+    if (pts > 2 && buffered <= 2)
         av_log(avctx, AV_LOG_WARNING, "There are not enough buffered video frames."
                " Video may misbehave!\n");
 
     /* Preroll video frames. */
-    if (!ctx->playback_started && pkt->pts > ctx->frames_preroll) {
+    if (!ctx->playback_started && pts > ctx->frames_preroll) {
         av_log(avctx, AV_LOG_DEBUG, "Ending audio preroll.\n");
         if (ctx->audio && ctx->dlo->EndAudioPreroll() != S_OK) {
             av_log(avctx, AV_LOG_ERROR, "Could not end audio preroll!\n");
@@ -290,6 +368,30 @@ static int decklink_write_video_packet(AVFormatContext *avctx, AVPacket *pkt)
     return 0;
 }
 
+static int decklink_write_video_packet(AVFormatContext *avctx, AVPacket *pkt)
+{
+    struct decklink_cctx *cctx = (struct decklink_cctx *) avctx->priv_data;
+    struct decklink_ctx *ctx = (struct decklink_ctx *) cctx->ctx;
+    AVFrame *avframe;
+
+    if (ctx->raw_format == bmdFormat10BitYUV) {
+        if (pkt->size < ctx->row_bytes * ctx->bmd_height) {
+            av_log(avctx, AV_LOG_ERROR, "Got %d bytes of v210, expected %d.\n",
+                   pkt->size, ctx->row_bytes * ctx->bmd_height);
+            return AVERROR(EINVAL);
+        }
+        avframe = decklink_wrap_packet(ctx, pkt);
+    } else {
+        /* Raw pictures point into a frame the caller keeps. */
+        AVPicture *avpicture = (AVPicture *) pkt->data;
+        avframe = decklink_copy_picture(ctx, avpicture->data, avpicture->linesize);
+    }
+    if (!avframe)
+        return AVERROR(ENOMEM);
+
+    return decklink_schedule_frame(avctx, avframe, pkt->pts);
+}
+
 static int decklink_write_audio_packet(AVFormatContext *avctx, AVPacket *pkt)
 {
     struct decklink_cctx *cctx = (struct decklink_cctx *) avctx->priv_data;
@@ -328,6 +430,7 @@ av_cold int ff_decklink_write_header(AVFormatContext *avctx)
     ctx->list_devices = cctx->list_devices;
     ctx->list_formats = cctx->list_formats;
     ctx->preroll      = cctx->preroll;
+    ctx->buffer_ms    = cctx->buffer_ms;
     cctx->ctx = ctx;
 
     iter = CreateDeckLinkIteratorInstance();
@@ -425,4 +528,47 @@ int ff_decklink_write_packet(AVFormatContext *avctx, AVPacket *pkt)
     return AVERROR(EIO);
 }
 
+int ff_decklink_write_uncoded_frame(AVFormatContext *avctx, int stream_index,
+                                    AVFrame **frame, unsigned flags)
+{
+    struct decklink_cctx *cctx = (struct decklink_cctx *) avctx->priv_data;
+    struct decklink_ctx *ctx = (struct decklink_ctx *) cctx->ctx;
+    AVStream *st = avctx->streams[stream_index];
+    AVFrame *avframe;
+
+    /* May be queried before the header is written, when there is no
+     * device context yet: answer from the stream parameters only. */
+    if (st->codec->codec_type != AVMEDIA_TYPE_VIDEO ||
+        st->codec->codec_id    != AV_CODEC_ID_RAWVIDEO ||
+        st->codec->pix_fmt     != AV_PIX_FMT_UYVY422)
+        return AVERROR(ENOSYS);
+    if (flags & AV_WRITE_UNCODED_FRAME_QUERY)
+        return 0;
+
+    avframe = *frame;
+    if (avframe->format != AV_PIX_FMT_UYVY422 ||
+        avframe->width  != ctx->bmd_width     ||
+        avframe->height != ctx->bmd_height) {
+        av_log(avctx, AV_LOG_ERROR, "Frame does not match the output format.\n");
+        return AVERROR(EINVAL);
+    }
+
+    /* Let the device read refcounted frames in place when their rows are
+     * laid out as it expects. */
+    if (avframe->buf[0] && avframe->linesize[0] == ctx->row_bytes &&
+        !((intptr_t) avframe->data[0] & 15)) {
+        *frame = NULL;
+        ctx->frames_referenced++;
+    } else {
+        avframe = decklink_copy_picture(ctx, avframe->data, avframe->linesize);
+        if (!avframe)
+            return AVERROR(ENOMEM);
+        avframe->pts = (*frame)->pts;
+    }
+
+    ctx->last_pts = FFMAX(ctx->last_pts, avframe->pts);
+
+    return decklink_schedule_frame(avctx, avframe, avframe->pts);
+}
+
 } /* extern "C" */
@@ -26,6 +26,8 @@ extern "C" {
 int ff_decklink_write_header(AVFormatContext *avctx);
 int ff_decklink_write_packet(AVFormatContext *avctx, AVPacket *pkt);
 int ff_decklink_write_trailer(AVFormatContext *avctx);
+int ff_decklink_write_uncoded_frame(AVFormatContext *avctx, int stream_index,
+                                    AVFrame **frame, unsigned flags);
 
 #ifdef __cplusplus
 } /* extern "C" */
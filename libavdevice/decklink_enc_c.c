@@ -31,6 +31,9 @@ static const AVOption options[] = {
     { "list_devices", "list available devices"  , OFFSET(list_devices), AV_OPT_TYPE_INT   , { .i64 = 0   }, 0, 1, ENC },
     { "list_formats", "list supported formats"  , OFFSET(list_formats), AV_OPT_TYPE_INT   , { .i64 = 0   }, 0, 1, ENC },
     { "preroll"     , "video preroll in seconds", OFFSET(preroll     ), AV_OPT_TYPE_DOUBLE, { .dbl = 0.1 }, 0, 5, ENC },
+    { "buffer_ms"   , "video scheduled ahead in milliseconds, 0 for twice the preroll", OFFSET(buffer_ms), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, INT_MAX, ENC },
+    { "frames_late"   , "frames the device displayed late" , OFFSET(frames_late   ), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, INT_MAX, ENC | AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
+    { "frames_dropped", "frames the device dropped"        , OFFSET(frames_dropped), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, INT_MAX, ENC | AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
     { NULL },
 };
 
@@ -54,4 +57,5 @@ AVOutputFormat ff_decklink_muxer = {
     .write_header   = ff_decklink_write_header,
     .write_packet   = ff_decklink_write_packet,
     .write_trailer  = ff_decklink_write_trailer,
+    .write_uncoded_frame = ff_decklink_write_uncoded_frame,
 };
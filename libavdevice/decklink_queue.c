@@ -0,0 +1,316 @@
+/*
+ * Blackmagic DeckLink capture packet queue
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <string.h>
+
+#include "libavutil/atomic.h"
+#include "libavutil/common.h"
+#include "libavutil/log.h"
+#include "libavutil/mem.h"
+
+#include "decklink_queue.h"
+
+int ff_decklink_queue_init(DecklinkQueue *q, void *log_ctx, int capacity,
+                           enum DecklinkOverrun overrun)
+{
+    memset(q, 0, sizeof(*q));
+    q->capacity = FFMAX(capacity, 1);
+    q->overrun  = overrun;
+    q->log_ctx  = log_ctx;
+    q->nb_slots = q->capacity;
+    q->slots    = av_mallocz_array(q->nb_slots, sizeof(*q->slots));
+    if (!q->slots)
+        return AVERROR(ENOMEM);
+
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->cond, NULL);
+    return 0;
+}
+
+void ff_decklink_queue_end(DecklinkQueue *q)
+{
+    unsigned i;
+
+    if (!q->slots)
+        return;
+    for (i = q->tail; i != (unsigned)q->head; i++)
+        av_free_packet(&q->slots[i % q->nb_slots]);
+    av_freep(&q->slots);
+    pthread_mutex_destroy(&q->mutex);
+    pthread_cond_destroy(&q->cond);
+}
+
+unsigned ff_decklink_queue_count(DecklinkQueue *q)
+{
+    return (unsigned)avpriv_atomic_int_get(&q->head) -
+           (unsigned)avpriv_atomic_int_get(&q->tail);
+}
+
+/* The waiting count is raised before checking the indexes again, and read
+ * after updating them, so either the sleeper sees the update or the updater
+ * sees the sleeper. */
+static void wake_up(DecklinkQueue *q)
+{
+    if (avpriv_atomic_int_get(&q->waiting)) {
+        pthread_mutex_lock(&q->mutex);
+        pthread_cond_broadcast(&q->cond);
+        pthread_mutex_unlock(&q->mutex);
+    }
+}
+
+int ff_decklink_queue_put(DecklinkQueue *q, AVPacket *pkt)
+{
+    unsigned head = q->head;
+    unsigned fill = head - (unsigned)avpriv_atomic_int_get(&q->tail);
+    int ret;
+
+    if (fill >= q->nb_slots && q->overrun == DECKLINK_OVERRUN_DROP_OLDEST) {
+        unsigned tail = head - fill;
+
+        /* Claim the oldest packet like the reader does, if the reader got
+         * it first a slot was freed anyway. */
+        if (avpriv_atomic_int_cas(&q->tail, tail, tail + 1) == (int)tail) {
+            av_free_packet(&q->slots[tail % q->nb_slots]);
+            avpriv_atomic_int_add_and_fetch(&q->overruns, 1);
+            av_log(q->log_ctx, AV_LOG_WARNING,
+                   "Decklink input buffer overrun, dropped the oldest packet!\n");
+        }
+        fill = q->nb_slots - 1;
+    } else if (fill >= q->nb_slots) {
+        if (q->overrun == DECKLINK_OVERRUN_DROP_NEWEST) {
+            avpriv_atomic_int_add_and_fetch(&q->overruns, 1);
+            av_log(q->log_ctx, AV_LOG_WARNING, "Decklink input buffer overrun!\n");
+            return AVERROR(ENOBUFS);
+        }
+
+        pthread_mutex_lock(&q->mutex);
+        avpriv_atomic_int_add_and_fetch(&q->waiting, 1);
+        while (!q->abort_request &&
+               (fill = head - (unsigned)avpriv_atomic_int_get(&q->tail)) >= q->nb_slots)
+            pthread_cond_wait(&q->cond, &q->mutex);
+        avpriv_atomic_int_add_and_fetch(&q->waiting, -1);
+        ret = q->abort_request;
+        pthread_mutex_unlock(&q->mutex);
+        if (ret)
+            return AVERROR_EXIT;
+    }
+
+    if ((ret = av_dup_packet(pkt)) < 0)
+        return ret;
+
+    q->slots[head % q->nb_slots] = *pkt;
+    avpriv_atomic_int_set(&q->head, head + 1);
+    q->high_water = FFMAX(q->high_water, fill + 1);
+
+    wake_up(q);
+    return 0;
+}
+
+int ff_decklink_queue_get(DecklinkQueue *q, AVPacket *pkt, int block)
+{
+    while (1) {
+        unsigned tail = avpriv_atomic_int_get(&q->tail);
+        unsigned fill = (unsigned)avpriv_atomic_int_get(&q->head) - tail;
+
+        if (!fill) {
+            if (!block)
+                return 0;
+
+            pthread_mutex_lock(&q->mutex);
+            avpriv_atomic_int_add_and_fetch(&q->waiting, 1);
+            while (!q->abort_request &&
+                   !(fill = (unsigned)avpriv_atomic_int_get(&q->head) - tail))
+                pthread_cond_wait(&q->cond, &q->mutex);
+            avpriv_atomic_int_add_and_fetch(&q->waiting, -1);
+            pthread_mutex_unlock(&q->mutex);
+            if (!fill)
+                return AVERROR_EXIT;
+        }
+
+        /* The slot is not reused before the tail moves past it. If the
+         * writer dropped the packet meanwhile, the copy is stale and the
+         * next one is tried. */
+        *pkt = q->slots[tail % q->nb_slots];
+        if (avpriv_atomic_int_cas(&q->tail, tail, tail + 1) == (int)tail)
+            break;
+    }
+
+    wake_up(q);
+    return 1;
+}
+
+void ff_decklink_queue_abort(DecklinkQueue *q)
+{
+    if (!q->slots)
+        return;
+    pthread_mutex_lock(&q->mutex);
+    q->abort_request = 1;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+#ifdef TEST
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "libavutil/time.h"
+
+#undef printf
+
+typedef struct Generator {
+    DecklinkQueue *q;
+    int nb_frames;
+    int64_t frame_duration;     ///< in microseconds, 0 to run flat out
+    volatile int done;
+} Generator;
+
+static int make_packet(AVPacket *pkt, int n)
+{
+    int ret = av_new_packet(pkt, sizeof(n));
+
+    if (ret < 0)
+        return ret;
+    memcpy(pkt->data, &n, sizeof(n));
+    pkt->pts = pkt->dts = n;
+    return 0;
+}
+
+/* stands in for the SDK callback thread, one packet per frame */
+static void *generator(void *arg)
+{
+    Generator *g = arg;
+    int64_t start = av_gettime_relative();
+    int i;
+
+    for (i = 0; i < g->nb_frames; i++) {
+        AVPacket pkt;
+
+        if (g->frame_duration) {
+            int64_t delay = start + i * g->frame_duration - av_gettime_relative();
+            if (delay > 0)
+                av_usleep(delay);
+        }
+        if (make_packet(&pkt, i) < 0)
+            break;
+        if (ff_decklink_queue_put(g->q, &pkt) < 0)
+            av_free_packet(&pkt);
+    }
+    avpriv_atomic_int_set(&g->done, 1);
+    return NULL;
+}
+
+static void test_overrun(const char *name, enum DecklinkOverrun overrun)
+{
+    DecklinkQueue q;
+    AVPacket pkt;
+    int i, n;
+
+    if (ff_decklink_queue_init(&q, NULL, 4, overrun) < 0)
+        exit(1);
+    for (i = 0; i < 10; i++) {
+        if (make_packet(&pkt, i) < 0)
+            exit(1);
+        if (ff_decklink_queue_put(&q, &pkt) < 0)
+            av_free_packet(&pkt);
+    }
+    printf("%-11s:", name);
+    while (ff_decklink_queue_get(&q, &pkt, 0) > 0) {
+        memcpy(&n, pkt.data, sizeof(n));
+        printf(" %d", n);
+        av_free_packet(&pkt);
+    }
+    printf(", overruns %d\n", q.overruns);
+    ff_decklink_queue_end(&q);
+}
+
+/* Read the packets of a generator thread, taking consumer_delay
+ * microseconds for each. Returns the number of packets read. */
+static int run_generator(DecklinkQueue *q, int capacity,
+                         enum DecklinkOverrun overrun, int nb_frames,
+                         int64_t frame_duration, int64_t consumer_delay,
+                         int *out_of_order)
+{
+    Generator g = { q, nb_frames, frame_duration };
+    pthread_t thread;
+    AVPacket pkt;
+    int last = -1, read = 0, n;
+
+    if (ff_decklink_queue_init(q, NULL, capacity, overrun) < 0 ||
+        pthread_create(&thread, NULL, generator, &g))
+        exit(1);
+    *out_of_order = 0;
+    while (1) {
+        int done = avpriv_atomic_int_get(&g.done);
+
+        if (ff_decklink_queue_get(q, &pkt, 0) <= 0) {
+            if (done)
+                break;
+            av_usleep(100);
+            continue;
+        }
+        memcpy(&n, pkt.data, sizeof(n));
+        *out_of_order += n <= last;
+        last = n;
+        read++;
+        av_free_packet(&pkt);
+        if (consumer_delay)
+            av_usleep(consumer_delay);
+    }
+    pthread_join(thread, NULL);
+    return read;
+}
+
+int main(int argc, char **argv)
+{
+    static const char *policies[] = { "drop_newest", "drop_oldest", "block" };
+    DecklinkQueue q;
+    int read, out_of_order;
+
+    av_log_set_level(AV_LOG_ERROR);
+    test_overrun("drop_newest", DECKLINK_OVERRUN_DROP_NEWEST);
+    test_overrun("drop_oldest", DECKLINK_OVERRUN_DROP_OLDEST);
+
+    read = run_generator(&q, 8, DECKLINK_OVERRUN_BLOCK, 100000, 0, 0, &out_of_order);
+    printf("block      : read %d, out of order %d, overruns %d, high water %s\n",
+           read, out_of_order, q.overruns, q.high_water <= 8 ? "ok" : "too high");
+    ff_decklink_queue_end(&q);
+
+    /* a slow reader racing the writer for the oldest packets */
+    read = run_generator(&q, 4, DECKLINK_OVERRUN_DROP_OLDEST, 20000, 0, 10, &out_of_order);
+    printf("drop_oldest: %s, out of order %d, high water %s\n",
+           read + q.overruns == 20000 ? "read or dropped all" : "lost packets",
+           out_of_order, q.high_water <= 4 ? "ok" : "too high");
+    ff_decklink_queue_end(&q);
+
+    /* decklink_queue-test <fps> <frames> <read delay in us> <capacity> */
+    if (argc > 4) {
+        int i;
+        for (i = 0; i < FF_ARRAY_ELEMS(policies); i++) {
+            read = run_generator(&q, atoi(argv[4]), i, atoi(argv[2]),
+                                 1000000 / atoi(argv[1]), atoi(argv[3]),
+                                 &out_of_order);
+            printf("%-11s: read %d of %s, overruns %d, high water %d\n",
+                   policies[i], read, argv[2], q.overruns, q.high_water);
+            ff_decklink_queue_end(&q);
+        }
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,89 @@
+/*
+ * Blackmagic DeckLink capture packet queue
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVDEVICE_DECKLINK_QUEUE_H
+#define AVDEVICE_DECKLINK_QUEUE_H
+
+#include <pthread.h>
+
+#include "libavcodec/avcodec.h"
+
+enum DecklinkOverrun {
+    DECKLINK_OVERRUN_DROP_NEWEST,
+    DECKLINK_OVERRUN_DROP_OLDEST,
+    DECKLINK_OVERRUN_BLOCK,
+};
+
+/**
+ * Ring of packets from the capture callback thread to the reading thread.
+ * Putting and getting packets takes no lock, the mutex is only used to sleep
+ * when the ring is empty, or full with the block policy. When dropping the
+ * oldest packets, the producer discards the packet at the tail itself.
+ */
+typedef struct DecklinkQueue {
+    AVPacket *slots;
+    unsigned nb_slots;
+    unsigned capacity;          ///< number of packets the reader may lag
+    enum DecklinkOverrun overrun;
+
+    volatile int head;          ///< packets put, written by the producer only
+    volatile int tail;          ///< packets got or dropped, moved with compare and swap
+                                ///< by the consumer, and by the producer dropping the
+                                ///< oldest packet
+    volatile int waiting;       ///< threads sleeping on cond
+    int abort_request;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    void *log_ctx;
+
+    /* statistics */
+    volatile int overruns;      ///< packets dropped because the queue was full
+    int high_water;             ///< most packets queued at once
+} DecklinkQueue;
+
+int ff_decklink_queue_init(DecklinkQueue *q, void *log_ctx, int capacity,
+                           enum DecklinkOverrun overrun);
+void ff_decklink_queue_end(DecklinkQueue *q);
+
+/**
+ * Queue pkt, making it refcounted if it is not.
+ *
+ * @return 0 on success, AVERROR(ENOBUFS) if the packet was dropped because
+ *         the queue is full with DECKLINK_OVERRUN_DROP_NEWEST, AVERROR_EXIT
+ *         if the queue was aborted; the caller keeps the packet on failure
+ */
+int ff_decklink_queue_put(DecklinkQueue *q, AVPacket *pkt);
+
+/**
+ * Get the oldest packet.
+ *
+ * @return 1 if a packet was returned, 0 if block is not set and the queue is
+ *         empty, AVERROR_EXIT if the queue was aborted
+ */
+int ff_decklink_queue_get(DecklinkQueue *q, AVPacket *pkt, int block);
+
+/**
+ * Wake up and fail any thread blocked on the queue.
+ */
+void ff_decklink_queue_abort(DecklinkQueue *q);
+
+unsigned ff_decklink_queue_count(DecklinkQueue *q);
+
+#endif /* AVDEVICE_DECKLINK_QUEUE_H */
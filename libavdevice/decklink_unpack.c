@@ -0,0 +1,199 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <string.h>
+
+#include "config.h"
+#include "libavutil/attributes.h"
+#include "libavutil/common.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/intreadwrite.h"
+
+#include "decklink_unpack.h"
+
+/* When avg is set, the chroma already in u and v is averaged with the line's. */
+static av_always_inline void uyvy_unpack(uint8_t *y, uint8_t *u, uint8_t *v,
+                                         const uint8_t *src, int width, int avg)
+{
+    int i;
+
+    for (i = 0; i < width >> 1; i++) {
+        u[i]         = avg ? (u[i] + src[4 * i] + 1) >> 1 : src[4 * i];
+        y[2 * i]     = src[4 * i + 1];
+        v[i]         = avg ? (v[i] + src[4 * i + 2] + 1) >> 1 : src[4 * i + 2];
+        y[2 * i + 1] = src[4 * i + 3];
+    }
+}
+
+/* v210 packs 6 pixels in 4 little-endian words of 3 10-bit samples each,
+ * in the order Cb Y Cr Y. */
+static av_always_inline void v210_unpack(uint16_t *y, uint16_t *u, uint16_t *v,
+                                         const uint8_t *src, int width, int avg)
+{
+    unsigned s[12];
+    int i, j, n;
+
+    for (i = 0; i < width; i += 6, src += 16) {
+        n = FFMIN(width - i, 6);
+        for (j = 0; j < 2 * n; j++)
+            s[j] = AV_RL32(src + 4 * (j / 3)) >> 10 * (j % 3) & 0x3FF;
+        for (j = 0; j < n; j++)
+            y[i + j] = s[2 * j + 1];
+        for (j = 0; j < n >> 1; j++) {
+            u[(i >> 1) + j] = avg ? (u[(i >> 1) + j] + s[4 * j]     + 1) >> 1 : s[4 * j];
+            v[(i >> 1) + j] = avg ? (v[(i >> 1) + j] + s[4 * j + 2] + 1) >> 1 : s[4 * j + 2];
+        }
+    }
+}
+
+void ff_decklink_uyvy_to_yuv422p_c(uint8_t *y, uint8_t *u, uint8_t *v,
+                                   const uint8_t *src, int width)
+{
+    uyvy_unpack(y, u, v, src, width, 0);
+}
+
+void ff_decklink_uyvy_to_yuv420p_c(uint8_t *y0, uint8_t *y1, uint8_t *u,
+                                   uint8_t *v, const uint8_t *src0,
+                                   const uint8_t *src1, int width)
+{
+    uyvy_unpack(y0, u, v, src0, width, 0);
+    uyvy_unpack(y1, u, v, src1, width, 1);
+}
+
+void ff_decklink_v210_to_yuv422p10_c(uint16_t *y, uint16_t *u, uint16_t *v,
+                                     const uint8_t *src, int width)
+{
+    v210_unpack(y, u, v, src, width, 0);
+}
+
+void ff_decklink_v210_to_yuv420p10_c(uint16_t *y0, uint16_t *y1, uint16_t *u,
+                                     uint16_t *v, const uint8_t *src0,
+                                     const uint8_t *src1, int width)
+{
+    v210_unpack(y0, u, v, src0, width, 0);
+    v210_unpack(y1, u, v, src1, width, 1);
+}
+
+av_cold void ff_decklink_unpack_dsp_init(DecklinkUnpackDSPContext *dsp)
+{
+    dsp->uyvy_to_yuv422p   = ff_decklink_uyvy_to_yuv422p_c;
+    dsp->uyvy_to_yuv420p   = ff_decklink_uyvy_to_yuv420p_c;
+    dsp->v210_to_yuv422p10 = ff_decklink_v210_to_yuv422p10_c;
+    dsp->v210_to_yuv420p10 = ff_decklink_v210_to_yuv420p10_c;
+
+    if (ARCH_X86)
+        ff_decklink_unpack_dsp_init_x86(dsp);
+}
+
+int ff_decklink_unpack_depth(enum AVPixelFormat fmt)
+{
+    switch (fmt) {
+    case AV_PIX_FMT_YUV422P:
+    case AV_PIX_FMT_YUV420P:
+        return 8;
+    case AV_PIX_FMT_YUV422P10:
+    case AV_PIX_FMT_YUV420P10:
+        return 10;
+    default:
+        return 0;
+    }
+}
+
+#define LINE(type, plane, n) ((type *)(data[plane] + (n) * linesize[plane]))
+
+void ff_decklink_unpack_frame(const DecklinkUnpackDSPContext *dsp,
+                              enum AVPixelFormat fmt, uint8_t *dst,
+                              const uint8_t *src, int src_linesize,
+                              int width, int height)
+{
+    uint8_t *data[4];
+    int linesize[4];
+    int i;
+
+    av_image_fill_arrays(data, linesize, dst, fmt, width, height, 1);
+
+    switch (fmt) {
+    case AV_PIX_FMT_YUV422P:
+        for (i = 0; i < height; i++, src += src_linesize)
+            dsp->uyvy_to_yuv422p(LINE(uint8_t, 0, i), LINE(uint8_t, 1, i),
+                                 LINE(uint8_t, 2, i), src, width);
+        break;
+    case AV_PIX_FMT_YUV420P:
+        for (i = 0; i < height - 1; i += 2, src += 2 * src_linesize)
+            dsp->uyvy_to_yuv420p(LINE(uint8_t, 0, i), LINE(uint8_t, 0, i + 1),
+                                 LINE(uint8_t, 1, i >> 1), LINE(uint8_t, 2, i >> 1),
+                                 src, src + src_linesize, width);
+        if (height & 1)
+            dsp->uyvy_to_yuv422p(LINE(uint8_t, 0, i), LINE(uint8_t, 1, i >> 1),
+                                 LINE(uint8_t, 2, i >> 1), src, width);
+        break;
+    case AV_PIX_FMT_YUV422P10:
+        for (i = 0; i < height; i++, src += src_linesize)
+            dsp->v210_to_yuv422p10(LINE(uint16_t, 0, i), LINE(uint16_t, 1, i),
+                                   LINE(uint16_t, 2, i), src, width);
+        break;
+    case AV_PIX_FMT_YUV420P10:
+        for (i = 0; i < height - 1; i += 2, src += 2 * src_linesize)
+            dsp->v210_to_yuv420p10(LINE(uint16_t, 0, i), LINE(uint16_t, 0, i + 1),
+                                   LINE(uint16_t, 1, i >> 1), LINE(uint16_t, 2, i >> 1),
+                                   src, src + src_linesize, width);
+        if (height & 1)
+            dsp->v210_to_yuv422p10(LINE(uint16_t, 0, i), LINE(uint16_t, 1, i >> 1),
+                                   LINE(uint16_t, 2, i >> 1), src, width);
+        break;
+    default:
+        break;
+    }
+}
+
+/* Cb, Y, Cr */
+static const uint8_t bars[8][3] = {
+    { 0x80, 0xEA, 0x80 }, { 0x10, 0xD2, 0x92 }, { 0xA5, 0xA9, 0x10 },
+    { 0x35, 0x90, 0x22 }, { 0xCA, 0x6A, 0xDD }, { 0x5A, 0x51, 0xEF },
+    { 0xEF, 0x28, 0x6D }, { 0x80, 0x10, 0x80 },
+};
+
+void ff_decklink_fill_bars(uint8_t *dst, int linesize, int width, int height,
+                           int v210)
+{
+    int row_bytes = v210 ? (width + 47) / 48 * 128 : width << 1;
+    int x, i;
+
+    if (v210) {
+        uint8_t *p = dst;
+        for (x = 0; x < width; x += 6) {
+            unsigned s[12];
+            for (i = 0; i < 12; i++) {
+                int pixel = FFMIN((x + (i >> 1)) & ~1, width - 1);
+                const uint8_t *bar = bars[pixel * 8 / width];
+                s[i] = bar[i & 1 ? 1 : i & 2 ? 2 : 0] << 2;
+            }
+            for (i = 0; i < 4; i++, p += 4)
+                AV_WL32(p, s[3 * i] | s[3 * i + 1] << 10 | s[3 * i + 2] << 20);
+        }
+        memset(p, 0, dst + row_bytes - p);
+    } else {
+        for (x = 0; x < width; x += 2) {
+            const uint8_t *bar = bars[x * 8 / width];
+            AV_WL32(dst + 2 * x, bar[0] | bar[1] << 8 | bar[2] << 16 | bar[1] << 24);
+        }
+    }
+
+    for (i = 1; i < height; i++)
+        memcpy(dst + i * linesize, dst, row_bytes);
+}
@@ -0,0 +1,94 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Conversion of DeckLink capture frames to planar YUV.
+ *
+ * The capture callback unpacks UYVY and v210 frames while they are still
+ * in cache, so that the packets handed downstream need no further
+ * conversion. 4:2:0 output averages the chroma of each pair of lines.
+ */
+
+#ifndef AVDEVICE_DECKLINK_UNPACK_H
+#define AVDEVICE_DECKLINK_UNPACK_H
+
+#include <stdint.h>
+
+#include "libavutil/pixfmt.h"
+
+typedef struct DecklinkUnpackDSPContext {
+    /**
+     * Unpack width pixels of a UYVY line, width is even.
+     */
+    void (*uyvy_to_yuv422p)(uint8_t *y, uint8_t *u, uint8_t *v,
+                            const uint8_t *src, int width);
+    /**
+     * Unpack two UYVY lines, averaging their chroma.
+     */
+    void (*uyvy_to_yuv420p)(uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                            const uint8_t *src0, const uint8_t *src1, int width);
+    /**
+     * Unpack width pixels of a v210 line, width is even.
+     */
+    void (*v210_to_yuv422p10)(uint16_t *y, uint16_t *u, uint16_t *v,
+                              const uint8_t *src, int width);
+    /**
+     * Unpack two v210 lines, averaging their chroma.
+     */
+    void (*v210_to_yuv420p10)(uint16_t *y0, uint16_t *y1, uint16_t *u,
+                              uint16_t *v, const uint8_t *src0,
+                              const uint8_t *src1, int width);
+} DecklinkUnpackDSPContext;
+
+void ff_decklink_uyvy_to_yuv422p_c(uint8_t *y, uint8_t *u, uint8_t *v,
+                                   const uint8_t *src, int width);
+void ff_decklink_uyvy_to_yuv420p_c(uint8_t *y0, uint8_t *y1, uint8_t *u,
+                                   uint8_t *v, const uint8_t *src0,
+                                   const uint8_t *src1, int width);
+void ff_decklink_v210_to_yuv422p10_c(uint16_t *y, uint16_t *u, uint16_t *v,
+                                     const uint8_t *src, int width);
+void ff_decklink_v210_to_yuv420p10_c(uint16_t *y0, uint16_t *y1, uint16_t *u,
+                                     uint16_t *v, const uint8_t *src0,
+                                     const uint8_t *src1, int width);
+
+void ff_decklink_unpack_dsp_init(DecklinkUnpackDSPContext *dsp);
+void ff_decklink_unpack_dsp_init_x86(DecklinkUnpackDSPContext *dsp);
+
+/**
+ * @return 8 if fmt is unpacked from UYVY, 10 if it is unpacked from v210,
+ *         0 if it is not supported
+ */
+int ff_decklink_unpack_depth(enum AVPixelFormat fmt);
+
+/**
+ * Unpack a UYVY or v210 frame into dst, with the planes of fmt laid out
+ * contiguously as by av_image_fill_arrays() with an alignment of 1.
+ */
+void ff_decklink_unpack_frame(const DecklinkUnpackDSPContext *dsp,
+                              enum AVPixelFormat fmt, uint8_t *dst,
+                              const uint8_t *src, int src_linesize,
+                              int width, int height);
+
+/**
+ * Paint 75% color bars in UYVY or v210.
+ */
+void ff_decklink_fill_bars(uint8_t *dst, int linesize, int width, int height,
+                           int v210);
+
+#endif /* AVDEVICE_DECKLINK_UNPACK_H */
@@ -0,0 +1,446 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "libavutil/attributes.h"
+#include "libavutil/cpu.h"
+#include "libavutil/mem.h"
+#include "libavutil/x86/cpu.h"
+#include "libavutil/x86/asm.h"
+#include "libavdevice/decklink_unpack.h"
+
+/*
+ * UYVY is split with word shifts and masks: packing the high bytes of each
+ * word gives luma, packing the low bytes gives interleaved chroma, which is
+ * split again the same way. The AVX2 packs work per 128-bit lane, vpermq
+ * puts their quadwords back in order.
+ *
+ * A v210 group of 4 words holds 6 pixels. Masking the samples at bits 0, 10
+ * and 20 of each word gives
+ *   a = Cb0 Y1  Cr2 Y4,  b = Y0  Cb2 Y3  Cr4,  c = Cr0 Y2  Cb4 Y5
+ * which are packed to words as ab and cc, and shuffled into 6 luma samples
+ * and 3 + 3 chroma samples. Each group is stored with 16-byte luma and 8-byte
+ * chroma writes, the excess is overwritten by the next group, and the last
+ * groups of a line are left to C so that no write goes past its end.
+ */
+
+DECLARE_ALIGNED(16, static const uint8_t, shuf_y_ab)[16] = {
+    8, 9, 2, 3, 0x80, 0x80, 12, 13, 6, 7, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+};
+DECLARE_ALIGNED(16, static const uint8_t, shuf_y_c)[16] = {
+    0x80, 0x80, 0x80, 0x80, 2, 3, 0x80, 0x80, 0x80, 0x80, 6, 7, 0x80, 0x80, 0x80, 0x80,
+};
+DECLARE_ALIGNED(16, static const uint8_t, shuf_uv_ab)[16] = {
+    0, 1, 10, 11, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 4, 5, 14, 15, 0x80, 0x80,
+};
+DECLARE_ALIGNED(16, static const uint8_t, shuf_uv_c)[16] = {
+    0x80, 0x80, 0x80, 0x80, 4, 5, 0x80, 0x80, 0, 1, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+};
+
+#if HAVE_SSE2_INLINE
+static void uyvy_to_yuv422p_sse2(uint8_t *y, uint8_t *u, uint8_t *v,
+                                 const uint8_t *src, int width)
+{
+    x86_reg n = (width >> 1) & ~7;
+
+    if (n) {
+        x86_reg i = -n;
+        __asm__ volatile(
+            "pcmpeqw    %%xmm7, %%xmm7              \n\t"
+            "psrlw      $8, %%xmm7                  \n\t" // 0x00ff
+            ".p2align 4                             \n\t"
+            "1:                                     \n\t"
+            "movdqu     (%1, %0, 4), %%xmm0         \n\t"
+            "movdqu   16(%1, %0, 4), %%xmm1         \n\t"
+            "movdqa     %%xmm0, %%xmm2              \n\t"
+            "movdqa     %%xmm1, %%xmm3              \n\t"
+            "psrlw      $8, %%xmm0                  \n\t"
+            "psrlw      $8, %%xmm1                  \n\t"
+            "packuswb   %%xmm1, %%xmm0              \n\t" // Y
+            "pand       %%xmm7, %%xmm2              \n\t"
+            "pand       %%xmm7, %%xmm3              \n\t"
+            "packuswb   %%xmm3, %%xmm2              \n\t" // UV
+            "movdqa     %%xmm2, %%xmm3              \n\t"
+            "pand       %%xmm7, %%xmm2              \n\t"
+            "psrlw      $8, %%xmm3                  \n\t"
+            "packuswb   %%xmm3, %%xmm2              \n\t" // U | V
+            "movdqu     %%xmm0, (%2, %0, 2)         \n\t"
+            "movq       %%xmm2, (%3, %0)            \n\t"
+            "movhps     %%xmm2, (%4, %0)            \n\t"
+            "add        $8, %0                      \n\t"
+            " js 1b                                 \n\t"
+            : "+r"(i)
+            : "r"(src + 4 * n), "r"(y + 2 * n), "r"(u + n), "r"(v + n)
+            : XMM_CLOBBERS("xmm0", "xmm1", "xmm2", "xmm3", "xmm7",) "memory"
+        );
+    }
+    if (2 * n != width)
+        ff_decklink_uyvy_to_yuv422p_c(y + 2 * n, u + n, v + n, src + 4 * n,
+                                      width - 2 * n);
+}
+#endif
+
+#if HAVE_SSE2_INLINE && ARCH_X86_64
+static void uyvy_to_yuv420p_sse2(uint8_t *y0, uint8_t *y1, uint8_t *u,
+                                 uint8_t *v, const uint8_t *src0,
+                                 const uint8_t *src1, int width)
+{
+    x86_reg n = (width >> 1) & ~7;
+
+    if (n) {
+        x86_reg i = -n;
+        __asm__ volatile(
+            "pcmpeqw    %%xmm7, %%xmm7              \n\t"
+            "psrlw      $8, %%xmm7                  \n\t" // 0x00ff
+            ".p2align 4                             \n\t"
+            "1:                                     \n\t"
+            "movdqu     (%1, %0, 4), %%xmm0         \n\t"
+            "movdqu   16(%1, %0, 4), %%xmm1         \n\t"
+            "movdqu     (%2, %0, 4), %%xmm4         \n\t"
+            "movdqu   16(%2, %0, 4), %%xmm5         \n\t"
+            "movdqa     %%xmm0, %%xmm2              \n\t"
+            "movdqa     %%xmm1, %%xmm3              \n\t"
+            "psrlw      $8, %%xmm0                  \n\t"
+            "psrlw      $8, %%xmm1                  \n\t"
+            "packuswb   %%xmm1, %%xmm0              \n\t" // Y0
+            "pand       %%xmm7, %%xmm2              \n\t"
+            "pand       %%xmm7, %%xmm3              \n\t"
+            "packuswb   %%xmm3, %%xmm2              \n\t" // UV0
+            "movdqu     %%xmm0, (%3, %0, 2)         \n\t"
+            "movdqa     %%xmm4, %%xmm0              \n\t"
+            "movdqa     %%xmm5, %%xmm1              \n\t"
+            "psrlw      $8, %%xmm4                  \n\t"
+            "psrlw      $8, %%xmm5                  \n\t"
+            "packuswb   %%xmm5, %%xmm4              \n\t" // Y1
+            "pand       %%xmm7, %%xmm0              \n\t"
+            "pand       %%xmm7, %%xmm1              \n\t"
+            "packuswb   %%xmm1, %%xmm0              \n\t" // UV1
+            "movdqu     %%xmm4, (%4, %0, 2)         \n\t"
+            "pavgb      %%xmm0, %%xmm2              \n\t"
+            "movdqa     %%xmm2, %%xmm3              \n\t"
+            "pand       %%xmm7, %%xmm2              \n\t"
+            "psrlw      $8, %%xmm3                  \n\t"
+            "packuswb   %%xmm3, %%xmm2              \n\t" // U | V
+            "movq       %%xmm2, (%5, %0)            \n\t"
+            "movhps     %%xmm2, (%6, %0)            \n\t"
+            "add        $8, %0                      \n\t"
+            " js 1b                                 \n\t"
+            : "+r"(i)
+            : "r"(src0 + 4 * n), "r"(src1 + 4 * n), "r"(y0 + 2 * n),
+              "r"(y1 + 2 * n), "r"(u + n), "r"(v + n)
+            : XMM_CLOBBERS("xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+                           "xmm7",) "memory"
+        );
+    }
+    if (2 * n != width)
+        ff_decklink_uyvy_to_yuv420p_c(y0 + 2 * n, y1 + 2 * n, u + n, v + n,
+                                      src0 + 4 * n, src1 + 4 * n, width - 2 * n);
+}
+#endif
+
+#if HAVE_AVX2_INLINE
+static void uyvy_to_yuv422p_avx2(uint8_t *y, uint8_t *u, uint8_t *v,
+                                 const uint8_t *src, int width)
+{
+    x86_reg n = (width >> 1) & ~15;
+
+    if (n) {
+        x86_reg i = -n;
+        __asm__ volatile(
+            "vpcmpeqw     %%ymm7, %%ymm7, %%ymm7            \n\t"
+            "vpsrlw       $8, %%ymm7, %%ymm7                \n\t" // 0x00ff
+            ".p2align 4                                     \n\t"
+            "1:                                             \n\t"
+            "vmovdqu        (%1, %0, 4), %%ymm0             \n\t"
+            "vmovdqu      32(%1, %0, 4), %%ymm1             \n\t"
+            "vpsrlw       $8, %%ymm0, %%ymm2                \n\t"
+            "vpsrlw       $8, %%ymm1, %%ymm3                \n\t"
+            "vpackuswb    %%ymm3, %%ymm2, %%ymm2            \n\t"
+            "vpermq       $0xd8, %%ymm2, %%ymm2             \n\t" // Y
+            "vpand        %%ymm7, %%ymm0, %%ymm0            \n\t"
+            "vpand        %%ymm7, %%ymm1, %%ymm1            \n\t"
+            "vpackuswb    %%ymm1, %%ymm0, %%ymm0            \n\t"
+            "vpermq       $0xd8, %%ymm0, %%ymm0             \n\t" // UV
+            "vpsrlw       $8, %%ymm0, %%ymm1                \n\t"
+            "vpand        %%ymm7, %%ymm0, %%ymm0            \n\t"
+            "vpackuswb    %%ymm1, %%ymm0, %%ymm0            \n\t"
+            "vpermq       $0xd8, %%ymm0, %%ymm0             \n\t" // U | V
+            "vmovdqu      %%ymm2, (%2, %0, 2)               \n\t"
+            "vmovdqu      %%xmm0, (%3, %0)                  \n\t"
+            "vextracti128 $1, %%ymm0, (%4, %0)              \n\t"
+            "add          $16, %0                           \n\t"
+            " js 1b                                         \n\t"
+            "vzeroupper                                     \n\t"
+            : "+r"(i)
+            : "r"(src + 4 * n), "r"(y + 2 * n), "r"(u + n), "r"(v + n)
+            : XMM_CLOBBERS("xmm0", "xmm1", "xmm2", "xmm3", "xmm7",) "memory"
+        );
+    }
+    if (2 * n != width)
+        ff_decklink_uyvy_to_yuv422p_c(y + 2 * n, u + n, v + n, src + 4 * n,
+                                      width - 2 * n);
+}
+#endif
+
+#if HAVE_AVX2_INLINE && ARCH_X86_64
+static void uyvy_to_yuv420p_avx2(uint8_t *y0, uint8_t *y1, uint8_t *u,
+                                 uint8_t *v, const uint8_t *src0,
+                                 const uint8_t *src1, int width)
+{
+    x86_reg n = (width >> 1) & ~15;
+
+    if (n) {
+        x86_reg i = -n;
+        __asm__ volatile(
+            "vpcmpeqw     %%ymm7, %%ymm7, %%ymm7            \n\t"
+            "vpsrlw       $8, %%ymm7, %%ymm7                \n\t" // 0x00ff
+            ".p2align 4                                     \n\t"
+            "1:                                             \n\t"
+            "vmovdqu        (%1, %0, 4), %%ymm0             \n\t"
+            "vmovdqu      32(%1, %0, 4), %%ymm1             \n\t"
+            "vmovdqu        (%2, %0, 4), %%ymm4             \n\t"
+            "vmovdqu      32(%2, %0, 4), %%ymm5             \n\t"
+            "vpsrlw       $8, %%ymm0, %%ymm2                \n\t"
+            "vpsrlw       $8, %%ymm1, %%ymm3                \n\t"
+            "vpackuswb    %%ymm3, %%ymm2, %%ymm2            \n\t"
+            "vpermq       $0xd8, %%ymm2, %%ymm2             \n\t" // Y0
+            "vmovdqu      %%ymm2, (%3, %0, 2)               \n\t"
+            "vpsrlw       $8, %%ymm4, %%ymm2                \n\t"
+            "vpsrlw       $8, %%ymm5, %%ymm3                \n\t"
+            "vpackuswb    %%ymm3, %%ymm2, %%ymm2            \n\t"
+            "vpermq       $0xd8, %%ymm2, %%ymm2             \n\t" // Y1
+            "vmovdqu      %%ymm2, (%4, %0, 2)               \n\t"
+            "vpand        %%ymm7, %%ymm0, %%ymm0            \n\t"
+            "vpand        %%ymm7, %%ymm1, %%ymm1            \n\t"
+            "vpackuswb    %%ymm1, %%ymm0, %%ymm0            \n\t" // UV0
+            "vpand        %%ymm7, %%ymm4, %%ymm4            \n\t"
+            "vpand        %%ymm7, %%ymm5, %%ymm5            \n\t"
+            "vpackuswb    %%ymm5, %%ymm4, %%ymm4            \n\t" // UV1
+            "vpavgb       %%ymm4, %%ymm0, %%ymm0            \n\t"
+            "vpermq       $0xd8, %%ymm0, %%ymm0             \n\t" // UV
+            "vpsrlw       $8, %%ymm0, %%ymm1                \n\t"
+            "vpand        %%ymm7, %%ymm0, %%ymm0            \n\t"
+            "vpackuswb    %%ymm1, %%ymm0, %%ymm0            \n\t"
+            "vpermq       $0xd8, %%ymm0, %%ymm0             \n\t" // U | V
+            "vmovdqu      %%xmm0, (%5, %0)                  \n\t"
+            "vextracti128 $1, %%ymm0, (%6, %0)              \n\t"
+            "add          $16, %0                           \n\t"
+            " js 1b                                         \n\t"
+            "vzeroupper                                     \n\t"
+            : "+r"(i)
+            : "r"(src0 + 4 * n), "r"(src1 + 4 * n), "r"(y0 + 2 * n),
+              "r"(y1 + 2 * n), "r"(u + n), "r"(v + n)
+            : XMM_CLOBBERS("xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+                           "xmm7",) "memory"
+        );
+    }
+    if (2 * n != width)
+        ff_decklink_uyvy_to_yuv420p_c(y0 + 2 * n, y1 + 2 * n, u + n, v + n,
+                                      src0 + 4 * n, src1 + 4 * n, width - 2 * n);
+}
+#endif
+
+/* Unpack the v210 group at src into Y at y and U | V in xmm1, with the
+ * mask in xmm7 and the shuffles in xmm4, xmm5, xmm6 and uv_c. */
+#define V210_UNPACK_GROUP(src, y, uv_c)                                   \
+            "movdqu     ("src"), %%xmm0             \n\t"                 \
+            "movdqa     %%xmm0, %%xmm1              \n\t"                 \
+            "movdqa     %%xmm0, %%xmm2              \n\t"                 \
+            "pand       %%xmm7, %%xmm0              \n\t" /* a */         \
+            "psrld      $10, %%xmm1                 \n\t"                 \
+            "pand       %%xmm7, %%xmm1              \n\t" /* b */         \
+            "psrld      $20, %%xmm2                 \n\t"                 \
+            "pand       %%xmm7, %%xmm2              \n\t" /* c */         \
+            "packssdw   %%xmm1, %%xmm0              \n\t" /* ab */        \
+            "packssdw   %%xmm2, %%xmm2              \n\t" /* cc */        \
+            "movdqa     %%xmm0, %%xmm1              \n\t"                 \
+            "movdqa     %%xmm2, %%xmm3              \n\t"                 \
+            "pshufb     %%xmm4, %%xmm0              \n\t"                 \
+            "pshufb     %%xmm5, %%xmm2              \n\t"                 \
+            "por        %%xmm2, %%xmm0              \n\t" /* Y */         \
+            "pshufb     %%xmm6, %%xmm1              \n\t"                 \
+            "pshufb     "uv_c", %%xmm3              \n\t"                 \
+            "por        %%xmm3, %%xmm1              \n\t" /* U | V */     \
+            "movdqu     %%xmm0, ("y")               \n\t"
+
+#if HAVE_SSSE3_INLINE
+static void v210_to_yuv422p10_ssse3(uint16_t *y, uint16_t *u, uint16_t *v,
+                                    const uint8_t *src, int width)
+{
+    x86_reg n = width >= 8 ? (width - 8) / 6 + 1 : 0;
+    int done = 6 * n;
+
+    if (n) {
+        __asm__ volatile(
+            "pcmpeqd    %%xmm7, %%xmm7              \n\t"
+            "psrld      $22, %%xmm7                 \n\t" // 0x3ff
+            "movdqa     %5, %%xmm4                  \n\t"
+            "movdqa     %6, %%xmm5                  \n\t"
+            "movdqa     %7, %%xmm6                  \n\t"
+            ".p2align 4                             \n\t"
+            "1:                                     \n\t"
+            V210_UNPACK_GROUP("%1", "%2", "%8")
+            "movq       %%xmm1, (%3)                \n\t"
+            "movhps     %%xmm1, (%4)                \n\t"
+            "add        $16, %1                     \n\t"
+            "add        $12, %2                     \n\t"
+            "add        $6, %3                      \n\t"
+            "add        $6, %4                      \n\t"
+            "sub        $1, %0                      \n\t"
+            " jg 1b                                 \n\t"
+            : "+r"(n), "+r"(src), "+r"(y), "+r"(u), "+r"(v)
+            : "m"(shuf_y_ab), "m"(shuf_y_c), "m"(shuf_uv_ab), "m"(shuf_uv_c)
+            : XMM_CLOBBERS("xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+                           "xmm6", "xmm7",) "memory"
+        );
+    }
+    if (done != width)
+        ff_decklink_v210_to_yuv422p10_c(y, u, v, src, width - done);
+}
+#endif
+
+#if HAVE_SSSE3_INLINE && ARCH_X86_64
+static void v210_to_yuv420p10_ssse3(uint16_t *y0, uint16_t *y1, uint16_t *u,
+                                    uint16_t *v, const uint8_t *src0,
+                                    const uint8_t *src1, int width)
+{
+    x86_reg n = width >= 8 ? (width - 8) / 6 + 1 : 0;
+    int done = 6 * n;
+
+    if (n) {
+        __asm__ volatile(
+            "pcmpeqd    %%xmm7, %%xmm7              \n\t"
+            "psrld      $22, %%xmm7                 \n\t" // 0x3ff
+            "movdqa     %7, %%xmm4                  \n\t"
+            "movdqa     %8, %%xmm5                  \n\t"
+            "movdqa     %9, %%xmm6                  \n\t"
+            "movdqa     %10, %%xmm9                 \n\t"
+            ".p2align 4                             \n\t"
+            "1:                                     \n\t"
+            V210_UNPACK_GROUP("%1", "%2", "%%xmm9")
+            "movdqa     %%xmm1, %%xmm8              \n\t"
+            V210_UNPACK_GROUP("%3", "%4", "%%xmm9")
+            "pavgw      %%xmm8, %%xmm1              \n\t"
+            "movq       %%xmm1, (%5)                \n\t"
+            "movhps     %%xmm1, (%6)                \n\t"
+            "add        $16, %1                     \n\t"
+            "add        $16, %3                     \n\t"
+            "add        $12, %2                     \n\t"
+            "add        $12, %4                     \n\t"
+            "add        $6, %5                      \n\t"
+            "add        $6, %6                      \n\t"
+            "sub        $1, %0                      \n\t"
+            " jg 1b                                 \n\t"
+            : "+r"(n), "+r"(src0), "+r"(y0), "+r"(src1), "+r"(y1),
+              "+r"(u), "+r"(v)
+            : "m"(shuf_y_ab), "m"(shuf_y_c), "m"(shuf_uv_ab), "m"(shuf_uv_c)
+            : XMM_CLOBBERS("xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+                           "xmm6", "xmm7", "xmm8", "xmm9",) "memory"
+        );
+    }
+    if (done != width)
+        ff_decklink_v210_to_yuv420p10_c(y0, y1, u, v, src0, src1, width - done);
+}
+#endif
+
+#if HAVE_AVX2_INLINE && ARCH_X86_64
+/* Two groups per iteration, one in each lane. */
+static void v210_to_yuv422p10_avx2(uint16_t *y, uint16_t *u, uint16_t *v,
+                                   const uint8_t *src, int width)
+{
+    x86_reg n = width >= 14 ? (width - 14) / 12 + 1 : 0;
+    int done = 12 * n;
+
+    if (n) {
+        __asm__ volatile(
+            "vpcmpeqd     %%ymm7, %%ymm7, %%ymm7            \n\t"
+            "vpsrld       $22, %%ymm7, %%ymm7               \n\t" // 0x3ff
+            "vbroadcasti128 %5, %%ymm4                      \n\t"
+            "vbroadcasti128 %6, %%ymm5                      \n\t"
+            "vbroadcasti128 %7, %%ymm6                      \n\t"
+            "vbroadcasti128 %8, %%ymm3                      \n\t"
+            ".p2align 4                                     \n\t"
+            "1:                                             \n\t"
+            "vmovdqu      (%1), %%ymm0                      \n\t"
+            "vpsrld       $10, %%ymm0, %%ymm1               \n\t"
+            "vpsrld       $20, %%ymm0, %%ymm2               \n\t"
+            "vpand        %%ymm7, %%ymm0, %%ymm0            \n\t" // a
+            "vpand        %%ymm7, %%ymm1, %%ymm1            \n\t" // b
+            "vpand        %%ymm7, %%ymm2, %%ymm2            \n\t" // c
+            "vpackssdw    %%ymm1, %%ymm0, %%ymm0            \n\t" // ab
+            "vpackssdw    %%ymm2, %%ymm2, %%ymm2            \n\t" // cc
+            "vpshufb      %%ymm4, %%ymm0, %%ymm1            \n\t"
+            "vpshufb      %%ymm5, %%ymm2, %%ymm8            \n\t"
+            "vpor         %%ymm8, %%ymm1, %%ymm1            \n\t" // Y
+            "vpshufb      %%ymm6, %%ymm0, %%ymm0            \n\t"
+            "vpshufb      %%ymm3, %%ymm2, %%ymm2            \n\t"
+            "vpor         %%ymm2, %%ymm0, %%ymm0            \n\t" // U | V
+            "vmovdqu      %%xmm1, (%2)                      \n\t"
+            "vextracti128 $1, %%ymm1, 12(%2)                \n\t"
+            "vextracti128 $1, %%ymm0, %%xmm2                \n\t"
+            "vmovq        %%xmm0, (%3)                      \n\t"
+            "vmovhps      %%xmm0, (%4)                      \n\t"
+            "vmovq        %%xmm2, 6(%3)                     \n\t"
+            "vmovhps      %%xmm2, 6(%4)                     \n\t"
+            "add          $32, %1                           \n\t"
+            "add          $24, %2                           \n\t"
+            "add          $12, %3                           \n\t"
+            "add          $12, %4                           \n\t"
+            "sub          $1, %0                            \n\t"
+            " jg 1b                                         \n\t"
+            "vzeroupper                                     \n\t"
+            : "+r"(n), "+r"(src), "+r"(y), "+r"(u), "+r"(v)
+            : "m"(shuf_y_ab), "m"(shuf_y_c), "m"(shuf_uv_ab), "m"(shuf_uv_c)
+            : XMM_CLOBBERS("xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+                           "xmm6", "xmm7", "xmm8",) "memory"
+        );
+    }
+    if (done != width)
+        ff_decklink_v210_to_yuv422p10_c(y, u, v, src, width - done);
+}
+#endif
+
+av_cold void ff_decklink_unpack_dsp_init_x86(DecklinkUnpackDSPContext *dsp)
+{
+    int cpu_flags = av_get_cpu_flags();
+
+#if HAVE_SSE2_INLINE
+    if (INLINE_SSE2(cpu_flags)) {
+        dsp->uyvy_to_yuv422p = uyvy_to_yuv422p_sse2;
+#if ARCH_X86_64
+        dsp->uyvy_to_yuv420p = uyvy_to_yuv420p_sse2;
+#endif
+    }
+#endif
+#if HAVE_SSSE3_INLINE
+    if (INLINE_SSSE3(cpu_flags)) {
+        dsp->v210_to_yuv422p10 = v210_to_yuv422p10_ssse3;
+#if ARCH_X86_64
+        dsp->v210_to_yuv420p10 = v210_to_yuv420p10_ssse3;
+#endif
+    }
+#endif
+#if HAVE_AVX2_INLINE
+    if (INLINE_AVX2(cpu_flags)) {
+        dsp->uyvy_to_yuv422p   = uyvy_to_yuv422p_avx2;
+#if ARCH_X86_64
+        dsp->uyvy_to_yuv420p   = uyvy_to_yuv420p_avx2;
+        dsp->v210_to_yuv422p10 = v210_to_yuv422p10_avx2;
+#endif
+    }
+#endif
+}
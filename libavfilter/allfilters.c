@@ -46,6 +46,8 @@ void avfilter_register_all(void)
     initialized = 1;
 
     REGISTER_FILTER(VR_MAP,         vr_map,         vf);
+    REGISTER_FILTER(VR_PROJECT,     vr_project,     vf);
+    REGISTER_FILTER(VR_TILES,       vr_tiles,       vf);
 
     REGISTER_FILTER(ACROSSFADE,     acrossfade,     af);
     REGISTER_FILTER(ADELAY,         adelay,         af);
@@ -60,6 +62,7 @@ void avfilter_register_all(void)
     REGISTER_FILTER(ANULL,          anull,          af);
     REGISTER_FILTER(APAD,           apad,           af);
     REGISTER_FILTER(APERMS,         aperms,         af);
+    REGISTER_FILTER(APIPELINE,      apipeline,      af);
     REGISTER_FILTER(APHASER,        aphaser,        af);
     REGISTER_FILTER(ARESAMPLE,      aresample,      af);
     REGISTER_FILTER(AREVERSE,       areverse,       af);
@@ -201,6 +204,7 @@ void avfilter_register_all(void)
     REGISTER_FILTER(PALETTEGEN,     palettegen,     vf);
     REGISTER_FILTER(PALETTEUSE,     paletteuse,     vf);
     REGISTER_FILTER(PERMS,          perms,          vf);
+    REGISTER_FILTER(PIPELINE,       pipeline,       vf);
     REGISTER_FILTER(PERSPECTIVE,    perspective,    vf);
     REGISTER_FILTER(PHASE,          phase,          vf);
     REGISTER_FILTER(PIXDESCTEST,    pixdesctest,    vf);
@@ -36,6 +36,7 @@
 #include "avfilter.h"
 #include "formats.h"
 #include "internal.h"
+#include "video.h"
 
 #include "libavutil/ffversion.h"
 const char av_filter_ffversion[] = "FFmpeg version " FFMPEG_VERSION;
@@ -168,6 +169,7 @@ void avfilter_link_free(AVFilterLink **link)
         return;
 
     av_frame_free(&(*link)->partial_buf);
+    ff_video_frame_pool_uninit(*link);
 
     av_freep(link);
 }
@@ -447,6 +449,32 @@ static int set_enable_expr(AVFilterContext *ctx, const char *expr)
     return 0;
 }
 
+void ff_filter_segment_lock(AVFilterContext *ctx)
+{
+#if HAVE_PTHREADS
+    if (ctx->internal->segment)
+        pthread_mutex_lock(&ctx->internal->segment->lock);
+#endif
+}
+
+int ff_filter_segment_trylock(AVFilterContext *ctx)
+{
+#if HAVE_PTHREADS
+    if (ctx->internal->segment &&
+        pthread_mutex_trylock(&ctx->internal->segment->lock))
+        return AVERROR(EAGAIN);
+#endif
+    return 0;
+}
+
+void ff_filter_segment_unlock(AVFilterContext *ctx)
+{
+#if HAVE_PTHREADS
+    if (ctx->internal->segment)
+        pthread_mutex_unlock(&ctx->internal->segment->lock);
+#endif
+}
+
 void ff_update_link_current_pts(AVFilterLink *link, int64_t pts)
 {
     if (pts == AV_NOPTS_VALUE)
@@ -727,6 +755,10 @@ void avfilter_free(AVFilterContext *filter)
     if (!filter)
         return;
 
+    /* the pipeline filter running this one must stop its thread first */
+    if (filter->internal && filter->internal->segment)
+        avfilter_free(filter->internal->segment->stage);
+
     if (filter->graph)
         ff_filter_graph_remove_filter(filter->graph, filter);
 
@@ -627,6 +627,16 @@ typedef struct AVFilter {
  */
 #define AVFILTER_THREAD_SLICE (1 << 0)
 
+/**
+ * Share the slice threads with the other graphs using the same number of
+ * threads and flags, instead of starting threads for this graph.
+ */
+#define AVFILTER_THREAD_FLAG_SHARED   (1 << 0)
+/**
+ * Pin each slice thread to one of the CPUs the process may run on.
+ */
+#define AVFILTER_THREAD_FLAG_AFFINITY (1 << 1)
+
 typedef struct AVFilterInternal AVFilterInternal;
 
 /** An instance of a filter */
@@ -864,6 +874,11 @@ struct AVFilterLink {
      * Number of past frames sent through the link.
      */
     int64_t frame_count;
+
+    /**
+     * A pointer to a FFFramePool struct.
+     */
+    void *frame_pool;
 };
 
 /**
@@ -1234,6 +1249,12 @@ typedef struct AVFilterGraph {
 
     char *aresample_swr_opts; ///< swr options to use for the auto-inserted aresample filters, Access ONLY through AVOptions
 
+    /**
+     * Slice threading flags, a combination of AVFILTER_THREAD_FLAG_*.
+     * May be set by the caller before adding any filters to the filtergraph.
+     */
+    int thread_flags;
+
     /**
      * Private fields
      *
@@ -45,6 +45,10 @@ static const AVOption filtergraph_options[] = {
         { "slice", NULL, 0, AV_OPT_TYPE_CONST, { .i64 = AVFILTER_THREAD_SLICE }, .flags = FLAGS, .unit = "thread_type" },
     { "threads",     "Maximum number of threads", OFFSET(nb_threads),
         AV_OPT_TYPE_INT,   { .i64 = 0 }, 0, INT_MAX, FLAGS },
+    { "thread_flags", "Slice threading flags", OFFSET(thread_flags), AV_OPT_TYPE_FLAGS,
+        { .i64 = 0 }, 0, INT_MAX, FLAGS, "thread_flags" },
+        { "shared",   "share the threads with other graphs", 0, AV_OPT_TYPE_CONST, { .i64 = AVFILTER_THREAD_FLAG_SHARED },   .flags = FLAGS, .unit = "thread_flags" },
+        { "affinity", "pin the threads to CPUs",             0, AV_OPT_TYPE_CONST, { .i64 = AVFILTER_THREAD_FLAG_AFFINITY }, .flags = FLAGS, .unit = "thread_flags" },
     {"scale_sws_opts"       , "default scale filter options"        , OFFSET(scale_sws_opts)        ,
         AV_OPT_TYPE_STRING, {.str = NULL}, 0, 0, FLAGS },
     {"aresample_swr_opts"   , "default aresample filter options"    , OFFSET(aresample_swr_opts)    ,
@@ -88,6 +92,11 @@ AVFilterGraph *avfilter_graph_alloc(void)
     ret->av_class = &filtergraph_class;
     av_opt_set_defaults(ret);
 
+#if HAVE_PTHREADS
+    pthread_mutex_init(&ret->internal->pipeline_lock, NULL);
+    pthread_cond_init(&ret->internal->pipeline_cond, NULL);
+#endif
+
     return ret;
 }
 
@@ -114,6 +123,11 @@ void avfilter_graph_free(AVFilterGraph **graph)
 
     ff_graph_thread_free(*graph);
 
+#if HAVE_PTHREADS
+    pthread_mutex_destroy(&(*graph)->internal->pipeline_lock);
+    pthread_cond_destroy(&(*graph)->internal->pipeline_cond);
+#endif
+
     av_freep(&(*graph)->sink_links);
 
     av_freep(&(*graph)->scale_sws_opts);
@@ -1283,7 +1297,9 @@ int avfilter_graph_send_command(AVFilterGraph *graph, const char *target, const
     for (i = 0; i < graph->nb_filters; i++) {
         AVFilterContext *filter = graph->filters[i];
         if (!strcmp(target, "all") || (filter->name && !strcmp(target, filter->name)) || !strcmp(target, filter->filter->name)) {
+            ff_filter_segment_lock(filter);
             r = avfilter_process_command(filter, cmd, arg, res, res_len, flags);
+            ff_filter_segment_unlock(filter);
             if (r != AVERROR(ENOSYS)) {
                 if ((flags & AVFILTER_CMD_FLAG_ONE) || r < 0)
                     return r;
@@ -1305,6 +1321,7 @@ int avfilter_graph_queue_command(AVFilterGraph *graph, const char *target, const
         AVFilterContext *filter = graph->filters[i];
         if(filter && (!strcmp(target, "all") || !strcmp(target, filter->name) || !strcmp(target, filter->filter->name))){
             AVFilterCommand **queue = &filter->command_queue, *next;
+            ff_filter_segment_lock(filter);
             while (*queue && (*queue)->time <= ts)
                 queue = &(*queue)->next;
             next = *queue;
@@ -1314,6 +1331,7 @@ int avfilter_graph_queue_command(AVFilterGraph *graph, const char *target, const
             (*queue)->time    = ts;
             (*queue)->flags   = flags;
             (*queue)->next    = next;
+            ff_filter_segment_unlock(filter);
             if(flags & AVFILTER_CMD_FLAG_ONE)
                 return 0;
         }
@@ -1365,28 +1383,58 @@ static void heap_bubble_down(AVFilterGraph *graph,
     link->age_index = index;
 }
 
+void ff_filter_graph_pipeline_lock(AVFilterGraph *graph)
+{
+#if HAVE_PTHREADS
+    if (graph->internal->nb_pipeline_stages)
+        pthread_mutex_lock(&graph->internal->pipeline_lock);
+#endif
+}
+
+void ff_filter_graph_pipeline_unlock(AVFilterGraph *graph)
+{
+#if HAVE_PTHREADS
+    if (graph->internal->nb_pipeline_stages)
+        pthread_mutex_unlock(&graph->internal->pipeline_lock);
+#endif
+}
+
 void ff_avfilter_graph_update_heap(AVFilterGraph *graph, AVFilterLink *link)
 {
-    heap_bubble_up  (graph, link, link->age_index);
-    heap_bubble_down(graph, link, link->age_index);
+    ff_filter_graph_pipeline_lock(graph);
+    if (link->age_index >= 0) {
+        heap_bubble_up  (graph, link, link->age_index);
+        heap_bubble_down(graph, link, link->age_index);
+    }
+    ff_filter_graph_pipeline_unlock(graph);
 }
 
 
 int avfilter_graph_request_oldest(AVFilterGraph *graph)
 {
+    ff_filter_graph_pipeline_lock(graph);
     while (graph->sink_links_count) {
         AVFilterLink *oldest = graph->sink_links[0];
-        int r = ff_request_frame(oldest);
+        int r;
+
+        ff_filter_graph_pipeline_unlock(graph);
+        /* a busy segment is producing frames, do not wait for it */
+        if ((r = ff_filter_segment_trylock(oldest->dst)) < 0)
+            return r;
+        r = ff_request_frame(oldest);
+        ff_filter_segment_unlock(oldest->dst);
         if (r != AVERROR_EOF)
             return r;
         av_log(oldest->dst, AV_LOG_DEBUG, "EOF on sink link %s:%s.\n",
                oldest->dst ? oldest->dst->name : "unknown",
                oldest->dstpad ? oldest->dstpad->name : "unknown");
         /* EOF: remove the link from the heap */
+        ff_filter_graph_pipeline_lock(graph);
         if (oldest->age_index < --graph->sink_links_count)
             heap_bubble_down(graph, graph->sink_links[graph->sink_links_count],
                              oldest->age_index);
         oldest->age_index = -1;
     }
+    ff_filter_graph_pipeline_unlock(graph);
     return AVERROR_EOF;
 }
@@ -125,7 +125,7 @@ int attribute_align_arg av_buffersink_get_frame(AVFilterContext *ctx, AVFrame *f
     return av_buffersink_get_frame_flags(ctx, frame, 0);
 }
 
-int attribute_align_arg av_buffersink_get_frame_flags(AVFilterContext *ctx, AVFrame *frame, int flags)
+static int get_frame_internal(AVFilterContext *ctx, AVFrame *frame, int flags)
 {
     BufferSinkContext *buf = ctx->priv;
     AVFilterLink *inlink = ctx->inputs[0];
@@ -158,6 +158,21 @@ int attribute_align_arg av_buffersink_get_frame_flags(AVFilterContext *ctx, AVFr
     return 0;
 }
 
+int attribute_align_arg av_buffersink_get_frame_flags(AVFilterContext *ctx, AVFrame *frame, int flags)
+{
+    int ret;
+
+    if (flags & AV_BUFFERSINK_FLAG_NO_REQUEST) {
+        if ((ret = ff_filter_segment_trylock(ctx)) < 0)
+            return ret;
+    } else {
+        ff_filter_segment_lock(ctx);
+    }
+    ret = get_frame_internal(ctx, frame, flags);
+    ff_filter_segment_unlock(ctx);
+    return ret;
+}
+
 static int read_from_fifo(AVFilterContext *ctx, AVFrame *frame,
                           int nb_samples)
 {
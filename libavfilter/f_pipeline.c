@@ -0,0 +1,402 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Run the filters after this one on their own thread.
+ *
+ * Frames pushed into the filter are queued and the thread sends them on,
+ * so the filters before and after it work on different frames at the same
+ * time. The filters after it, up to the graph outputs or the next pipeline
+ * filters, form a segment: they run on the thread of this filter, or on
+ * another thread holding the segment lock (see FFFilterSegment).
+ *
+ * All the shared state (queues, flags) is guarded by the pipeline lock of
+ * the graph, which is never held while filters run.
+ */
+
+#include <pthread.h>
+
+#include "libavutil/opt.h"
+#include "avfilter.h"
+#include "bufferqueue.h"
+#include "internal.h"
+
+typedef struct PipelineContext {
+    const AVClass *class;
+    int queue_size;
+
+    FFFilterSegment segment;        ///< the filters after this one
+    struct FFBufQueue queue;
+    int running;                    ///< the thread takes or holds the segment lock
+    int in_request;                 ///< the segment lock holder requests upstream
+    int eof;
+    int error;
+    int quit;
+
+    pthread_t thread;
+    int thread_started;
+} PipelineContext;
+
+static int init(AVFilterContext *ctx);
+
+static int is_pipeline(AVFilterContext *ctx)
+{
+    return ctx->filter->init == init;
+}
+
+static PipelineContext *segment_stage(FFFilterSegment *segment)
+{
+    return segment ? segment->stage->priv : NULL;
+}
+
+/* Send the oldest queued frame on; the caller holds the segment lock.
+ * Returns 1 if a frame was sent, 0 if the queue was empty. */
+static int send_frame(AVFilterContext *ctx)
+{
+    PipelineContext *s = ctx->priv;
+    pthread_mutex_t *lock = &ctx->graph->internal->pipeline_lock;
+    pthread_cond_t  *cond = &ctx->graph->internal->pipeline_cond;
+    AVFrame *frame = NULL;
+    int ret;
+
+    pthread_mutex_lock(lock);
+    if (s->queue.available) {
+        frame = ff_bufqueue_get(&s->queue);
+        pthread_cond_broadcast(cond);
+    }
+    pthread_mutex_unlock(lock);
+    if (!frame)
+        return 0;
+
+    ret = ff_filter_frame(ctx->outputs[0], frame);
+
+    pthread_mutex_lock(lock);
+    if (ret < 0 && !s->error)
+        s->error = ret;
+    pthread_mutex_unlock(lock);
+    return ret < 0 ? ret : 1;
+}
+
+static void *pipeline_thread(void *arg)
+{
+    AVFilterContext *ctx = arg;
+    PipelineContext *s = ctx->priv;
+    pthread_mutex_t *lock = &ctx->graph->internal->pipeline_lock;
+    pthread_cond_t  *cond = &ctx->graph->internal->pipeline_cond;
+
+    pthread_mutex_lock(lock);
+    while (1) {
+        while (!s->quit && !s->queue.available)
+            pthread_cond_wait(cond, lock);
+        if (s->quit)
+            break;
+        s->running = 1;
+        pthread_mutex_unlock(lock);
+
+        pthread_mutex_lock(&s->segment.lock);
+        send_frame(ctx);
+        pthread_mutex_unlock(&s->segment.lock);
+
+        pthread_mutex_lock(lock);
+        s->running = 0;
+        pthread_cond_broadcast(cond);
+    }
+    pthread_mutex_unlock(lock);
+    return NULL;
+}
+
+static int filter_frame(AVFilterLink *inlink, AVFrame *frame)
+{
+    AVFilterContext *ctx = inlink->dst;
+    PipelineContext *s = ctx->priv;
+    pthread_mutex_t *lock = &ctx->graph->internal->pipeline_lock;
+    pthread_cond_t  *cond = &ctx->graph->internal->pipeline_cond;
+    int ret = 0;
+
+    pthread_mutex_lock(lock);
+    while (!s->error && s->queue.available >= s->queue_size) {
+        if (s->in_request) {
+            /* the thread would wait for the segment lock we hold */
+            pthread_mutex_unlock(lock);
+            send_frame(ctx);
+            pthread_mutex_lock(lock);
+        } else {
+            pthread_cond_wait(cond, lock);
+        }
+    }
+    if (s->error) {
+        ret = s->error;
+        av_frame_free(&frame);
+    } else {
+        ff_bufqueue_add(ctx, &s->queue, frame);
+        pthread_cond_broadcast(cond);
+    }
+    pthread_mutex_unlock(lock);
+    return ret;
+}
+
+static int request_upstream(AVFilterContext *ctx)
+{
+    PipelineContext *s = ctx->priv;
+    pthread_mutex_t *lock = &ctx->graph->internal->pipeline_lock;
+    int ret;
+
+    pthread_mutex_lock(lock);
+    s->in_request = 1;
+    pthread_mutex_unlock(lock);
+
+    ret = ff_request_frame(ctx->inputs[0]);
+
+    pthread_mutex_lock(lock);
+    s->in_request = 0;
+    if (ret == AVERROR_EOF)
+        s->eof = 1;
+    pthread_mutex_unlock(lock);
+    return ret;
+}
+
+/*
+ * Called with our segment lock held. Frames already queued are left to the
+ * thread, unless the filters before us are not run by the caller either: a
+ * request that cannot make progress upstream sends one of them itself.
+ */
+static int request_frame(AVFilterLink *outlink)
+{
+    AVFilterContext *ctx = outlink->src;
+    PipelineContext *s = ctx->priv;
+    FFFilterSegment *upstream = ctx->internal->segment;
+    PipelineContext *up = segment_stage(upstream);
+    pthread_mutex_t *lock = &ctx->graph->internal->pipeline_lock;
+    pthread_cond_t  *cond = &ctx->graph->internal->pipeline_cond;
+    int ret;
+
+    while (1) {
+        pthread_mutex_lock(lock);
+        ret = s->error;
+        if (!ret && s->queue.available && (up || s->eof)) {
+            pthread_mutex_unlock(lock);
+            ret = send_frame(ctx);
+            return ret < 0 ? ret : 0;
+        }
+        if (!ret && s->eof)
+            ret = AVERROR_EOF;
+        if (!ret && up && (up->running || up->queue.available)) {
+            /* the previous pipeline thread is working for us */
+            pthread_cond_wait(cond, lock);
+            pthread_mutex_unlock(lock);
+            continue;
+        }
+        pthread_mutex_unlock(lock);
+        if (ret)
+            return ret;
+
+        if (!upstream) {
+            /* filters before us are run by the caller, like this request */
+            ret = request_upstream(ctx);
+            if (ret == AVERROR_EOF)
+                continue;
+            if (ret < 0)
+                return ret;
+            pthread_mutex_lock(lock);
+            ret = s->queue.available;
+            pthread_mutex_unlock(lock);
+            if (ret) {
+                ret = send_frame(ctx);
+                return ret < 0 ? ret : 0;
+            }
+        } else if (!pthread_mutex_trylock(&upstream->lock)) {
+            ret = request_upstream(ctx);
+            pthread_mutex_unlock(&upstream->lock);
+            if (ret < 0 && ret != AVERROR_EOF)
+                return ret;
+        }
+    }
+}
+
+/* Assign the filters after us to our segment, they must not be fed from
+ * outside of it. */
+static void mark_segment(AVFilterContext *f, FFFilterSegment *segment)
+{
+    int i;
+
+    for (i = 0; i < f->nb_outputs; i++) {
+        AVFilterContext *dst = f->outputs[i] ? f->outputs[i]->dst : NULL;
+
+        if (!dst || dst->internal->segment == segment)
+            continue;
+        dst->internal->segment = segment;
+        if (!is_pipeline(dst))
+            mark_segment(dst, segment);
+    }
+}
+
+static int config_output(AVFilterLink *outlink)
+{
+    AVFilterContext *ctx = outlink->src;
+    PipelineContext *s = ctx->priv;
+    AVFilterGraph *graph = ctx->graph;
+    int i, j, ret;
+
+    mark_segment(ctx, &s->segment);
+    for (i = 0; i < graph->nb_filters; i++) {
+        AVFilterContext *f = graph->filters[i];
+
+        if (f->internal->segment != &s->segment)
+            continue;
+        for (j = 0; j < f->nb_inputs; j++) {
+            AVFilterContext *src = f->inputs[j] ? f->inputs[j]->src : NULL;
+            if (src && src != ctx && src->internal->segment != &s->segment) {
+                av_log(ctx, AV_LOG_ERROR, "%s gets frames from this pipeline "
+                       "stage and from %s, all its inputs must come from the "
+                       "same stage.\n", f->name, src->name);
+                return AVERROR(EINVAL);
+            }
+        }
+    }
+
+    if (!s->thread_started) {
+        ret = pthread_create(&s->thread, NULL, pipeline_thread, ctx);
+        if (ret) {
+            av_log(ctx, AV_LOG_ERROR, "Could not create the thread: %s\n",
+                   av_err2str(AVERROR(ret)));
+            return AVERROR(ret);
+        }
+        s->thread_started = 1;
+    }
+    return 0;
+}
+
+static av_cold int init(AVFilterContext *ctx)
+{
+    PipelineContext *s = ctx->priv;
+
+    if (!ctx->graph) {
+        av_log(ctx, AV_LOG_ERROR, "The pipeline filter only works in a graph.\n");
+        return AVERROR(EINVAL);
+    }
+    s->segment.stage = ctx;
+    pthread_mutex_init(&s->segment.lock, NULL);
+    ctx->graph->internal->nb_pipeline_stages++;
+    return 0;
+}
+
+static av_cold void uninit(AVFilterContext *ctx)
+{
+    PipelineContext *s = ctx->priv;
+    int i;
+
+    if (!s->segment.stage)
+        return;
+
+    if (s->thread_started) {
+        pthread_mutex_lock(&ctx->graph->internal->pipeline_lock);
+        s->quit = 1;
+        pthread_cond_broadcast(&ctx->graph->internal->pipeline_cond);
+        pthread_mutex_unlock(&ctx->graph->internal->pipeline_lock);
+        pthread_join(s->thread, NULL);
+    }
+    ff_bufqueue_discard_all(&s->queue);
+
+    for (i = 0; i < ctx->graph->nb_filters; i++)
+        if (ctx->graph->filters[i]->internal->segment == &s->segment)
+            ctx->graph->filters[i]->internal->segment = NULL;
+    pthread_mutex_destroy(&s->segment.lock);
+    ctx->graph->internal->nb_pipeline_stages--;
+}
+
+#define OFFSET(x) offsetof(PipelineContext, x)
+#define FLAGS AV_OPT_FLAG_FILTERING_PARAM
+static const AVOption options[] = {
+    { "queue", "set the number of frames queued for the thread", OFFSET(queue_size), AV_OPT_TYPE_INT, { .i64 = 4 }, 1, FF_BUFQUEUE_SIZE - 1, FLAGS },
+    { NULL }
+};
+
+#if CONFIG_PIPELINE_FILTER
+
+#define pipeline_options options
+AVFILTER_DEFINE_CLASS(pipeline);
+
+static const AVFilterPad pipeline_inputs[] = {
+    {
+        .name         = "default",
+        .type         = AVMEDIA_TYPE_VIDEO,
+        .filter_frame = filter_frame,
+    },
+    { NULL }
+};
+
+static const AVFilterPad pipeline_outputs[] = {
+    {
+        .name          = "default",
+        .type          = AVMEDIA_TYPE_VIDEO,
+        .config_props  = config_output,
+        .request_frame = request_frame,
+    },
+    { NULL }
+};
+
+AVFilter ff_vf_pipeline = {
+    .name        = "pipeline",
+    .description = NULL_IF_CONFIG_SMALL("Run the following filters on their own thread."),
+    .priv_size   = sizeof(PipelineContext),
+    .priv_class  = &pipeline_class,
+    .init        = init,
+    .uninit      = uninit,
+    .inputs      = pipeline_inputs,
+    .outputs     = pipeline_outputs,
+};
+
+#endif /* CONFIG_PIPELINE_FILTER */
+
+#if CONFIG_APIPELINE_FILTER
+
+#define apipeline_options options
+AVFILTER_DEFINE_CLASS(apipeline);
+
+static const AVFilterPad apipeline_inputs[] = {
+    {
+        .name         = "default",
+        .type         = AVMEDIA_TYPE_AUDIO,
+        .filter_frame = filter_frame,
+    },
+    { NULL }
+};
+
+static const AVFilterPad apipeline_outputs[] = {
+    {
+        .name          = "default",
+        .type          = AVMEDIA_TYPE_AUDIO,
+        .config_props  = config_output,
+        .request_frame = request_frame,
+    },
+    { NULL }
+};
+
+AVFilter ff_af_apipeline = {
+    .name        = "apipeline",
+    .description = NULL_IF_CONFIG_SMALL("Run the following filters on their own thread."),
+    .priv_size   = sizeof(PipelineContext),
+    .priv_class  = &apipeline_class,
+    .init        = init,
+    .uninit      = uninit,
+    .inputs      = apipeline_inputs,
+    .outputs     = apipeline_outputs,
+};
+
+#endif /* CONFIG_APIPELINE_FILTER */
@@ -0,0 +1,177 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "libavutil/buffer.h"
+#include "libavutil/common.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/mem.h"
+#include "libavutil/pixdesc.h"
+#include "framepool.h"
+
+struct FFFramePool {
+    int width;
+    int height;
+    enum AVPixelFormat format;
+    int align;
+    int linesize[4];
+    AVBufferPool *pools[4];
+
+    AVBufferRef* (*alloc)(int size);
+    int64_t gets, misses;
+};
+
+static AVBufferRef *pool_alloc(void *opaque, int size)
+{
+    FFFramePool *pool = opaque;
+
+    pool->misses++;
+    return pool->alloc(size);
+}
+
+FFFramePool *ff_frame_pool_video_init(AVBufferRef* (*alloc)(int size),
+                                      int width,
+                                      int height,
+                                      enum AVPixelFormat format,
+                                      int align)
+{
+    int i, ret;
+    FFFramePool *pool;
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(format);
+
+    if (!desc)
+        return NULL;
+
+    pool = av_mallocz(sizeof(FFFramePool));
+    if (!pool)
+        return NULL;
+
+    pool->width  = width;
+    pool->height = height;
+    pool->format = format;
+    pool->align  = align;
+    pool->alloc  = alloc ? alloc : av_buffer_alloc;
+
+    if ((ret = av_image_check_size(width, height, 0, NULL)) < 0)
+        goto fail;
+
+    /* same layout as av_frame_get_buffer() */
+    for (i = 1; i <= align; i += i) {
+        ret = av_image_fill_linesizes(pool->linesize, format, FFALIGN(width, i));
+        if (ret < 0)
+            goto fail;
+        if (!(pool->linesize[0] & (align - 1)))
+            break;
+    }
+    for (i = 0; i < 4 && pool->linesize[i]; i++)
+        pool->linesize[i] = FFALIGN(pool->linesize[i], align);
+
+    for (i = 0; i < 4 && pool->linesize[i]; i++) {
+        int h = FFALIGN(height, 32);
+        if (i == 1 || i == 2)
+            h = FF_CEIL_RSHIFT(h, desc->log2_chroma_h);
+
+        pool->pools[i] = av_buffer_pool_init2(pool->linesize[i] * h + 16 + 16 - 1,
+                                              pool, pool_alloc, NULL);
+        if (!pool->pools[i])
+            goto fail;
+    }
+
+    if (desc->flags & AV_PIX_FMT_FLAG_PAL ||
+        desc->flags & AV_PIX_FMT_FLAG_PSEUDOPAL) {
+        av_buffer_pool_uninit(&pool->pools[1]);
+        pool->pools[1] = av_buffer_pool_init2(1024, pool, pool_alloc, NULL);
+        if (!pool->pools[1])
+            goto fail;
+    }
+
+    return pool;
+
+fail:
+    ff_frame_pool_uninit(&pool);
+    return NULL;
+}
+
+int ff_frame_pool_get_video_config(FFFramePool *pool,
+                                   int *width,
+                                   int *height,
+                                   enum AVPixelFormat *format,
+                                   int *align)
+{
+    if (!pool)
+        return AVERROR(EINVAL);
+
+    *width  = pool->width;
+    *height = pool->height;
+    *format = pool->format;
+    *align  = pool->align;
+
+    return 0;
+}
+
+void ff_frame_pool_get_stats(FFFramePool *pool, int64_t *hits, int64_t *misses)
+{
+    *hits   = pool->gets - pool->misses;
+    *misses = pool->misses;
+}
+
+AVFrame *ff_frame_pool_get(FFFramePool *pool)
+{
+    int i;
+    AVFrame *frame;
+
+    frame = av_frame_alloc();
+    if (!frame)
+        return NULL;
+
+    frame->width  = pool->width;
+    frame->height = pool->height;
+    frame->format = pool->format;
+
+    for (i = 0; i < 4; i++) {
+        frame->linesize[i] = pool->linesize[i];
+        if (!pool->pools[i])
+            break;
+
+        frame->buf[i] = av_buffer_pool_get(pool->pools[i]);
+        if (!frame->buf[i])
+            goto fail;
+        pool->gets++;
+
+        frame->data[i] = frame->buf[i]->data;
+    }
+
+    frame->extended_data = frame->data;
+
+    return frame;
+fail:
+    av_frame_free(&frame);
+    return NULL;
+}
+
+void ff_frame_pool_uninit(FFFramePool **pool)
+{
+    int i;
+
+    if (!pool || !*pool)
+        return;
+
+    for (i = 0; i < 4; i++)
+        av_buffer_pool_uninit(&(*pool)->pools[i]);
+
+    av_freep(pool);
+}
@@ -0,0 +1,90 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVFILTER_FRAMEPOOL_H
+#define AVFILTER_FRAMEPOOL_H
+
+#include <stdint.h>
+
+#include "libavutil/buffer.h"
+#include "libavutil/frame.h"
+
+/**
+ * Frame pool. This structure is opaque and not meant to be accessed
+ * directly. It is allocated with ff_frame_pool_video_init() and freed with
+ * ff_frame_pool_uninit().
+ */
+typedef struct FFFramePool FFFramePool;
+
+/**
+ * Allocate and initialize a video frame pool.
+ *
+ * @param alloc a function that will be used to allocate new frame buffers when
+ * the pool is empty. May be NULL, then the default allocator will be used
+ * (av_buffer_alloc()).
+ * @param width width of each frame in this pool
+ * @param height height of each frame in this pool
+ * @param format format of each frame in this pool
+ * @param align buffers alignment of each frame in this pool
+ * @return newly created video frame pool on success, NULL on error.
+ */
+FFFramePool *ff_frame_pool_video_init(AVBufferRef* (*alloc)(int size),
+                                      int width,
+                                      int height,
+                                      enum AVPixelFormat format,
+                                      int align);
+
+/**
+ * Deallocate the frame pool. It is safe to call this function while
+ * some of the allocated frames are still in use.
+ *
+ * @param pool pointer to the frame pool to be freed. It will be set to NULL.
+ */
+void ff_frame_pool_uninit(FFFramePool **pool);
+
+/**
+ * Get the video frame pool configuration.
+ *
+ * @param width width of each frame in this pool
+ * @param height height of each frame in this pool
+ * @param format format of each frame in this pool
+ * @param align buffers alignment of each frame in this pool
+ * @return 0 on success, a negative AVERROR otherwise.
+ */
+int ff_frame_pool_get_video_config(FFFramePool *pool,
+                                   int *width,
+                                   int *height,
+                                   enum AVPixelFormat *format,
+                                   int *align);
+
+/**
+ * Get the number of plane buffers reused from the pool and the number that
+ * had to be allocated. The counters are not synchronized, they are exact
+ * only when the pool is used from a single thread.
+ */
+void ff_frame_pool_get_stats(FFFramePool *pool, int64_t *hits, int64_t *misses);
+
+/**
+ * Allocate a new AVFrame, reusing old buffers from the pool when available.
+ * This function may be called simultaneously from multiple threads.
+ *
+ * @return a new AVFrame on success, NULL on error.
+ */
+AVFrame *ff_frame_pool_get(FFFramePool *pool);
+
+#endif /* AVFILTER_FRAMEPOOL_H */
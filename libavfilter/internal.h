@@ -33,6 +33,10 @@
 #include "video.h"
 #include "libavcodec/avcodec.h"
 
+#if HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
 #if FF_API_AVFILTERBUFFER
 #define POOL_SIZE 32
 typedef struct AVFilterPool {
@@ -158,12 +162,56 @@ struct AVFilterPad {
 struct AVFilterGraphInternal {
     void *thread;
     avfilter_execute_func *thread_execute;
+
+    /**
+     * Number of pipeline filters. While there are any, sink_links and the
+     * queues of the pipeline filters are guarded by pipeline_lock, and
+     * pipeline_cond is broadcast whenever the state of a queue changes.
+     */
+    int nb_pipeline_stages;
+#if HAVE_PTHREADS
+    pthread_mutex_t pipeline_lock;
+    pthread_cond_t  pipeline_cond;
+#endif
 };
 
+/**
+ * The filters after a pipeline filter, up to the graph outputs or the next
+ * pipeline filters, run on the thread of the pipeline filter. Any other
+ * thread must hold the segment lock while it runs one of them, the public
+ * API takes it for the caller.
+ */
+typedef struct FFFilterSegment {
+    AVFilterContext *stage;
+#if HAVE_PTHREADS
+    pthread_mutex_t lock;
+#endif
+} FFFilterSegment;
+
 struct AVFilterInternal {
     avfilter_execute_func *execute;
+
+    /**
+     * Segment the filter runs in, NULL if it is only run by the caller of
+     * the public API.
+     */
+    FFFilterSegment *segment;
 };
 
+void ff_filter_segment_lock(AVFilterContext *ctx);
+/**
+ * @return 0 on success, AVERROR(EAGAIN) if the segment is busy
+ */
+int  ff_filter_segment_trylock(AVFilterContext *ctx);
+void ff_filter_segment_unlock(AVFilterContext *ctx);
+
+/**
+ * Lock the sink heap and the pipeline queues of a graph, a no-op for graphs
+ * without pipeline filters.
+ */
+void ff_filter_graph_pipeline_lock(AVFilterGraph *graph);
+void ff_filter_graph_pipeline_unlock(AVFilterGraph *graph);
+
 #if FF_API_AVFILTERBUFFER
 /** default handler for freeing audio/video buffer when there are no references left */
 void ff_avfilter_default_free_buffer(AVFilterBuffer *buf);
@@ -0,0 +1,119 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <string.h>
+
+#include "libavutil/common.h"
+#include "libavutil/error.h"
+#include "libavutil/mem.h"
+#include "latency.h"
+
+#define SUB (1 << FF_LATENCY_SUB_BITS)
+
+/* Values below SUB get a bucket each, above that bucket e * SUB + (v >> e)
+ * holds the values sharing their top FF_LATENCY_SUB_BITS + 1 bits. */
+static int bucket_index(int64_t v)
+{
+    int e;
+
+    if (v < SUB)
+        return FFMAX(v, 0);
+    e = (v >> 32 ? 32 + av_log2(v >> 32) : av_log2(v)) - FF_LATENCY_SUB_BITS;
+    return FFMIN(e * SUB + (int)(v >> e), FF_LATENCY_BUCKETS - 1);
+}
+
+static int64_t bucket_middle(int i)
+{
+    int e;
+
+    if (i < 2 * SUB)
+        return i;
+    e = i / SUB - 1;
+    return ((int64_t)(i % SUB + SUB) << e) + ((int64_t)1 << (e - 1));
+}
+
+int ff_latency_init(FFLatencyHistogram *h, const char *name, int nb_shards)
+{
+    h->name      = name;
+    h->nb_shards = FFMAX(nb_shards, 1);
+    h->shards    = av_mallocz_array(h->nb_shards, sizeof(*h->shards));
+    return h->shards ? 0 : AVERROR(ENOMEM);
+}
+
+void ff_latency_uninit(FFLatencyHistogram *h)
+{
+    av_freep(&h->shards);
+    h->nb_shards = 0;
+}
+
+void ff_latency_add(FFLatencyHistogram *h, int shard, int64_t usec)
+{
+    FFLatencyShard *s = &h->shards[shard];
+
+    usec = FFMAX(usec, 0);
+    s->counts[bucket_index(usec)]++;
+    s->sum += usec;
+    if (usec > s->max)
+        s->max = usec;
+}
+
+void ff_latency_stats(const FFLatencyHistogram *h, FFLatencyStats *st)
+{
+    static const double quantiles[3] = { 0.50, 0.90, 0.99 };
+    int64_t *results[3] = { &st->p50, &st->p90, &st->p99 };
+    uint64_t counts[FF_LATENCY_BUCKETS] = { 0 };
+    uint64_t seen = 0;
+    int64_t sum = 0;
+    int i, j, q = 0;
+
+    memset(st, 0, sizeof(*st));
+    for (i = 0; i < h->nb_shards; i++) {
+        const FFLatencyShard *s = &h->shards[i];
+
+        for (j = 0; j < FF_LATENCY_BUCKETS; j++)
+            counts[j] += s->counts[j];
+        sum     += s->sum;
+        st->max  = FFMAX(st->max, s->max);
+    }
+    for (i = 0; i < FF_LATENCY_BUCKETS; i++)
+        st->count += counts[i];
+    if (!st->count)
+        return;
+    st->mean = (double)sum / st->count;
+
+    for (i = 0; i < FF_LATENCY_BUCKETS && q < 3; i++) {
+        seen += counts[i];
+        while (q < 3 && seen >= quantiles[q] * st->count)
+            *results[q++] = FFMIN(bucket_middle(i), st->max);
+    }
+}
+
+void ff_latency_reset(FFLatencyHistogram *h)
+{
+    memset(h->shards, 0, h->nb_shards * sizeof(*h->shards));
+}
+
+void ff_latency_print(const FFLatencyHistogram *h, AVBPrint *bp)
+{
+    FFLatencyStats st;
+
+    ff_latency_stats(h, &st);
+    av_bprintf(bp, "count=%"PRIu64" mean=%.0f p50=%"PRId64" p90=%"PRId64
+               " p99=%"PRId64" max=%"PRId64, st.count, st.mean,
+               st.p50, st.p90, st.p99, st.max);
+}
@@ -0,0 +1,82 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVFILTER_LATENCY_H
+#define AVFILTER_LATENCY_H
+
+/**
+ * @file
+ * Latency histograms for filters.
+ *
+ * Durations in microseconds are counted in logarithmic buckets with 4 bits
+ * of mantissa, so quantiles are known within 1/16 of their value whatever
+ * their magnitude, in constant memory.
+ *
+ * A histogram has one set of counters per shard, and a shard must only be
+ * written by one thread at a time, e.g. by the slice job of the same index.
+ * Recording takes no lock; readers merge all shards and may see a few
+ * samples more or less while writers run.
+ */
+
+#include <stdint.h>
+
+#include "libavutil/bprint.h"
+
+#define FF_LATENCY_SUB_BITS 4
+#define FF_LATENCY_BUCKETS  (32 << FF_LATENCY_SUB_BITS)
+
+typedef struct FFLatencyShard {
+    uint32_t counts[FF_LATENCY_BUCKETS];
+    int64_t sum;
+    int64_t max;
+} FFLatencyShard;
+
+typedef struct FFLatencyHistogram {
+    const char *name;
+    FFLatencyShard *shards;
+    int nb_shards;
+} FFLatencyHistogram;
+
+typedef struct FFLatencyStats {
+    uint64_t count;
+    double mean;
+    int64_t p50, p90, p99, max;
+} FFLatencyStats;
+
+int ff_latency_init(FFLatencyHistogram *h, const char *name, int nb_shards);
+
+void ff_latency_uninit(FFLatencyHistogram *h);
+
+/**
+ * Record a duration in microseconds, negative values count as 0.
+ */
+void ff_latency_add(FFLatencyHistogram *h, int shard, int64_t usec);
+
+/**
+ * Merge all shards. Quantiles are the middle of the bucket they fall in.
+ */
+void ff_latency_stats(const FFLatencyHistogram *h, FFLatencyStats *st);
+
+void ff_latency_reset(FFLatencyHistogram *h);
+
+/**
+ * Append "count=... mean=... p50=... p90=... p99=... max=..." to bp.
+ */
+void ff_latency_print(const FFLatencyHistogram *h, AVBPrint *bp);
+
+#endif /* AVFILTER_LATENCY_H */
@@ -20,13 +20,29 @@
 /**
  * @file
  * Libavfilter multithreading support
+ *
+ * Jobs are handed out by an atomic counter. Each execute() call opens a
+ * generation by bumping execute_id to an even value, the workers and the
+ * calling thread take jobs until the counter runs past nb_jobs, then the
+ * caller closes the generation (odd execute_id) and waits for the workers
+ * still inside it. Idle workers spin on execute_id for a while before they
+ * park on a condition variable, so back to back calls need no syscalls.
  */
 
 #include "config.h"
 
+#if HAVE_SCHED_SETAFFINITY
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+#include <sched.h>
+#endif
+
+#include "libavutil/atomic.h"
 #include "libavutil/common.h"
 #include "libavutil/cpu.h"
 #include "libavutil/mem.h"
+#include "libavutil/threadpool_internal.h"
 
 #include "avfilter.h"
 #include "internal.h"
@@ -40,99 +56,190 @@
 #include "compat/w32pthreads.h"
 #endif
 
-typedef struct ThreadContext {
-    AVFilterGraph *graph;
+/* number of polls of a shared counter before going to sleep */
+#define SPIN_COUNT 4096
 
-    int nb_threads;
+typedef struct ThreadContext {
+    int nb_threads;                 ///< workers plus the calling thread
     pthread_t *workers;
-    avfilter_action_func *func;
+    int flags;                      ///< AVFILTER_THREAD_FLAG_*
+    int spin;
 
-    /* per-execute perameters */
+    /* per-execute parameters */
+    avfilter_action_func *func;
     AVFilterContext *ctx;
     void *arg;
     int   *rets;
     int nb_rets;
     int nb_jobs;
 
-    pthread_cond_t last_job_cond;
-    pthread_cond_t current_job_cond;
-    pthread_mutex_t current_job_lock;
-    int current_job;
-    unsigned int current_execute;
-    int done;
+    volatile int execute_id;        ///< even while jobs are handed out
+    volatile int current_job;
+    volatile int executing;         ///< callers inside execute()
+    volatile int nb_busy;           ///< workers inside the current execute
+    volatile int nb_parked;         ///< workers sleeping on park_cond
+    volatile int caller_parked;
+    volatile int nb_started;
+    volatile int done;
+
+    pthread_mutex_t park_lock;
+    pthread_cond_t park_cond;
+    pthread_cond_t busy_cond;
+
+    /* pools shared between graphs */
+    int refcount;
+    struct ThreadContext *next;
 } ThreadContext;
 
+#if HAVE_PTHREADS
+static pthread_mutex_t shared_pools_lock = PTHREAD_MUTEX_INITIALIZER;
+static ThreadContext *shared_pools;
+#endif
+
+#if HAVE_SCHED_SETAFFINITY
+/* Pin the calling thread to the index-th CPU it may run on. */
+static void set_affinity(int index)
+{
+    cpu_set_t allowed, set;
+    int cpu;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) || !CPU_COUNT(&allowed))
+        return;
+    index %= CPU_COUNT(&allowed);
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && !index--) {
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            sched_setaffinity(0, sizeof(set), &set);
+            return;
+        }
+    }
+}
+#endif
+
+static void run_jobs(ThreadContext *c)
+{
+    int job;
+
+    while ((job = avpriv_atomic_int_add_and_fetch(&c->current_job, 1) - 1) < c->nb_jobs)
+        c->rets[job % c->nb_rets] = c->func(c->ctx, c->arg, job, c->nb_jobs);
+}
+
+static int execute_opened(ThreadContext *c, int last_execute)
+{
+    int id = avpriv_atomic_int_get(&c->execute_id);
+    return id != last_execute && !(id & 1);
+}
+
+/* Return the id of the next execute, or -1 when the pool is shut down. */
+static int wait_execute(ThreadContext *c, int last_execute)
+{
+    int i;
+
+    for (i = 0; i < c->spin; i++)
+        if (execute_opened(c, last_execute))
+            goto opened;
+
+    pthread_mutex_lock(&c->park_lock);
+    avpriv_atomic_int_add_and_fetch(&c->nb_parked, 1);
+    while (!execute_opened(c, last_execute))
+        pthread_cond_wait(&c->park_cond, &c->park_lock);
+    avpriv_atomic_int_add_and_fetch(&c->nb_parked, -1);
+    pthread_mutex_unlock(&c->park_lock);
+
+opened:
+    if (avpriv_atomic_int_get(&c->done))
+        return -1;
+    return avpriv_atomic_int_get(&c->execute_id);
+}
+
 static void* attribute_align_arg worker(void *v)
 {
     ThreadContext *c = v;
-    int our_job      = c->nb_jobs;
-    int nb_threads   = c->nb_threads;
-    unsigned int last_execute = 0;
-    int self_id;
-
-    pthread_mutex_lock(&c->current_job_lock);
-    self_id = c->current_job++;
-    for (;;) {
-        while (our_job >= c->nb_jobs) {
-            if (c->current_job == nb_threads + c->nb_jobs)
-                pthread_cond_signal(&c->last_job_cond);
-
-            while (last_execute == c->current_execute && !c->done)
-                pthread_cond_wait(&c->current_job_cond, &c->current_job_lock);
-            last_execute = c->current_execute;
-            our_job = self_id;
-
-            if (c->done) {
-                pthread_mutex_unlock(&c->current_job_lock);
-                return NULL;
-            }
+    int self_id = avpriv_atomic_int_add_and_fetch(&c->nb_started, 1);
+    int last_execute = 1;   /* the pool starts with a closed execute */
+    int id;
+
+#if HAVE_SCHED_SETAFFINITY
+    /* the calling thread is not pinned, it keeps the first CPU */
+    if (c->flags & AVFILTER_THREAD_FLAG_AFFINITY)
+        set_affinity(self_id);
+#endif
+
+    while ((id = wait_execute(c, last_execute)) >= 0) {
+        last_execute = id;
+
+        /* the caller does not reuse the job counter while we are busy,
+         * it only has to be checked that the execute is still open */
+        avpriv_atomic_int_add_and_fetch(&c->nb_busy, 1);
+        if (avpriv_atomic_int_get(&c->execute_id) == id)
+            run_jobs(c);
+        if (!avpriv_atomic_int_add_and_fetch(&c->nb_busy, -1) &&
+            avpriv_atomic_int_get(&c->caller_parked)) {
+            pthread_mutex_lock(&c->park_lock);
+            pthread_cond_signal(&c->busy_cond);
+            pthread_mutex_unlock(&c->park_lock);
         }
-        pthread_mutex_unlock(&c->current_job_lock);
+    }
+    return NULL;
+}
 
-        c->rets[our_job % c->nb_rets] = c->func(c->ctx, c->arg, our_job, c->nb_jobs);
+static void wait_workers(ThreadContext *c)
+{
+    int i;
 
-        pthread_mutex_lock(&c->current_job_lock);
-        our_job = c->current_job++;
-    }
+    for (i = 0; i < c->spin; i++)
+        if (!avpriv_atomic_int_get(&c->nb_busy))
+            return;
+
+    pthread_mutex_lock(&c->park_lock);
+    avpriv_atomic_int_set(&c->caller_parked, 1);
+    while (avpriv_atomic_int_get(&c->nb_busy))
+        pthread_cond_wait(&c->busy_cond, &c->park_lock);
+    avpriv_atomic_int_set(&c->caller_parked, 0);
+    pthread_mutex_unlock(&c->park_lock);
 }
 
 static void slice_thread_uninit(ThreadContext *c)
 {
     int i;
 
-    pthread_mutex_lock(&c->current_job_lock);
-    c->done = 1;
-    pthread_cond_broadcast(&c->current_job_cond);
-    pthread_mutex_unlock(&c->current_job_lock);
+    pthread_mutex_lock(&c->park_lock);
+    avpriv_atomic_int_set(&c->done, 1);
+    avpriv_atomic_int_add_and_fetch(&c->execute_id, 1);
+    pthread_cond_broadcast(&c->park_cond);
+    pthread_mutex_unlock(&c->park_lock);
 
-    for (i = 0; i < c->nb_threads; i++)
+    for (i = 0; i < c->nb_threads - 1; i++)
          pthread_join(c->workers[i], NULL);
 
-    pthread_mutex_destroy(&c->current_job_lock);
-    pthread_cond_destroy(&c->current_job_cond);
-    pthread_cond_destroy(&c->last_job_cond);
+    pthread_mutex_destroy(&c->park_lock);
+    pthread_cond_destroy(&c->park_cond);
+    pthread_cond_destroy(&c->busy_cond);
     av_freep(&c->workers);
 }
 
-static void slice_thread_park_workers(ThreadContext *c)
-{
-    while (c->current_job != c->nb_threads + c->nb_jobs)
-        pthread_cond_wait(&c->last_job_cond, &c->current_job_lock);
-    pthread_mutex_unlock(&c->current_job_lock);
-}
-
 static int thread_execute(AVFilterContext *ctx, avfilter_action_func *func,
                           void *arg, int *ret, int nb_jobs)
 {
     ThreadContext *c = ctx->graph->internal->thread;
-    int dummy_ret;
+    int dummy_ret, nb_parked, i;
 
     if (nb_jobs <= 0)
         return 0;
 
-    pthread_mutex_lock(&c->current_job_lock);
+    if (avpriv_atomic_int_add_and_fetch(&c->executing, 1) > 1) {
+        /* The pool is busy with another filter or graph. Running the jobs
+         * here does not add threads to the ones already working. */
+        avpriv_atomic_int_add_and_fetch(&c->executing, -1);
+        for (i = 0; i < nb_jobs; i++) {
+            int r = func(ctx, arg, i, nb_jobs);
+            if (ret)
+                ret[i] = r;
+        }
+        return 0;
+    }
 
-    c->current_job = c->nb_threads;
     c->nb_jobs     = nb_jobs;
     c->ctx         = ctx;
     c->arg         = arg;
@@ -144,62 +251,155 @@ static int thread_execute(AVFilterContext *ctx, avfilter_action_func *func,
         c->rets    = &dummy_ret;
         c->nb_rets = 1;
     }
-    c->current_execute++;
+    avpriv_atomic_int_set(&c->current_job, 0);
+    avpriv_atomic_int_add_and_fetch(&c->execute_id, 1);
+
+    /* wake only as many sleeping workers as there are jobs left for them */
+    nb_parked = FFMIN(avpriv_atomic_int_get(&c->nb_parked), nb_jobs - 1);
+    if (nb_parked > 0) {
+        pthread_mutex_lock(&c->park_lock);
+        for (i = 0; i < nb_parked; i++)
+            pthread_cond_signal(&c->park_cond);
+        pthread_mutex_unlock(&c->park_lock);
+    }
 
-    pthread_cond_broadcast(&c->current_job_cond);
+    run_jobs(c);
 
-    slice_thread_park_workers(c);
+    avpriv_atomic_int_add_and_fetch(&c->execute_id, 1);
+    wait_workers(c);
 
+    avpriv_atomic_int_add_and_fetch(&c->executing, -1);
     return 0;
 }
 
-static int thread_init_internal(ThreadContext *c, int nb_threads)
+typedef struct PoolJobs {
+    AVFilterContext *ctx;
+    avfilter_action_func *func;
+    void *arg;
+} PoolJobs;
+
+static int pool_job(void *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    PoolJobs *p = arg;
+    return p->func(p->ctx, p->arg, jobnr, nb_jobs);
+}
+
+static int pool_execute(AVFilterContext *ctx, avfilter_action_func *func,
+                        void *arg, int *ret, int nb_jobs)
+{
+    PoolJobs p = { ctx, func, arg };
+    return avpriv_thread_pool_execute(AV_THREAD_POOL_FILTER, pool_job, NULL, &p,
+                                      ret, nb_jobs, ctx->graph->nb_threads);
+}
+
+static int thread_init_internal(ThreadContext *c, int nb_threads, int flags)
 {
     int i, ret;
+    int nb_cpus = av_cpu_count();
 
-    if (!nb_threads) {
-        int nb_cpus = av_cpu_count();
-        // use number of cores + 1 as thread count if there is more than one
-        if (nb_cpus > 1)
-            nb_threads = nb_cpus + 1;
-        else
-            nb_threads = 1;
-    }
+    if (!nb_threads)
+        nb_threads = nb_cpus;
 
     if (nb_threads <= 1)
         return 1;
 
     c->nb_threads = nb_threads;
-    c->workers = av_mallocz_array(sizeof(*c->workers), nb_threads);
+    c->flags      = flags;
+    /* spinning only helps when the threads have CPUs to spin on */
+    c->spin       = nb_cpus > 1 ? SPIN_COUNT : 0;
+    c->workers = av_mallocz_array(sizeof(*c->workers), nb_threads - 1);
     if (!c->workers)
         return AVERROR(ENOMEM);
 
-    c->current_job = 0;
-    c->nb_jobs     = 0;
-    c->done        = 0;
+    c->execute_id = 1;
 
-    pthread_cond_init(&c->current_job_cond, NULL);
-    pthread_cond_init(&c->last_job_cond,    NULL);
+    pthread_cond_init(&c->park_cond, NULL);
+    pthread_cond_init(&c->busy_cond, NULL);
+    pthread_mutex_init(&c->park_lock, NULL);
 
-    pthread_mutex_init(&c->current_job_lock, NULL);
-    pthread_mutex_lock(&c->current_job_lock);
-    for (i = 0; i < nb_threads; i++) {
+    for (i = 0; i < nb_threads - 1; i++) {
         ret = pthread_create(&c->workers[i], NULL, worker, c);
         if (ret) {
-           pthread_mutex_unlock(&c->current_job_lock);
-           c->nb_threads = i;
+           c->nb_threads = i + 1;
            slice_thread_uninit(c);
            return AVERROR(ret);
         }
     }
 
-    slice_thread_park_workers(c);
-
     return c->nb_threads;
 }
 
+static void thread_free(ThreadContext **c)
+{
+    slice_thread_uninit(*c);
+    av_freep(c);
+}
+
+static int thread_alloc(ThreadContext **c, int nb_threads, int flags)
+{
+    int ret;
+
+    *c = av_mallocz(sizeof(**c));
+    if (!*c)
+        return AVERROR(ENOMEM);
+
+    ret = thread_init_internal(*c, nb_threads, flags);
+    if (ret <= 1)
+        av_freep(c);
+    return ret;
+}
+
+#if HAVE_PTHREADS
+/* Graphs asking for the same number of threads and flags share a pool. */
+static int get_shared_pool(ThreadContext **c, int nb_threads, int flags)
+{
+    ThreadContext *p;
+    int ret;
+
+    if (!nb_threads)
+        nb_threads = av_cpu_count();
+
+    pthread_mutex_lock(&shared_pools_lock);
+    for (p = shared_pools; p; p = p->next)
+        if (p->nb_threads == nb_threads && p->flags == flags)
+            break;
+    if (p) {
+        p->refcount++;
+        *c  = p;
+        ret = p->nb_threads;
+    } else {
+        ret = thread_alloc(c, nb_threads, flags);
+        if (*c) {
+            (*c)->refcount = 1;
+            (*c)->next     = shared_pools;
+            shared_pools   = *c;
+        }
+    }
+    pthread_mutex_unlock(&shared_pools_lock);
+    return ret;
+}
+
+static void release_shared_pool(ThreadContext *c)
+{
+    ThreadContext **p;
+
+    pthread_mutex_lock(&shared_pools_lock);
+    if (--c->refcount) {
+        pthread_mutex_unlock(&shared_pools_lock);
+        return;
+    }
+    for (p = &shared_pools; *p != c; p = &(*p)->next);
+    *p = c->next;
+    pthread_mutex_unlock(&shared_pools_lock);
+
+    thread_free(&c);
+}
+#endif
+
 int ff_graph_thread_init(AVFilterGraph *graph)
 {
+    ThreadContext *c = NULL;
+    int pool_size = av_thread_pool_get_size();
     int ret;
 
 #if HAVE_W32THREADS
@@ -211,17 +411,26 @@ int ff_graph_thread_init(AVFilterGraph *graph)
         return 0;
     }
 
-    graph->internal->thread = av_mallocz(sizeof(ThreadContext));
-    if (!graph->internal->thread)
-        return AVERROR(ENOMEM);
+    if (pool_size) {
+        /* the process-wide pool takes precedence over our own threads */
+        if (!graph->nb_threads)
+            graph->nb_threads = pool_size + 1;
+        graph->internal->thread_execute = pool_execute;
+        return 0;
+    }
 
-    ret = thread_init_internal(graph->internal->thread, graph->nb_threads);
+#if HAVE_PTHREADS
+    if (graph->thread_flags & AVFILTER_THREAD_FLAG_SHARED)
+        ret = get_shared_pool(&c, graph->nb_threads, graph->thread_flags);
+    else
+#endif
+        ret = thread_alloc(&c, graph->nb_threads, graph->thread_flags);
     if (ret <= 1) {
-        av_freep(&graph->internal->thread);
         graph->thread_type = 0;
         graph->nb_threads  = 1;
         return (ret < 0) ? ret : 0;
     }
+    graph->internal->thread = c;
     graph->nb_threads = ret;
 
     graph->internal->thread_execute = thread_execute;
@@ -231,7 +440,66 @@ int ff_graph_thread_init(AVFilterGraph *graph)
 
 void ff_graph_thread_free(AVFilterGraph *graph)
 {
-    if (graph->internal->thread)
-        slice_thread_uninit(graph->internal->thread);
-    av_freep(&graph->internal->thread);
+    ThreadContext *c = graph->internal->thread;
+
+    if (!c)
+        return;
+#if HAVE_PTHREADS
+    if (c->refcount)
+        release_shared_pool(c);
+    else
+#endif
+        thread_free(&c);
+    graph->internal->thread = NULL;
 }
+
+#ifdef TEST
+
+#include "libavutil/time.h"
+
+#undef printf
+
+static int nop_job(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    return 0;
+}
+
+/* Measure the overhead of one execute() call with empty jobs. */
+int main(int argc, char **argv)
+{
+    static const int threads[] = { 2, 4, 8, 16, 32, 64 };
+    int iterations = argc > 1 ? atoi(argv[1]) : 10000;
+    int i, j, k;
+
+    avfilter_register_all();
+    printf("threads  jobs  ns/call\n");
+    for (i = 0; i < FF_ARRAY_ELEMS(threads); i++) {
+        for (j = 1; j <= 4; j *= 4) {
+            AVFilterGraph *graph = avfilter_graph_alloc();
+            AVFilterContext *ctx;
+            int64_t t;
+
+            if (!graph)
+                return 1;
+            graph->nb_threads = threads[i];
+            ctx = avfilter_graph_alloc_filter(graph, avfilter_get_by_name("null"), NULL);
+            if (!ctx || !graph->internal->thread_execute) {
+                avfilter_graph_free(&graph);
+                return 1;
+            }
+
+            t = av_gettime_relative();
+            for (k = 0; k < iterations; k++)
+                graph->internal->thread_execute(ctx, nop_job, NULL, NULL,
+                                                j * graph->nb_threads);
+            t = av_gettime_relative() - t;
+
+            printf("%7d %5d %8.0f\n", graph->nb_threads, j * graph->nb_threads,
+                   t * 1000.0 / iterations);
+            avfilter_graph_free(&graph);
+        }
+    }
+    return 0;
+}
+
+#endif /* TEST */
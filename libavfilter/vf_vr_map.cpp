@@ -13,29 +13,42 @@
 #include <iomanip>
 
 extern "C" {
+#include "config.h"
 #include "avfilter.h"
 #include "formats.h"
 #include "internal.h"
 #include "video.h"
 #include "libavutil/eval.h"
 #include "libavutil/avstring.h"
+#include "libavutil/bprint.h"
+#include "libavutil/buffer.h"
 #include "libavutil/internal.h"
 #include "libavutil/libm.h"
 #include "libavutil/imgutils.h"
 #include "libavutil/mathematics.h"
+#include "libavutil/murmur3.h"
 #include "libavutil/opt.h"
+#include "libavutil/pixdesc.h"
+#include "libavutil/time.h"
 #include "bufferqueue.h"
+#include "latency.h"
+#include "vr_blend.h"
+#include "vr_remap.h"
+#include "vr_template.h"
 }
 
 #include <fstream>
 #include <iostream>
 #include <algorithm>
 #include <string>
+#include <memory>
 #include <sstream>
 #include <vector>
 
+#if CONFIG_LIBOCTVR
 #include "opencv2/core/cuda.hpp"
 #include "octvr.hpp"
+#endif
 
 // helper
 static std::vector<std::string> &split(const std::string &s, char delim, std::vector<std::string> &elems) {
@@ -54,10 +67,70 @@ std::vector<std::string> split(const char * s, char delim) {
 }
 
 
+enum VRMapBackend {
+    VR_MAP_BACKEND_OCTVR,
+    VR_MAP_BACKEND_CPU,
+};
+
+// Latency histograms, followed by one per input for the time frames wait in its queue
+enum VRMapStage {
+    VR_MAP_STAGE_INPUTS,    // dequeue and bind input frames
+    VR_MAP_STAGE_OUTPUTS,   // get and bind the output frame
+    VR_MAP_STAGE_REMAP,     // remap passes (cpu) or push to the async remapper (octvr)
+    VR_MAP_STAGE_SLICE,     // each remap job, sharded by job number (cpu)
+    VR_MAP_STAGE_BLEND,     // seam blending and exposure update (cpu)
+    VR_MAP_STAGE_POP,       // wait for the async remapper (octvr)
+    VR_MAP_STAGE_FILTER,    // downstream ff_filter_frame()
+    VR_MAP_NB_STAGES,
+};
+
+static const char * const stage_names[VR_MAP_NB_STAGES] = {
+    "inputs", "outputs", "remap", "slice", "blend", "pop", "filter",
+};
+
+enum VRMapSync {
+    VR_MAP_SYNC_NONE,       // one frame from each queue, whatever its pts
+    VR_MAP_SYNC_PTS,        // frames within the skew window of each other
+};
+
+// what to do once a queue reaches max_queue while another input has no frame
+enum VRMapStall {
+    VR_MAP_STALL_DROP,      // drop the oldest frame of every waiting queue
+    VR_MAP_STALL_DUP,       // remap again the last frame of the stalled inputs
+};
+
+typedef struct {
+    AVFrame * last;         // last frame taken, kept with VR_MAP_STALL_DUP
+    int repeat;             // take last instead of dequeuing for this set
+    int max_depth;
+    int64_t dropped, repeated;
+} VRMapInputSync;
+
+// One frame set in flight: input frames, output frame and the cv::Mat headers
+// bound to them, kept alive until the async remapper pops it
+typedef struct {
+    AVFrame ** in;
+    AVFrame * out;
+#if CONFIG_LIBOCTVR
+    std::vector<std::tuple<cv::Mat, cv::Mat, cv::Mat>> in_mats;
+    std::tuple<cv::Mat, cv::Mat, cv::Mat> out_mat;
+#endif
+} VRMapSlot;
+
+typedef struct {
+    int width, height;
+} VRMapSize;
+
+// part of the output an output template is mapped to, relative to the output size
+typedef struct {
+    double x, y, width, height;
+} VRMapRegion;
+
 typedef struct {
     const AVClass *avclass;
 
     // opts
+    int opt_backend;
     int opt_inputs;
     char * opt_outputs;
     int opt_crop_x, opt_crop_w;
@@ -66,39 +139,93 @@ typedef struct {
     char * opt_region;
     int opt_width, opt_height;
     int opt_preview_width, opt_preview_height;
+    char * opt_cache_dir;
+    int opt_tile_size;
+    int opt_bench;
+    int opt_depth;
+    int opt_stats_period;
+    int opt_bits;
+    int opt_sync;
+    int64_t opt_max_skew;
+    int opt_max_queue;
+    int opt_stall;
 
     // parsed opts
     int * blend_modes;
     int * gain_modes;
-    cv::Rect_<double> * output_regions;
+    VRMapRegion * output_regions;
 
     // storage
     int input_format;
-    vr::MapperTemplate ** mapper_templates;
+    // where the Y, U and V samples of an input frame are: data plane, byte offset
+    int in_planes[3], in_offsets[3];
+    int in_chroma_w, in_chroma_h;
 
     int outputs; // size of most above lists
 
+#if CONFIG_LIBOCTVR
+    vr::MapperTemplate ** mapper_templates;
     vr::AsyncMultiMapper * async_remapper;
+#endif
+
+    // cpu backend, one table (luma and chroma plane) for each output,
+    // kernels for the Y, U and V samples of the input format
+    VRRemapDSPContext remap_dsp[3];
+    VRRemapTable * remap_tables;
+    VRBlendContext * blenders;
+    int (* remap_rects)[4];
+    int64_t remap_time;
+    int remap_frames;
+
+    // ring of opt_depth + 1 slots, nb_pending of them pushed starting at slot_head
+    VRMapSlot * slots;
+    int slot_head, nb_pending;
+    AVBufferPool * out_pools[3];
+    int out_linesize[3];
+
+    // VR_MAP_NB_STAGES histograms then one per input, arrival times mirror the queue slots
+    FFLatencyHistogram * latency;
+    int nb_latency;
+    int64_t (* arrival)[FF_BUFQUEUE_SIZE];
+    int stats_frames;
+
+    // per input synchronization state, skew window in AV_TIME_BASE units,
+    // input whose frame properties the output takes
+    VRMapInputSync * sync;
+    int64_t sync_window;
+    int sync_ref;
 
     // others
-    cv::Size * in_sizes;
-    AVFrame ** last_frames;
+    VRMapSize * in_sizes;
     struct FFBufQueue * queues;
 
 } VRMapContext;
 
 static int query_formats(AVFilterContext *ctx)
 {
+    VRMapContext *s = static_cast<VRMapContext *>(ctx->priv);
+    // the cpu backend samples packed and semi-planar inputs directly
+    static const enum AVPixelFormat cpu_formats[] = {
+        AV_PIX_FMT_YUV420P, AV_PIX_FMT_YUVJ420P, AV_PIX_FMT_NV12, AV_PIX_FMT_UYVY422,
+        AV_PIX_FMT_NONE
+    };
     AVFilterFormats *formats = NULL;
-    ff_add_format(&formats, AV_PIX_FMT_YUV420P);
-    ff_add_format(&formats, AV_PIX_FMT_YUVJ420P);
+    if(s->opt_bits > 8)
+        ff_add_format(&formats, AV_PIX_FMT_YUV420P10);
+    else if(s->opt_backend == VR_MAP_BACKEND_CPU)
+        for(int i = 0 ; cpu_formats[i] != AV_PIX_FMT_NONE ; i += 1)
+            ff_add_format(&formats, cpu_formats[i]);
+    else {
+        ff_add_format(&formats, AV_PIX_FMT_YUV420P);
+        ff_add_format(&formats, AV_PIX_FMT_YUVJ420P);
+    }
     for(size_t i = 0 ; i < ctx->nb_inputs; i += 1) {
         if(ctx->inputs[i] && !ctx->inputs[i]->out_formats)
             ff_formats_ref(formats, &ctx->inputs[i]->out_formats);
     }
 
     AVFilterFormats *oformats = NULL;
-    ff_add_format(&oformats, AV_PIX_FMT_YUV420P);
+    ff_add_format(&oformats, s->opt_bits > 8 ? AV_PIX_FMT_YUV420P10 : AV_PIX_FMT_YUV420P);
     for(size_t i = 0 ; i < ctx->nb_outputs ; i += 1) {
         if(ctx->outputs[i] && !ctx->outputs[i]->in_formats)
             ff_formats_ref(oformats, &ctx->outputs[i]->in_formats);
@@ -107,87 +234,415 @@ static int query_formats(AVFilterContext *ctx)
     return 0;
 }
 
-static int push_frame(AVFilterContext * ctx) {
+typedef struct {
+    AVFrame ** in;
+    AVFrame * out;
+} VRMapThreadData;
+
+static void input_planes(AVFilterContext * ctx, VRMapThreadData * td, int plane,
+                         const uint8_t ** src, ptrdiff_t * src_linesize) {
+    VRMapContext *s = static_cast<VRMapContext *>(ctx->priv);
+    int shift = plane ? s->in_chroma_w : 0;
+    for(size_t j = 0 ; j < ctx->nb_inputs ; j += 1) {
+        src[j] = td->in[j]->data[s->in_planes[plane]] + s->in_offsets[plane] +
+                 (s->opt_crop_x >> shift) * s->remap_dsp[plane].step;
+        src_linesize[j] = td->in[j]->linesize[s->in_planes[plane]];
+    }
+}
+
+static uint8_t * output_plane(VRMapContext * s, VRMapThreadData * td, int output, int plane) {
+    int shift = !!plane;
+    return td->out->data[plane] +
+           (s->remap_rects[output][1] >> shift) * td->out->linesize[plane] +
+           (s->remap_rects[output][0] >> shift) * s->remap_dsp[plane].sample_size;
+}
+
+static int remap_slice(AVFilterContext * ctx, void * arg, int jobnr, int nb_jobs) {
+    VRMapContext *s = static_cast<VRMapContext *>(ctx->priv);
+    VRMapThreadData *td = static_cast<VRMapThreadData *>(arg);
+    int64_t start = av_gettime_relative();
+
+    std::vector<const uint8_t *> src(ctx->nb_inputs);
+    std::vector<ptrdiff_t> src_linesize(ctx->nb_inputs);
+
+    for(int plane = 0 ; plane < 3 ; plane += 1) {
+        input_planes(ctx, td, plane, src.data(), src_linesize.data());
+        for(int i = 0 ; i < s->outputs ; i += 1) {
+            const VRRemapPlane * p = &s->remap_tables[i].planes[!!plane];
+            ff_vr_remap_plane_slice(&s->remap_dsp[plane], p,
+                                    output_plane(s, td, i, plane), td->out->linesize[plane],
+                                    src.data(), src_linesize.data(),
+                                    plane ? NULL : s->blenders[i].luts,
+                                    p->nb_tiles * jobnr / nb_jobs,
+                                    p->nb_tiles * (jobnr + 1) / nb_jobs);
+        }
+    }
+    // each job writes its own shard
+    ff_latency_add(&s->latency[VR_MAP_STAGE_SLICE], jobnr, av_gettime_relative() - start);
+    return 0;
+}
+
+static int blend_slice(AVFilterContext * ctx, void * arg, int jobnr, int nb_jobs) {
+    VRMapContext *s = static_cast<VRMapContext *>(ctx->priv);
+    VRMapThreadData *td = static_cast<VRMapThreadData *>(arg);
+
+    std::vector<const uint8_t *> src(ctx->nb_inputs);
+    std::vector<ptrdiff_t> src_linesize(ctx->nb_inputs);
+
+    for(int plane = 0 ; plane < 3 ; plane += 1) {
+        input_planes(ctx, td, plane, src.data(), src_linesize.data());
+        for(int i = 0 ; i < s->outputs ; i += 1) {
+            VRBlendContext * b = &s->blenders[i];
+            int nb_seams = s->remap_tables[i].planes[!!plane].nb_seams;
+            if(!b->bands && !b->exposure)
+                continue;
+            ff_vr_blend_plane_slice(b, &s->remap_dsp[plane], plane,
+                                    output_plane(s, td, i, plane), td->out->linesize[plane],
+                                    src.data(), src_linesize.data(),
+                                    nb_seams * jobnr / nb_jobs,
+                                    nb_seams * (jobnr + 1) / nb_jobs, jobnr);
+        }
+    }
+    return 0;
+}
+
+// multi-band windows overlap, results are only written once all of them are done
+static int writeback_slice(AVFilterContext * ctx, void * arg, int jobnr, int nb_jobs) {
+    VRMapContext *s = static_cast<VRMapContext *>(ctx->priv);
+    VRMapThreadData *td = static_cast<VRMapThreadData *>(arg);
+
+    for(int plane = 0 ; plane < 3 ; plane += 1) {
+        for(int i = 0 ; i < s->outputs ; i += 1) {
+            int nb_seams = s->remap_tables[i].planes[!!plane].nb_seams;
+            ff_vr_blend_plane_writeback(&s->blenders[i], plane,
+                                        output_plane(s, td, i, plane), td->out->linesize[plane],
+                                        nb_seams * jobnr / nb_jobs,
+                                        nb_seams * (jobnr + 1) / nb_jobs);
+        }
+    }
+    return 0;
+}
+
+static AVFrame * get_output_frame(AVFilterContext * ctx) {
+    VRMapContext *s = static_cast<VRMapContext *>(ctx->priv);
+    AVFrame * frame = av_frame_alloc();
+    if(!frame)
+        return NULL;
+
+    frame->width = s->opt_width;
+    frame->height = s->opt_height;
+    frame->format = ctx->outputs[0]->format;
+    for(int i = 0 ; i < 3 ; i += 1) {
+        frame->buf[i] = av_buffer_pool_get(s->out_pools[i]);
+        if(!frame->buf[i]) {
+            av_frame_free(&frame);
+            return NULL;
+        }
+        frame->data[i] = frame->buf[i]->data;
+        frame->linesize[i] = s->out_linesize[i];
+    }
+    frame->extended_data = frame->data;
+    return frame;
+}
+
+static void release_slot(VRMapSlot * slot, int nb_inputs) {
+    for(int i = 0 ; i < nb_inputs ; i += 1)
+        av_frame_free(&slot->in[i]);
+    av_frame_free(&slot->out);
+}
+
+// record the time since *t in a stage histogram and restart *t
+static void latency_lap(VRMapContext * s, int stage, int64_t * t) {
+    int64_t now = av_gettime_relative();
+    ff_latency_add(&s->latency[stage], 0, now - *t);
+    *t = now;
+}
+
+static AVFrame * dequeue_input(AVFilterContext * ctx, int in_no) {
+    VRMapContext *s = static_cast<VRMapContext *>(ctx->priv);
+    struct FFBufQueue * q = &s->queues[in_no];
+    ff_latency_add(&s->latency[VR_MAP_NB_STAGES + in_no], 0,
+                   av_gettime_relative() - s->arrival[in_no][q->head]);
+    return ff_bufqueue_get(q);
+}
+
+static int64_t head_pts(AVFilterContext * ctx, int in_no) {
+    VRMapContext *s = static_cast<VRMapContext *>(ctx->priv);
+    AVFrame * f = ff_bufqueue_peek(&s->queues[in_no], 0);
+    if(f->pts == AV_NOPTS_VALUE)
+        return AV_NOPTS_VALUE;
+    return av_rescale_q(f->pts, ctx->inputs[in_no]->time_base, AV_TIME_BASE_Q);
+}
+
+static void drop_input(AVFilterContext * ctx, int in_no, const char * reason) {
+    VRMapContext *s = static_cast<VRMapContext *>(ctx->priv);
+    AVFrame * f = dequeue_input(ctx, in_no);
+    av_log(ctx, AV_LOG_VERBOSE, "Dropping frame pts %" PRId64 " of input %d: %s\n",
+           f->pts, in_no, reason);
+    av_frame_free(&f);
+    s->sync[in_no].dropped += 1;
+}
+
+// Decide whether a frame set can be remapped. With VR_MAP_SYNC_PTS, queue
+// heads older than the newest head by more than the skew window are dropped
+// until all heads match. Queues never hold more than max_queue frames while
+// an input stalls. Returns 1 when every input contributes a frame, either
+// its queue head or its repeated last frame, 0 to wait for more frames.
+static int sync_inputs(AVFilterContext * ctx) {
+    VRMapContext *s = static_cast<VRMapContext *>(ctx->priv);
+
+    for(;;) {
+        int64_t newest = INT64_MIN;
+        unsigned nb_ready = 0;
+        int overflow = 0, dropped = 0;
+
+        s->sync_ref = -1;
+        for(unsigned i = 0 ; i < ctx->nb_inputs ; i += 1) {
+            struct FFBufQueue * q = &s->queues[i];
+            s->sync[i].repeat = 0;
+            s->sync[i].max_depth = FFMAX(s->sync[i].max_depth, (int)q->available);
+            if(!q->available)
+                continue;
+            nb_ready += 1;
+            overflow |= q->available >= s->opt_max_queue;
+            if(s->sync_ref < 0)
+                s->sync_ref = i;
+            int64_t pts = head_pts(ctx, i);
+            if(pts != AV_NOPTS_VALUE)
+                newest = FFMAX(newest, pts);
+        }
+        if(!nb_ready)
+            return 0;
+
+        if(s->opt_sync == VR_MAP_SYNC_PTS && newest != INT64_MIN) {
+            for(unsigned i = 0 ; i < ctx->nb_inputs ; i += 1) {
+                if(!s->queues[i].available)
+                    continue;
+                int64_t pts = head_pts(ctx, i);
+                if(pts != AV_NOPTS_VALUE && pts < newest - s->sync_window) {
+                    drop_input(ctx, i, "too old to match the other inputs");
+                    dropped = 1;
+                }
+            }
+            if(dropped)
+                continue;
+        }
+
+        if(nb_ready == ctx->nb_inputs)
+            return 1;
+        if(!overflow)
+            return 0;
+
+        if(s->opt_stall == VR_MAP_STALL_DUP &&
+           std::all_of(s->sync, s->sync + ctx->nb_inputs, [](VRMapInputSync &sync){ return sync.last != NULL; })) {
+            for(unsigned i = 0 ; i < ctx->nb_inputs ; i += 1) {
+                if(s->queues[i].available)
+                    continue;
+                s->sync[i].repeat = 1;
+                s->sync[i].repeated += 1;
+            }
+            return 1;
+        }
+        for(unsigned i = 0 ; i < ctx->nb_inputs ; i += 1)
+            if(s->queues[i].available)
+                drop_input(ctx, i, "another input stalled");
+        return 0;
+    }
+}
+
+// take the frame of an input chosen by sync_inputs()
+static AVFrame * take_input(AVFilterContext * ctx, int in_no) {
+    VRMapContext *s = static_cast<VRMapContext *>(ctx->priv);
+    VRMapInputSync * sync = &s->sync[in_no];
+
+    if(sync->repeat)
+        return av_frame_clone(sync->last);
+    AVFrame * f = dequeue_input(ctx, in_no);
+    if(s->opt_stall == VR_MAP_STALL_DUP) {
+        av_frame_free(&sync->last);
+        sync->last = av_frame_clone(f);
+    }
+    return f;
+}
+
+// every opt_stats_period frames, attach the histograms to the frame as metadata
+static void export_latency(AVFilterContext * ctx, AVFrame * frame) {
+    VRMapContext *s = static_cast<VRMapContext *>(ctx->priv);
+    if(!s->opt_stats_period || ++s->stats_frames % s->opt_stats_period)
+        return;
+
+    AVDictionary ** metadata = avpriv_frame_get_metadatap(frame);
+    for(int i = 0 ; i < s->nb_latency ; i += 1) {
+        char key[128];
+        char * value;
+        AVBPrint bp;
+
+        if(s->latency[i].name == NULL)
+            continue;
+        av_bprint_init(&bp, 0, AV_BPRINT_SIZE_AUTOMATIC);
+        ff_latency_print(&s->latency[i], &bp);
+        snprintf(key, sizeof(key), "lavfi.vr_map.latency.%s", s->latency[i].name);
+        if(av_bprint_finalize(&bp, &value) >= 0)
+            av_dict_set(metadata, key, value, AV_DICT_DONT_STRDUP_VAL);
+    }
+}
+
+static int push_frame_cpu(AVFilterContext * ctx) {
     VRMapContext *s = static_cast<VRMapContext *>(ctx->priv);
 
     bool inputs_eof = std::any_of(ctx->inputs, ctx->inputs + ctx->nb_inputs,
                                   [](AVFilterLink *l){ return l->closed; });
-    bool queues_available = std::all_of(s->queues, s->queues + ctx->nb_inputs,
-                                        [](struct FFBufQueue &q){ return q.available; });
-    bool has_last_frame = s->last_frames != NULL;
+    bool queues_available = sync_inputs(ctx);
+    if(!queues_available)
+        return inputs_eof ? AVERROR_EOF : 0;
+
+    // remapping is synchronous, a single slot is enough
+    int64_t t = av_gettime_relative();
+    VRMapSlot * slot = &s->slots[0];
+    bool inputs_ok = true;
+    for(size_t i = 0 ; i < ctx->nb_inputs ; i += 1)
+        inputs_ok &= (slot->in[i] = take_input(ctx, i)) != NULL;
+    latency_lap(s, VR_MAP_STAGE_INPUTS, &t);
+
+    AVFrame * out_frame = inputs_ok ? get_output_frame(ctx) : NULL;
+    if(!out_frame) {
+        release_slot(slot, ctx->nb_inputs);
+        return AVERROR(ENOMEM);
+    }
+    av_frame_copy_props(out_frame, slot->in[s->sync_ref]);
+    latency_lap(s, VR_MAP_STAGE_OUTPUTS, &t);
+
+    VRMapThreadData td = { slot->in, out_frame };
+    int max_tiles = 1, max_seams = 0;
+    bool multiband = false;
+    for(int i = 0 ; i < s->outputs ; i += 1) {
+        max_tiles = FFMAX(max_tiles, s->remap_tables[i].planes[0].nb_tiles);
+        if(s->blenders[i].bands || s->blenders[i].exposure)
+            max_seams = FFMAX3(max_seams, s->remap_tables[i].planes[0].nb_seams,
+                               s->remap_tables[i].planes[1].nb_seams);
+        multiband |= s->blenders[i].bands > 1;
+    }
+    int64_t start = t;
+    ctx->internal->execute(ctx, remap_slice, &td, NULL,
+                           FFMIN(max_tiles, ctx->graph->nb_threads));
+    latency_lap(s, VR_MAP_STAGE_REMAP, &t);
+    if(max_seams > 0) {
+        int nb_jobs = FFMIN(max_seams, ctx->graph->nb_threads);
+        ctx->internal->execute(ctx, blend_slice, &td, NULL, nb_jobs);
+        if(multiband)
+            ctx->internal->execute(ctx, writeback_slice, &td, NULL, nb_jobs);
+    }
+    for(int i = 0 ; i < s->outputs ; i += 1)
+        ff_vr_blend_end_frame(&s->blenders[i]);
+    latency_lap(s, VR_MAP_STAGE_BLEND, &t);
+    if(s->opt_bench) {
+        s->remap_time += t - start;
+        s->remap_frames += 1;
+        if(s->remap_frames % 100 == 0)
+            av_log(ctx, AV_LOG_INFO, "Remap: %.3f ms/frame over %d frames\n",
+                   s->remap_time / 1000.0 / s->remap_frames, s->remap_frames);
+    }
 
-    if(!queues_available && inputs_eof && !has_last_frame)
+    release_slot(slot, ctx->nb_inputs);
+    export_latency(ctx, out_frame);
+    int ret = ff_filter_frame(ctx->outputs[0], out_frame);
+    latency_lap(s, VR_MAP_STAGE_FILTER, &t);
+    return ret;
+}
+
+#if CONFIG_LIBOCTVR
+static int push_frame_octvr(AVFilterContext * ctx) {
+    VRMapContext *s = static_cast<VRMapContext *>(ctx->priv);
+
+    bool inputs_eof = std::any_of(ctx->inputs, ctx->inputs + ctx->nb_inputs,
+                                  [](AVFilterLink *l){ return l->closed; });
+    bool queues_available = sync_inputs(ctx);
+
+    if(!queues_available && inputs_eof && s->nb_pending == 0)
         return AVERROR_EOF;
     if(!queues_available && !inputs_eof)
         return 0;
 
     vr::Timer timer("FFMpeg Filter");
+    int64_t t = av_gettime_relative();
 
-    std::vector<AVFrame *> frames(ctx->nb_inputs, NULL);
-    AVFrame * out_frame = NULL;
-
-    std::vector<std::tuple<cv::Mat, cv::Mat, cv::Mat>> in_mats;
-    std::tuple<cv::Mat, cv::Mat, cv::Mat> out_mat;
-
+    int nb_slots = s->opt_depth + 1;
     if(queues_available) {
+        VRMapSlot * slot = &s->slots[(s->slot_head + s->nb_pending) % nb_slots];
         for(size_t i = 0 ; i < ctx->nb_inputs ; i += 1) {
-            frames[i] = ff_bufqueue_get(&s->queues[i]);
-            av_assert0(frames[i] != nullptr);
+            AVFrame * f = slot->in[i] = take_input(ctx, i);
+            if(!f) {
+                release_slot(slot, ctx->nb_inputs);
+                return AVERROR(ENOMEM);
+            }
 
-            auto & f = frames[i];
             int real_w = s->opt_crop_w != 0 ? s->opt_crop_w : f->width;
             av_assert0(real_w % 2 == 0 && s->opt_crop_x % 2 == 0);
 
-            in_mats.emplace_back(cv::Mat(f->height, real_w, CV_8U,
-                                         f->data[0] + s->opt_crop_x,
-                                         f->linesize[0]),
-                                 cv::Mat(f->height / 2, real_w / 2, CV_8U,
-                                         f->data[1] + s->opt_crop_x / 2,
-                                         f->linesize[1]),
-                                 cv::Mat(f->height / 2, real_w / 2, CV_8U,
-                                         f->data[2] + s->opt_crop_x / 2,
-                                         f->linesize[2]));
+            // rebind the slot's headers, no allocation happens here
+            std::get<0>(slot->in_mats[i]) = cv::Mat(f->height, real_w, CV_8U,
+                                                    f->data[0] + s->opt_crop_x,
+                                                    f->linesize[0]);
+            std::get<1>(slot->in_mats[i]) = cv::Mat(f->height / 2, real_w / 2, CV_8U,
+                                                    f->data[1] + s->opt_crop_x / 2,
+                                                    f->linesize[1]);
+            std::get<2>(slot->in_mats[i]) = cv::Mat(f->height / 2, real_w / 2, CV_8U,
+                                                    f->data[2] + s->opt_crop_x / 2,
+                                                    f->linesize[2]);
         }
         timer.tick("Prepare inputs");
+        latency_lap(s, VR_MAP_STAGE_INPUTS, &t);
 
-        out_frame = ff_get_video_buffer(ctx->outputs[0], s->opt_width, s->opt_height);
-        av_frame_copy_props(out_frame, frames[0]);
-        out_mat = std::make_tuple(cv::Mat(cv::Size(s->opt_width, s->opt_height), CV_8U,
-                                          out_frame->data[0], out_frame->linesize[0]),
-                                  cv::Mat(cv::Size(s->opt_width / 2, s->opt_height / 2), CV_8U,
-                                          out_frame->data[1], out_frame->linesize[1]),
-                                  cv::Mat(cv::Size(s->opt_width / 2, s->opt_height / 2), CV_8U,
-                                          out_frame->data[2], out_frame->linesize[2]));
+        slot->out = get_output_frame(ctx);
+        if(!slot->out) {
+            release_slot(slot, ctx->nb_inputs);
+            return AVERROR(ENOMEM);
+        }
+        av_frame_copy_props(slot->out, slot->in[s->sync_ref]);
+        slot->out_mat = std::make_tuple(cv::Mat(cv::Size(s->opt_width, s->opt_height), CV_8U,
+                                                slot->out->data[0], slot->out->linesize[0]),
+                                        cv::Mat(cv::Size(s->opt_width / 2, s->opt_height / 2), CV_8U,
+                                                slot->out->data[1], slot->out->linesize[1]),
+                                        cv::Mat(cv::Size(s->opt_width / 2, s->opt_height / 2), CV_8U,
+                                                slot->out->data[2], slot->out->linesize[2]));
 
         timer.tick("Prepare outputs");
-        s->async_remapper->push(in_mats, out_mat);
+        latency_lap(s, VR_MAP_STAGE_OUTPUTS, &t);
+        s->async_remapper->push(slot->in_mats, slot->out_mat);
+        s->nb_pending += 1;
+        latency_lap(s, VR_MAP_STAGE_REMAP, &t);
+        // keep up to opt_depth frames in flight
+        if(s->nb_pending <= s->opt_depth)
+            return 0;
     }
 
-    AVFrame * real_out_frame = NULL;
-    if(!has_last_frame)
-        s->last_frames = new AVFrame * [ctx->nb_inputs + 1];
-    else {
-        s->async_remapper->pop();
-        real_out_frame = s->last_frames[ctx->nb_inputs];
-        for(size_t i = 0 ; i < ctx->nb_inputs ; i += 1)
-            av_frame_free(&s->last_frames[i]);
-        timer.tick("Pop last frames");
-    }
+    VRMapSlot * slot = &s->slots[s->slot_head];
+    s->async_remapper->pop();
+    s->slot_head = (s->slot_head + 1) % nb_slots;
+    s->nb_pending -= 1;
 
-    if(queues_available) {
-        for(size_t i = 0 ; i < ctx->nb_inputs ; i += 1)
-            s->last_frames[i] = frames[i];
-        s->last_frames[ctx->nb_inputs] = out_frame;
-    } else {
-        delete [] s->last_frames;
-        s->last_frames = NULL;
-    }
+    AVFrame * out_frame = slot->out;
+    slot->out = NULL;
+    release_slot(slot, ctx->nb_inputs);
+    timer.tick("Pop last frames");
+    latency_lap(s, VR_MAP_STAGE_POP, &t);
 
-    if(real_out_frame)
-        ff_filter_frame(ctx->outputs[0], real_out_frame);
+    export_latency(ctx, out_frame);
+    int ret = ff_filter_frame(ctx->outputs[0], out_frame);
     timer.tick("Do next filter");
+    latency_lap(s, VR_MAP_STAGE_FILTER, &t);
 
-    return 0;
+    return ret;
+}
+#endif
+
+static int push_frame(AVFilterContext * ctx) {
+#if CONFIG_LIBOCTVR
+    VRMapContext *s = static_cast<VRMapContext *>(ctx->priv);
+    if(s->opt_backend == VR_MAP_BACKEND_OCTVR)
+        return push_frame_octvr(ctx);
+#endif
+    return push_frame_cpu(ctx);
 }
 
 static int filter_frame(AVFilterLink *inlink, AVFrame * frame) {
@@ -196,11 +651,233 @@ static int filter_frame(AVFilterLink *inlink, AVFrame * frame) {
     unsigned in_no = FF_INLINK_IDX(inlink);
 
     av_log(ctx, AV_LOG_DEBUG, "filter_frame: %u\n", in_no);
-    ff_bufqueue_add(ctx, &s->queues[in_no], frame);
+    struct FFBufQueue * q = &s->queues[in_no];
+    ff_bufqueue_add(ctx, q, frame);
+    s->arrival[in_no][(q->head + q->available - 1) % FF_BUFQUEUE_SIZE] = av_gettime_relative();
 
     return push_frame(ctx);
 }
 
+#if CONFIG_LIBOCTVR
+static vr::MapperTemplate * load_template(AVFilterContext * ctx, const std::string & filename) {
+    av_log(ctx, AV_LOG_INFO, "Loading template %s\n", filename.c_str());
+    std::ifstream f(filename.c_str(), std::ios::binary);
+    vr::MapperTemplate * tmpl = NULL;
+    try {
+        tmpl = new vr::MapperTemplate(f);
+    } catch (std::string & e) {
+        av_log(ctx, AV_LOG_ERROR, "Error loading template: %s\n", e.c_str());
+        return NULL;
+    }
+    av_log(ctx, AV_LOG_INFO, "Load complete, size: %dx%d\n",
+           tmpl->out_size.width, tmpl->out_size.height);
+    return tmpl;
+}
+#endif
+
+// Key of a compiled table: hash of the template file and of the geometry it is compiled for
+static int remap_cache_key(const std::string & filename, const VRRemapPlaneDesc * desc,
+                           int nb_inputs, uint8_t key[16]) {
+    struct AVMurMur3 * murmur = av_murmur3_alloc();
+    if(!murmur)
+        return AVERROR(ENOMEM);
+    av_murmur3_init(murmur);
+
+    std::ifstream f(filename.c_str(), std::ios::binary);
+    if(!f) {
+        av_free(murmur);
+        return AVERROR(ENOENT);
+    }
+    std::vector<char> buf(1 << 16);
+    while(f.read(buf.data(), buf.size()) || f.gcount() > 0)
+        av_murmur3_update(murmur, reinterpret_cast<const uint8_t *>(buf.data()), f.gcount());
+
+    for(int plane = 0 ; plane < 2 ; plane += 1) {
+        std::vector<int32_t> geometry = { desc[plane].w, desc[plane].h, desc[plane].fill,
+                                          desc[plane].tile_size };
+        geometry.insert(geometry.end(), desc[plane].in_w, desc[plane].in_w + nb_inputs);
+        geometry.insert(geometry.end(), desc[plane].in_h, desc[plane].in_h + nb_inputs);
+        av_murmur3_update(murmur, reinterpret_cast<const uint8_t *>(geometry.data()),
+                          geometry.size() * sizeof(geometry[0]));
+    }
+    av_murmur3_final(murmur, key);
+    av_free(murmur);
+    return 0;
+}
+
+#if CONFIG_LIBOCTVR
+// templates of the octvr format are converted to the layout of native ones
+static int load_octvr_template(AVFilterContext * ctx, VRTemplate * t, const std::string & filename) {
+    std::unique_ptr<vr::MapperTemplate> tmpl(load_template(ctx, filename));
+    if(!tmpl)
+        return AVERROR_INVALIDDATA;
+
+    int w = tmpl->out_size.width, h = tmpl->out_size.height;
+    t->w = w;
+    t->h = h;
+    t->map_x = static_cast<float **>(av_mallocz_array(tmpl->inputs.size(), sizeof(*t->map_x)));
+    t->map_y = static_cast<float **>(av_mallocz_array(tmpl->inputs.size(), sizeof(*t->map_y)));
+    if(!t->map_x || !t->map_y) {
+        ff_vr_template_free(t);
+        return AVERROR(ENOMEM);
+    }
+    t->nb_inputs = tmpl->inputs.size();
+    for(int i = 0 ; i < t->nb_inputs ; i += 1) {
+        auto & in = tmpl->inputs[i];
+        if(in.map1.type() != CV_32FC1 || in.map2.type() != CV_32FC1 ||
+           in.map1.size() != tmpl->out_size || in.map2.size() != tmpl->out_size) {
+            av_log(ctx, AV_LOG_ERROR, "Unsupported map layout in template %s\n", filename.c_str());
+            ff_vr_template_free(t);
+            return AVERROR_INVALIDDATA;
+        }
+        t->map_x[i] = static_cast<float *>(av_malloc_array((size_t)w * h, sizeof(float)));
+        t->map_y[i] = static_cast<float *>(av_malloc_array((size_t)w * h, sizeof(float)));
+        if(!t->map_x[i] || !t->map_y[i]) {
+            ff_vr_template_free(t);
+            return AVERROR(ENOMEM);
+        }
+        for(int y = 0 ; y < h ; y += 1) {
+            memcpy(t->map_x[i] + (size_t)y * w, in.map1.ptr<float>(y), w * sizeof(float));
+            memcpy(t->map_y[i] + (size_t)y * w, in.map2.ptr<float>(y), w * sizeof(float));
+        }
+    }
+    return 0;
+}
+#endif
+
+static int compile_remap_table(AVFilterContext * ctx, VRRemapTable * table,
+                               const std::string & filename, const VRRemapPlaneDesc * desc) {
+    VRTemplate tmpl;
+    int ret = ff_vr_template_load(&tmpl, filename.c_str(), ctx);
+#if CONFIG_LIBOCTVR
+    if(ret == AVERROR_INVALIDDATA)
+        ret = load_octvr_template(ctx, &tmpl, filename);
+#endif
+    if(ret < 0) {
+        av_log(ctx, AV_LOG_ERROR, "Cannot load template %s\n", filename.c_str());
+        return ret;
+    }
+    if(tmpl.nb_inputs != (int)ctx->nb_inputs) {
+        av_log(ctx, AV_LOG_ERROR, "Template %s has %d inputs, expected %d\n",
+               filename.c_str(), tmpl.nb_inputs, ctx->nb_inputs);
+        ff_vr_template_free(&tmpl);
+        return AVERROR(EINVAL);
+    }
+
+    ret = ff_vr_remap_table_init(table, desc, 2, ctx->nb_inputs,
+                                 tmpl.map_x, tmpl.map_y, tmpl.w, tmpl.h, tmpl.w);
+    ff_vr_template_free(&tmpl);
+    return ret;
+}
+
+static int init_cpu_remapper(AVFilterContext * ctx) {
+    VRMapContext *s = static_cast<VRMapContext *>(ctx->priv);
+
+    s->remap_tables = static_cast<VRRemapTable *>(av_calloc(s->outputs, sizeof(*s->remap_tables)));
+    s->blenders = static_cast<VRBlendContext *>(av_calloc(s->outputs, sizeof(*s->blenders)));
+    s->remap_rects = static_cast<int (*)[4]>(av_calloc(s->outputs, sizeof(*s->remap_rects)));
+    if(!s->remap_tables || !s->blenders || !s->remap_rects)
+        return AVERROR(ENOMEM);
+
+    const AVPixFmtDescriptor * fmt = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(s->input_format));
+    for(int c = 0 ; c < 3 ; c += 1) {
+        const AVComponentDescriptor * comp = &fmt->comp[c];
+        int depth = comp->depth_minus1 + 1;
+        int step = (comp->step_minus1 + 1) / (depth > 8 ? 2 : 1);
+        s->in_planes[c] = comp->plane;
+        s->in_offsets[c] = comp->offset_plus1 - 1;
+        ff_vr_remap_dsp_init(&s->remap_dsp[c], step, depth);
+    }
+    s->in_chroma_w = fmt->log2_chroma_w;
+    s->in_chroma_h = fmt->log2_chroma_h;
+
+    std::vector<int> in_w[2], in_h[2];
+    for(size_t j = 0 ; j < ctx->nb_inputs ; j += 1) {
+        in_w[0].push_back(s->in_sizes[j].width);
+        in_h[0].push_back(s->in_sizes[j].height);
+        in_w[1].push_back(s->in_sizes[j].width >> s->in_chroma_w);
+        in_h[1].push_back(s->in_sizes[j].height >> s->in_chroma_h);
+    }
+
+    auto filenames = split(s->opt_outputs, '|');
+    for(int i = 0 ; i < s->outputs ; i += 1) {
+        auto & region = s->output_regions[i];
+        int * rect = s->remap_rects[i];
+        rect[0] = int(region.x * s->opt_width) & ~1;
+        rect[1] = int(region.y * s->opt_height) & ~1;
+        rect[2] = FFMIN(int(region.width * s->opt_width) & ~1, s->opt_width - rect[0]);
+        rect[3] = FFMIN(int(region.height * s->opt_height) & ~1, s->opt_height - rect[1]);
+
+        VRRemapPlaneDesc desc[2];
+        for(int plane = 0 ; plane < 2 ; plane += 1) {
+            desc[plane].w = rect[2] >> plane;
+            desc[plane].h = rect[3] >> plane;
+            desc[plane].fill = (plane ? 128 : 16) << (s->opt_bits - 8);
+            desc[plane].tile_size = s->opt_tile_size;
+            desc[plane].in_w = in_w[plane].data();
+            desc[plane].in_h = in_h[plane].data();
+        }
+
+        std::string cache_file;
+        uint8_t key[16];
+        int ret;
+        if(s->opt_cache_dir) {
+            if((ret = remap_cache_key(filenames[i], desc, ctx->nb_inputs, key)) < 0)
+                return ret;
+            std::ostringstream name;
+            name << s->opt_cache_dir << "/vr_map-";
+            for(int k = 0 ; k < 16 ; k += 1)
+                name << std::hex << std::setw(2) << std::setfill('0') << int(key[k]);
+            name << ".cache";
+            cache_file = name.str();
+
+            ret = ff_vr_remap_table_load(&s->remap_tables[i], cache_file.c_str(), key,
+                                         desc, 2, ctx->nb_inputs, ctx);
+            if(ret >= 0)
+                av_log(ctx, AV_LOG_INFO, "Output No.%d: using cached table %s\n",
+                       i, cache_file.c_str());
+        }
+
+        if(cache_file.empty() || ret < 0) {
+            if((ret = compile_remap_table(ctx, &s->remap_tables[i], filenames[i], desc)) < 0)
+                return ret;
+            av_log(ctx, AV_LOG_DEBUG, "Output No.%d: %d spans, %d tiles for %dx%d pixels\n",
+                   i, s->remap_tables[i].planes[0].nb_spans,
+                   s->remap_tables[i].planes[0].nb_tiles, rect[2], rect[3]);
+            if(!cache_file.empty() &&
+               ff_vr_remap_table_save(&s->remap_tables[i], cache_file.c_str(), key, ctx) >= 0)
+                av_log(ctx, AV_LOG_INFO, "Output No.%d: table cached to %s\n",
+                       i, cache_file.c_str());
+        }
+
+        // blend: 1 for feathering, more for multi-band; exposure: frames between gain updates
+        int bands = FFMAX(s->blend_modes[i], 0), exposure = FFMAX(s->gain_modes[i], 0);
+        if(s->opt_bits > 8 && (bands || exposure)) {
+            av_log(ctx, AV_LOG_WARNING, "Output No.%d: blending and exposure compensation "
+                   "need 8-bit samples, disabled\n", i);
+            bands = exposure = 0;
+        }
+        if((ret = ff_vr_blend_init(&s->blenders[i], &s->remap_tables[i], ctx->nb_inputs,
+                                   bands, exposure, FFMAX(ctx->graph->nb_threads, 1))) < 0)
+            return ret;
+        if(s->blenders[i].bands || s->blenders[i].exposure)
+            av_log(ctx, AV_LOG_INFO, "Output No.%d: %d seam tiles, %d blend bands, "
+                   "exposure update every %d frames\n", i, s->remap_tables[i].planes[0].nb_seams,
+                   s->blenders[i].bands, s->blenders[i].exposure);
+
+        if(s->opt_bench) {
+            double tiled, raster;
+            if((ret = ff_vr_remap_plane_miss_rate(&s->remap_tables[i].planes[0],
+                                                  in_w[0].data(), &tiled, &raster)) < 0)
+                return ret;
+            av_log(ctx, AV_LOG_INFO, "Output No.%d: modeled luma cache miss rate "
+                   "%.2f%% tiled, %.2f%% raster\n", i, tiled * 100, raster * 100);
+        }
+    }
+
+    return 0;
+}
+
 static int config_input(AVFilterLink *inlink) {
     AVFilterContext * ctx = inlink->dst;
     VRMapContext *s = static_cast<VRMapContext *>(ctx->priv);
@@ -209,33 +886,54 @@ static int config_input(AVFilterLink *inlink) {
            in_no, inlink->w, inlink->h);
     if(s->opt_crop_w != 0)
         av_log(ctx, AV_LOG_WARNING, "Using width %d for input %d\n", s->opt_crop_w, in_no);
-    s->in_sizes[in_no] = cv::Size(s->opt_crop_w != 0 ? s->opt_crop_w : inlink->w, inlink->h);
+    s->in_sizes[in_no].width = s->opt_crop_w != 0 ? s->opt_crop_w : inlink->w;
+    s->in_sizes[in_no].height = inlink->h;
 
-    if(s->input_format != 0 && s->input_format != inlink->format) {
+    if(s->input_format != AV_PIX_FMT_NONE && s->input_format != inlink->format) {
         av_log(ctx, AV_LOG_ERROR, "Pixel formats for all inputs should be same.\n");
         return -1;
     }
-    if(s->input_format == 0) {
-        s->input_format = inlink->format;
-        av_assert0(s->input_format == AV_PIX_FMT_YUV420P || s->input_format == AV_PIX_FMT_YUVJ420P);
+    s->input_format = inlink->format;
+
+    // match frames within half a frame interval of the fastest input
+    // unless a skew is given
+    if(in_no == 0)
+        s->sync_window = s->opt_max_skew ? s->opt_max_skew : 20000;
+    if(!s->opt_max_skew && inlink->frame_rate.num > 0 && inlink->frame_rate.den > 0)
+        s->sync_window = FFMIN(s->sync_window,
+                               av_rescale_q(1, av_inv_q(inlink->frame_rate), AV_TIME_BASE_Q) / 2);
+
+    if(in_no == ctx->nb_inputs - 1 && s->opt_backend == VR_MAP_BACKEND_CPU) {
+        int ret = init_cpu_remapper(ctx);
+        if(ret < 0)
+            return ret;
+        av_log(ctx, AV_LOG_INFO, "Init cpu remapper done\n");
     }
-
-    if(in_no == ctx->nb_inputs - 1) {
+#if CONFIG_LIBOCTVR
+    else if(in_no == ctx->nb_inputs - 1) {
         std::vector<vr::MapperTemplate> _templates;
-        for(int i = 0 ; i < s->outputs ; i += 1)
+        std::vector<cv::Size> _in_sizes;
+        std::vector<cv::Rect_<double>> _regions;
+        for(int i = 0 ; i < s->outputs ; i += 1) {
+            const VRMapRegion & r = s->output_regions[i];
             _templates.push_back(*s->mapper_templates[i]);
+            _regions.push_back(cv::Rect_<double>(r.x, r.y, r.width, r.height));
+        }
+        for(size_t i = 0 ; i < ctx->nb_inputs ; i += 1)
+            _in_sizes.push_back(cv::Size(s->in_sizes[i].width, s->in_sizes[i].height));
 
         s->async_remapper = vr::AsyncMultiMapper::New(
             _templates,
-            std::vector<cv::Size>(s->in_sizes, s->in_sizes + ctx->nb_inputs),
+            _in_sizes,
             cv::Size(s->opt_width, s->opt_height),
             std::vector<int>(s->blend_modes, s->blend_modes + s->outputs),
             std::vector<int>(s->gain_modes, s->gain_modes + s->outputs),
-            std::vector<cv::Rect_<double>>(s->output_regions, s->output_regions + s->outputs),
+            _regions,
             cv::Size(s->opt_preview_width, s->opt_preview_height)
         );
         av_log(ctx, AV_LOG_INFO, "Init async remapper done\n");
     }
+#endif
 
     return 0;
 }
@@ -246,6 +944,24 @@ static int config_output(AVFilterLink *link)
 
     link->w = s->opt_width;
     link->h = s->opt_height;
+
+    // thread count is final once links are configured
+    ff_latency_uninit(&s->latency[VR_MAP_STAGE_SLICE]);
+    int ret = ff_latency_init(&s->latency[VR_MAP_STAGE_SLICE], stage_names[VR_MAP_STAGE_SLICE],
+                              link->src->graph->nb_threads);
+    if(ret < 0)
+        return ret;
+
+    // every output frame has the same geometry, so recycle their buffers
+    for(int i = 0 ; i < 3 ; i += 1) {
+        int shift = !!i;
+        s->out_linesize[i] = FFALIGN(((s->opt_width + shift) >> shift) * (s->opt_bits > 8 ? 2 : 1), 64);
+        av_buffer_pool_uninit(&s->out_pools[i]);
+        s->out_pools[i] = av_buffer_pool_init(s->out_linesize[i] *
+                                              ((s->opt_height + shift) >> shift) + 64, NULL);
+        if(!s->out_pools[i])
+            return AVERROR(ENOMEM);
+    }
     return 0;
 }
 
@@ -267,6 +983,25 @@ static int request_frame(AVFilterLink *outlink) {
 static int init(AVFilterContext *ctx) {
     VRMapContext *s = static_cast<VRMapContext *>(ctx->priv);
 
+    s->input_format = AV_PIX_FMT_NONE;
+#if !CONFIG_LIBOCTVR
+    if(s->opt_backend == VR_MAP_BACKEND_OCTVR) {
+        av_log(ctx, AV_LOG_ERROR, "The octvr backend needs --enable-liboctvr\n");
+        return AVERROR(ENOSYS);
+    }
+#endif
+    if(s->opt_bits != 8 && s->opt_bits != 10) {
+        av_log(ctx, AV_LOG_ERROR, "Unsupported bits per sample %d\n", s->opt_bits);
+        return AVERROR(EINVAL);
+    }
+    if(s->opt_bits > 8 && s->opt_backend != VR_MAP_BACKEND_CPU) {
+        av_log(ctx, AV_LOG_ERROR, "10-bit samples need the cpu backend\n");
+        return AVERROR(EINVAL);
+    }
+    if(s->opt_depth > 1 && s->opt_backend == VR_MAP_BACKEND_CPU)
+        av_log(ctx, AV_LOG_WARNING, "depth only applies to the octvr backend, "
+               "the cpu backend remaps one frame at a time\n");
+
     // parse opts
     auto opt_outputs_split = split(s->opt_outputs, '|');
     s->outputs = opt_outputs_split.size();
@@ -281,23 +1016,22 @@ static int init(AVFilterContext *ctx) {
     auto opt_region_split = split(s->opt_region, '|');
     av_assert0(opt_region_split.size() == s->outputs || opt_region_split.empty());
 
-    s->mapper_templates = new vr::MapperTemplate * [s->outputs];
+#if CONFIG_LIBOCTVR
+    s->mapper_templates = new vr::MapperTemplate * [s->outputs]();
+#endif
     s->blend_modes = new int [s->outputs];
     s->gain_modes = new int [s->outputs];
-    s->output_regions = new cv::Rect_<double> [s->outputs];
+    s->output_regions = new VRMapRegion [s->outputs];
 
     for(int i = 0 ; i < s->outputs ; i += 1) {
-        av_log(ctx, AV_LOG_INFO, "Loading template %s\n", opt_outputs_split[i].c_str());
-        std::ifstream f(opt_outputs_split[i].c_str(), std::ios::binary);
-        try {
-            s->mapper_templates[i] = new vr::MapperTemplate(f);
-        } catch (std::string & e) {
-            av_log(ctx, AV_LOG_ERROR, "Error loading template: %s\n", e.c_str());
-            return AVERROR_INVALIDDATA;
+        // the cpu backend compiles templates once input sizes are known
+#if CONFIG_LIBOCTVR
+        if(s->opt_backend == VR_MAP_BACKEND_OCTVR) {
+            s->mapper_templates[i] = load_template(ctx, opt_outputs_split[i]);
+            if(!s->mapper_templates[i])
+                return AVERROR_INVALIDDATA;
         }
-        av_log(ctx, AV_LOG_INFO, "Load complete, size: %dx%d\n",
-               s->mapper_templates[i]->out_size.width,
-               s->mapper_templates[i]->out_size.height);
+#endif
 
         if(opt_blend_split.empty())
             s->blend_modes[i] = -1;
@@ -310,7 +1044,7 @@ static int init(AVFilterContext *ctx) {
             s->gain_modes[i] = std::atoi(opt_exposure_split[i].c_str());
 
         if(opt_region_split.empty())
-            s->output_regions[i] = cv::Rect_<double>(0., 0., 1., 1.);
+            s->output_regions[i] = VRMapRegion{ 0., 0., 1., 1. };
         else {
             auto region_split_more = split(opt_region_split[i].c_str(), '/');
             s->output_regions[i].x = std::atof(region_split_more[0].c_str());
@@ -326,7 +1060,8 @@ static int init(AVFilterContext *ctx) {
     }
 
     s->queues = static_cast<struct FFBufQueue *>(av_calloc(s->opt_inputs, sizeof(s->queues[0])));
-    if(!s->queues)
+    s->sync = static_cast<VRMapInputSync *>(av_calloc(s->opt_inputs, sizeof(s->sync[0])));
+    if(!s->queues || !s->sync)
         return AVERROR(ENOMEM);
 
     for(int i = 0 ; i < s->opt_inputs ; i += 1) {
@@ -337,7 +1072,29 @@ static int init(AVFilterContext *ctx) {
         inpad.config_props = config_input;
         ff_insert_inpad(ctx, i, &inpad);
     }
-    s->in_sizes = new cv::Size [s->opt_inputs];
+    s->in_sizes = new VRMapSize [s->opt_inputs];
+
+    s->nb_latency = VR_MAP_NB_STAGES + s->opt_inputs;
+    s->latency = static_cast<FFLatencyHistogram *>(av_calloc(s->nb_latency, sizeof(*s->latency)));
+    s->arrival = static_cast<int64_t (*)[FF_BUFQUEUE_SIZE]>(av_calloc(s->opt_inputs,
+                                                                      sizeof(*s->arrival)));
+    if(!s->latency || !s->arrival)
+        return AVERROR(ENOMEM);
+    for(int i = 0 ; i < s->nb_latency ; i += 1) {
+        int ret = ff_latency_init(&s->latency[i], i < VR_MAP_NB_STAGES ? stage_names[i] :
+                                  av_asprintf("queue%d", i - VR_MAP_NB_STAGES), 1);
+        if(ret < 0 || !s->latency[i].name)
+            return AVERROR(ENOMEM);
+    }
+
+    s->slots = new VRMapSlot [s->opt_depth + 1];
+    for(int i = 0 ; i <= s->opt_depth ; i += 1) {
+        s->slots[i].in = new AVFrame * [s->opt_inputs]();
+        s->slots[i].out = NULL;
+#if CONFIG_LIBOCTVR
+        s->slots[i].in_mats.resize(s->opt_inputs);
+#endif
+    }
 
     AVFilterPad outpad = { 0 };
     outpad.name = av_strdup("output0");
@@ -353,36 +1110,141 @@ static void uninit(AVFilterContext *ctx) {
     av_log(ctx, AV_LOG_INFO, "uniniting...\n");
 
     VRMapContext *s = static_cast<VRMapContext *>(ctx->priv);
+    // frames still in flight must be done before their buffers go away
+    for(; s->nb_pending > 0 ; s->nb_pending -= 1) {
+#if CONFIG_LIBOCTVR
+        if(s->async_remapper)
+            s->async_remapper->pop();
+#endif
+        release_slot(&s->slots[s->slot_head], ctx->nb_inputs);
+        s->slot_head = (s->slot_head + 1) % (s->opt_depth + 1);
+    }
+    if(s->slots) {
+        for(int i = 0 ; i <= s->opt_depth ; i += 1) {
+            release_slot(&s->slots[i], ctx->nb_inputs);
+            delete [] s->slots[i].in;
+        }
+        delete [] s->slots;
+        s->slots = NULL;
+    }
+    for(int i = 0 ; i < 3 ; i += 1)
+        av_buffer_pool_uninit(&s->out_pools[i]);
+
     for(size_t i = 0 ; i < ctx->nb_inputs ; i += 1) {
         ff_bufqueue_discard_all(&s->queues[i]);
-        av_freep(&s->queues[i]);
         av_freep(&ctx->input_pads[i].name);
+        if(s->sync) {
+            av_log(ctx, AV_LOG_VERBOSE, "Input %zu: max depth %d, %" PRId64 " dropped, %" PRId64 " repeated\n",
+                   i, s->sync[i].max_depth, s->sync[i].dropped, s->sync[i].repeated);
+            av_frame_free(&s->sync[i].last);
+        }
     }
-    for(size_t i = 0 ; i < s->outputs ; i += 1) {
-        delete s->mapper_templates[i];
-        s->mapper_templates[i] = NULL;
+    av_freep(&s->queues);
+    av_freep(&s->sync);
+#if CONFIG_LIBOCTVR
+    if(s->mapper_templates) {
+        for(size_t i = 0 ; i < s->outputs ; i += 1)
+            delete s->mapper_templates[i];
+        delete [] s->mapper_templates;
+        s->mapper_templates = NULL;
     }
     if(s->async_remapper) {
         delete s->async_remapper;
         s->async_remapper = NULL;
     }
+#endif
+    if(s->blenders) {
+        for(int i = 0 ; i < s->outputs ; i += 1)
+            ff_vr_blend_uninit(&s->blenders[i]);
+        av_freep(&s->blenders);
+    }
+    if(s->remap_tables) {
+        for(int i = 0 ; i < s->outputs ; i += 1)
+            ff_vr_remap_table_uninit(&s->remap_tables[i]);
+        av_freep(&s->remap_tables);
+    }
+    av_freep(&s->remap_rects);
+    if(s->latency) {
+        for(int i = 0 ; i < s->nb_latency ; i += 1) {
+            if(i >= VR_MAP_NB_STAGES)
+                av_free(const_cast<char *>(s->latency[i].name));
+            ff_latency_uninit(&s->latency[i]);
+        }
+        av_freep(&s->latency);
+    }
+    av_freep(&s->arrival);
+    if(s->opt_bench && s->remap_frames)
+        av_log(ctx, AV_LOG_INFO, "Remap: %.3f ms/frame over %d frames\n",
+               s->remap_time / 1000.0 / s->remap_frames, s->remap_frames);
+}
+
+// "latency" returns one line per histogram, "latency_reset" clears them,
+// "sync" returns the queue depth and drop counts of each input
+static int process_command(AVFilterContext *ctx, const char *cmd, const char *args,
+                           char *res, int res_len, int flags) {
+    VRMapContext *s = static_cast<VRMapContext *>(ctx->priv);
+
+    if(!strcmp(cmd, "latency")) {
+        AVBPrint bp;
+        if(!res || res_len <= 0)
+            return 0;
+        av_bprint_init_for_buffer(&bp, res, res_len);
+        for(int i = 0 ; i < s->nb_latency ; i += 1) {
+            av_bprintf(&bp, "%s: ", s->latency[i].name);
+            ff_latency_print(&s->latency[i], &bp);
+            av_bprintf(&bp, "\n");
+        }
+        return av_bprint_is_complete(&bp) ? 0 : AVERROR(ENOSPC);
+    } else if(!strcmp(cmd, "sync")) {
+        AVBPrint bp;
+        if(!res || res_len <= 0)
+            return 0;
+        av_bprint_init_for_buffer(&bp, res, res_len);
+        for(unsigned i = 0 ; i < ctx->nb_inputs ; i += 1)
+            av_bprintf(&bp, "input%u: depth=%u max_depth=%d dropped=%" PRId64 " repeated=%" PRId64 "\n",
+                       i, s->queues[i].available, s->sync[i].max_depth,
+                       s->sync[i].dropped, s->sync[i].repeated);
+        return av_bprint_is_complete(&bp) ? 0 : AVERROR(ENOSPC);
+    } else if(!strcmp(cmd, "latency_reset")) {
+        for(int i = 0 ; i < s->nb_latency ; i += 1)
+            ff_latency_reset(&s->latency[i]);
+        return 0;
+    }
+    return AVERROR(ENOSYS);
 }
 
 #define OFFSET(x) offsetof(VRMapContext, x)
 #define FLAGS (AV_OPT_FLAG_FILTERING_PARAM | AV_OPT_FLAG_VIDEO_PARAM)
 
 static const AVOption vr_map_options[] = {
+    { "backend", "Remapping backend", OFFSET(opt_backend), AV_OPT_TYPE_INT, {CONFIG_LIBOCTVR ? VR_MAP_BACKEND_OCTVR : VR_MAP_BACKEND_CPU}, 0, VR_MAP_BACKEND_CPU, FLAGS, "backend"},
+        { "octvr", "Use octvr async mapper", 0, AV_OPT_TYPE_CONST, {VR_MAP_BACKEND_OCTVR}, 0, 0, FLAGS, "backend"},
+        { "cpu", "Use native bilinear remapping on CPU", 0, AV_OPT_TYPE_CONST, {VR_MAP_BACKEND_CPU}, 0, 0, FLAGS, "backend"},
     { "inputs", "Number of input streams", OFFSET(opt_inputs), AV_OPT_TYPE_INT, {2}, 1, INT_MAX, FLAGS},
     { "outputs", "`|`-seperated output templates", OFFSET(opt_outputs), AV_OPT_TYPE_STRING, {0}, CHAR_MIN, CHAR_MAX, FLAGS},
     { "crop_x", "Crop X", OFFSET(opt_crop_x), AV_OPT_TYPE_INT, {0}, 0, INT_MAX, FLAGS},
     { "crop_w", "Crop width", OFFSET(opt_crop_w), AV_OPT_TYPE_INT, {0}, 0, INT_MAX, FLAGS},
-    { "blend", "`|`-seperated blending param", OFFSET(opt_blend), AV_OPT_TYPE_STRING, {0}, CHAR_MIN, CHAR_MAX, FLAGS},
-    { "exposure", "`|`-seperated exposure param", OFFSET(opt_exposure), AV_OPT_TYPE_STRING, {0}, CHAR_MIN, CHAR_MAX, FLAGS},
+    { "blend", "`|`-seperated blending param (cpu backend: 1 feather, 2-5 multi-band levels)", OFFSET(opt_blend), AV_OPT_TYPE_STRING, {0}, CHAR_MIN, CHAR_MAX, FLAGS},
+    { "exposure", "`|`-seperated exposure param (cpu backend: frames between gain updates)", OFFSET(opt_exposure), AV_OPT_TYPE_STRING, {0}, CHAR_MIN, CHAR_MAX, FLAGS},
     { "region", "`|`-seperated region param", OFFSET(opt_region), AV_OPT_TYPE_STRING, {0}, CHAR_MIN, CHAR_MAX, FLAGS},
     { "width", "Output width", OFFSET(opt_width), AV_OPT_TYPE_INT, {3840}, INT_MIN, INT_MAX, FLAGS},
     { "height", "Output height", OFFSET(opt_height), AV_OPT_TYPE_INT, {2160}, INT_MIN, INT_MAX, FLAGS},
     { "preview_width", "Preview output width (for QT only)", OFFSET(opt_preview_width), AV_OPT_TYPE_INT, {0}, 0, INT_MAX, FLAGS},
     { "preview_height", "Preview output height (for QT only)", OFFSET(opt_preview_height), AV_OPT_TYPE_INT, {0}, 0, INT_MAX, FLAGS},
+    { "cache_dir", "Directory for compiled remap tables (cpu backend only)", OFFSET(opt_cache_dir), AV_OPT_TYPE_STRING, {0}, CHAR_MIN, CHAR_MAX, FLAGS},
+    { "tile_size", "Size of the tiles remap tables are laid out in (cpu backend only)", OFFSET(opt_tile_size), AV_OPT_TYPE_INT, {VR_REMAP_TILE_SIZE}, 8, 1024, FLAGS},
+    { "depth", "Number of frames in flight in the remapper (octvr backend only)", OFFSET(opt_depth), AV_OPT_TYPE_INT, {1}, 1, 16, FLAGS},
+    { "bits", "Bits per sample of inputs and output, 8 or 10 (10 needs the cpu backend)", OFFSET(opt_bits), AV_OPT_TYPE_INT, {8}, 8, 10, FLAGS},
+    { "stats_period", "Attach latency histograms as frame metadata every N frames, 0 to disable", OFFSET(opt_stats_period), AV_OPT_TYPE_INT, {0}, 0, INT_MAX, FLAGS},
+    { "sync", "How input frames are matched", OFFSET(opt_sync), AV_OPT_TYPE_INT, {VR_MAP_SYNC_PTS}, 0, VR_MAP_SYNC_PTS, FLAGS, "sync"},
+        { "none", "Take one frame from each input", 0, AV_OPT_TYPE_CONST, {VR_MAP_SYNC_NONE}, 0, 0, FLAGS, "sync"},
+        { "pts", "Take frames whose timestamps are within max_skew", 0, AV_OPT_TYPE_CONST, {VR_MAP_SYNC_PTS}, 0, 0, FLAGS, "sync"},
+    { "max_skew", "Largest timestamp difference between matched frames, 0 for half a frame interval", OFFSET(opt_max_skew), AV_OPT_TYPE_DURATION, {0}, 0, INT_MAX, FLAGS},
+    { "max_queue", "Frames an input may queue while waiting for a stalled input", OFFSET(opt_max_queue), AV_OPT_TYPE_INT, {8}, 1, FF_BUFQUEUE_SIZE - 1, FLAGS},
+    { "stall", "What to do when max_queue is reached", OFFSET(opt_stall), AV_OPT_TYPE_INT, {VR_MAP_STALL_DROP}, 0, VR_MAP_STALL_DUP, FLAGS, "stall"},
+        { "drop", "Drop the oldest queued frames", 0, AV_OPT_TYPE_CONST, {VR_MAP_STALL_DROP}, 0, 0, FLAGS, "stall"},
+        { "dup", "Repeat the last frame of stalled inputs", 0, AV_OPT_TYPE_CONST, {VR_MAP_STALL_DUP}, 0, 0, FLAGS, "stall"},
+    { "bench", "Log cache and timing statistics of the remapping (cpu backend only)", OFFSET(opt_bench), AV_OPT_TYPE_INT, {0}, 0, 1, FLAGS},
     { NULL }
 };
 
@@ -420,14 +1282,14 @@ AVFilter ff_vf_vr_map = {
     NULL, // inputs
     NULL, // outputs
     &vr_map_class, // priv_class
-    AVFILTER_FLAG_DYNAMIC_INPUTS | AVFILTER_FLAG_DYNAMIC_OUTPUTS, // flags
+    AVFILTER_FLAG_DYNAMIC_INPUTS | AVFILTER_FLAG_DYNAMIC_OUTPUTS | AVFILTER_FLAG_SLICE_THREADS, // flags
     init, // init
     NULL, // init_dict
     uninit, // uninit
     query_formats, // query_formats
     sizeof(VRMapContext), // priv_size
     NULL, // next
-    NULL, // process_command
+    process_command, // process_command
     NULL, // init_opaque
 };
 
@@ -0,0 +1,473 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Conversion between 360 degree video projections.
+ *
+ * Source positions are computed analytically for every output pixel at
+ * configuration time and compiled into vr_remap tables, one for each face of
+ * cube layouts so that faces render as independent slice jobs.
+ *
+ * Directions use x to the right, y up and z forward. Cube layouts are 3x2
+ * with right, left, up on the first row and down, front, back on the second.
+ */
+
+#include <math.h>
+
+#include "libavutil/avassert.h"
+#include "libavutil/common.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/opt.h"
+#include "libavutil/pixdesc.h"
+#include "avfilter.h"
+#include "formats.h"
+#include "internal.h"
+#include "video.h"
+#include "vr_remap.h"
+
+enum Projection {
+    EQUIRECT,
+    CUBEMAP_3X2,
+    EAC,
+    FISHEYE,
+    NB_PROJECTIONS,
+};
+
+enum Face {
+    RIGHT, LEFT, UP, DOWN, FRONT, BACK, NB_FACES,
+};
+
+typedef struct VRProjectContext {
+    const AVClass *class;
+    int in_proj, out_proj;
+    int w, h;
+    double in_fov, out_fov;
+
+    int nb_planes;
+    int hsub, vsub;
+    VRRemapDSPContext dsp;
+
+    VRRemapTable *tables;       ///< luma then chroma, VR_REMAP_MAX_PLANES per region
+    int (*regions)[4];          ///< x, y, w, h of each region in luma pixels
+    int nb_regions;
+    int jobs_per_region;
+} VRProjectContext;
+
+typedef struct ThreadData {
+    AVFrame *in, *out;
+} ThreadData;
+
+static int query_formats(AVFilterContext *ctx)
+{
+    static const enum AVPixelFormat pix_fmts[] = {
+        AV_PIX_FMT_GRAY8,
+        AV_PIX_FMT_YUV420P,   AV_PIX_FMT_YUVJ420P,
+        AV_PIX_FMT_YUV422P,   AV_PIX_FMT_YUVJ422P,
+        AV_PIX_FMT_YUV444P,   AV_PIX_FMT_YUVJ444P,
+        AV_PIX_FMT_YUV420P10, AV_PIX_FMT_YUV422P10, AV_PIX_FMT_YUV444P10,
+        AV_PIX_FMT_NONE
+    };
+    AVFilterFormats *fmts_list = ff_make_format_list(pix_fmts);
+
+    if (!fmts_list)
+        return AVERROR(ENOMEM);
+    return ff_set_common_formats(ctx, fmts_list);
+}
+
+/* Direction of face coordinates a (right) and b (down) in [-1, 1]. */
+static void face_to_dir(int face, double a, double b, double *d)
+{
+    switch (face) {
+    case RIGHT: d[0] =  1; d[1] = -b; d[2] = -a; break;
+    case LEFT:  d[0] = -1; d[1] = -b; d[2] =  a; break;
+    case UP:    d[0] =  a; d[1] =  1; d[2] =  b; break;
+    case DOWN:  d[0] =  a; d[1] = -1; d[2] = -b; break;
+    case FRONT: d[0] =  a; d[1] = -b; d[2] =  1; break;
+    case BACK:  d[0] = -a; d[1] = -b; d[2] = -1; break;
+    }
+}
+
+static int dir_to_face(const double *d, double *a, double *b)
+{
+    double ax = fabs(d[0]), ay = fabs(d[1]), az = fabs(d[2]);
+
+    if (ax >= ay && ax >= az) {
+        *a = (d[0] > 0 ? -d[2] : d[2]) / ax;
+        *b = -d[1] / ax;
+        return d[0] > 0 ? RIGHT : LEFT;
+    } else if (ay >= az) {
+        *a = d[0] / ay;
+        *b = (d[1] > 0 ? d[2] : -d[2]) / ay;
+        return d[1] > 0 ? UP : DOWN;
+    }
+    *a = (d[2] > 0 ? d[0] : -d[0]) / az;
+    *b = -d[1] / az;
+    return d[2] > 0 ? FRONT : BACK;
+}
+
+/* Equi-angular cubemaps sample faces uniformly in angle. */
+static double eac_to_cube(double a)
+{
+    return tan(a * M_PI / 4);
+}
+
+static double cube_to_eac(double a)
+{
+    return atan(a) * 4 / M_PI;
+}
+
+/**
+ * Direction of the output pixel at (u, v), normalized to [0, 1] over the
+ * region it belongs to. Returns 0 if the pixel is outside of the projection.
+ */
+static int output_dir(const VRProjectContext *s, int region, double u, double v, double *d)
+{
+    double lon, lat, x, y, r, theta, phi;
+
+    switch (s->out_proj) {
+    case EQUIRECT:
+        lon = (u - 0.5) * 2 * M_PI;
+        lat = (0.5 - v) * M_PI;
+        d[0] = cos(lat) * sin(lon);
+        d[1] = sin(lat);
+        d[2] = cos(lat) * cos(lon);
+        return 1;
+    case CUBEMAP_3X2:
+        face_to_dir(region, 2 * u - 1, 2 * v - 1, d);
+        return 1;
+    case EAC:
+        face_to_dir(region, eac_to_cube(2 * u - 1), eac_to_cube(2 * v - 1), d);
+        return 1;
+    case FISHEYE:
+        x = 2 * u - 1;
+        y = 2 * v - 1;
+        r = sqrt(x * x + y * y);
+        if (r > 1)
+            return 0;
+        theta = r * s->out_fov * M_PI / 360;
+        phi   = atan2(-y, x);
+        d[0] = sin(theta) * cos(phi);
+        d[1] = sin(theta) * sin(phi);
+        d[2] = cos(theta);
+        return 1;
+    }
+    av_assert0(0);
+    return 0;
+}
+
+/**
+ * Normalized position of a direction in an input plane of in_w x in_h
+ * pixels. Cube faces are clamped half a pixel of that plane inside so that
+ * bilinear sampling never reads the neighbouring face.
+ */
+static int input_pos(const VRProjectContext *s, int in_w, int in_h, const double *d,
+                     float *mx, float *my)
+{
+    double a, b, theta, phi, r, n;
+    int face, fw = in_w / 3, fh = in_h / 2;
+
+    switch (s->in_proj) {
+    case EQUIRECT:
+        *mx = atan2(d[0], d[2]) / (2 * M_PI) + 0.5;
+        *my = 0.5 - atan2(d[1], hypot(d[0], d[2])) / M_PI;
+        return 1;
+    case CUBEMAP_3X2:
+    case EAC:
+        face = dir_to_face(d, &a, &b);
+        if (s->in_proj == EAC) {
+            a = cube_to_eac(a);
+            b = cube_to_eac(b);
+        }
+        a = av_clipd((a + 1) / 2 * fw, 0.5, fw - 0.5);
+        b = av_clipd((b + 1) / 2 * fh, 0.5, fh - 0.5);
+        *mx = (face % 3 * fw + a) / in_w;
+        *my = (face / 3 * fh + b) / in_h;
+        return 1;
+    case FISHEYE:
+        n     = sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+        theta = acos(av_clipd(d[2] / n, -1, 1));
+        r     = theta / (s->in_fov * M_PI / 360);
+        if (r > 1)
+            return 0;
+        phi = atan2(d[1], d[0]);
+        *mx = (1 + r * cos(phi)) / 2;
+        *my = (1 - r * sin(phi)) / 2;
+        return 1;
+    }
+    av_assert0(0);
+    return 0;
+}
+
+/* Luma and chroma are compiled separately, each at its own resolution, so
+ * that faces are clamped in the pixels of the plane. */
+static int build_region(AVFilterContext *ctx, int region, int plane,
+                        int in_w, int in_h, int depth)
+{
+    VRProjectContext *s = ctx->priv;
+    const int *rect = s->regions[region];
+    int hsub = plane ? s->hsub : 0, vsub = plane ? s->vsub : 0;
+    int w = rect[2] >> hsub, h = rect[3] >> vsub;
+    int plane_in_w = FF_CEIL_RSHIFT(in_w, hsub), plane_in_h = FF_CEIL_RSHIFT(in_h, vsub);
+    VRRemapPlaneDesc desc;
+    float *map_x, *map_y;
+    int x, y, ret;
+
+    map_x = av_malloc_array(w * h, sizeof(*map_x));
+    map_y = av_malloc_array(w * h, sizeof(*map_y));
+    if (!map_x || !map_y) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    for (y = 0; y < h; y++) {
+        for (x = 0; x < w; x++) {
+            double d[3];
+            float *mx = &map_x[y * w + x], *my = &map_y[y * w + x];
+
+            if (!output_dir(s, region, (x + 0.5) / w, (y + 0.5) / h, d) ||
+                !input_pos(s, plane_in_w, plane_in_h, d, mx, my))
+                *mx = *my = -1;
+        }
+    }
+
+    desc.w         = w;
+    desc.h         = h;
+    desc.fill      = (plane ? 128 : 16) << (depth - 8);
+    desc.tile_size = VR_REMAP_TILE_SIZE;
+    desc.in_w      = &plane_in_w;
+    desc.in_h      = &plane_in_h;
+    ret = ff_vr_remap_table_init(&s->tables[region * VR_REMAP_MAX_PLANES + plane], &desc, 1,
+                                 1, (const float * const *)&map_x, (const float * const *)&map_y,
+                                 w, h, w);
+end:
+    av_freep(&map_x);
+    av_freep(&map_y);
+    return ret;
+}
+
+static void free_tables(VRProjectContext *s)
+{
+    int i;
+
+    for (i = 0; i < s->nb_regions * VR_REMAP_MAX_PLANES && s->tables; i++)
+        ff_vr_remap_table_uninit(&s->tables[i]);
+    av_freep(&s->tables);
+    av_freep(&s->regions);
+    s->nb_regions = 0;
+}
+
+static int config_output(AVFilterLink *outlink)
+{
+    AVFilterContext *ctx = outlink->src;
+    AVFilterLink *inlink = ctx->inputs[0];
+    VRProjectContext *s = ctx->priv;
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(inlink->format);
+    int align, face, w = s->w, h = s->h, i, plane, ret;
+
+    s->nb_planes = av_pix_fmt_count_planes(inlink->format);
+    s->hsub      = desc->log2_chroma_w;
+    s->vsub      = desc->log2_chroma_h;
+    align        = 1 << FFMAX(s->hsub, s->vsub);
+
+    if ((s->in_proj == CUBEMAP_3X2 || s->in_proj == EAC) &&
+        (inlink->w % (3 << s->hsub) || inlink->h % (2 << s->vsub))) {
+        av_log(ctx, AV_LOG_ERROR, "Cube map input size %dx%d is not made of 3x2 faces "
+               "with a size multiple of the chroma subsampling\n", inlink->w, inlink->h);
+        return AVERROR(EINVAL);
+    }
+
+    if (!w || !h) {
+        switch (s->out_proj) {
+        case EQUIRECT:
+            face = s->in_proj == CUBEMAP_3X2 || s->in_proj == EAC ? inlink->w / 3 : inlink->h / 2;
+            w = 4 * face;
+            h = 2 * face;
+            break;
+        case CUBEMAP_3X2:
+        case EAC:
+            face = s->in_proj == CUBEMAP_3X2 || s->in_proj == EAC ? inlink->w / 3 : inlink->h / 2;
+            face = FFMAX(face & ~(align - 1), align);
+            w = 3 * face;
+            h = 2 * face;
+            break;
+        case FISHEYE:
+            w = h = inlink->h;
+            break;
+        }
+    }
+
+    if (s->out_proj == CUBEMAP_3X2 || s->out_proj == EAC) {
+        if (w % (3 * align) || h % (2 * align)) {
+            av_log(ctx, AV_LOG_ERROR, "Cube map output size %dx%d is not made of 3x2 faces "
+                   "with a size multiple of %d\n", w, h, align);
+            return AVERROR(EINVAL);
+        }
+    } else {
+        if (w % align || h % align) {
+            av_log(ctx, AV_LOG_ERROR, "Output size %dx%d is not a multiple of %d\n", w, h, align);
+            return AVERROR(EINVAL);
+        }
+    }
+
+    free_tables(s);
+    s->nb_regions = s->out_proj == CUBEMAP_3X2 || s->out_proj == EAC ? NB_FACES : 1;
+    s->tables  = av_calloc(s->nb_regions * VR_REMAP_MAX_PLANES, sizeof(*s->tables));
+    s->regions = av_calloc(s->nb_regions, sizeof(*s->regions));
+    if (!s->tables || !s->regions)
+        return AVERROR(ENOMEM);
+    for (i = 0; i < s->nb_regions; i++) {
+        int *rect = s->regions[i];
+
+        if (s->nb_regions == NB_FACES) {
+            rect[2] = w / 3;
+            rect[3] = h / 2;
+            rect[0] = i % 3 * rect[2];
+            rect[1] = i / 3 * rect[3];
+        } else {
+            rect[2] = w;
+            rect[3] = h;
+        }
+        for (plane = 0; plane < FFMIN(s->nb_planes, VR_REMAP_MAX_PLANES); plane++)
+            if ((ret = build_region(ctx, i, plane, inlink->w, inlink->h,
+                                    desc->comp[0].depth_minus1 + 1)) < 0)
+                return ret;
+    }
+
+    ff_vr_remap_dsp_init(&s->dsp, 1, desc->comp[0].depth_minus1 + 1);
+    s->jobs_per_region = FFMAX(1, (ctx->graph->nb_threads + s->nb_regions - 1) / s->nb_regions);
+
+    outlink->w = w;
+    outlink->h = h;
+    outlink->sample_aspect_ratio = (AVRational){ 1, 1 };
+    return 0;
+}
+
+/* Each job renders a part of one region, all regions are split evenly. */
+static int project_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    VRProjectContext *s = ctx->priv;
+    ThreadData *td = arg;
+    int region = jobnr / s->jobs_per_region;
+    int part   = jobnr % s->jobs_per_region;
+    const int *rect = s->regions[region];
+    int plane;
+
+    for (plane = 0; plane < s->nb_planes; plane++) {
+        const VRRemapPlane *p = &s->tables[region * VR_REMAP_MAX_PLANES + !!plane].planes[0];
+        int hsub = plane ? s->hsub : 0, vsub = plane ? s->vsub : 0;
+        const uint8_t *src = td->in->data[plane];
+        ptrdiff_t src_linesize = td->in->linesize[plane];
+        uint8_t *dst = td->out->data[plane] +
+                       (rect[1] >> vsub) * td->out->linesize[plane] +
+                       (rect[0] >> hsub) * s->dsp.sample_size;
+
+        ff_vr_remap_plane_slice(&s->dsp, p, dst, td->out->linesize[plane],
+                                &src, &src_linesize, NULL,
+                                p->nb_tiles *  part      / s->jobs_per_region,
+                                p->nb_tiles * (part + 1) / s->jobs_per_region);
+    }
+    return 0;
+}
+
+static int filter_frame(AVFilterLink *inlink, AVFrame *in)
+{
+    AVFilterContext *ctx = inlink->dst;
+    AVFilterLink *outlink = ctx->outputs[0];
+    VRProjectContext *s = ctx->priv;
+    ThreadData td;
+    AVFrame *out;
+    int i;
+
+    for (i = 0; i < s->nb_planes; i++) {
+        if (in->linesize[i] < 0) {
+            av_log(ctx, AV_LOG_ERROR, "Negative linesizes are not supported\n");
+            av_frame_free(&in);
+            return AVERROR_PATCHWELCOME;
+        }
+    }
+
+    out = ff_get_video_buffer(outlink, outlink->w, outlink->h);
+    if (!out) {
+        av_frame_free(&in);
+        return AVERROR(ENOMEM);
+    }
+    av_frame_copy_props(out, in);
+    out->sample_aspect_ratio = outlink->sample_aspect_ratio;
+
+    td.in  = in;
+    td.out = out;
+    ctx->internal->execute(ctx, project_slice, &td, NULL, s->nb_regions * s->jobs_per_region);
+
+    av_frame_free(&in);
+    return ff_filter_frame(outlink, out);
+}
+
+static av_cold void uninit(AVFilterContext *ctx)
+{
+    free_tables(ctx->priv);
+}
+
+#define OFFSET(x) offsetof(VRProjectContext, x)
+#define FLAGS AV_OPT_FLAG_FILTERING_PARAM|AV_OPT_FLAG_VIDEO_PARAM
+
+static const AVOption vr_project_options[] = {
+    { "input",  "set input projection",  OFFSET(in_proj),  AV_OPT_TYPE_INT, { .i64 = EQUIRECT },    0, NB_PROJECTIONS - 1, FLAGS, "proj" },
+    { "output", "set output projection", OFFSET(out_proj), AV_OPT_TYPE_INT, { .i64 = CUBEMAP_3X2 }, 0, NB_PROJECTIONS - 1, FLAGS, "proj" },
+        { "e",       "equirectangular",                  0, AV_OPT_TYPE_CONST, { .i64 = EQUIRECT    }, .flags = FLAGS, .unit = "proj" },
+        { "c3x2",    "cube map, 3x2 faces",              0, AV_OPT_TYPE_CONST, { .i64 = CUBEMAP_3X2 }, .flags = FLAGS, .unit = "proj" },
+        { "eac",     "equi-angular cube map, 3x2 faces", 0, AV_OPT_TYPE_CONST, { .i64 = EAC         }, .flags = FLAGS, .unit = "proj" },
+        { "fisheye", "equidistant fisheye",              0, AV_OPT_TYPE_CONST, { .i64 = FISHEYE     }, .flags = FLAGS, .unit = "proj" },
+    { "w",       "set output width, 0 to derive it from the input",  OFFSET(w), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, VR_REMAP_MAX_SIZE, FLAGS },
+    { "h",       "set output height, 0 to derive it from the input", OFFSET(h), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, VR_REMAP_MAX_SIZE, FLAGS },
+    { "in_fov",  "set field of view of a fisheye input, in degrees",  OFFSET(in_fov),  AV_OPT_TYPE_DOUBLE, { .dbl = 180 }, 1, 360, FLAGS },
+    { "out_fov", "set field of view of a fisheye output, in degrees", OFFSET(out_fov), AV_OPT_TYPE_DOUBLE, { .dbl = 180 }, 1, 360, FLAGS },
+    { NULL }
+};
+
+AVFILTER_DEFINE_CLASS(vr_project);
+
+static const AVFilterPad vr_project_inputs[] = {
+    {
+        .name         = "default",
+        .type         = AVMEDIA_TYPE_VIDEO,
+        .filter_frame = filter_frame,
+    },
+    { NULL }
+};
+
+static const AVFilterPad vr_project_outputs[] = {
+    {
+        .name         = "default",
+        .type         = AVMEDIA_TYPE_VIDEO,
+        .config_props = config_output,
+    },
+    { NULL }
+};
+
+AVFilter ff_vf_vr_project = {
+    .name          = "vr_project",
+    .description   = NULL_IF_CONFIG_SMALL("Convert between 360 degree video projections."),
+    .priv_size     = sizeof(VRProjectContext),
+    .priv_class    = &vr_project_class,
+    .query_formats = query_formats,
+    .uninit        = uninit,
+    .inputs        = vr_project_inputs,
+    .outputs       = vr_project_outputs,
+    .flags         = AVFILTER_FLAG_SLICE_THREADS,
+};
@@ -0,0 +1,285 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Split a panorama into a grid of tiles, one output each, for viewport
+ * adaptive streaming. Tiles reference the input buffers, nothing is copied.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "libavutil/avstring.h"
+#include "libavutil/bprint.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/internal.h"
+#include "libavutil/opt.h"
+#include "libavutil/pixdesc.h"
+#include "avfilter.h"
+#include "formats.h"
+#include "internal.h"
+#include "video.h"
+
+typedef struct VRTilesContext {
+    const AVClass *class;
+    int cols, rows;
+    int align;
+    char *manifest;
+    char *url;
+    char *projection;
+
+    int hsub, vsub;
+    int max_step[4];
+    int (*rects)[4];            ///< x, y, w, h of each tile
+} VRTilesContext;
+
+static int config_output(AVFilterLink *outlink)
+{
+    VRTilesContext *s = outlink->src->priv;
+    const int *r = s->rects[FF_OUTLINK_IDX(outlink)];
+
+    outlink->w = r[2];
+    outlink->h = r[3];
+    return 0;
+}
+
+static av_cold int init(AVFilterContext *ctx)
+{
+    VRTilesContext *s = ctx->priv;
+    int i;
+
+    s->rects = av_calloc(s->cols * s->rows, sizeof(*s->rects));
+    if (!s->rects)
+        return AVERROR(ENOMEM);
+
+    for (i = 0; i < s->cols * s->rows; i++) {
+        AVFilterPad pad = { 0 };
+
+        pad.type         = AVMEDIA_TYPE_VIDEO;
+        pad.config_props = config_output;
+        pad.name         = av_asprintf("tile%d", i);
+        if (!pad.name)
+            return AVERROR(ENOMEM);
+
+        ff_insert_outpad(ctx, i, &pad);
+    }
+    return 0;
+}
+
+static av_cold void uninit(AVFilterContext *ctx)
+{
+    VRTilesContext *s = ctx->priv;
+    int i;
+
+    for (i = 0; i < ctx->nb_outputs; i++)
+        av_freep(&ctx->output_pads[i].name);
+    av_freep(&s->rects);
+}
+
+static int query_formats(AVFilterContext *ctx)
+{
+    AVFilterFormats *formats = NULL;
+    int fmt;
+
+    for (fmt = 0; av_pix_fmt_desc_get(fmt); fmt++) {
+        const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(fmt);
+        if (!(desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BITSTREAM |
+                             AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_PSEUDOPAL)) &&
+            !((desc->log2_chroma_w || desc->log2_chroma_h) && !(desc->flags & AV_PIX_FMT_FLAG_PLANAR)))
+            ff_add_format(&formats, fmt);
+    }
+
+    return ff_set_common_formats(ctx, formats);
+}
+
+static void print_string(AVBPrint *bp, const char *key, const char *value)
+{
+    av_bprintf(bp, "\"%s\": \"", key);
+    av_bprint_escape(bp, value, "\"", AV_ESCAPE_MODE_BACKSLASH, 0);
+    av_bprintf(bp, "\"");
+}
+
+static int write_manifest(AVFilterContext *ctx, int w, int h)
+{
+    VRTilesContext *s = ctx->priv;
+    AVBPrint bp;
+    FILE *f;
+    int i, ret = 0;
+
+    av_bprint_init(&bp, 0, AV_BPRINT_SIZE_UNLIMITED);
+    av_bprintf(&bp, "{\n    ");
+    print_string(&bp, "projection", s->projection);
+    av_bprintf(&bp, ",\n    \"width\": %d,\n    \"height\": %d,\n"
+               "    \"cols\": %d,\n    \"rows\": %d,\n    \"tiles\": [\n",
+               w, h, s->cols, s->rows);
+    for (i = 0; i < s->cols * s->rows; i++) {
+        const int *r = s->rects[i];
+
+        av_bprintf(&bp, "        { \"index\": %d, \"col\": %d, \"row\": %d, "
+                   "\"x\": %d, \"y\": %d, \"w\": %d, \"h\": %d",
+                   i, i % s->cols, i / s->cols, r[0], r[1], r[2], r[3]);
+        if (s->url) {
+            const char *p = strstr(s->url, "%d");
+            char url[1024];
+
+            if (p)
+                snprintf(url, sizeof(url), "%.*s%d%s", (int)(p - s->url), s->url, i, p + 2);
+            else
+                av_strlcpy(url, s->url, sizeof(url));
+            av_bprintf(&bp, ", ");
+            print_string(&bp, "url", url);
+        }
+        av_bprintf(&bp, " }%s\n", i + 1 < s->cols * s->rows ? "," : "");
+    }
+    av_bprintf(&bp, "    ]\n}\n");
+    if (!av_bprint_is_complete(&bp)) {
+        av_bprint_finalize(&bp, NULL);
+        return AVERROR(ENOMEM);
+    }
+
+    f = fopen(s->manifest, "w");
+    if (!f) {
+        ret = AVERROR(errno);
+        av_log(ctx, AV_LOG_ERROR, "Could not open manifest %s\n", s->manifest);
+    } else {
+        if (fwrite(bp.str, 1, bp.len, f) != bp.len)
+            ret = AVERROR(EIO);
+        if (fclose(f) && !ret)
+            ret = AVERROR(errno);
+    }
+    av_bprint_finalize(&bp, NULL);
+    return ret;
+}
+
+/* Tile edges fall on multiples of align, the last column and row take the rest. */
+static int config_input(AVFilterLink *inlink)
+{
+    AVFilterContext *ctx = inlink->dst;
+    VRTilesContext *s = ctx->priv;
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(inlink->format);
+    int align_x, align_y, i;
+
+    s->hsub = desc->log2_chroma_w;
+    s->vsub = desc->log2_chroma_h;
+    av_image_fill_max_pixsteps(s->max_step, NULL, desc);
+    /* chroma planes must be split on whole samples too */
+    align_x = FFALIGN(s->align, 1 << s->hsub);
+    align_y = FFALIGN(s->align, 1 << s->vsub);
+
+    if (inlink->w / s->cols < align_x || inlink->h / s->rows < align_y) {
+        av_log(ctx, AV_LOG_ERROR, "%dx%d is too small for %dx%d tiles aligned to %dx%d\n",
+               inlink->w, inlink->h, s->cols, s->rows, align_x, align_y);
+        return AVERROR(EINVAL);
+    }
+
+    for (i = 0; i < s->cols * s->rows; i++) {
+        int col = i % s->cols, row = i / s->cols;
+        int x0 = inlink->w *  col      / s->cols / align_x * align_x;
+        int x1 = inlink->w * (col + 1) / s->cols / align_x * align_x;
+        int y0 = inlink->h *  row      / s->rows / align_y * align_y;
+        int y1 = inlink->h * (row + 1) / s->rows / align_y * align_y;
+
+        if (col == s->cols - 1)
+            x1 = inlink->w;
+        if (row == s->rows - 1)
+            y1 = inlink->h;
+        s->rects[i][0] = x0;
+        s->rects[i][1] = y0;
+        s->rects[i][2] = x1 - x0;
+        s->rects[i][3] = y1 - y0;
+    }
+
+    if (s->manifest)
+        return write_manifest(ctx, inlink->w, inlink->h);
+    return 0;
+}
+
+static int filter_frame(AVFilterLink *inlink, AVFrame *in)
+{
+    AVFilterContext *ctx = inlink->dst;
+    VRTilesContext *s = ctx->priv;
+    int i, p, ret = AVERROR_EOF;
+
+    for (i = 0; i < ctx->nb_outputs; i++) {
+        const int *r = s->rects[i];
+        AVFrame *out;
+
+        if (ctx->outputs[i]->closed)
+            continue;
+        out = av_frame_clone(in);
+        if (!out) {
+            ret = AVERROR(ENOMEM);
+            break;
+        }
+
+        out->width  = r[2];
+        out->height = r[3];
+        for (p = 0; p < 4 && out->data[p]; p++) {
+            int hsub = p == 1 || p == 2 ? s->hsub : 0;
+            int vsub = p == 1 || p == 2 ? s->vsub : 0;
+
+            out->data[p] += (r[1] >> vsub) * out->linesize[p] +
+                            (r[0] >> hsub) * s->max_step[p];
+        }
+
+        ret = ff_filter_frame(ctx->outputs[i], out);
+        if (ret < 0)
+            break;
+    }
+    av_frame_free(&in);
+    return ret;
+}
+
+#define OFFSET(x) offsetof(VRTilesContext, x)
+#define FLAGS AV_OPT_FLAG_FILTERING_PARAM|AV_OPT_FLAG_VIDEO_PARAM
+
+static const AVOption vr_tiles_options[] = {
+    { "cols",       "set number of tile columns", OFFSET(cols), AV_OPT_TYPE_INT, { .i64 = 4 }, 1, 64, FLAGS },
+    { "rows",       "set number of tile rows",    OFFSET(rows), AV_OPT_TYPE_INT, { .i64 = 2 }, 1, 64, FLAGS },
+    { "align",      "align tile edges to multiples of this", OFFSET(align), AV_OPT_TYPE_INT, { .i64 = 16 }, 1, 256, FLAGS },
+    { "manifest",   "write the tile geometry to this file", OFFSET(manifest), AV_OPT_TYPE_STRING, { .str = NULL }, .flags = FLAGS },
+    { "url",        "set the tile url pattern written to the manifest, %d is the tile index", OFFSET(url), AV_OPT_TYPE_STRING, { .str = NULL }, .flags = FLAGS },
+    { "projection", "set the projection written to the manifest", OFFSET(projection), AV_OPT_TYPE_STRING, { .str = "equirectangular" }, .flags = FLAGS },
+    { NULL }
+};
+
+AVFILTER_DEFINE_CLASS(vr_tiles);
+
+static const AVFilterPad vr_tiles_inputs[] = {
+    {
+        .name         = "default",
+        .type         = AVMEDIA_TYPE_VIDEO,
+        .config_props = config_input,
+        .filter_frame = filter_frame,
+    },
+    { NULL }
+};
+
+AVFilter ff_vf_vr_tiles = {
+    .name          = "vr_tiles",
+    .description   = NULL_IF_CONFIG_SMALL("Split a panorama into a grid of tiles."),
+    .priv_size     = sizeof(VRTilesContext),
+    .priv_class    = &vr_tiles_class,
+    .init          = init,
+    .uninit        = uninit,
+    .query_formats = query_formats,
+    .inputs        = vr_tiles_inputs,
+    .outputs       = NULL,
+    .flags         = AVFILTER_FLAG_DYNAMIC_OUTPUTS,
+};
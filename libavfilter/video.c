@@ -29,34 +29,64 @@
 #include "libavutil/mem.h"
 
 #include "avfilter.h"
+#include "framepool.h"
 #include "internal.h"
 #include "video.h"
 
+#define BUFFER_ALIGN 32
+
 AVFrame *ff_null_get_video_buffer(AVFilterLink *link, int w, int h)
 {
     return ff_get_video_buffer(link->dst->outputs[0], w, h);
 }
 
-/* TODO: set the buffer's priv member to a context structure for the whole
- * filter chain.  This will allow for a buffer pool instead of the constant
- * alloc & free cycle currently implemented. */
-AVFrame *ff_default_get_video_buffer(AVFilterLink *link, int w, int h)
+void ff_video_frame_pool_uninit(AVFilterLink *link)
 {
-    AVFrame *frame = av_frame_alloc();
-    int ret;
-
-    if (!frame)
-        return NULL;
+    int64_t hits, misses;
 
-    frame->width  = w;
-    frame->height = h;
-    frame->format = link->format;
+    if (!link->frame_pool)
+        return;
 
-    ret = av_frame_get_buffer(frame, 32);
-    if (ret < 0)
-        av_frame_free(&frame);
+    ff_frame_pool_get_stats(link->frame_pool, &hits, &misses);
+    av_log(link->src, AV_LOG_DEBUG, "Frame pool of link %s -> %s: %"PRId64" buffers "
+           "reused, %"PRId64" allocated\n", link->src ? link->src->name : "?",
+           link->dst ? link->dst->name : "?", hits, misses);
+    ff_frame_pool_uninit((FFFramePool **)&link->frame_pool);
+}
 
-    return frame;
+/* Each link keeps a pool of buffers for its current geometry, so frames
+ * allocated on it reuse the buffers of the frames freed before. */
+AVFrame *ff_default_get_video_buffer(AVFilterLink *link, int w, int h)
+{
+    int pool_width = 0;
+    int pool_height = 0;
+    int pool_align = 0;
+    enum AVPixelFormat pool_format = AV_PIX_FMT_NONE;
+
+    if (!link->frame_pool) {
+        link->frame_pool = ff_frame_pool_video_init(NULL, w, h,
+                                                    link->format, BUFFER_ALIGN);
+        if (!link->frame_pool)
+            return NULL;
+    } else {
+        if (ff_frame_pool_get_video_config(link->frame_pool,
+                                           &pool_width, &pool_height,
+                                           &pool_format, &pool_align) < 0) {
+            return NULL;
+        }
+
+        if (pool_width != w || pool_height != h ||
+            pool_format != link->format || pool_align != BUFFER_ALIGN) {
+
+            ff_video_frame_pool_uninit(link);
+            link->frame_pool = ff_frame_pool_video_init(NULL, w, h,
+                                                        link->format, BUFFER_ALIGN);
+            if (!link->frame_pool)
+                return NULL;
+        }
+    }
+
+    return ff_frame_pool_get(link->frame_pool);
 }
 
 #if FF_API_AVFILTERBUFFER
@@ -26,6 +26,12 @@
 AVFrame *ff_default_get_video_buffer(AVFilterLink *link, int w, int h);
 AVFrame *ff_null_get_video_buffer(AVFilterLink *link, int w, int h);
 
+/**
+ * Free the frame pool of a link, logging how many buffers it reused.
+ * Frames allocated from it stay valid.
+ */
+void ff_video_frame_pool_uninit(AVFilterLink *link);
+
 /**
  * Request a picture buffer with a specific set of permissions.
  *
@@ -0,0 +1,469 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "libavutil/attributes.h"
+#include "libavutil/common.h"
+#include "libavutil/error.h"
+#include "libavutil/mem.h"
+#include "vr_blend.h"
+
+/* Standard deviations of the intensity error and of the gains, from
+ * Brown & Lowe, "Automatic Panoramic Image Stitching using Invariant
+ * Features". */
+#define NOISE_SIGMA 10.0
+#define GAIN_SIGMA  0.1
+
+#define MIN_GAIN 0.5
+#define MAX_GAIN 2.0
+
+static const VRRemapPlane *image_plane(const VRBlendContext *b, int plane, int *table_plane)
+{
+    *table_plane = FFMIN(!!plane, b->table->nb_planes - 1);
+    return &b->table->planes[*table_plane];
+}
+
+static size_t pyramid_size(int w, int h, int levels)
+{
+    size_t size = 0;
+    int i;
+
+    for (i = 0; i < levels; i++, w = (w + 1) >> 1, h = (h + 1) >> 1)
+        size += (size_t)w * h;
+    return size;
+}
+
+static void update_luts(VRBlendContext *b)
+{
+    int i, v;
+
+    for (i = 0; i < b->nb_inputs; i++)
+        for (v = 0; v < 256; v++)
+            b->lut_buf[i][v] = av_clip_uint8(lrint(v * b->gains[i]));
+}
+
+av_cold int ff_vr_blend_init(VRBlendContext *b, const VRRemapTable *t, int nb_inputs,
+                             int bands, int exposure, int nb_jobs)
+{
+    int max_w = 1, max_h = 1, i, j;
+
+    memset(b, 0, sizeof(*b));
+    b->table     = t;
+    b->nb_inputs = nb_inputs;
+    b->bands     = av_clip(bands, 0, VR_REMAP_MAX_BANDS);
+    b->exposure  = FFMAX(exposure, 0);
+    b->nb_jobs   = FFMAX(nb_jobs, 1);
+    if (!b->bands && !b->exposure)
+        return 0;
+
+    for (i = 0; i < t->nb_planes; i++) {
+        for (j = 0; j < t->planes[i].nb_seams; j++) {
+            max_w = FFMAX(max_w, t->planes[i].seams[j].w);
+            max_h = FFMAX(max_h, t->planes[i].seams[j].h);
+        }
+    }
+
+    b->line_size = FFALIGN(max_w, 32);
+    b->line      = av_malloc_array(b->nb_jobs, b->line_size);
+    if (!b->line)
+        goto fail;
+
+    if (b->bands > 1) {
+        b->scratch_size = 3 * pyramid_size(max_w, max_h, b->bands) + 2 * (size_t)max_w * max_h;
+        b->scratch = av_malloc_array(b->nb_jobs, b->scratch_size * sizeof(*b->scratch));
+        if (!b->scratch)
+            goto fail;
+
+        for (i = 0; i < t->nb_planes; i++) {
+            const VRRemapPlane *p = &t->planes[i];
+            int size = 0;
+
+            b->result_offsets[i] = av_malloc_array(p->nb_seams + 1, sizeof(*b->result_offsets[i]));
+            if (!b->result_offsets[i])
+                goto fail;
+            for (j = 0; j < p->nb_seams; j++) {
+                b->result_offsets[i][j] = size;
+                size += p->seams[j].tile_w * p->seams[j].tile_h;
+            }
+            b->result_offsets[i][j] = size;
+        }
+        for (i = 0; i < 3; i++) {
+            int tp;
+            const VRRemapPlane *p = image_plane(b, i, &tp);
+
+            b->results[i] = av_malloc(FFMAX(b->result_offsets[tp][p->nb_seams], 1));
+            if (!b->results[i])
+                goto fail;
+        }
+    }
+
+    if (b->exposure) {
+        b->gains   = av_malloc_array(nb_inputs, sizeof(*b->gains));
+        b->solve   = av_malloc_array(nb_inputs * (nb_inputs + 1), sizeof(*b->solve));
+        b->lut_buf = av_malloc_array(nb_inputs, sizeof(*b->lut_buf));
+        b->luts    = av_malloc_array(nb_inputs, sizeof(*b->luts));
+        b->stats   = av_mallocz_array(b->nb_jobs * nb_inputs * nb_inputs * 3, sizeof(*b->stats));
+        if (!b->gains || !b->solve || !b->lut_buf || !b->luts || !b->stats)
+            goto fail;
+        for (i = 0; i < nb_inputs; i++) {
+            b->gains[i] = 1.0;
+            b->luts[i]  = b->lut_buf[i];
+        }
+        update_luts(b);
+    }
+    return 0;
+fail:
+    ff_vr_blend_uninit(b);
+    return AVERROR(ENOMEM);
+}
+
+av_cold void ff_vr_blend_uninit(VRBlendContext *b)
+{
+    int i;
+
+    av_freep(&b->gains);
+    av_freep(&b->solve);
+    av_freep(&b->lut_buf);
+    av_freep(&b->luts);
+    av_freep(&b->stats);
+    av_freep(&b->scratch);
+    av_freep(&b->line);
+    for (i = 0; i < 3; i++)
+        av_freep(&b->results[i]);
+    for (i = 0; i < VR_REMAP_MAX_PLANES; i++)
+        av_freep(&b->result_offsets[i]);
+}
+
+static void sample_span(const VRRemapDSPContext *dsp, const VRRemapPlane *p,
+                        const VRRemapSeamSpan *span, uint8_t *dst,
+                        const uint8_t * const *src, const ptrdiff_t *src_linesize,
+                        const uint8_t * const *luts)
+{
+    int k;
+
+    dsp->remap_line(dst, src[span->input], src_linesize[span->input],
+                    p->seam_xy + span->offset, p->seam_frac + span->offset, span->len);
+    if (luts) {
+        const uint8_t *lut = luts[span->input];
+        for (k = 0; k < span->len; k++)
+            dst[k] = lut[dst[k]];
+    }
+}
+
+/* Sample the second input over the tile, collect exposure statistics and
+ * feather the overlap pixels in place. */
+static void blend_tile(VRBlendContext *b, const VRRemapDSPContext *dsp,
+                       const VRRemapPlane *p, const VRRemapSeam *s,
+                       uint8_t *dst, ptrdiff_t dst_linesize,
+                       const uint8_t * const *src, const ptrdiff_t *src_linesize,
+                       const uint8_t * const *luts, int64_t *stats, uint8_t *line)
+{
+    int j, k;
+
+    for (j = s->span_start; j < s->span_inner_end; j++) {
+        const VRRemapSeamSpan *span = &p->seam_spans[j];
+        uint8_t *d = dst + span->y * dst_linesize + span->x;
+
+        sample_span(dsp, p, span, line, src, src_linesize, luts);
+        if (stats) {
+            int64_t *st = stats + 3 * (span->primary * b->nb_inputs + span->input);
+            int sum_primary = 0, sum_input = 0;
+
+            for (k = 0; k < span->len; k++) {
+                sum_primary += d[k];
+                sum_input   += line[k];
+            }
+            st[0] += span->len;
+            st[1] += sum_primary;
+            st[2] += sum_input;
+        }
+        if (b->bands == 1)
+            dsp->blend_line(d, line, p->seam_weight + span->offset, span->len);
+    }
+}
+
+/* 5-tap binomial filter and decimation. */
+static void pyr_down(int16_t *dst, const int16_t *src, int w, int h, int16_t *tmp)
+{
+    int dw = (w + 1) >> 1, dh = (h + 1) >> 1;
+    int x, y;
+
+    for (y = 0; y < h; y++) {
+        const int16_t *s = src + y * w;
+        int16_t *t = tmp + y * dw;
+
+        for (x = 0; x < dw; x++) {
+            int c = 2 * x;
+            t[x] = s[FFMAX(c - 2, 0)] + 4 * s[FFMAX(c - 1, 0)] + 6 * s[c] +
+                   4 * s[FFMIN(c + 1, w - 1)] + s[FFMIN(c + 2, w - 1)];
+        }
+    }
+    for (y = 0; y < dh; y++) {
+        int c = 2 * y;
+        const int16_t *t0 = tmp + FFMAX(c - 2, 0)     * dw;
+        const int16_t *t1 = tmp + FFMAX(c - 1, 0)     * dw;
+        const int16_t *t2 = tmp + c                   * dw;
+        const int16_t *t3 = tmp + FFMIN(c + 1, h - 1) * dw;
+        const int16_t *t4 = tmp + FFMIN(c + 2, h - 1) * dw;
+        int16_t *d = dst + y * dw;
+
+        for (x = 0; x < dw; x++)
+            d[x] = (t0[x] + 4 * t1[x] + 6 * t2[x] + 4 * t3[x] + t4[x] + 128) >> 8;
+    }
+}
+
+/* Upsample a level to w x h with the same kernel. */
+static void pyr_up(int16_t *dst, int w, int h, const int16_t *src, int16_t *tmp)
+{
+    int sw = (w + 1) >> 1, sh = (h + 1) >> 1;
+    int x, y;
+
+    for (y = 0; y < sh; y++) {
+        const int16_t *s = src + y * sw;
+        int16_t *t = tmp + y * w;
+
+        for (x = 0; x < w; x++) {
+            int i = x >> 1;
+            if (x & 1)
+                t[x] = 4 * (s[i] + s[FFMIN(i + 1, sw - 1)]);
+            else
+                t[x] = s[FFMAX(i - 1, 0)] + 6 * s[i] + s[FFMIN(i + 1, sw - 1)];
+        }
+    }
+    for (y = 0; y < h; y++) {
+        int i = y >> 1;
+        const int16_t *t0 = tmp + FFMAX(i - 1, 0)      * w;
+        const int16_t *t1 = tmp + i                    * w;
+        const int16_t *t2 = tmp + FFMIN(i + 1, sh - 1) * w;
+        int16_t *d = dst + y * w;
+
+        if (y & 1) {
+            for (x = 0; x < w; x++)
+                d[x] = (4 * (t1[x] + t2[x]) + 32) >> 6;
+        } else {
+            for (x = 0; x < w; x++)
+                d[x] = (t0[x] + 6 * t1[x] + t2[x] + 32) >> 6;
+        }
+    }
+}
+
+/* Multi-band blend the window of a seam: the remap pass result against the
+ * same image with the second input sampled over the overlap. */
+static void blend_window(VRBlendContext *b, const VRRemapDSPContext *dsp,
+                         const VRRemapPlane *p, const VRRemapSeam *s,
+                         const uint8_t *dst, ptrdiff_t dst_linesize,
+                         const uint8_t * const *src, const ptrdiff_t *src_linesize,
+                         const uint8_t * const *luts, int16_t *scratch, uint8_t *line,
+                         uint8_t *result)
+{
+    int16_t *first[VR_REMAP_MAX_BANDS], *second[VR_REMAP_MAX_BANDS], *mask[VR_REMAP_MAX_BANDS];
+    int lw[VR_REMAP_MAX_BANDS], lh[VR_REMAP_MAX_BANDS];
+    int16_t *tmp = scratch, *up = tmp + s->w * s->h, *pos = up + s->w * s->h;
+    const uint8_t *m = p->seam_mask + s->mask_offset;
+    int levels = b->bands, i, j, k, x, y;
+
+    for (i = 0; i < levels; i++) {
+        lw[i] = i ? (lw[i - 1] + 1) >> 1 : s->w;
+        lh[i] = i ? (lh[i - 1] + 1) >> 1 : s->h;
+    }
+    for (i = 0; i < levels; i++) {
+        first[i]  = pos;
+        second[i] = first[i]  + pyramid_size(s->w, s->h, levels);
+        mask[i]   = second[i] + pyramid_size(s->w, s->h, levels);
+        pos      += lw[i] * lh[i];
+    }
+
+    for (y = 0; y < s->h; y++) {
+        const uint8_t *d = dst + (s->y + y) * dst_linesize + s->x;
+        for (x = 0; x < s->w; x++) {
+            first[0][y * s->w + x] = d[x];
+            mask[0][y * s->w + x]  = m[y * s->w + x] ? 256 : 0;
+        }
+    }
+    memcpy(second[0], first[0], s->w * s->h * sizeof(*second[0]));
+    for (j = s->span_start; j < s->span_end; j++) {
+        const VRRemapSeamSpan *span = &p->seam_spans[j];
+        int16_t *d = second[0] + (span->y - s->y) * s->w + span->x - s->x;
+
+        if (span->input != s->input)
+            continue;
+        sample_span(dsp, p, span, line, src, src_linesize, luts);
+        for (k = 0; k < span->len; k++)
+            d[k] = line[k];
+    }
+
+    for (i = 0; i < levels - 1; i++) {
+        pyr_down(first[i + 1],  first[i],  lw[i], lh[i], tmp);
+        pyr_down(second[i + 1], second[i], lw[i], lh[i], tmp);
+        pyr_down(mask[i + 1],   mask[i],   lw[i], lh[i], tmp);
+    }
+    for (i = 0; i < levels - 1; i++) {
+        int n = lw[i] * lh[i];
+
+        pyr_up(up, lw[i], lh[i], first[i + 1], tmp);
+        for (k = 0; k < n; k++)
+            first[i][k] -= up[k];
+        pyr_up(up, lw[i], lh[i], second[i + 1], tmp);
+        for (k = 0; k < n; k++)
+            second[i][k] -= up[k];
+    }
+    for (i = 0; i < levels; i++)
+        dsp->blend_bands(first[i], second[i], mask[i], lw[i] * lh[i]);
+    for (i = levels - 2; i >= 0; i--) {
+        int n = lw[i] * lh[i];
+
+        pyr_up(up, lw[i], lh[i], first[i + 1], tmp);
+        for (k = 0; k < n; k++)
+            first[i][k] += up[k];
+    }
+
+    for (y = 0; y < s->tile_h; y++) {
+        const int16_t *r = first[0] + (s->tile_y - s->y + y) * s->w + s->tile_x - s->x;
+        for (x = 0; x < s->tile_w; x++)
+            result[y * s->tile_w + x] = av_clip_uint8(r[x]);
+    }
+}
+
+void ff_vr_blend_plane_slice(VRBlendContext *b, const VRRemapDSPContext *dsp, int plane,
+                             uint8_t *dst, ptrdiff_t dst_linesize,
+                             const uint8_t * const *src, const ptrdiff_t *src_linesize,
+                             int seam_start, int seam_end, int jobnr)
+{
+    int tp;
+    const VRRemapPlane *p = image_plane(b, plane, &tp);
+    const uint8_t * const *luts = plane ? NULL : b->luts;
+    int64_t *stats = b->exposure && !plane ?
+                     b->stats + jobnr * b->nb_inputs * b->nb_inputs * 3 : NULL;
+    uint8_t *line = b->line + jobnr * b->line_size;
+    int i;
+
+    for (i = seam_start; i < seam_end; i++) {
+        const VRRemapSeam *s = &p->seams[i];
+
+        if (stats || b->bands == 1)
+            blend_tile(b, dsp, p, s, dst, dst_linesize, src, src_linesize,
+                       luts, stats, line);
+        if (b->bands > 1)
+            blend_window(b, dsp, p, s, dst, dst_linesize, src, src_linesize, luts,
+                         b->scratch + jobnr * b->scratch_size, line,
+                         b->results[plane] + b->result_offsets[tp][i]);
+    }
+}
+
+void ff_vr_blend_plane_writeback(const VRBlendContext *b, int plane,
+                                 uint8_t *dst, ptrdiff_t dst_linesize,
+                                 int seam_start, int seam_end)
+{
+    int tp, i, y;
+    const VRRemapPlane *p = image_plane(b, plane, &tp);
+
+    if (b->bands < 2)
+        return;
+    for (i = seam_start; i < seam_end; i++) {
+        const VRRemapSeam *s = &p->seams[i];
+        const uint8_t *r = b->results[plane] + b->result_offsets[tp][i];
+
+        for (y = 0; y < s->tile_h; y++)
+            memcpy(dst + (s->tile_y + y) * dst_linesize + s->tile_x,
+                   r + y * s->tile_w, s->tile_w);
+    }
+}
+
+/*
+ * Minimize, over the gains g, the sum over overlapping input pairs of
+ * N_ij * ((g_i * I_ij - g_j * I_ji)^2 / NOISE_SIGMA^2 + (1 - g_i)^2 / GAIN_SIGMA^2)
+ * where I_ij is the mean of input i over its overlap with input j.
+ *
+ * The statistics are taken on compensated pixels, so the solution is a
+ * correction of the current gains; the prior on the gains damps it.
+ */
+static void update_gains(VRBlendContext *b)
+{
+    int n = b->nb_inputs, i, j, k, job;
+    double *solve = b->solve;
+#define A(i, j) solve[(i) * (n + 1) + (j)]
+
+    memset(solve, 0, n * (n + 1) * sizeof(*solve));
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) {
+            int64_t count = 0, sum_i = 0, sum_j = 0;
+            double mean_i, mean_j;
+
+            if (i == j)
+                continue;
+            for (job = 0; job < b->nb_jobs; job++) {
+                const int64_t *st = b->stats + job * n * n * 3;
+                const int64_t *ij = st + 3 * (i * n + j), *ji = st + 3 * (j * n + i);
+
+                count += ij[0] + ji[0];
+                sum_i += ij[1] + ji[2];
+                sum_j += ij[2] + ji[1];
+            }
+            if (!count)
+                continue;
+            mean_i = (double)sum_i / count;
+            mean_j = (double)sum_j / count;
+            A(i, i) += count * (mean_i * mean_i / (NOISE_SIGMA * NOISE_SIGMA) +
+                                1.0 / (GAIN_SIGMA * GAIN_SIGMA));
+            A(i, j) -= count * mean_i * mean_j / (NOISE_SIGMA * NOISE_SIGMA);
+            A(i, n) += count / (GAIN_SIGMA * GAIN_SIGMA);
+        }
+        /* inputs without overlap keep their gain */
+        if (A(i, i) == 0) {
+            A(i, i) = 1;
+            A(i, n) = 1;
+        }
+    }
+
+    for (k = 0; k < n; k++) {
+        int pivot = k;
+
+        for (i = k + 1; i < n; i++)
+            if (fabs(A(i, k)) > fabs(A(pivot, k)))
+                pivot = i;
+        if (fabs(A(pivot, k)) < 1e-12)
+            return;
+        for (j = k; j <= n; j++)
+            FFSWAP(double, A(k, j), A(pivot, j));
+        for (i = k + 1; i < n; i++) {
+            double f = A(i, k) / A(k, k);
+            for (j = k; j <= n; j++)
+                A(i, j) -= f * A(k, j);
+        }
+    }
+    for (i = n - 1; i >= 0; i--) {
+        for (j = i + 1; j < n; j++)
+            A(i, n) -= A(i, j) * A(j, n);
+        A(i, n) /= A(i, i);
+    }
+
+    for (i = 0; i < n; i++)
+        b->gains[i] = av_clipd(b->gains[i] * A(i, n), MIN_GAIN, MAX_GAIN);
+#undef A
+    update_luts(b);
+}
+
+void ff_vr_blend_end_frame(VRBlendContext *b)
+{
+    if (!b->exposure || ++b->frames % b->exposure)
+        return;
+    update_gains(b);
+    memset(b->stats, 0, b->nb_jobs * b->nb_inputs * b->nb_inputs * 3 * sizeof(*b->stats));
+}
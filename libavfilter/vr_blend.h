@@ -0,0 +1,94 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Seam blending and exposure compensation for the vr_map CPU backend.
+ *
+ * Blending only visits the seams of a compiled remap table. Feathering mixes
+ * the two inputs of each overlap pixel by weight, multi-band blending runs a
+ * Laplacian pyramid over the window of each seam tile and keeps the tile.
+ *
+ * Per-input gains are estimated from the overlap pixels (Brown & Lowe) and
+ * applied to luma through lookup tables, both in the remap pass and to the
+ * second input samples read here.
+ */
+
+#ifndef AVFILTER_VR_BLEND_H
+#define AVFILTER_VR_BLEND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vr_remap.h"
+
+typedef struct VRBlendContext {
+    const VRRemapTable *table;
+    int nb_inputs;
+    int bands;                  ///< 0 for no blending, 1 for feathering, more for multi-band
+    int exposure;               ///< frames between gain updates, 0 to disable
+    int nb_jobs;
+
+    double *gains;
+    double *solve;              ///< nb_inputs x (nb_inputs + 1) normal equations
+    uint8_t (*lut_buf)[256];
+    const uint8_t **luts;       ///< per input, NULL if exposure is disabled
+    int64_t *stats;             ///< per job and input pair: pixels, sum of both inputs
+    int frames;
+
+    int16_t *scratch;           ///< pyramids of each job
+    size_t scratch_size;
+    uint8_t *line;              ///< second input samples of each job
+    int line_size;
+    uint8_t *results[3];        ///< blended tiles of each image plane, multi-band only
+    int *result_offsets[VR_REMAP_MAX_PLANES];
+} VRBlendContext;
+
+/**
+ * @param bands  0 to disable blending, 1 for feathering, 2 to
+ *               VR_REMAP_MAX_BANDS for multi-band blending
+ * @param nb_jobs largest number of jobs the slice functions are called with
+ */
+int ff_vr_blend_init(VRBlendContext *b, const VRRemapTable *t, int nb_inputs,
+                     int bands, int exposure, int nb_jobs);
+
+void ff_vr_blend_uninit(VRBlendContext *b);
+
+/**
+ * Blend seams [seam_start, seam_end) of an image plane remapped with the
+ * table the context was created for, and collect exposure statistics.
+ *
+ * Plane 0 is luma, planes 1 and 2 use the second plane of the table.
+ * Multi-band results only reach dst in ff_vr_blend_plane_writeback(), since
+ * windows of neighbouring seams overlap.
+ */
+void ff_vr_blend_plane_slice(VRBlendContext *b, const VRRemapDSPContext *dsp, int plane,
+                             uint8_t *dst, ptrdiff_t dst_linesize,
+                             const uint8_t * const *src, const ptrdiff_t *src_linesize,
+                             int seam_start, int seam_end, int jobnr);
+
+void ff_vr_blend_plane_writeback(const VRBlendContext *b, int plane,
+                                 uint8_t *dst, ptrdiff_t dst_linesize,
+                                 int seam_start, int seam_end);
+
+/**
+ * Update the gains once all slices of a frame are done.
+ */
+void ff_vr_blend_end_frame(VRBlendContext *b);
+
+#endif /* AVFILTER_VR_BLEND_H */
@@ -0,0 +1,1041 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/attributes.h"
+#include "libavutil/avstring.h"
+#include "libavutil/common.h"
+#include "libavutil/error.h"
+#include "libavutil/file.h"
+#include "libavutil/log.h"
+#include "libavutil/mem.h"
+#include "vr_remap.h"
+
+#define CACHE_MAGIC   MKTAG('V', 'R', 'R', 'T')
+#define CACHE_VERSION 3
+#define CACHE_ALIGN   64
+
+/* Geometry and array sizes of a plane, which fully determine its layout. */
+enum PlaneInfo {
+    INFO_W,
+    INFO_H,
+    INFO_FILL,
+    INFO_TILE_SIZE,
+    INFO_NB_SPANS,
+    INFO_NB_SEAMS,
+    INFO_NB_SEAM_SPANS,
+    INFO_NB_SEAM_ENTRIES,
+    INFO_SEAM_MASK_SIZE,
+    PLANE_INFO_SIZE,
+};
+
+typedef struct CacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint8_t  key[16];
+    int32_t  nb_planes;
+    int32_t  plane_info[VR_REMAP_MAX_PLANES][PLANE_INFO_SIZE];
+    uint64_t payload_size;
+} CacheHeader;
+
+#define CACHE_HEADER_SIZE FFALIGN(sizeof(CacheHeader), CACHE_ALIGN)
+
+/* Products of 16-bit samples and both weights still fit in 32 bits. */
+#define REMAP_LINE(name, type, step)                                                \
+void name(uint8_t *_dst, const uint8_t *_src, ptrdiff_t linesize,                   \
+          const uint32_t *xy, const uint16_t *frac, int len)                        \
+{                                                                                   \
+    type *dst = (type *)_dst;                                                       \
+    const type *src = (const type *)_src;                                           \
+    int i;                                                                          \
+                                                                                    \
+    linesize /= sizeof(type);                                                       \
+    for (i = 0; i < len; i++) {                                                     \
+        const type *p = src + (xy[i] >> 16) * linesize + (xy[i] & 0xffff) * step;   \
+        unsigned fx  = frac[i] & 0xff;                                              \
+        unsigned fy  = frac[i] >> 8;                                                \
+        unsigned top = p[0]        * (VR_REMAP_ONE - fx) + p[step]            * fx; \
+        unsigned bot = p[linesize] * (VR_REMAP_ONE - fx) + p[linesize + step] * fx; \
+                                                                                    \
+        dst[i] = (top * (VR_REMAP_ONE - fy) + bot * fy +                            \
+                  (1 << (2 * VR_REMAP_FRAC_BITS - 1))) >> (2 * VR_REMAP_FRAC_BITS); \
+    }                                                                               \
+}
+
+REMAP_LINE(ff_vr_remap_line_c, uint8_t, 1)
+static REMAP_LINE(remap_line_8_step2,  uint8_t,  2)
+static REMAP_LINE(remap_line_8_step4,  uint8_t,  4)
+static REMAP_LINE(remap_line_16_step1, uint16_t, 1)
+static REMAP_LINE(remap_line_16_step2, uint16_t, 2)
+
+static void fill_line_8(uint8_t *dst, int value, int len)
+{
+    memset(dst, value, len);
+}
+
+static void fill_line_16(uint8_t *_dst, int value, int len)
+{
+    uint16_t *dst = (uint16_t *)_dst;
+    int i;
+
+    for (i = 0; i < len; i++)
+        dst[i] = value;
+}
+
+void ff_vr_blend_line_c(uint8_t *dst, const uint8_t *src, const uint8_t *w, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++)
+        dst[i] = (dst[i] * (256 - w[i]) + src[i] * w[i] + 128) >> 8;
+}
+
+void ff_vr_blend_bands_c(int16_t *a, const int16_t *b, const int16_t *m, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++)
+        a[i] = (a[i] * (256 - m[i]) + b[i] * m[i] + 128) >> 8;
+}
+
+static void just_return(const uint8_t *buf, ptrdiff_t stride, int h)
+{
+}
+
+av_cold void ff_vr_remap_dsp_init(VRRemapDSPContext *dsp, int step, int depth)
+{
+    dsp->sample_size = depth > 8 ? 2 : 1;
+    dsp->step        = step * dsp->sample_size;
+    if (depth > 8) {
+        dsp->remap_line = step == 1 ? remap_line_16_step1 : remap_line_16_step2;
+        dsp->fill_line  = fill_line_16;
+    } else {
+        dsp->remap_line = step == 1 ? ff_vr_remap_line_c :
+                          step == 2 ? remap_line_8_step2 : remap_line_8_step4;
+        dsp->fill_line  = fill_line_8;
+    }
+    dsp->prefetch    = just_return;
+    dsp->blend_line  = ff_vr_blend_line_c;
+    dsp->blend_bands = ff_vr_blend_bands_c;
+
+    if (ARCH_X86)
+        ff_vr_remap_dsp_init_x86(dsp, step, depth);
+}
+
+/* Convert a normalized map position to a clamped fixed-point coordinate,
+ * returns -1 if the position is not covered by the input. */
+static int32_t map_coord(float m, int size)
+{
+    float v;
+
+    if (!(m >= 0.f && m <= 1.f))
+        return -1;
+    v = (m * size - 0.5f) * VR_REMAP_ONE;
+    return av_clip(lrintf(v), 0, (size - 1) * VR_REMAP_ONE - 1);
+}
+
+static int nb_tiles(int w, int h, int tile_size)
+{
+    return ((w + tile_size - 1) / tile_size) * ((h + tile_size - 1) / tile_size);
+}
+
+/* Offsets of the arrays of a plane inside a table buffer, in the order of
+ * VRRemapPlane, the plane itself ends at offsets[PLANE_ARRAYS]. */
+#define PLANE_ARRAYS 10
+
+static void plane_layout(size_t offsets[PLANE_ARRAYS + 1], size_t start, const int32_t *info)
+{
+    size_t nb_entries = (size_t)info[INFO_W] * info[INFO_H];
+    size_t sizes[PLANE_ARRAYS] = {
+        nb_entries * sizeof(uint32_t),
+        nb_entries * sizeof(uint16_t),
+        info[INFO_NB_SPANS] * sizeof(VRRemapSpan),
+        nb_tiles(info[INFO_W], info[INFO_H], info[INFO_TILE_SIZE]) * sizeof(VRRemapTile),
+        info[INFO_NB_SEAMS] * sizeof(VRRemapSeam),
+        info[INFO_NB_SEAM_SPANS] * sizeof(VRRemapSeamSpan),
+        info[INFO_NB_SEAM_ENTRIES] * sizeof(uint32_t),
+        info[INFO_NB_SEAM_ENTRIES] * sizeof(uint16_t),
+        info[INFO_NB_SEAM_ENTRIES],
+        info[INFO_SEAM_MASK_SIZE],
+    };
+    int i;
+
+    offsets[0] = start;
+    for (i = 0; i < PLANE_ARRAYS; i++)
+        offsets[i + 1] = FFALIGN(offsets[i] + sizes[i], CACHE_ALIGN);
+}
+
+static void plane_setup(VRRemapPlane *p, const uint8_t *buf,
+                        const size_t offsets[PLANE_ARRAYS + 1], const int32_t *info)
+{
+    p->w               = info[INFO_W];
+    p->h               = info[INFO_H];
+    p->fill            = info[INFO_FILL];
+    p->tile_size       = info[INFO_TILE_SIZE];
+    p->xy              = (const uint32_t *)(buf + offsets[0]);
+    p->frac            = (const uint16_t *)(buf + offsets[1]);
+    p->spans           = (const VRRemapSpan *)(buf + offsets[2]);
+    p->nb_spans        = info[INFO_NB_SPANS];
+    p->tiles           = (const VRRemapTile *)(buf + offsets[3]);
+    p->nb_tiles        = nb_tiles(p->w, p->h, p->tile_size);
+    p->seams           = (const VRRemapSeam *)(buf + offsets[4]);
+    p->nb_seams        = info[INFO_NB_SEAMS];
+    p->seam_spans      = (const VRRemapSeamSpan *)(buf + offsets[5]);
+    p->nb_seam_spans   = info[INFO_NB_SEAM_SPANS];
+    p->seam_xy         = (const uint32_t *)(buf + offsets[6]);
+    p->seam_frac       = (const uint16_t *)(buf + offsets[7]);
+    p->seam_weight     = buf + offsets[8];
+    p->nb_seam_entries = info[INFO_NB_SEAM_ENTRIES];
+    p->seam_mask       = buf + offsets[9];
+    p->seam_mask_size  = info[INFO_SEAM_MASK_SIZE];
+}
+
+static void plane_info(int32_t *info, const VRRemapPlane *p)
+{
+    info[INFO_W]               = p->w;
+    info[INFO_H]               = p->h;
+    info[INFO_FILL]            = p->fill;
+    info[INFO_TILE_SIZE]       = p->tile_size;
+    info[INFO_NB_SPANS]        = p->nb_spans;
+    info[INFO_NB_SEAMS]        = p->nb_seams;
+    info[INFO_NB_SEAM_SPANS]   = p->nb_seam_spans;
+    info[INFO_NB_SEAM_ENTRIES] = p->nb_seam_entries;
+    info[INFO_SEAM_MASK_SIZE]  = p->seam_mask_size;
+}
+
+typedef struct PlaneBuilder {
+    uint32_t *xy;
+    uint16_t *frac;
+    VRRemapSpan *spans;
+    int nb_spans;
+    VRRemapTile *tiles;
+    int nb_tiles;
+
+    VRRemapSeam *seams;
+    int nb_seams;
+    VRRemapSeamSpan *seam_spans;
+    int nb_seam_spans;
+    uint32_t *seam_xy;
+    uint16_t *seam_frac;
+    uint8_t *seam_weight;
+    int nb_seam_entries;
+    uint8_t *seam_mask;
+    int seam_mask_size;
+} PlaneBuilder;
+
+/* Raster maps of the two first inputs covering each pixel of a plane. */
+typedef struct SeamMap {
+    int8_t *primary, *input;
+    uint32_t *xy;
+    uint16_t *frac;
+    uint8_t *weight;
+} SeamMap;
+
+static int add_span(PlaneBuilder *b, int x, int y, int len, int input, int offset)
+{
+    VRRemapSpan span = { x, y, len, input, offset };
+
+    if (!av_dynarray2_add((void **)&b->spans, &b->nb_spans, sizeof(span),
+                          (const uint8_t *)&span))
+        return AVERROR(ENOMEM);
+    return 0;
+}
+
+/* Find the input sampled by most pixels of a tile and the area it reads. */
+static void tile_setup(VRRemapTile *tile, const PlaneBuilder *b, int *counts, int nb_inputs)
+{
+    int x0 = INT_MAX, y0 = INT_MAX, x1 = -1, y1 = -1;
+    int i, j, input = -1;
+
+    memset(counts, 0, nb_inputs * sizeof(*counts));
+    for (i = tile->span_start; i < tile->span_end; i++)
+        if (b->spans[i].input >= 0)
+            counts[b->spans[i].input] += b->spans[i].len;
+    for (i = 0; i < nb_inputs; i++)
+        if (counts[i] && (input < 0 || counts[i] > counts[input]))
+            input = i;
+
+    tile->input = input;
+    tile->src_x = tile->src_y = tile->src_w = tile->src_h = 0;
+    if (input < 0)
+        return;
+    for (i = tile->span_start; i < tile->span_end; i++) {
+        const VRRemapSpan *s = &b->spans[i];
+        if (s->input != input)
+            continue;
+        for (j = s->offset; j < s->offset + s->len; j++) {
+            int x = b->xy[j] & 0xffff, y = b->xy[j] >> 16;
+            x0 = FFMIN(x0, x);
+            y0 = FFMIN(y0, y);
+            x1 = FFMAX(x1, x + 1);
+            y1 = FFMAX(y1, y + 1);
+        }
+    }
+    tile->src_x = x0;
+    tile->src_y = y0;
+    tile->src_w = x1 - x0 + 1;
+    tile->src_h = y1 - y0 + 1;
+}
+
+/* Group tiles reading the same input, then sort them by source position so
+ * that neighbouring tiles in processing order share source cache lines. */
+static int cmp_tiles(const void *a, const void *b)
+{
+    const VRRemapTile *ta = a, *tb = b;
+
+    if (ta->input != tb->input)
+        return (unsigned)ta->input < (unsigned)tb->input ? -1 : 1;
+    if (ta->src_y != tb->src_y)
+        return ta->src_y < tb->src_y ? -1 : 1;
+    if (ta->src_x != tb->src_x)
+        return ta->src_x < tb->src_x ? -1 : 1;
+    return ta->span_start < tb->span_start ? -1 : ta->span_start > tb->span_start;
+}
+
+static int build_plane(PlaneBuilder *b, const VRRemapPlaneDesc *d, int nb_inputs,
+                       const float * const *map_x, const float * const *map_y,
+                       int map_w, int map_h, ptrdiff_t map_stride)
+{
+    int ts = d->tile_size;
+    int tiles_x = (d->w + ts - 1) / ts, tiles_y = (d->h + ts - 1) / ts;
+    int tx, ty, x, y, i, ret, offset = 0;
+    int *counts;
+
+    b->nb_tiles = tiles_x * tiles_y;
+    b->xy       = av_malloc_array((size_t)d->w * d->h, sizeof(*b->xy));
+    b->frac     = av_malloc_array((size_t)d->w * d->h, sizeof(*b->frac));
+    b->tiles    = av_malloc_array(b->nb_tiles, sizeof(*b->tiles));
+    if (!b->xy || !b->frac || !b->tiles)
+        return AVERROR(ENOMEM);
+
+    for (ty = 0; ty < tiles_y; ty++) {
+        for (tx = 0; tx < tiles_x; tx++) {
+            int x0 = tx * ts, x1 = FFMIN(x0 + ts, d->w);
+            int y0 = ty * ts, y1 = FFMIN(y0 + ts, d->h);
+
+            b->tiles[ty * tiles_x + tx].span_start = b->nb_spans;
+            for (y = y0; y < y1; y++) {
+                int my = FFMIN((int)((y + 0.5) * map_h / d->h), map_h - 1);
+                int span_x = x0, span_input = -1, span_offset = offset;
+
+                for (x = x0; x < x1; x++) {
+                    int mx = FFMIN((int)((x + 0.5) * map_w / d->w), map_w - 1);
+                    ptrdiff_t m = my * map_stride + mx;
+                    int32_t cx = 0, cy = 0;
+                    int input = -1;
+
+                    for (i = 0; i < nb_inputs; i++) {
+                        cx = map_coord(map_x[i][m], d->in_w[i]);
+                        cy = map_coord(map_y[i][m], d->in_h[i]);
+                        if (cx >= 0 && cy >= 0) {
+                            input = i;
+                            break;
+                        }
+                    }
+                    if (input < 0)
+                        cx = cy = 0;
+                    b->xy[offset]   = (cx >> VR_REMAP_FRAC_BITS) |
+                                      (cy >> VR_REMAP_FRAC_BITS) << 16;
+                    b->frac[offset] = (cx & (VR_REMAP_ONE - 1)) |
+                                      (cy & (VR_REMAP_ONE - 1)) << 8;
+
+                    if (x > x0 && input != span_input) {
+                        ret = add_span(b, span_x, y, x - span_x, span_input, span_offset);
+                        if (ret < 0)
+                            return ret;
+                        span_x      = x;
+                        span_offset = offset;
+                    }
+                    span_input = input;
+                    offset++;
+                }
+                ret = add_span(b, span_x, y, x1 - span_x, span_input, span_offset);
+                if (ret < 0)
+                    return ret;
+            }
+            b->tiles[ty * tiles_x + tx].span_end = b->nb_spans;
+        }
+    }
+
+    counts = av_malloc_array(nb_inputs, sizeof(*counts));
+    if (!counts)
+        return AVERROR(ENOMEM);
+    for (i = 0; i < b->nb_tiles; i++) {
+        b->tiles[i].reserved = 0;
+        tile_setup(&b->tiles[i], b, counts, nb_inputs);
+    }
+    av_free(counts);
+    qsort(b->tiles, b->nb_tiles, sizeof(*b->tiles), cmp_tiles);
+
+    return 0;
+}
+
+static float edge_distance(float mx, float my, int w, int h)
+{
+    return FFMIN(FFMIN(mx, 1.f - mx) * w, FFMIN(my, 1.f - my) * h);
+}
+
+static int build_seam_map(SeamMap *sm, const VRRemapPlaneDesc *d, int nb_inputs,
+                          const float * const *map_x, const float * const *map_y,
+                          int map_w, int map_h, ptrdiff_t map_stride)
+{
+    size_t nb_entries = (size_t)d->w * d->h, k = 0;
+    int x, y, i;
+
+    sm->primary = av_malloc(nb_entries);
+    sm->input   = av_malloc(nb_entries);
+    sm->xy      = av_malloc_array(nb_entries, sizeof(*sm->xy));
+    sm->frac    = av_malloc_array(nb_entries, sizeof(*sm->frac));
+    sm->weight  = av_malloc(nb_entries);
+    if (!sm->primary || !sm->input || !sm->xy || !sm->frac || !sm->weight)
+        return AVERROR(ENOMEM);
+
+    for (y = 0; y < d->h; y++) {
+        int my = FFMIN((int)((y + 0.5) * map_h / d->h), map_h - 1);
+
+        for (x = 0; x < d->w; x++, k++) {
+            int mx = FFMIN((int)((x + 0.5) * map_w / d->w), map_w - 1);
+            ptrdiff_t m = my * map_stride + mx;
+            int primary = -1, input = -1;
+            float dist_primary = 0, dist_input = 0;
+            int32_t cx = 0, cy = 0;
+
+            for (i = 0; i < nb_inputs && input < 0; i++) {
+                int32_t ix = map_coord(map_x[i][m], d->in_w[i]);
+                int32_t iy = map_coord(map_y[i][m], d->in_h[i]);
+                float dist;
+
+                if (ix < 0 || iy < 0)
+                    continue;
+                dist = edge_distance(map_x[i][m], map_y[i][m], d->in_w[i], d->in_h[i]);
+                if (primary < 0) {
+                    primary      = i;
+                    dist_primary = dist;
+                } else {
+                    input      = i;
+                    dist_input = dist;
+                    cx         = ix;
+                    cy         = iy;
+                }
+            }
+            sm->primary[k] = primary;
+            sm->input[k]   = input;
+            sm->xy[k]      = (cx >> VR_REMAP_FRAC_BITS) | (cy >> VR_REMAP_FRAC_BITS) << 16;
+            sm->frac[k]    = (cx & (VR_REMAP_ONE - 1)) | (cy & (VR_REMAP_ONE - 1)) << 8;
+            sm->weight[k]  = input < 0 ? 0 :
+                             av_clip_uint8(lrintf(255 * dist_input /
+                                                  FFMAX(dist_primary + dist_input, 1e-6f)));
+        }
+    }
+    return 0;
+}
+
+static void free_seam_map(SeamMap *sm)
+{
+    av_freep(&sm->primary);
+    av_freep(&sm->input);
+    av_freep(&sm->xy);
+    av_freep(&sm->frac);
+    av_freep(&sm->weight);
+}
+
+static int count_overlap(const SeamMap *sm, int w, int x0, int y0, int x1, int y1)
+{
+    int x, y, n = 0;
+
+    for (y = y0; y < y1; y++)
+        for (x = x0; x < x1; x++)
+            n += sm->input[y * w + x] >= 0;
+    return n;
+}
+
+/* Add the overlap pixels of row y in [x0, x1) as runs of the same input pair. */
+static int add_seam_spans(PlaneBuilder *b, const SeamMap *sm, int w, int y, int x0, int x1)
+{
+    int x = x0;
+
+    while (x < x1) {
+        size_t k = (size_t)y * w + x;
+        VRRemapSeamSpan span;
+        int end = x;
+
+        if (sm->input[k] < 0) {
+            x++;
+            continue;
+        }
+        while (end < x1 && sm->input[k + end - x] == sm->input[k] &&
+               sm->primary[k + end - x] == sm->primary[k])
+            end++;
+
+        span.x       = x;
+        span.y       = y;
+        span.len     = end - x;
+        span.input   = sm->input[k];
+        span.primary = sm->primary[k];
+        span.offset  = b->nb_seam_entries;
+        if (!av_dynarray2_add((void **)&b->seam_spans, &b->nb_seam_spans, sizeof(span),
+                              (const uint8_t *)&span))
+            return AVERROR(ENOMEM);
+        memcpy(b->seam_xy     + b->nb_seam_entries, sm->xy     + k, span.len * sizeof(*sm->xy));
+        memcpy(b->seam_frac   + b->nb_seam_entries, sm->frac   + k, span.len * sizeof(*sm->frac));
+        memcpy(b->seam_weight + b->nb_seam_entries, sm->weight + k, span.len);
+        b->nb_seam_entries += span.len;
+        x = end;
+    }
+    return 0;
+}
+
+static void seam_window(VRRemapSeam *s, const VRRemapPlaneDesc *d, int tx, int ty)
+{
+    int ts = d->tile_size;
+
+    s->tile_x = tx * ts;
+    s->tile_y = ty * ts;
+    s->tile_w = FFMIN(ts, d->w - s->tile_x);
+    s->tile_h = FFMIN(ts, d->h - s->tile_y);
+    s->x      = FFMAX(s->tile_x - VR_REMAP_SEAM_MARGIN, 0);
+    s->y      = FFMAX(s->tile_y - VR_REMAP_SEAM_MARGIN, 0);
+    s->w      = FFMIN(s->tile_x + s->tile_w + VR_REMAP_SEAM_MARGIN, d->w) - s->x;
+    s->h      = FFMIN(s->tile_y + s->tile_h + VR_REMAP_SEAM_MARGIN, d->h) - s->y;
+}
+
+static int build_seams(PlaneBuilder *b, const VRRemapPlaneDesc *d, const SeamMap *sm,
+                       int nb_inputs)
+{
+    int ts = d->tile_size;
+    int tiles_x = (d->w + ts - 1) / ts, tiles_y = (d->h + ts - 1) / ts;
+    int tx, ty, x, y, i, ret;
+    size_t nb_entries = 0, mask_size = 0;
+    int *counts;
+
+    /* size everything first, windows of neighbouring seams overlap */
+    for (ty = 0; ty < tiles_y; ty++) {
+        for (tx = 0; tx < tiles_x; tx++) {
+            VRRemapSeam s;
+
+            seam_window(&s, d, tx, ty);
+            if (!count_overlap(sm, d->w, s.tile_x, s.tile_y,
+                               s.tile_x + s.tile_w, s.tile_y + s.tile_h))
+                continue;
+            nb_entries += count_overlap(sm, d->w, s.x, s.y, s.x + s.w, s.y + s.h);
+            mask_size  += (size_t)s.w * s.h;
+            b->nb_seams++;
+        }
+    }
+    if (nb_entries > INT_MAX || mask_size > INT_MAX)
+        return AVERROR(EINVAL);
+    if (!b->nb_seams)
+        return 0;
+
+    b->seams       = av_malloc_array(b->nb_seams, sizeof(*b->seams));
+    b->seam_xy     = av_malloc_array(nb_entries, sizeof(*b->seam_xy));
+    b->seam_frac   = av_malloc_array(nb_entries, sizeof(*b->seam_frac));
+    b->seam_weight = av_malloc(nb_entries);
+    b->seam_mask   = av_malloc(mask_size);
+    counts         = av_malloc_array(nb_inputs, sizeof(*counts));
+    if (!b->seams || !b->seam_xy || !b->seam_frac || !b->seam_weight || !b->seam_mask ||
+        !counts) {
+        av_free(counts);
+        return AVERROR(ENOMEM);
+    }
+
+    b->nb_seams = 0;
+    for (ty = 0; ty < tiles_y; ty++) {
+        for (tx = 0; tx < tiles_x; tx++) {
+            VRRemapSeam *s, window;
+            int x1, y1;
+            uint8_t *mask;
+
+            seam_window(&window, d, tx, ty);
+            x1 = window.tile_x + window.tile_w;
+            y1 = window.tile_y + window.tile_h;
+            if (!count_overlap(sm, d->w, window.tile_x, window.tile_y, x1, y1))
+                continue;
+            s  = &b->seams[b->nb_seams++];
+            *s = window;
+
+            s->span_start = b->nb_seam_spans;
+            for (y = s->tile_y; y < y1; y++)
+                if ((ret = add_seam_spans(b, sm, d->w, y, s->tile_x, x1)) < 0)
+                    goto fail;
+            s->span_inner_end = b->nb_seam_spans;
+            for (y = s->y; y < s->y + s->h; y++) {
+                if (y < s->tile_y || y >= y1) {
+                    ret = add_seam_spans(b, sm, d->w, y, s->x, s->x + s->w);
+                } else {
+                    ret = add_seam_spans(b, sm, d->w, y, s->x, s->tile_x);
+                    if (ret >= 0)
+                        ret = add_seam_spans(b, sm, d->w, y, x1, s->x + s->w);
+                }
+                if (ret < 0)
+                    goto fail;
+            }
+            s->span_end = b->nb_seam_spans;
+
+            memset(counts, 0, nb_inputs * sizeof(*counts));
+            for (i = s->span_start; i < s->span_inner_end; i++)
+                counts[b->seam_spans[i].input] += b->seam_spans[i].len;
+            s->input = 0;
+            for (i = 1; i < nb_inputs; i++)
+                if (counts[i] > counts[s->input])
+                    s->input = i;
+
+            /* the mask switches to the second input where it outweighs the
+             * first one, and wherever it is the only input left */
+            s->mask_offset = b->seam_mask_size;
+            s->reserved    = 0;
+            mask = b->seam_mask + s->mask_offset;
+            for (y = s->y; y < s->y + s->h; y++) {
+                for (x = s->x; x < s->x + s->w; x++) {
+                    size_t k = (size_t)y * d->w + x;
+                    int second = sm->input[k] == s->input ? sm->weight[k] >= 128
+                                                          : sm->primary[k] == s->input;
+                    *mask++ = second ? 255 : 0;
+                }
+            }
+            b->seam_mask_size += s->w * s->h;
+        }
+    }
+    ret = 0;
+fail:
+    av_free(counts);
+    return ret;
+}
+
+static void free_builder(PlaneBuilder *b)
+{
+    av_freep(&b->xy);
+    av_freep(&b->frac);
+    av_freep(&b->spans);
+    av_freep(&b->tiles);
+    av_freep(&b->seams);
+    av_freep(&b->seam_spans);
+    av_freep(&b->seam_xy);
+    av_freep(&b->seam_frac);
+    av_freep(&b->seam_weight);
+    av_freep(&b->seam_mask);
+}
+
+av_cold int ff_vr_remap_table_init(VRRemapTable *t, const VRRemapPlaneDesc *desc,
+                                   int nb_planes, int nb_inputs,
+                                   const float * const *map_x, const float * const *map_y,
+                                   int map_w, int map_h, ptrdiff_t map_stride)
+{
+    PlaneBuilder builders[VR_REMAP_MAX_PLANES] = { { 0 } };
+    size_t offsets[VR_REMAP_MAX_PLANES][PLANE_ARRAYS + 1];
+    int32_t info[VR_REMAP_MAX_PLANES][PLANE_INFO_SIZE];
+    size_t size = 0;
+    int i, j, ret;
+
+    memset(t, 0, sizeof(*t));
+    if (nb_planes > VR_REMAP_MAX_PLANES || nb_inputs > INT8_MAX)
+        return AVERROR(EINVAL);
+    for (i = 0; i < nb_planes; i++) {
+        if (desc[i].w <= 0 || desc[i].h <= 0 || desc[i].tile_size <= 0)
+            return AVERROR(EINVAL);
+        for (j = 0; j < nb_inputs; j++)
+            if (desc[i].in_w[j] < 2 || desc[i].in_h[j] < 2 ||
+                desc[i].in_w[j] > VR_REMAP_MAX_SIZE || desc[i].in_h[j] > VR_REMAP_MAX_SIZE)
+                return AVERROR(EINVAL);
+    }
+
+    for (i = 0; i < nb_planes; i++) {
+        PlaneBuilder *b = &builders[i];
+        SeamMap sm = { 0 };
+
+        ret = build_plane(b, &desc[i], nb_inputs, map_x, map_y, map_w, map_h, map_stride);
+        if (ret >= 0)
+            ret = build_seam_map(&sm, &desc[i], nb_inputs,
+                                 map_x, map_y, map_w, map_h, map_stride);
+        if (ret >= 0)
+            ret = build_seams(b, &desc[i], &sm, nb_inputs);
+        free_seam_map(&sm);
+        if (ret < 0)
+            goto end;
+
+        info[i][INFO_W]               = desc[i].w;
+        info[i][INFO_H]               = desc[i].h;
+        info[i][INFO_FILL]            = desc[i].fill;
+        info[i][INFO_TILE_SIZE]       = desc[i].tile_size;
+        info[i][INFO_NB_SPANS]        = b->nb_spans;
+        info[i][INFO_NB_SEAMS]        = b->nb_seams;
+        info[i][INFO_NB_SEAM_SPANS]   = b->nb_seam_spans;
+        info[i][INFO_NB_SEAM_ENTRIES] = b->nb_seam_entries;
+        info[i][INFO_SEAM_MASK_SIZE]  = b->seam_mask_size;
+        plane_layout(offsets[i], size, info[i]);
+        size = offsets[i][PLANE_ARRAYS];
+    }
+
+    t->buf = av_malloc(size);
+    if (!t->buf) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    t->buf_size  = size;
+    t->nb_planes = nb_planes;
+    for (i = 0; i < nb_planes; i++) {
+        PlaneBuilder *b = &builders[i];
+        size_t nb_entries = (size_t)desc[i].w * desc[i].h;
+
+        memcpy(t->buf + offsets[i][0], b->xy,   nb_entries * sizeof(*b->xy));
+        memcpy(t->buf + offsets[i][1], b->frac, nb_entries * sizeof(*b->frac));
+        memcpy(t->buf + offsets[i][2], b->spans, b->nb_spans * sizeof(*b->spans));
+        memcpy(t->buf + offsets[i][3], b->tiles, b->nb_tiles * sizeof(*b->tiles));
+        if (b->nb_seams) {
+            memcpy(t->buf + offsets[i][4], b->seams, b->nb_seams * sizeof(*b->seams));
+            memcpy(t->buf + offsets[i][5], b->seam_spans,
+                   b->nb_seam_spans * sizeof(*b->seam_spans));
+            memcpy(t->buf + offsets[i][6], b->seam_xy,
+                   b->nb_seam_entries * sizeof(*b->seam_xy));
+            memcpy(t->buf + offsets[i][7], b->seam_frac,
+                   b->nb_seam_entries * sizeof(*b->seam_frac));
+            memcpy(t->buf + offsets[i][8], b->seam_weight, b->nb_seam_entries);
+            memcpy(t->buf + offsets[i][9], b->seam_mask, b->seam_mask_size);
+        }
+        plane_setup(&t->planes[i], t->buf, offsets[i], info[i]);
+    }
+    ret = 0;
+end:
+    for (i = 0; i < nb_planes; i++)
+        free_builder(&builders[i]);
+    return ret;
+}
+
+av_cold void ff_vr_remap_table_uninit(VRRemapTable *t)
+{
+    if (t->mapped)
+        av_file_unmap(t->buf, t->buf_size);
+    else
+        av_free(t->buf);
+    memset(t, 0, sizeof(*t));
+}
+
+av_cold int ff_vr_remap_table_save(const VRRemapTable *t, const char *filename,
+                                   const uint8_t key[16], void *log_ctx)
+{
+    uint8_t header_buf[CACHE_HEADER_SIZE] = { 0 };
+    CacheHeader *header = (CacheHeader *)header_buf;
+    char *tmp_name;
+    FILE *f;
+    int i, ret = 0;
+
+    header->magic        = CACHE_MAGIC;
+    header->version      = CACHE_VERSION;
+    header->nb_planes    = t->nb_planes;
+    header->payload_size = t->buf_size;
+    memcpy(header->key, key, sizeof(header->key));
+    for (i = 0; i < t->nb_planes; i++)
+        plane_info(header->plane_info[i], &t->planes[i]);
+
+    tmp_name = av_asprintf("%s.tmp", filename);
+    if (!tmp_name)
+        return AVERROR(ENOMEM);
+    f = fopen(tmp_name, "wb");
+    if (!f) {
+        ret = AVERROR(errno);
+        av_log(log_ctx, AV_LOG_WARNING, "Cannot create remap cache %s\n", tmp_name);
+        goto end;
+    }
+    if (fwrite(header_buf, sizeof(header_buf), 1, f) != 1 ||
+        fwrite(t->buf, t->buf_size, 1, f) != 1)
+        ret = AVERROR(EIO);
+    if (fclose(f) && !ret)
+        ret = AVERROR(EIO);
+    if (!ret && rename(tmp_name, filename))
+        ret = AVERROR(errno);
+    if (ret < 0) {
+        av_log(log_ctx, AV_LOG_WARNING, "Cannot write remap cache %s\n", filename);
+        remove(tmp_name);
+    }
+end:
+    av_free(tmp_name);
+    return ret;
+}
+
+static int check_plane(const VRRemapPlane *p, int nb_inputs, const int *in_w, const int *in_h)
+{
+    size_t nb_entries = (size_t)p->w * p->h;
+    int i, j;
+
+    for (i = 0; i < p->nb_tiles; i++) {
+        const VRRemapTile *t = &p->tiles[i];
+
+        if (t->span_start < 0 || t->span_end < t->span_start || t->span_end > p->nb_spans ||
+            t->input < -1 || t->input >= nb_inputs)
+            return AVERROR_INVALIDDATA;
+        if (t->input >= 0 &&
+            (t->src_x < 0 || t->src_y < 0 || t->src_w <= 0 || t->src_h <= 0 ||
+             t->src_x + t->src_w > in_w[t->input] || t->src_y + t->src_h > in_h[t->input]))
+            return AVERROR_INVALIDDATA;
+    }
+
+    for (i = 0; i < p->nb_spans; i++) {
+        const VRRemapSpan *s = &p->spans[i];
+
+        if (s->x < 0 || s->y < 0 || s->len <= 0 || s->offset < 0 ||
+            s->x + s->len > p->w || s->y >= p->h ||
+            s->offset + (size_t)s->len > nb_entries ||
+            s->input < -1 || s->input >= nb_inputs)
+            return AVERROR_INVALIDDATA;
+        if (s->input < 0)
+            continue;
+        for (j = s->offset; j < s->offset + s->len; j++)
+            if ((p->xy[j] & 0xffff) > in_w[s->input] - 2 ||
+                (p->xy[j] >> 16)    > in_h[s->input] - 2)
+                return AVERROR_INVALIDDATA;
+    }
+
+    for (i = 0; i < p->nb_seams; i++) {
+        const VRRemapSeam *s = &p->seams[i];
+
+        if (s->x < 0 || s->y < 0 || s->w <= 0 || s->h <= 0 ||
+            s->x + s->w > p->w || s->y + s->h > p->h ||
+            s->tile_x < s->x || s->tile_y < s->y || s->tile_w <= 0 || s->tile_h <= 0 ||
+            s->tile_x + s->tile_w > s->x + s->w || s->tile_y + s->tile_h > s->y + s->h ||
+            s->span_start < 0 || s->span_inner_end < s->span_start ||
+            s->span_end < s->span_inner_end || s->span_end > p->nb_seam_spans ||
+            s->input < 0 || s->input >= nb_inputs || s->mask_offset < 0 ||
+            s->mask_offset + (int64_t)s->w * s->h > p->seam_mask_size)
+            return AVERROR_INVALIDDATA;
+        for (j = s->span_start; j < s->span_end; j++) {
+            const VRRemapSeamSpan *span = &p->seam_spans[j];
+
+            if (span->x < s->x || span->y < s->y || span->len <= 0 ||
+                span->x + span->len > s->x + s->w || span->y >= s->y + s->h)
+                return AVERROR_INVALIDDATA;
+        }
+    }
+
+    for (i = 0; i < p->nb_seam_spans; i++) {
+        const VRRemapSeamSpan *s = &p->seam_spans[i];
+
+        if (s->len <= 0 || s->offset < 0 || s->offset + (int64_t)s->len > p->nb_seam_entries ||
+            s->input < 0 || s->input >= nb_inputs || s->primary < 0 || s->primary >= nb_inputs)
+            return AVERROR_INVALIDDATA;
+        for (j = s->offset; j < s->offset + s->len; j++)
+            if ((p->seam_xy[j] & 0xffff) > in_w[s->input] - 2 ||
+                (p->seam_xy[j] >> 16)    > in_h[s->input] - 2)
+                return AVERROR_INVALIDDATA;
+    }
+    return 0;
+}
+
+av_cold int ff_vr_remap_table_load(VRRemapTable *t, const char *filename,
+                                   const uint8_t key[16], const VRRemapPlaneDesc *desc,
+                                   int nb_planes, int nb_inputs, void *log_ctx)
+{
+    const CacheHeader *header;
+    size_t offsets[VR_REMAP_MAX_PLANES][PLANE_ARRAYS + 1];
+    size_t payload_size = 0;
+    int i, ret;
+
+    memset(t, 0, sizeof(*t));
+    if (nb_planes > VR_REMAP_MAX_PLANES)
+        return AVERROR(EINVAL);
+
+    /* a missing file is the common case, keep it quiet */
+    ret = av_file_map(filename, &t->buf, &t->buf_size, AV_LOG_DEBUG - AV_LOG_ERROR, log_ctx);
+    if (ret < 0)
+        return ret;
+    t->mapped    = 1;
+    t->nb_planes = nb_planes;
+
+    ret = AVERROR_INVALIDDATA;
+    header = (const CacheHeader *)t->buf;
+    if (t->buf_size < CACHE_HEADER_SIZE ||
+        header->magic != CACHE_MAGIC || header->version != CACHE_VERSION ||
+        memcmp(header->key, key, sizeof(header->key)) ||
+        header->nb_planes != nb_planes)
+        goto fail;
+
+    for (i = 0; i < nb_planes; i++) {
+        const int32_t *info = header->plane_info[i];
+
+        if (info[INFO_W] != desc[i].w || info[INFO_H] != desc[i].h ||
+            info[INFO_FILL] != desc[i].fill || info[INFO_TILE_SIZE] != desc[i].tile_size ||
+            info[INFO_NB_SPANS] < 0 || info[INFO_NB_SEAMS] < 0 ||
+            info[INFO_NB_SEAM_SPANS] < 0 || info[INFO_NB_SEAM_ENTRIES] < 0 ||
+            info[INFO_SEAM_MASK_SIZE] < 0)
+            goto fail;
+        plane_layout(offsets[i], CACHE_HEADER_SIZE + payload_size, info);
+        payload_size = offsets[i][PLANE_ARRAYS] - CACHE_HEADER_SIZE;
+    }
+    if (header->payload_size != payload_size ||
+        t->buf_size != CACHE_HEADER_SIZE + payload_size)
+        goto fail;
+
+    for (i = 0; i < nb_planes; i++) {
+        plane_setup(&t->planes[i], t->buf, offsets[i], header->plane_info[i]);
+        if (check_plane(&t->planes[i], nb_inputs, desc[i].in_w, desc[i].in_h) < 0)
+            goto fail;
+    }
+    return 0;
+fail:
+    av_log(log_ctx, AV_LOG_WARNING, "Ignoring stale or invalid remap cache %s\n", filename);
+    ff_vr_remap_table_uninit(t);
+    return ret;
+}
+
+/* Source areas larger than this are not worth prefetching, the tile is
+ * scattered over the input anyway. */
+#define PREFETCH_MAX_LINES 256
+
+static void prefetch_tile(const VRRemapDSPContext *dsp, const VRRemapTile *t,
+                          const uint8_t * const *src, const ptrdiff_t *src_linesize)
+{
+    const uint8_t *p;
+    int x;
+
+    if (t->input < 0 || (t->src_w / 64 + 1) * t->src_h > PREFETCH_MAX_LINES)
+        return;
+    p = src[t->input] + t->src_y * src_linesize[t->input] + t->src_x * dsp->step;
+    for (x = 0; x < t->src_w * dsp->step + 63; x += 64)
+        dsp->prefetch(p + FFMIN(x, (t->src_w - 1) * dsp->step), src_linesize[t->input], t->src_h);
+}
+
+void ff_vr_remap_plane_slice(const VRRemapDSPContext *dsp, const VRRemapPlane *p,
+                             uint8_t *dst, ptrdiff_t dst_linesize,
+                             const uint8_t * const *src, const ptrdiff_t *src_linesize,
+                             const uint8_t * const *luts, int tile_start, int tile_end)
+{
+    int i, j, k;
+
+    if (tile_start < tile_end)
+        prefetch_tile(dsp, &p->tiles[tile_start], src, src_linesize);
+
+    for (i = tile_start; i < tile_end; i++) {
+        const VRRemapTile *t = &p->tiles[i];
+
+        if (i + 1 < tile_end)
+            prefetch_tile(dsp, &p->tiles[i + 1], src, src_linesize);
+
+        for (j = t->span_start; j < t->span_end; j++) {
+            const VRRemapSpan *s = &p->spans[j];
+            uint8_t *d = dst + s->y * dst_linesize + s->x * dsp->sample_size;
+
+            if (s->input < 0) {
+                dsp->fill_line(d, p->fill, s->len);
+            } else {
+                dsp->remap_line(d, src[s->input], src_linesize[s->input],
+                                p->xy + s->offset, p->frac + s->offset, s->len);
+                if (luts && dsp->sample_size == 1) {
+                    const uint8_t *lut = luts[s->input];
+                    for (k = 0; k < s->len; k++)
+                        d[k] = lut[d[k]];
+                }
+            }
+        }
+    }
+}
+
+#define MODEL_SETS 512
+#define MODEL_WAYS 8
+
+typedef struct CacheModel {
+    uint64_t lines[MODEL_SETS][MODEL_WAYS];   ///< most recently used first
+    uint64_t accesses, misses;
+} CacheModel;
+
+static void model_access(CacheModel *m, uint64_t addr)
+{
+    uint64_t line = (addr >> 6) + 1;
+    uint64_t *set = m->lines[line % MODEL_SETS];
+    int i;
+
+    m->accesses++;
+    for (i = 0; i < MODEL_WAYS - 1 && set[i] != line; i++)
+        ;
+    if (set[i] != line)
+        m->misses++;
+    memmove(set + 1, set, i * sizeof(*set));
+    set[0] = line;
+}
+
+/* Feed the source lines read for one entry, assuming inputs are stored one
+ * after the other with 64-byte aligned lines. */
+static void model_entry(CacheModel *m, const VRRemapPlane *p, const uint64_t *bases,
+                        const int *in_w, int input, int offset)
+{
+    uint64_t stride = FFALIGN(in_w[input], 64);
+    uint64_t addr = bases[input] + (p->xy[offset] >> 16) * stride + (p->xy[offset] & 0xffff);
+
+    model_access(m, addr);
+    model_access(m, addr + stride);
+}
+
+av_cold int ff_vr_remap_plane_miss_rate(const VRRemapPlane *p, const int *in_w,
+                                        double *tiled, double *raster)
+{
+    CacheModel *m = av_mallocz(sizeof(*m));
+    uint64_t bases[256] = { 0 };
+    int8_t *inputs;
+    int i, j, x, y;
+
+    inputs = av_malloc((size_t)p->w * p->h);
+    if (!m || !inputs) {
+        av_free(m);
+        av_free(inputs);
+        return AVERROR(ENOMEM);
+    }
+
+    memset(inputs, -1, (size_t)p->w * p->h);
+    for (i = 0; i < p->nb_spans; i++) {
+        const VRRemapSpan *s = &p->spans[i];
+        if (s->input >= FF_ARRAY_ELEMS(bases))
+            goto fail;
+        memset(inputs + s->offset, s->input, s->len);
+    }
+    for (i = 1; i < FF_ARRAY_ELEMS(bases); i++)
+        bases[i] = (uint64_t)i << 40;
+
+    for (i = 0; i < p->nb_tiles; i++) {
+        for (j = p->tiles[i].span_start; j < p->tiles[i].span_end; j++) {
+            const VRRemapSpan *s = &p->spans[j];
+            for (x = 0; s->input >= 0 && x < s->len; x++)
+                model_entry(m, p, bases, in_w, s->input, s->offset + x);
+        }
+    }
+    *tiled = m->accesses ? (double)m->misses / m->accesses : 0;
+
+    memset(m, 0, sizeof(*m));
+    for (y = 0; y < p->h; y++) {
+        int ty = y / p->tile_size, th = FFMIN(p->tile_size, p->h - ty * p->tile_size);
+
+        for (x = 0; x < p->w; x++) {
+            int tx = x / p->tile_size, tw = FFMIN(p->tile_size, p->w - tx * p->tile_size);
+            int offset = ty * p->tile_size * p->w + tx * p->tile_size * th +
+                         (y - ty * p->tile_size) * tw + (x - tx * p->tile_size);
+
+            if (inputs[offset] >= 0)
+                model_entry(m, p, bases, in_w, inputs[offset], offset);
+        }
+    }
+    *raster = m->accesses ? (double)m->misses / m->accesses : 0;
+
+    av_free(m);
+    av_free(inputs);
+    return 0;
+fail:
+    av_free(m);
+    av_free(inputs);
+    return AVERROR(EINVAL);
+}
@@ -0,0 +1,265 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * CPU remap engine used by the vr_map filter.
+ *
+ * A remap plane maps every output pixel to a fixed-point position in one of
+ * the input planes. The plane is cut into tiles, and the rows of each tile
+ * into spans of consecutive pixels sampling the same input, so the line
+ * kernels only ever see a single source plane and can be vectorized.
+ *
+ * Tiles are processed in order of the source area they read rather than in
+ * raster order, so that consecutive tiles of a slice hit the same cache lines
+ * of the same input, and the source area of the next tile is prefetched.
+ *
+ * Positions take 6 bytes per output pixel: uint16 integer coordinates and
+ * 8-bit sub-pixel weights.
+ *
+ * Input planes may be packed or semi-planar, the line kernels are specialized
+ * for the distance between two samples and for 8-bit or 16-bit samples.
+ * Output planes always have the sample size of the inputs and a step of 1.
+ *
+ * Pixels covered by more than one input are also listed per tile as seams,
+ * along with the position in the second input, so that blending only ever
+ * touches the overlap areas.
+ */
+
+#ifndef AVFILTER_VR_REMAP_H
+#define AVFILTER_VR_REMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define VR_REMAP_FRAC_BITS 8
+#define VR_REMAP_ONE (1 << VR_REMAP_FRAC_BITS)
+
+/** Default size of the square tiles planes are laid out and traversed in. */
+#define VR_REMAP_TILE_SIZE 64
+
+/** Largest supported input dimension, coordinates are stored as uint16. */
+#define VR_REMAP_MAX_SIZE (1 << 15)
+
+#define VR_REMAP_MAX_PLANES 2
+
+/** Border added around seam tiles, enough support for VR_REMAP_MAX_BANDS. */
+#define VR_REMAP_SEAM_MARGIN 16
+#define VR_REMAP_MAX_BANDS 5
+
+typedef struct VRRemapSpan {
+    int32_t x, y;       ///< position of the first output pixel
+    int32_t len;        ///< number of output pixels in the span
+    int32_t input;      ///< input index sampled by the span, -1 for unmapped pixels
+    int32_t offset;     ///< index of the first entry of the span in xy/frac
+} VRRemapSpan;
+
+typedef struct VRRemapTile {
+    int32_t span_start;     ///< first span of the tile
+    int32_t span_end;       ///< one past the last span of the tile
+    int32_t input;          ///< input sampled by most pixels of the tile, -1 if none
+    int32_t src_x, src_y;   ///< top left corner of the area read from that input
+    int32_t src_w, src_h;   ///< size of that area
+    int32_t reserved;
+} VRRemapTile;
+
+typedef struct VRRemapSeamSpan {
+    int32_t x, y;       ///< position of the first output pixel
+    int32_t len;
+    int32_t input;      ///< second input covering the pixels
+    int32_t primary;    ///< input sampled by the remap pass
+    int32_t offset;     ///< index of the first entry in seam_xy/seam_frac/seam_weight
+} VRRemapSeamSpan;
+
+/**
+ * A tile holding overlap pixels, and the window around it that multi-band
+ * blending reads.
+ */
+typedef struct VRRemapSeam {
+    int32_t x, y, w, h;             ///< window, the tile plus a margin
+    int32_t tile_x, tile_y, tile_w, tile_h;
+    int32_t span_start;             ///< first span inside the tile
+    int32_t span_inner_end;         ///< spans of the margin start here
+    int32_t span_end;
+    int32_t input;                  ///< second input covering most tile pixels
+    int32_t mask_offset;            ///< w x h multi-band mask in seam_mask
+    int32_t reserved;
+} VRRemapSeam;
+
+typedef struct VRRemapPlane {
+    int w, h;               ///< plane size in output pixels
+    int fill;               ///< value written to unmapped pixels
+    int tile_size;
+    /**
+     * Integer part of the source position of each output pixel, x | y << 16.
+     * Entries are stored tile by tile in raster order, and row-major inside
+     * each tile.
+     */
+    const uint32_t *xy;
+    const uint16_t *frac;   ///< matching sub-pixel weights, fx | fy << 8
+    const VRRemapSpan *spans;   ///< spans of all tiles, in raster tile order
+    int nb_spans;
+    const VRRemapTile *tiles;   ///< all tiles, in processing order
+    int nb_tiles;
+
+    const VRRemapSeam *seams;
+    int nb_seams;
+    const VRRemapSeamSpan *seam_spans;
+    int nb_seam_spans;
+    const uint32_t *seam_xy;    ///< position in the second input, as xy
+    const uint16_t *seam_frac;
+    /**
+     * Feathering weight of the second input, 0-255, from the distance of the
+     * pixel to the border of each input.
+     */
+    const uint8_t *seam_weight;
+    int nb_seam_entries;
+    /**
+     * Multi-band masks: 255 where the second input of the seam wins, either
+     * by weight or because it is the only one covering the pixel.
+     */
+    const uint8_t *seam_mask;
+    int seam_mask_size;
+} VRRemapPlane;
+
+/**
+ * Compiled remap tables of one output, either owned or backed by a
+ * memory-mapped cache file.
+ */
+typedef struct VRRemapTable {
+    VRRemapPlane planes[VR_REMAP_MAX_PLANES];
+    int nb_planes;
+    uint8_t *buf;           ///< single allocation or mapping holding all arrays
+    size_t buf_size;
+    int mapped;             ///< buf comes from av_file_map()
+} VRRemapTable;
+
+typedef struct VRRemapPlaneDesc {
+    int w, h;               ///< plane size in output pixels
+    int fill;
+    int tile_size;
+    const int *in_w, *in_h; ///< size of each input plane
+} VRRemapPlaneDesc;
+
+typedef struct VRRemapDSPContext {
+    int step;                   ///< bytes between two samples of an input plane
+    int sample_size;            ///< bytes per sample, 1 or 2
+
+    /**
+     * Bilinearly sample len pixels from one input plane.
+     *
+     * xy holds the integer source position of each pixel, already clamped so
+     * that the 2x2 neighbourhood is inside the plane, frac the weights with
+     * VR_REMAP_FRAC_BITS of precision.
+     */
+    void (*remap_line)(uint8_t *dst, const uint8_t *src, ptrdiff_t linesize,
+                       const uint32_t *xy, const uint16_t *frac, int len);
+
+    void (*fill_line)(uint8_t *dst, int value, int len);
+
+    /**
+     * Prefetch one cache line from each of h rows of a buffer.
+     */
+    void (*prefetch)(const uint8_t *buf, ptrdiff_t stride, int h);
+
+    /**
+     * dst = (dst * (256 - w) + src * w + 128) >> 8, 8-bit samples only.
+     */
+    void (*blend_line)(uint8_t *dst, const uint8_t *src, const uint8_t *w, int len);
+
+    /**
+     * a = (a * (256 - m) + b * m + 128) >> 8, with m in [0, 256].
+     */
+    void (*blend_bands)(int16_t *a, const int16_t *b, const int16_t *m, int len);
+} VRRemapDSPContext;
+
+void ff_vr_remap_line_c(uint8_t *dst, const uint8_t *src, ptrdiff_t linesize,
+                        const uint32_t *xy, const uint16_t *frac, int len);
+void ff_vr_blend_line_c(uint8_t *dst, const uint8_t *src, const uint8_t *w, int len);
+void ff_vr_blend_bands_c(int16_t *a, const int16_t *b, const int16_t *m, int len);
+
+/**
+ * @param step  samples between two pixels of an input plane, 1 for planar,
+ *              2 or 4 for semi-planar and packed formats
+ * @param depth bits per sample, up to 8 for 8-bit samples, up to 16 otherwise
+ */
+void ff_vr_remap_dsp_init(VRRemapDSPContext *dsp, int step, int depth);
+void ff_vr_remap_dsp_init_x86(VRRemapDSPContext *dsp, int step, int depth);
+
+/**
+ * Compile the remap tables of one output from per-input coordinate maps.
+ *
+ * map_x[i]/map_y[i] are map_w x map_h float maps (map_stride floats per row)
+ * giving the position in input i of each output pixel, normalized to [0, 1].
+ * Positions outside of that range mark pixels not covered by the input. The
+ * maps are resampled to each plane size with nearest neighbour, so the same
+ * template can drive both luma and subsampled chroma planes. The first input
+ * covering a pixel wins, the second one is recorded in the seams.
+ *
+ * @return 0 on success, a negative AVERROR code on failure
+ */
+int ff_vr_remap_table_init(VRRemapTable *t, const VRRemapPlaneDesc *desc,
+                           int nb_planes, int nb_inputs,
+                           const float * const *map_x, const float * const *map_y,
+                           int map_w, int map_h, ptrdiff_t map_stride);
+
+void ff_vr_remap_table_uninit(VRRemapTable *t);
+
+/**
+ * Write a compiled table to a cache file, tagged with a 16 byte key that
+ * identifies the template and the input geometry it was compiled for.
+ */
+int ff_vr_remap_table_save(const VRRemapTable *t, const char *filename,
+                           const uint8_t key[16], void *log_ctx);
+
+/**
+ * Memory-map a cache file written by ff_vr_remap_table_save().
+ *
+ * The table is checked against desc, so that a damaged file can never make
+ * the kernels read outside of the inputs.
+ *
+ * @return 0 on success, a negative AVERROR code if the file is missing, stale
+ *         or does not match key and desc
+ */
+int ff_vr_remap_table_load(VRRemapTable *t, const char *filename,
+                           const uint8_t key[16], const VRRemapPlaneDesc *desc,
+                           int nb_planes, int nb_inputs, void *log_ctx);
+
+/**
+ * Remap tiles [tile_start, tile_end) of a plane, in processing order.
+ *
+ * src[i]/src_linesize[i] describe the plane of input i, laid out as set up
+ * in dsp; linesizes must be positive. If luts is not NULL, 8-bit pixels
+ * sampled from input i are mapped through luts[i].
+ */
+void ff_vr_remap_plane_slice(const VRRemapDSPContext *dsp, const VRRemapPlane *p,
+                             uint8_t *dst, ptrdiff_t dst_linesize,
+                             const uint8_t * const *src, const ptrdiff_t *src_linesize,
+                             const uint8_t * const *luts, int tile_start, int tile_end);
+
+/**
+ * Estimate the source cache miss rate of a plane by replaying its reads on a
+ * model of a 256 KiB 8-way set-associative LRU cache, both in processing order
+ * and in plain raster order for reference.
+ *
+ * @return 0 on success, a negative AVERROR code on failure
+ */
+int ff_vr_remap_plane_miss_rate(const VRRemapPlane *p, const int *in_w,
+                                double *tiled, double *raster);
+
+#endif /* AVFILTER_VR_REMAP_H */
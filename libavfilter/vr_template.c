@@ -0,0 +1,112 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "libavutil/common.h"
+#include "libavutil/file.h"
+#include "libavutil/intfloat.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/log.h"
+#include "libavutil/mem.h"
+#include "vr_template.h"
+
+int ff_vr_template_probe(const uint8_t *buf, int size)
+{
+    return size >= 4 && AV_RL32(buf) == VR_TEMPLATE_MAGIC;
+}
+
+static void read_map(float *dst, const uint8_t *src, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++)
+        dst[i] = av_int2float(AV_RL32(src + 4 * i));
+}
+
+av_cold int ff_vr_template_load(VRTemplate *t, const char *filename, void *log_ctx)
+{
+    uint8_t *buf;
+    size_t size, map_size;
+    unsigned w, h, nb_inputs;
+    int i, ret;
+
+    memset(t, 0, sizeof(*t));
+    ret = av_file_map(filename, &buf, &size, 0, log_ctx);
+    if (ret < 0)
+        return ret;
+
+    ret = AVERROR_INVALIDDATA;
+    if (size < VR_TEMPLATE_HEADER_SIZE || !ff_vr_template_probe(buf, size))
+        goto end;
+    if (AV_RL32(buf + 4) != VR_TEMPLATE_VERSION) {
+        av_log(log_ctx, AV_LOG_ERROR, "Unsupported template version %u in %s\n",
+               AV_RL32(buf + 4), filename);
+        goto end;
+    }
+    w         = AV_RL32(buf + 8);
+    h         = AV_RL32(buf + 12);
+    nb_inputs = AV_RL32(buf + 16);
+    if (!w || !h || w > INT16_MAX || h > INT16_MAX || !nb_inputs || nb_inputs > 64)
+        goto end;
+    map_size = (size_t)w * h;
+    if (size != VR_TEMPLATE_HEADER_SIZE + 2 * nb_inputs * map_size * sizeof(float)) {
+        av_log(log_ctx, AV_LOG_ERROR, "Truncated template %s\n", filename);
+        goto end;
+    }
+
+    t->w         = w;
+    t->h         = h;
+    t->nb_inputs = nb_inputs;
+    t->map_x     = av_mallocz_array(nb_inputs, sizeof(*t->map_x));
+    t->map_y     = av_mallocz_array(nb_inputs, sizeof(*t->map_y));
+    if (!t->map_x || !t->map_y) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    for (i = 0; i < nb_inputs; i++) {
+        const uint8_t *p = buf + VR_TEMPLATE_HEADER_SIZE + 2 * i * map_size * sizeof(float);
+
+        t->map_x[i] = av_malloc_array(map_size, sizeof(float));
+        t->map_y[i] = av_malloc_array(map_size, sizeof(float));
+        if (!t->map_x[i] || !t->map_y[i]) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        read_map(t->map_x[i], p, map_size);
+        read_map(t->map_y[i], p + map_size * sizeof(float), map_size);
+    }
+    ret = 0;
+end:
+    av_file_unmap(buf, size);
+    if (ret < 0)
+        ff_vr_template_free(t);
+    return ret;
+}
+
+av_cold void ff_vr_template_free(VRTemplate *t)
+{
+    int i;
+
+    for (i = 0; i < t->nb_inputs; i++) {
+        if (t->map_x)
+            av_freep(&t->map_x[i]);
+        if (t->map_y)
+            av_freep(&t->map_y[i]);
+    }
+    av_freep(&t->map_x);
+    av_freep(&t->map_y);
+    t->nb_inputs = 0;
+}
@@ -0,0 +1,68 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Native remap templates of the vr_map filter.
+ *
+ * A template gives, for every pixel of the output and every input, the
+ * position in that input the pixel is sampled from, normalized to [0,1].
+ * Positions outside of that range mean the input does not cover the pixel.
+ *
+ * All fields are little-endian:
+ *   4 bytes   "VRMT"
+ *   uint32    version, 1
+ *   uint32    output width
+ *   uint32    output height
+ *   uint32    number of inputs
+ * followed for each input by width * height float32 x positions, then
+ * width * height float32 y positions, in raster order.
+ */
+
+#ifndef AVFILTER_VR_TEMPLATE_H
+#define AVFILTER_VR_TEMPLATE_H
+
+#include <stdint.h>
+
+#define VR_TEMPLATE_MAGIC       MKTAG('V', 'R', 'M', 'T')
+#define VR_TEMPLATE_VERSION     1
+#define VR_TEMPLATE_HEADER_SIZE 20
+
+typedef struct VRTemplate {
+    int w, h;
+    int nb_inputs;
+    /* nb_inputs maps of w * h positions each */
+    float **map_x, **map_y;
+} VRTemplate;
+
+/**
+ * Check whether a buffer starts like a native template.
+ */
+int ff_vr_template_probe(const uint8_t *buf, int size);
+
+/**
+ * Read a native template.
+ *
+ * @return 0 on success, AVERROR_INVALIDDATA if the file is not a valid
+ *         native template, another negative error code otherwise
+ */
+int ff_vr_template_load(VRTemplate *t, const char *filename, void *log_ctx);
+
+void ff_vr_template_free(VRTemplate *t);
+
+#endif /* AVFILTER_VR_TEMPLATE_H */
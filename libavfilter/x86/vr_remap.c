@@ -0,0 +1,328 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "libavutil/attributes.h"
+#include "libavutil/cpu.h"
+#include "libavutil/mem.h"
+#include "libavutil/x86/cpu.h"
+#include "libavutil/x86/asm.h"
+#include "libavfilter/vr_remap.h"
+
+/*
+ * Both kernels read the top pair of a 2x2 neighbourhood with a 32-bit load at
+ * (x, y) and the bottom pair with a 32-bit load ending at (x + 1, y + 1).
+ * Since the positions are clamped to [0, w - 2] x [0, h - 2], neither load
+ * leaves the plane, even on its last row.
+ *
+ * The horizontal pass expands each pair to words and weights it with a single
+ * pmaddwd, the vertical pass needs 32-bit products.
+ *
+ * Register usage:
+ *   xmm0/1 fractional x/y, xmm3 offsets, xmm4/5 top/bottom rows,
+ *   xmm6 0xff, xmm7 linesize, xmm8 VR_REMAP_ONE, xmm9 rounding,
+ *   xmm10/11 top/bottom pair shuffles.
+ */
+
+DECLARE_ALIGNED(16, static const uint8_t, shuf_top)[16] = {
+    0, 0x80, 1, 0x80, 4, 0x80, 5, 0x80, 8, 0x80, 9, 0x80, 12, 0x80, 13, 0x80,
+};
+DECLARE_ALIGNED(16, static const uint8_t, shuf_bottom)[16] = {
+    2, 0x80, 3, 0x80, 6, 0x80, 7, 0x80, 10, 0x80, 11, 0x80, 14, 0x80, 15, 0x80,
+};
+
+#if HAVE_SSE4_INLINE && ARCH_X86_64
+static void remap_line_sse4(uint8_t *dst, const uint8_t *src, ptrdiff_t linesize,
+                            const uint32_t *xy, const uint16_t *frac, int len)
+{
+    x86_reg n = len & ~3;
+    const uint8_t *src1 = src + linesize - 2;
+    x86_reg t0, t1;
+
+    if (n) {
+        n = -n;
+        __asm__ volatile(
+            "movd       %8, %%xmm7                  \n\t"
+            "pshufd     $0, %%xmm7, %%xmm7          \n\t"
+            "pcmpeqd    %%xmm8, %%xmm8              \n\t"
+            "movdqa     %%xmm8, %%xmm9              \n\t"
+            "psrld      $31, %%xmm9                 \n\t"
+            "movdqa     %%xmm8, %%xmm6              \n\t"
+            "psrld      $24, %%xmm6                 \n\t"
+            "movdqa     %%xmm9, %%xmm8              \n\t"
+            "pslld      $8,  %%xmm8                 \n\t"
+            "pslld      $15, %%xmm9                 \n\t"
+            "movdqa     %9, %%xmm10                 \n\t"
+            "movdqa     %10, %%xmm11                \n\t"
+            ".p2align 4                             \n\t"
+            "1:                                     \n\t"
+            "movdqu     (%3, %2, 4), %%xmm3         \n\t"
+            "pmovzxwd   (%4, %2, 2), %%xmm1         \n\t"
+            "movdqa     %%xmm3, %%xmm2              \n\t"
+            "pslld      $16, %%xmm2                 \n\t"
+            "psrld      $16, %%xmm2                 \n\t" // x
+            "psrld      $16, %%xmm3                 \n\t" // y
+            "pmulld     %%xmm7, %%xmm3              \n\t"
+            "paddd      %%xmm2, %%xmm3              \n\t"
+            "movdqa     %%xmm1, %%xmm0              \n\t"
+            "pand       %%xmm6, %%xmm0              \n\t" // fx
+            "psrld      $8, %%xmm1                  \n\t" // fy
+
+            "pmovsxdq   %%xmm3, %%xmm2              \n\t"
+            "movq       %%xmm2, %0                  \n\t"
+            "pextrq     $1, %%xmm2, %1              \n\t"
+            "pinsrd     $0, (%5, %0), %%xmm4        \n\t"
+            "pinsrd     $0, (%6, %0), %%xmm5        \n\t"
+            "pinsrd     $1, (%5, %1), %%xmm4        \n\t"
+            "pinsrd     $1, (%6, %1), %%xmm5        \n\t"
+            "pshufd     $0xee, %%xmm3, %%xmm2       \n\t"
+            "pmovsxdq   %%xmm2, %%xmm2              \n\t"
+            "movq       %%xmm2, %0                  \n\t"
+            "pextrq     $1, %%xmm2, %1              \n\t"
+            "pinsrd     $2, (%5, %0), %%xmm4        \n\t"
+            "pinsrd     $2, (%6, %0), %%xmm5        \n\t"
+            "pinsrd     $3, (%5, %1), %%xmm4        \n\t"
+            "pinsrd     $3, (%6, %1), %%xmm5        \n\t"
+
+            "pshufb     %%xmm10, %%xmm4             \n\t"
+            "pshufb     %%xmm11, %%xmm5             \n\t"
+            "movdqa     %%xmm0, %%xmm2              \n\t"
+            "pslld      $16, %%xmm2                 \n\t"
+            "psubd      %%xmm0, %%xmm2              \n\t"
+            "paddd      %%xmm8, %%xmm2              \n\t" // fx << 16 | ONE - fx
+            "pmaddwd    %%xmm2, %%xmm4              \n\t" // top
+            "pmaddwd    %%xmm2, %%xmm5              \n\t" // bottom
+            "movdqa     %%xmm8, %%xmm2              \n\t"
+            "psubd      %%xmm1, %%xmm2              \n\t" // ONE - fy
+            "pmulld     %%xmm2, %%xmm4              \n\t"
+            "pmulld     %%xmm1, %%xmm5              \n\t"
+            "paddd      %%xmm5, %%xmm4              \n\t"
+            "paddd      %%xmm9, %%xmm4              \n\t"
+            "psrld      $16, %%xmm4                 \n\t"
+            "packusdw   %%xmm4, %%xmm4              \n\t"
+            "packuswb   %%xmm4, %%xmm4              \n\t"
+            "movd       %%xmm4, (%7, %2)            \n\t"
+            "add        $4, %2                      \n\t"
+            " js 1b                                 \n\t"
+            : "=&r"(t0), "=&r"(t1), "+r"(n)
+            : "r"(xy - n), "r"(frac - n), "r"(src), "r"(src1), "r"(dst - n),
+              "r"((int)linesize), "m"(shuf_top), "m"(shuf_bottom)
+            : XMM_CLOBBERS("xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+                           "xmm6", "xmm7", "xmm8", "xmm9", "xmm10", "xmm11",) "memory"
+        );
+    }
+    n = len & ~3;
+    if (n != len)
+        ff_vr_remap_line_c(dst + n, src, linesize, xy + n, frac + n, len - n);
+}
+#endif
+
+#if HAVE_AVX2_INLINE && ARCH_X86_64
+static void remap_line_avx2(uint8_t *dst, const uint8_t *src, ptrdiff_t linesize,
+                            const uint32_t *xy, const uint16_t *frac, int len)
+{
+    x86_reg n = len & ~7;
+    const uint8_t *src1 = src + linesize - 2;
+
+    if (n) {
+        n = -n;
+        __asm__ volatile(
+            "vmovd        %6, %%xmm7                        \n\t"
+            "vpbroadcastd %%xmm7, %%ymm7                    \n\t"
+            "vpcmpeqd     %%ymm8, %%ymm8, %%ymm8            \n\t"
+            "vpsrld       $31, %%ymm8, %%ymm9               \n\t"
+            "vpsrld       $24, %%ymm8, %%ymm6               \n\t"
+            "vpslld       $8,  %%ymm9, %%ymm8               \n\t"
+            "vpslld       $15, %%ymm9, %%ymm9               \n\t"
+            "vbroadcasti128 %7, %%ymm10                     \n\t"
+            "vbroadcasti128 %8, %%ymm11                     \n\t"
+            ".p2align 4                                     \n\t"
+            "1:                                             \n\t"
+            "vmovdqu      (%1, %0, 4), %%ymm3               \n\t"
+            "vpmovzxwd    (%2, %0, 2), %%ymm1               \n\t"
+            "vpslld       $16, %%ymm3, %%ymm2               \n\t"
+            "vpsrld       $16, %%ymm2, %%ymm2               \n\t" // x
+            "vpsrld       $16, %%ymm3, %%ymm3               \n\t" // y
+            "vpmulld      %%ymm7, %%ymm3, %%ymm3            \n\t"
+            "vpaddd       %%ymm2, %%ymm3, %%ymm3            \n\t"
+            "vpand        %%ymm6, %%ymm1, %%ymm0            \n\t" // fx
+            "vpsrld       $8, %%ymm1, %%ymm1                \n\t" // fy
+            "vpcmpeqd     %%ymm2, %%ymm2, %%ymm2            \n\t"
+            "vpgatherdd   %%ymm2, (%3, %%ymm3, 1), %%ymm4   \n\t"
+            "vpcmpeqd     %%ymm2, %%ymm2, %%ymm2            \n\t"
+            "vpgatherdd   %%ymm2, (%4, %%ymm3, 1), %%ymm5   \n\t"
+
+            "vpshufb      %%ymm10, %%ymm4, %%ymm4           \n\t"
+            "vpshufb      %%ymm11, %%ymm5, %%ymm5           \n\t"
+            "vpslld       $16, %%ymm0, %%ymm2               \n\t"
+            "vpsubd       %%ymm0, %%ymm2, %%ymm2            \n\t"
+            "vpaddd       %%ymm8, %%ymm2, %%ymm2            \n\t" // fx << 16 | ONE - fx
+            "vpmaddwd     %%ymm2, %%ymm4, %%ymm4            \n\t" // top
+            "vpmaddwd     %%ymm2, %%ymm5, %%ymm5            \n\t" // bottom
+            "vpsubd       %%ymm1, %%ymm8, %%ymm2            \n\t" // ONE - fy
+            "vpmulld      %%ymm2, %%ymm4, %%ymm4            \n\t"
+            "vpmulld      %%ymm1, %%ymm5, %%ymm5            \n\t"
+            "vpaddd       %%ymm5, %%ymm4, %%ymm4            \n\t"
+            "vpaddd       %%ymm9, %%ymm4, %%ymm4            \n\t"
+            "vpsrld       $16, %%ymm4, %%ymm4               \n\t"
+            "vpackusdw    %%ymm4, %%ymm4, %%ymm4            \n\t"
+            "vpackuswb    %%ymm4, %%ymm4, %%ymm4            \n\t"
+            "vextracti128 $1, %%ymm4, %%xmm5                \n\t"
+            "vmovd        %%xmm4,  (%5, %0)                 \n\t"
+            "vmovd        %%xmm5, 4(%5, %0)                 \n\t"
+            "add          $8, %0                            \n\t"
+            " js 1b                                         \n\t"
+            "vzeroupper                                     \n\t"
+            : "+r"(n)
+            : "r"(xy - n), "r"(frac - n), "r"(src), "r"(src1), "r"(dst - n),
+              "r"((int)linesize), "m"(shuf_top), "m"(shuf_bottom)
+            : XMM_CLOBBERS("xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+                           "xmm6", "xmm7", "xmm8", "xmm9", "xmm10", "xmm11",) "memory"
+        );
+    }
+    n = len & ~7;
+    if (n != len)
+        ff_vr_remap_line_c(dst + n, src, linesize, xy + n, frac + n, len - n);
+}
+#endif
+
+#if HAVE_SSE2_INLINE
+static void blend_line_sse2(uint8_t *dst, const uint8_t *src, const uint8_t *w, int len)
+{
+    x86_reg n = len & ~7;
+
+    if (n) {
+        n = -n;
+        __asm__ volatile(
+            "pxor       %%xmm7, %%xmm7              \n\t"
+            "pcmpeqw    %%xmm6, %%xmm6              \n\t"
+            "psrlw      $15, %%xmm6                 \n\t"
+            "movdqa     %%xmm6, %%xmm5              \n\t"
+            "psllw      $8, %%xmm6                  \n\t" // 256
+            "psllw      $7, %%xmm5                  \n\t" // 128
+            ".p2align 4                             \n\t"
+            "1:                                     \n\t"
+            "movq       (%1, %0), %%xmm0            \n\t"
+            "movq       (%2, %0), %%xmm1            \n\t"
+            "movq       (%3, %0), %%xmm2            \n\t"
+            "punpcklbw  %%xmm7, %%xmm0              \n\t"
+            "punpcklbw  %%xmm7, %%xmm1              \n\t"
+            "punpcklbw  %%xmm7, %%xmm2              \n\t"
+            "movdqa     %%xmm6, %%xmm3              \n\t"
+            "psubw      %%xmm2, %%xmm3              \n\t"
+            "pmullw     %%xmm3, %%xmm0              \n\t"
+            "pmullw     %%xmm2, %%xmm1              \n\t"
+            "paddw      %%xmm1, %%xmm0              \n\t" // at most 255 * 256, no overflow
+            "paddw      %%xmm5, %%xmm0              \n\t"
+            "psrlw      $8, %%xmm0                  \n\t"
+            "packuswb   %%xmm0, %%xmm0              \n\t"
+            "movq       %%xmm0, (%1, %0)            \n\t"
+            "add        $8, %0                      \n\t"
+            " js 1b                                 \n\t"
+            : "+r"(n)
+            : "r"(dst - n), "r"(src - n), "r"(w - n)
+            : XMM_CLOBBERS("xmm0", "xmm1", "xmm2", "xmm3", "xmm5", "xmm6", "xmm7",)
+              "memory"
+        );
+    }
+    n = len & ~7;
+    if (n != len)
+        ff_vr_blend_line_c(dst + n, src + n, w + n, len - n);
+}
+
+static void blend_bands_sse2(int16_t *a, const int16_t *b, const int16_t *m, int len)
+{
+    x86_reg n = len & ~7;
+
+    if (n) {
+        n = -n;
+        __asm__ volatile(
+            "pcmpeqw    %%xmm6, %%xmm6              \n\t"
+            "psrlw      $15, %%xmm6                 \n\t"
+            "psllw      $8, %%xmm6                  \n\t" // 256
+            "pcmpeqd    %%xmm7, %%xmm7              \n\t"
+            "psrld      $31, %%xmm7                 \n\t"
+            "pslld      $7, %%xmm7                  \n\t" // 128
+            ".p2align 4                             \n\t"
+            "1:                                     \n\t"
+            "movdqu     (%1, %0, 2), %%xmm0         \n\t"
+            "movdqu     (%2, %0, 2), %%xmm1         \n\t"
+            "movdqu     (%3, %0, 2), %%xmm2         \n\t"
+            "movdqa     %%xmm6, %%xmm3              \n\t"
+            "psubw      %%xmm2, %%xmm3              \n\t"
+            "movdqa     %%xmm0, %%xmm4              \n\t"
+            "punpcklwd  %%xmm1, %%xmm0              \n\t"
+            "punpckhwd  %%xmm1, %%xmm4              \n\t" // a, b pairs
+            "movdqa     %%xmm3, %%xmm1              \n\t"
+            "punpcklwd  %%xmm2, %%xmm3              \n\t"
+            "punpckhwd  %%xmm2, %%xmm1              \n\t" // 256 - m, m pairs
+            "pmaddwd    %%xmm3, %%xmm0              \n\t"
+            "pmaddwd    %%xmm1, %%xmm4              \n\t"
+            "paddd      %%xmm7, %%xmm0              \n\t"
+            "paddd      %%xmm7, %%xmm4              \n\t"
+            "psrad      $8, %%xmm0                  \n\t"
+            "psrad      $8, %%xmm4                  \n\t"
+            "packssdw   %%xmm4, %%xmm0              \n\t"
+            "movdqu     %%xmm0, (%1, %0, 2)         \n\t"
+            "add        $8, %0                      \n\t"
+            " js 1b                                 \n\t"
+            : "+r"(n)
+            : "r"(a - n), "r"(b - n), "r"(m - n)
+            : XMM_CLOBBERS("xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm6", "xmm7",)
+              "memory"
+        );
+    }
+    n = len & ~7;
+    if (n != len)
+        ff_vr_blend_bands_c(a + n, b + n, m + n, len - n);
+}
+#endif
+
+#if HAVE_MMXEXT_INLINE
+static void prefetch_mmxext(const uint8_t *buf, ptrdiff_t stride, int h)
+{
+    for (; h > 0; h--, buf += stride)
+        __asm__ volatile ("prefetcht0 %0" :: "m"(*buf));
+}
+#endif
+
+av_cold void ff_vr_remap_dsp_init_x86(VRRemapDSPContext *dsp, int step, int depth)
+{
+    int cpu_flags = av_get_cpu_flags();
+
+#if HAVE_MMXEXT_INLINE
+    if (INLINE_MMXEXT(cpu_flags))
+        dsp->prefetch = prefetch_mmxext;
+#endif
+
+#if HAVE_SSE2_INLINE
+    if (INLINE_SSE2(cpu_flags)) {
+        dsp->blend_line  = blend_line_sse2;
+        dsp->blend_bands = blend_bands_sse2;
+    }
+#endif
+    if (step != 1 || depth > 8)
+        return;
+#if HAVE_SSE4_INLINE && ARCH_X86_64
+    if (INLINE_SSE4(cpu_flags))
+        dsp->remap_line = remap_line_sse4;
+#endif
+#if HAVE_AVX2_INLINE && ARCH_X86_64
+    if (INLINE_AVX2(cpu_flags))
+        dsp->remap_line = remap_line_avx2;
+#endif
+}
@@ -20,9 +20,6 @@
  */
 
 #include "config.h"
-#if HAVE_UNISTD_H
-#include <unistd.h>
-#endif
 
 #include "libavutil/avstring.h"
 #include "libavutil/intreadwrite.h"
@@ -34,6 +31,7 @@
 #include "avformat.h"
 #include "avio_internal.h"
 #include "internal.h"
+#include "iothread.h"
 #include "isom.h"
 #include "os_support.h"
 #include "url.h"
@@ -61,7 +59,7 @@ typedef struct OutputStream {
     AVFormatContext *ctx;
     int ctx_inited;
     uint8_t iobuf[32768];
-    URLContext *out;
+    AVIOContext *out;
     int packets_written;
     char initfile[1024];
     int64_t init_start_pos;
@@ -94,13 +92,18 @@ typedef struct DASHContext {
     const char *single_file_name;
     const char *init_seg_name;
     const char *media_seg_name;
+    int async_io;
+    int io_buffer_size;
+    FFIOThread *io;
+    int64_t start_pts;      /* first timestamp of all the representations */
+    AVRational start_tb;
 } DASHContext;
 
 static int dash_write(void *opaque, uint8_t *buf, int buf_size)
 {
     OutputStream *os = opaque;
     if (os->out)
-        ffurl_write(os->out, buf, buf_size);
+        avio_write(os->out, buf, buf_size);
     return buf_size;
 }
 
@@ -182,8 +185,8 @@ static void dash_free(AVFormatContext *s)
             av_write_trailer(os->ctx);
         if (os->ctx && os->ctx->pb)
             av_free(os->ctx->pb);
-        ffurl_close(os->out);
-        os->out =  NULL;
+        if (c->io)
+            ff_io_thread_close(c->io, &os->out);
         if (os->ctx)
             avformat_free_context(os->ctx);
         for (j = 0; j < os->nb_segments; j++)
@@ -440,15 +443,15 @@ static int write_manifest(AVFormatContext *s, int final)
     DASHContext *c = s->priv_data;
     AVIOContext *out;
     char temp_filename[1024];
-    int ret, i;
+    uint8_t *buf;
+    int ret, i, size;
     AVDictionaryEntry *title = av_dict_get(s->metadata, "title", NULL, 0);
 
     snprintf(temp_filename, sizeof(temp_filename), "%s.tmp", s->filename);
-    ret = avio_open2(&out, temp_filename, AVIO_FLAG_WRITE, &s->interrupt_callback, NULL);
-    if (ret < 0) {
-        av_log(s, AV_LOG_ERROR, "Unable to open %s for writing\n", temp_filename);
+    /* The manifest is rendered in memory and written by the I/O worker */
+    ret = avio_open_dyn_buf(&out);
+    if (ret < 0)
         return ret;
-    }
     avio_printf(out, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n");
     avio_printf(out, "<MPD xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\"\n"
                 "\txmlns=\"urn:mpeg:dash:schema:mpd:2011\"\n"
@@ -535,9 +538,8 @@ static int write_manifest(AVFormatContext *s, int final)
     }
     avio_printf(out, "\t</Period>\n");
     avio_printf(out, "</MPD>\n");
-    avio_flush(out);
-    avio_close(out);
-    return ff_rename(temp_filename, s->filename, s);
+    size = avio_close_dyn_buf(out, &buf);
+    return ff_io_thread_write_file(c->io, temp_filename, s->filename, buf, size);
 }
 
 static int dash_write_header(AVFormatContext *s)
@@ -579,6 +581,11 @@ static int dash_write_header(AVFormatContext *s)
         goto fail;
     }
 
+    if ((ret = ff_io_thread_alloc(&c->io, s, &s->interrupt_callback,
+                                  c->async_io, c->io_buffer_size)) < 0)
+        goto fail;
+    c->start_pts = AV_NOPTS_VALUE;
+
     for (i = 0; i < s->nb_streams; i++) {
         OutputStream *os = &c->streams[i];
         AVFormatContext *ctx;
@@ -635,7 +642,7 @@ static int dash_write_header(AVFormatContext *s)
             dash_fill_tmpl_params(os->initfile, sizeof(os->initfile), c->init_seg_name, i, 0, os->bit_rate, 0);
         }
         snprintf(filename, sizeof(filename), "%s%s", c->dirname, os->initfile);
-        ret = ffurl_open(&os->out, filename, AVIO_FLAG_WRITE, &s->interrupt_callback, NULL);
+        ret = ff_io_thread_open(c->io, &os->out, filename, NULL);
         if (ret < 0)
             goto fail;
         os->init_start_pos = 0;
@@ -676,8 +683,10 @@ static int dash_write_header(AVFormatContext *s)
         av_log(s, AV_LOG_VERBOSE, "Manifest written to: %s\n", s->filename);
 
 fail:
-    if (ret)
+    if (ret) {
         dash_free(s);
+        ff_io_thread_free(&c->io);
+    }
     return ret;
 }
 
@@ -804,8 +813,9 @@ static int dash_flush(AVFormatContext *s, int final, int stream)
             av_write_frame(os->ctx, NULL);
             os->init_range_length = avio_tell(os->ctx->pb);
             if (!c->single_file) {
-                ffurl_close(os->out);
-                os->out = NULL;
+                ret = ff_io_thread_close(c->io, &os->out);
+                if (ret < 0)
+                    break;
             }
         }
 
@@ -815,7 +825,7 @@ static int dash_flush(AVFormatContext *s, int final, int stream)
             dash_fill_tmpl_params(filename, sizeof(filename), c->media_seg_name, i, os->segment_index, os->bit_rate, os->start_pts);
             snprintf(full_path, sizeof(full_path), "%s%s", c->dirname, filename);
             snprintf(temp_path, sizeof(temp_path), "%s.tmp", full_path);
-            ret = ffurl_open(&os->out, temp_path, AVIO_FLAG_WRITE, &s->interrupt_callback, NULL);
+            ret = ff_io_thread_open(c->io, &os->out, temp_path, NULL);
             if (ret < 0)
                 break;
             write_styp(os->ctx->pb);
@@ -829,11 +839,15 @@ static int dash_flush(AVFormatContext *s, int final, int stream)
 
         range_length = avio_tell(os->ctx->pb) - start_pos;
         if (c->single_file) {
+            /* The index is read back from the file */
+            ret = ff_io_thread_flush(c->io, os->out);
+            if (ret < 0)
+                break;
             find_index_range(s, full_path, start_pos, &index_length);
         } else {
-            ffurl_close(os->out);
-            os->out = NULL;
-            ret = ff_rename(temp_path, full_path, s);
+            ret = ff_io_thread_close(c->io, &os->out);
+            if (ret >= 0)
+                ret = ff_io_thread_rename(c->io, temp_path, full_path);
             if (ret < 0)
                 break;
         }
@@ -852,7 +866,7 @@ static int dash_flush(AVFormatContext *s, int final, int stream)
                 for (j = 0; j < remove; j++) {
                     char filename[1024];
                     snprintf(filename, sizeof(filename), "%s%s", c->dirname, os->segments[j]->file);
-                    unlink(filename);
+                    ff_io_thread_delete(c->io, filename);
                     av_free(os->segments[j]);
                 }
                 os->nb_segments -= remove;
@@ -898,11 +912,18 @@ static int dash_write_packet(AVFormatContext *s, AVPacket *pkt)
 
     if (os->first_pts == AV_NOPTS_VALUE)
         os->first_pts = pkt->pts;
+    if (c->start_pts == AV_NOPTS_VALUE) {
+        c->start_pts = pkt->pts;
+        c->start_tb  = st->time_base;
+    }
 
+    // Segment boundaries are counted from the start of the first
+    // representation, so that all the representations are cut on
+    // the same keyframes.
     if ((!c->has_video || st->codec->codec_type == AVMEDIA_TYPE_VIDEO) &&
         pkt->flags & AV_PKT_FLAG_KEY && os->packets_written &&
-        av_compare_ts(pkt->pts - os->first_pts, st->time_base,
-                      seg_end_duration, AV_TIME_BASE_Q) >= 0) {
+        av_compare_ts(pkt->pts - av_rescale_q(c->start_pts, c->start_tb, st->time_base),
+                      st->time_base, seg_end_duration, AV_TIME_BASE_Q) >= 0) {
         int64_t prev_duration = c->last_duration;
 
         c->last_duration = av_rescale_q(pkt->pts - os->start_pts,
@@ -945,6 +966,7 @@ static int dash_write_packet(AVFormatContext *s, AVPacket *pkt)
 static int dash_write_trailer(AVFormatContext *s)
 {
     DASHContext *c = s->priv_data;
+    int ret;
 
     if (s->nb_streams > 0) {
         OutputStream *os = &c->streams[0];
@@ -966,13 +988,14 @@ static int dash_write_trailer(AVFormatContext *s)
         for (i = 0; i < s->nb_streams; i++) {
             OutputStream *os = &c->streams[i];
             snprintf(filename, sizeof(filename), "%s%s", c->dirname, os->initfile);
-            unlink(filename);
+            ff_io_thread_delete(c->io, filename);
         }
-        unlink(s->filename);
+        ff_io_thread_delete(c->io, s->filename);
     }
 
     dash_free(s);
-    return 0;
+    ret = ff_io_thread_free(&c->io);
+    return ret;
 }
 
 #define OFFSET(x) offsetof(DASHContext, x)
@@ -988,6 +1011,8 @@ static const AVOption options[] = {
     { "single_file_name", "DASH-templated name to be used for baseURL. Implies storing all segments in one file, accessed using byte ranges", OFFSET(single_file_name), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, E },
     { "init_seg_name", "DASH-templated name to used for the initialization segment", OFFSET(init_seg_name), AV_OPT_TYPE_STRING, {.str = "init-stream$RepresentationID$.m4s"}, 0, 0, E },
     { "media_seg_name", "DASH-templated name to used for the media segments", OFFSET(media_seg_name), AV_OPT_TYPE_STRING, {.str = "chunk-stream$RepresentationID$-$Number%05d$.m4s"}, 0, 0, E },
+    { "async_io", "write segments and manifests from a background thread", OFFSET(async_io), AV_OPT_TYPE_INT, { .i64 = 1 }, 0, 1, E },
+    { "io_buffer_size", "maximum bytes waiting to be written by the background thread", OFFSET(io_buffer_size), AV_OPT_TYPE_INT, { .i64 = 16 * 1024 * 1024 }, 0, INT_MAX, E },
     { NULL },
 };
 
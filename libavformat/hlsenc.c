@@ -30,12 +30,15 @@
 #include "libavutil/mathematics.h"
 #include "libavutil/parseutils.h"
 #include "libavutil/avstring.h"
+#include "libavutil/bprint.h"
 #include "libavutil/opt.h"
 #include "libavutil/log.h"
 #include "libavutil/time_internal.h"
 
 #include "avformat.h"
+#include "avio_internal.h"
 #include "internal.h"
+#include "iothread.h"
 #include "os_support.h"
 
 #define KEYSIZE 16
@@ -63,29 +66,16 @@ typedef enum HLSFlags {
     HLS_OMIT_ENDLIST = (1 << 4),
 } HLSFlags;
 
-typedef struct HLSContext {
-    const AVClass *class;  // Class for private options.
+/* One rendition, with its own segments and playlist */
+typedef struct VariantStream {
     unsigned number;
     int64_t sequence;
-    int64_t start_sequence;
-    AVOutputFormat *oformat;
-    AVOutputFormat *vtt_oformat;
 
     AVFormatContext *avf;
     AVFormatContext *vtt_avf;
 
-    float time;            // Set by a private option.
-    int max_nb_segments;   // Set by a private option.
-    int  wrap;             // Set by a private option.
-    uint32_t flags;        // enum HLSFlags
-    char *segment_filename;
-
-    int use_localtime;      ///< flag to expand filename with localtime
-    int allowcache;
-    int64_t recording_time;
     int has_video;
     int has_subtitle;
-    int64_t start_pts;
     int64_t end_pts;
     double duration;      // last segment duration computed so far, in seconds
     int64_t start_pos;    // last segment starting position
@@ -97,9 +87,39 @@ typedef struct HLSContext {
     HLSSegment *last_segment;
     HLSSegment *old_segments;
 
+    char *m3u8_name;
     char *basename;
     char *vtt_basename;
     char *vtt_m3u8_name;
+
+    AVStream **streams;   // muxer streams written to this variant
+    unsigned nb_streams;
+} VariantStream;
+
+typedef struct HLSContext {
+    const AVClass *class;  // Class for private options.
+    int64_t start_sequence;
+    AVOutputFormat *oformat;
+    AVOutputFormat *vtt_oformat;
+
+    float time;            // Set by a private option.
+    int max_nb_segments;   // Set by a private option.
+    int  wrap;             // Set by a private option.
+    uint32_t flags;        // enum HLSFlags
+    char *segment_filename;
+
+    int use_localtime;      ///< flag to expand filename with localtime
+    int allowcache;
+    int64_t recording_time;
+    int64_t start_pts;      // first timestamp of all the variants
+    AVRational start_tb;
+
+    VariantStream *var_streams;
+    unsigned nb_varstreams;
+    char *var_stream_map;   // Set by a private option.
+    char *master_pl_name;   // Set by a private option.
+    int master_pl_written;
+
     char *baseurl;
     char *format_options_str;
     char *vtt_format_options_str;
@@ -113,9 +133,13 @@ typedef struct HLSContext {
     char iv_string[KEYSIZE*2 + 1];
     AVDictionary *vtt_format_options;
 
+    FFIOThread *io;         ///< performs the file system operations
+    int async_io;
+    int io_buffer_size;
+
 } HLSContext;
 
-static int hls_delete_old_segments(HLSContext *hls) {
+static int hls_delete_old_segments(HLSContext *hls, VariantStream *vs) {
 
     HLSSegment *segment, *previous_segment = NULL;
     float playlist_duration = 0.0f;
@@ -123,13 +147,13 @@ static int hls_delete_old_segments(HLSContext *hls) {
     char *dirname = NULL, *p, *sub_path;
     char *path = NULL;
 
-    segment = hls->segments;
+    segment = vs->segments;
     while (segment) {
         playlist_duration += segment->duration;
         segment = segment->next;
     }
 
-    segment = hls->old_segments;
+    segment = vs->old_segments;
     while (segment) {
         playlist_duration -= segment->duration;
         previous_segment = segment;
@@ -142,9 +166,9 @@ static int hls_delete_old_segments(HLSContext *hls) {
 
     if (segment) {
         if (hls->segment_filename) {
-            dirname = av_strdup(hls->segment_filename);
+            dirname = av_strdup(vs->basename);
         } else {
-            dirname = av_strdup(hls->avf->filename);
+            dirname = av_strdup(vs->avf->filename);
         }
         if (!dirname) {
             ret = AVERROR(ENOMEM);
@@ -166,10 +190,8 @@ static int hls_delete_old_segments(HLSContext *hls) {
 
         av_strlcpy(path, dirname, path_size);
         av_strlcat(path, segment->filename, path_size);
-        if (unlink(path) < 0) {
-            av_log(hls, AV_LOG_ERROR, "failed to delete old segment %s: %s\n",
-                                     path, strerror(errno));
-        }
+        if ((ret = ff_io_thread_delete(hls->io, path)) < 0)
+            goto fail;
 
         if (segment->sub_filename[0] != '\0') {
             sub_path_size = strlen(dirname) + strlen(segment->sub_filename) + 1;
@@ -181,11 +203,10 @@ static int hls_delete_old_segments(HLSContext *hls) {
 
             av_strlcpy(sub_path, dirname, sub_path_size);
             av_strlcat(sub_path, segment->sub_filename, sub_path_size);
-            if (unlink(sub_path) < 0) {
-                av_log(hls, AV_LOG_ERROR, "failed to delete old segment %s: %s\n",
-                                         sub_path, strerror(errno));
-            }
+            ret = ff_io_thread_delete(hls->io, sub_path);
             av_free(sub_path);
+            if (ret < 0)
+                goto fail;
         }
         av_freep(&path);
         previous_segment = segment;
@@ -254,17 +275,17 @@ static int hls_encryption_start(AVFormatContext *s)
     return 0;
 }
 
-static int hls_mux_init(AVFormatContext *s)
+static int hls_mux_init(AVFormatContext *s, VariantStream *vs)
 {
     HLSContext *hls = s->priv_data;
     AVFormatContext *oc;
     AVFormatContext *vtt_oc = NULL;
     int i, ret;
 
-    ret = avformat_alloc_output_context2(&hls->avf, hls->oformat, NULL, NULL);
+    ret = avformat_alloc_output_context2(&vs->avf, hls->oformat, NULL, NULL);
     if (ret < 0)
         return ret;
-    oc = hls->avf;
+    oc = vs->avf;
 
     oc->oformat            = hls->oformat;
     oc->interrupt_callback = s->interrupt_callback;
@@ -272,36 +293,36 @@ static int hls_mux_init(AVFormatContext *s)
     av_dict_copy(&oc->metadata, s->metadata, 0);
 
     if(hls->vtt_oformat) {
-        ret = avformat_alloc_output_context2(&hls->vtt_avf, hls->vtt_oformat, NULL, NULL);
+        ret = avformat_alloc_output_context2(&vs->vtt_avf, hls->vtt_oformat, NULL, NULL);
         if (ret < 0)
             return ret;
-        vtt_oc          = hls->vtt_avf;
+        vtt_oc          = vs->vtt_avf;
         vtt_oc->oformat = hls->vtt_oformat;
         av_dict_copy(&vtt_oc->metadata, s->metadata, 0);
     }
 
-    for (i = 0; i < s->nb_streams; i++) {
+    for (i = 0; i < vs->nb_streams; i++) {
         AVStream *st;
         AVFormatContext *loc;
-        if (s->streams[i]->codec->codec_type == AVMEDIA_TYPE_SUBTITLE)
+        if (vs->streams[i]->codec->codec_type == AVMEDIA_TYPE_SUBTITLE)
             loc = vtt_oc;
         else
             loc = oc;
 
         if (!(st = avformat_new_stream(loc, NULL)))
             return AVERROR(ENOMEM);
-        avcodec_copy_context(st->codec, s->streams[i]->codec);
-        st->sample_aspect_ratio = s->streams[i]->sample_aspect_ratio;
-        st->time_base = s->streams[i]->time_base;
+        avcodec_copy_context(st->codec, vs->streams[i]->codec);
+        st->sample_aspect_ratio = vs->streams[i]->sample_aspect_ratio;
+        st->time_base = vs->streams[i]->time_base;
     }
-    hls->start_pos = 0;
+    vs->start_pos = 0;
 
     return 0;
 }
 
 /* Create a new segment and append it to the segment list */
-static int hls_append_segment(HLSContext *hls, double duration, int64_t pos,
-                              int64_t size)
+static int hls_append_segment(HLSContext *hls, VariantStream *vs,
+                              double duration, int64_t pos, int64_t size)
 {
     HLSSegment *en = av_malloc(sizeof(*en));
     int ret;
@@ -309,10 +330,10 @@ static int hls_append_segment(HLSContext *hls, double duration, int64_t pos,
     if (!en)
         return AVERROR(ENOMEM);
 
-    av_strlcpy(en->filename, av_basename(hls->avf->filename), sizeof(en->filename));
+    av_strlcpy(en->filename, av_basename(vs->avf->filename), sizeof(en->filename));
 
-    if(hls->has_subtitle)
-        av_strlcpy(en->sub_filename, av_basename(hls->vtt_avf->filename), sizeof(en->sub_filename));
+    if(vs->has_subtitle)
+        av_strlcpy(en->sub_filename, av_basename(vs->vtt_avf->filename), sizeof(en->sub_filename));
     else
         en->sub_filename[0] = '\0';
 
@@ -326,28 +347,28 @@ static int hls_append_segment(HLSContext *hls, double duration, int64_t pos,
         av_strlcpy(en->iv_string, hls->iv_string, sizeof(en->iv_string));
     }
 
-    if (!hls->segments)
-        hls->segments = en;
+    if (!vs->segments)
+        vs->segments = en;
     else
-        hls->last_segment->next = en;
+        vs->last_segment->next = en;
 
-    hls->last_segment = en;
+    vs->last_segment = en;
 
-    if (hls->max_nb_segments && hls->nb_entries >= hls->max_nb_segments) {
-        en = hls->segments;
-        hls->segments = en->next;
+    if (hls->max_nb_segments && vs->nb_entries >= hls->max_nb_segments) {
+        en = vs->segments;
+        vs->segments = en->next;
         if (en && hls->flags & HLS_DELETE_SEGMENTS &&
                 !(hls->flags & HLS_SINGLE_FILE || hls->wrap)) {
-            en->next = hls->old_segments;
-            hls->old_segments = en;
-            if ((ret = hls_delete_old_segments(hls)) < 0)
+            en->next = vs->old_segments;
+            vs->old_segments = en;
+            if ((ret = hls_delete_old_segments(hls, vs)) < 0)
                 return ret;
         } else
             av_free(en);
     } else
-        hls->nb_entries++;
+        vs->nb_entries++;
 
-    hls->sequence++;
+    vs->sequence++;
 
     return 0;
 }
@@ -363,7 +384,7 @@ static void hls_free_segments(HLSSegment *p)
     }
 }
 
-static int hls_window(AVFormatContext *s, int last)
+static int hls_window(AVFormatContext *s, VariantStream *vs, int last)
 {
     HLSContext *hls = s->priv_data;
     HLSSegment *en;
@@ -371,10 +392,12 @@ static int hls_window(AVFormatContext *s, int last)
     int ret = 0;
     AVIOContext *out = NULL;
     AVIOContext *sub_out = NULL;
+    uint8_t *buf;
+    int size;
     char temp_filename[1024];
-    int64_t sequence = FFMAX(hls->start_sequence, hls->sequence - hls->nb_entries);
+    int64_t sequence = FFMAX(hls->start_sequence, vs->sequence - vs->nb_entries);
     int version = hls->flags & HLS_SINGLE_FILE ? 4 : 3;
-    const char *proto = avio_find_protocol_name(s->filename);
+    const char *proto = avio_find_protocol_name(vs->m3u8_name);
     int use_rename = proto && !strcmp(proto, "file");
     static unsigned warned_non_file;
     char *key_uri = NULL;
@@ -383,17 +406,16 @@ static int hls_window(AVFormatContext *s, int last)
     if (!use_rename && !warned_non_file++)
         av_log(s, AV_LOG_ERROR, "Cannot use rename on non file protocol, this may lead to races and temporarly partial files\n");
 
-    snprintf(temp_filename, sizeof(temp_filename), use_rename ? "%s.tmp" : "%s", s->filename);
-    if ((ret = avio_open2(&out, temp_filename, AVIO_FLAG_WRITE,
-                          &s->interrupt_callback, NULL)) < 0)
+    snprintf(temp_filename, sizeof(temp_filename), use_rename ? "%s.tmp" : "%s", vs->m3u8_name);
+    if ((ret = avio_open_dyn_buf(&out)) < 0)
         goto fail;
 
-    for (en = hls->segments; en; en = en->next) {
+    for (en = vs->segments; en; en = en->next) {
         if (target_duration < en->duration)
             target_duration = ceil(en->duration);
     }
 
-    hls->discontinuity_set = 0;
+    vs->discontinuity_set = 0;
     avio_printf(out, "#EXTM3U\n");
     avio_printf(out, "#EXT-X-VERSION:%d\n", version);
     if (hls->allowcache == 0 || hls->allowcache == 1) {
@@ -404,11 +426,11 @@ static int hls_window(AVFormatContext *s, int last)
 
     av_log(s, AV_LOG_VERBOSE, "EXT-X-MEDIA-SEQUENCE:%"PRId64"\n",
            sequence);
-    if((hls->flags & HLS_DISCONT_START) && sequence==hls->start_sequence && hls->discontinuity_set==0 ){
+    if((hls->flags & HLS_DISCONT_START) && sequence==hls->start_sequence && vs->discontinuity_set==0 ){
         avio_printf(out, "#EXT-X-DISCONTINUITY\n");
-        hls->discontinuity_set = 1;
+        vs->discontinuity_set = 1;
     }
-    for (en = hls->segments; en; en = en->next) {
+    for (en = vs->segments; en; en = en->next) {
         if (hls->key_info_file && (!key_uri || strcmp(en->key_uri, key_uri) ||
                                     av_strcasecmp(en->iv_string, iv_string))) {
             avio_printf(out, "#EXT-X-KEY:METHOD=AES-128,URI=\"%s\"", en->key_uri);
@@ -434,9 +456,8 @@ static int hls_window(AVFormatContext *s, int last)
     if (last && (hls->flags & HLS_OMIT_ENDLIST)==0)
         avio_printf(out, "#EXT-X-ENDLIST\n");
 
-    if( hls->vtt_m3u8_name ) {
-        if ((ret = avio_open2(&sub_out, hls->vtt_m3u8_name, AVIO_FLAG_WRITE,
-                          &s->interrupt_callback, NULL)) < 0)
+    if( vs->vtt_m3u8_name ) {
+        if ((ret = avio_open_dyn_buf(&sub_out)) < 0)
             goto fail;
         avio_printf(sub_out, "#EXTM3U\n");
         avio_printf(sub_out, "#EXT-X-VERSION:%d\n", version);
@@ -449,7 +470,7 @@ static int hls_window(AVFormatContext *s, int last)
         av_log(s, AV_LOG_VERBOSE, "EXT-X-MEDIA-SEQUENCE:%"PRId64"\n",
                sequence);
 
-        for (en = hls->segments; en; en = en->next) {
+        for (en = vs->segments; en; en = en->next) {
             avio_printf(sub_out, "#EXTINF:%f,\n", en->duration);
             if (hls->flags & HLS_SINGLE_FILE)
                  avio_printf(sub_out, "#EXT-X-BYTERANGE:%"PRIi64"@%"PRIi64"\n",
@@ -464,28 +485,39 @@ static int hls_window(AVFormatContext *s, int last)
 
     }
 
+    size = avio_close_dyn_buf(out, &buf);
+    out  = NULL;
+    if ((ret = ff_io_thread_write_file(hls->io, temp_filename,
+                                       use_rename ? vs->m3u8_name : NULL,
+                                       buf, size)) < 0)
+        goto fail;
+    if (sub_out) {
+        size    = avio_close_dyn_buf(sub_out, &buf);
+        sub_out = NULL;
+        ret = ff_io_thread_write_file(hls->io, vs->vtt_m3u8_name, NULL,
+                                      buf, size);
+    }
+
 fail:
-    avio_closep(&out);
-    avio_closep(&sub_out);
-    if (ret >= 0 && use_rename)
-        ff_rename(temp_filename, s->filename, s);
+    ffio_free_dyn_buf(&out);
+    ffio_free_dyn_buf(&sub_out);
     return ret;
 }
 
-static int hls_start(AVFormatContext *s)
+static int hls_start(AVFormatContext *s, VariantStream *vs)
 {
     HLSContext *c = s->priv_data;
-    AVFormatContext *oc = c->avf;
-    AVFormatContext *vtt_oc = c->vtt_avf;
+    AVFormatContext *oc = vs->avf;
+    AVFormatContext *vtt_oc = vs->vtt_avf;
     AVDictionary *options = NULL;
     char *filename, iv_string[KEYSIZE*2 + 1];
     int err = 0;
 
     if (c->flags & HLS_SINGLE_FILE) {
-        av_strlcpy(oc->filename, c->basename,
+        av_strlcpy(oc->filename, vs->basename,
                    sizeof(oc->filename));
-        if (c->vtt_basename)
-            av_strlcpy(vtt_oc->filename, c->vtt_basename,
+        if (vs->vtt_basename)
+            av_strlcpy(vtt_oc->filename, vs->vtt_basename,
                   sizeof(vtt_oc->filename));
     } else {
         if (c->use_localtime) {
@@ -493,24 +525,24 @@ static int hls_start(AVFormatContext *s)
             struct tm *tm, tmpbuf;
             time(&now0);
             tm = localtime_r(&now0, &tmpbuf);
-            if (!strftime(oc->filename, sizeof(oc->filename), c->basename, tm)) {
+            if (!strftime(oc->filename, sizeof(oc->filename), vs->basename, tm)) {
                 av_log(oc, AV_LOG_ERROR, "Could not get segment filename with use_localtime\n");
                 return AVERROR(EINVAL);
             }
        } else if (av_get_frame_filename(oc->filename, sizeof(oc->filename),
-                                  c->basename, c->wrap ? c->sequence % c->wrap : c->sequence) < 0) {
-            av_log(oc, AV_LOG_ERROR, "Invalid segment filename template '%s' you can try use -use_localtime 1 with it\n", c->basename);
+                                  vs->basename, c->wrap ? vs->sequence % c->wrap : vs->sequence) < 0) {
+            av_log(oc, AV_LOG_ERROR, "Invalid segment filename template '%s' you can try use -use_localtime 1 with it\n", vs->basename);
             return AVERROR(EINVAL);
         }
-        if( c->vtt_basename) {
+        if( vs->vtt_basename) {
             if (av_get_frame_filename(vtt_oc->filename, sizeof(vtt_oc->filename),
-                              c->vtt_basename, c->wrap ? c->sequence % c->wrap : c->sequence) < 0) {
-                av_log(vtt_oc, AV_LOG_ERROR, "Invalid segment filename template '%s'\n", c->vtt_basename);
+                              vs->vtt_basename, c->wrap ? vs->sequence % c->wrap : vs->sequence) < 0) {
+                av_log(vtt_oc, AV_LOG_ERROR, "Invalid segment filename template '%s'\n", vs->vtt_basename);
                 return AVERROR(EINVAL);
             }
        }
     }
-    c->number++;
+    vs->number++;
 
     if (c->key_info_file) {
         if ((err = hls_encryption_start(s)) < 0)
@@ -520,7 +552,7 @@ static int hls_start(AVFormatContext *s)
             return err;
         err = av_strlcpy(iv_string, c->iv_string, sizeof(iv_string));
         if (!err)
-            snprintf(iv_string, sizeof(iv_string), "%032"PRIx64, c->sequence);
+            snprintf(iv_string, sizeof(iv_string), "%032"PRIx64, vs->sequence);
         if ((err = av_dict_set(&options, "encryption_iv", iv_string, 0)) < 0)
             return err;
 
@@ -529,26 +561,24 @@ static int hls_start(AVFormatContext *s)
             av_dict_free(&options);
             return AVERROR(ENOMEM);
         }
-        err = avio_open2(&oc->pb, filename, AVIO_FLAG_WRITE,
-                         &s->interrupt_callback, &options);
+        err = ff_io_thread_open(c->io, &oc->pb, filename, &options);
         av_free(filename);
         av_dict_free(&options);
         if (err < 0)
             return err;
     } else
-        if ((err = avio_open2(&oc->pb, oc->filename, AVIO_FLAG_WRITE,
-                          &s->interrupt_callback, NULL)) < 0)
+        if ((err = ff_io_thread_open(c->io, &oc->pb, oc->filename, NULL)) < 0)
             return err;
-    if (c->vtt_basename) {
-        if ((err = avio_open2(&vtt_oc->pb, vtt_oc->filename, AVIO_FLAG_WRITE,
-                         &s->interrupt_callback, NULL)) < 0)
+    if (vs->vtt_basename) {
+        if ((err = ff_io_thread_open(c->io, &vtt_oc->pb, vtt_oc->filename,
+                                     NULL)) < 0)
             return err;
     }
 
     if (oc->oformat->priv_class && oc->priv_data)
         av_opt_set(oc->priv_data, "mpegts_flags", "resend_headers", 0);
 
-    if (c->vtt_basename) {
+    if (vs->vtt_basename) {
         err = avformat_write_header(vtt_oc,NULL);
         if (err < 0)
             return err;
@@ -557,143 +587,428 @@ static int hls_start(AVFormatContext *s)
     return 0;
 }
 
-static int hls_write_header(AVFormatContext *s)
+/**
+ * Return the index of st in the muxer of vs, or -1 if vs does not hold it.
+ */
+static int hls_inner_stream_index(VariantStream *vs, AVStream *st)
+{
+    int i, index = 0;
+
+    for (i = 0; i < vs->nb_streams; i++) {
+        if (vs->streams[i] == st)
+            return st->codec->codec_type == AVMEDIA_TYPE_SUBTITLE ? 0 : index;
+        if (vs->streams[i]->codec->codec_type != AVMEDIA_TYPE_SUBTITLE)
+            index++;
+    }
+    return -1;
+}
+
+static int hls_master_playlist(AVFormatContext *s)
 {
     HLSContext *hls = s->priv_data;
-    int ret, i;
-    char *p;
-    const char *pattern = "%d.ts";
-    const char *pattern_localtime_fmt = "-%s.ts";
-    const char *vtt_pattern = "%d.vtt";
-    AVDictionary *options = NULL;
-    int basename_size;
-    int vtt_basename_size;
+    VariantStream *vs;
+    HLSSegment *en;
+    AVIOContext *out = NULL;
+    char master_name[1024], temp_filename[1024];
+    const char *proto, *dir_end, *uri;
+    uint8_t *buf;
+    int size, dir_len, ret, i, j;
+
+    /* The master playlist goes next to the playlist of the first variant */
+    dir_end = av_basename(hls->var_streams[0].m3u8_name);
+    dir_len = dir_end - hls->var_streams[0].m3u8_name;
+    if (dir_len >= sizeof(master_name))
+        return AVERROR(EINVAL);
+    av_strlcpy(master_name, hls->var_streams[0].m3u8_name, dir_len + 1);
+    av_strlcat(master_name, hls->master_pl_name, sizeof(master_name));
 
-    hls->sequence       = hls->start_sequence;
-    hls->recording_time = hls->time * AV_TIME_BASE;
-    hls->start_pts      = AV_NOPTS_VALUE;
+    proto = avio_find_protocol_name(master_name);
+    snprintf(temp_filename, sizeof(temp_filename),
+             proto && !strcmp(proto, "file") ? "%s.tmp" : "%s", master_name);
 
-    if (hls->format_options_str) {
-        ret = av_dict_parse_string(&hls->format_options, hls->format_options_str, "=", ":", 0);
-        if (ret < 0) {
-            av_log(s, AV_LOG_ERROR, "Could not parse format options list '%s'\n", hls->format_options_str);
-            goto fail;
+    if ((ret = avio_open_dyn_buf(&out)) < 0)
+        return ret;
+
+    avio_printf(out, "#EXTM3U\n");
+    avio_printf(out, "#EXT-X-VERSION:%d\n", hls->flags & HLS_SINGLE_FILE ? 4 : 3);
+    for (i = 0; i < hls->nb_varstreams; i++) {
+        AVCodecContext *video = NULL;
+        int64_t bandwidth = 0;
+
+        vs = &hls->var_streams[i];
+        for (j = 0; j < vs->nb_streams; j++) {
+            AVCodecContext *codec = vs->streams[j]->codec;
+            bandwidth += FFMAX(codec->bit_rate, codec->rc_max_rate);
+            if (codec->codec_type == AVMEDIA_TYPE_VIDEO && !video)
+                video = codec;
         }
+        if (bandwidth) {
+            bandwidth += bandwidth / 10;
+        } else {
+            /* Nothing declared, use the peak rate of the segments so far */
+            for (en = vs->segments; en; en = en->next)
+                if (en->duration > 0)
+                    bandwidth = FFMAX(bandwidth, en->size * 8 / en->duration);
+        }
+
+        uri = vs->m3u8_name;
+        if (!strncmp(uri, master_name, dir_len))
+            uri += dir_len;
+
+        avio_printf(out, "#EXT-X-STREAM-INF:BANDWIDTH=%"PRId64, bandwidth);
+        if (video && video->width > 0 && video->height > 0)
+            avio_printf(out, ",RESOLUTION=%dx%d", video->width, video->height);
+        avio_printf(out, "\n%s\n", uri);
     }
 
-    for (i = 0; i < s->nb_streams; i++) {
-        hls->has_video +=
-            s->streams[i]->codec->codec_type == AVMEDIA_TYPE_VIDEO;
-        hls->has_subtitle +=
-            s->streams[i]->codec->codec_type == AVMEDIA_TYPE_SUBTITLE;
+    size = avio_close_dyn_buf(out, &buf);
+    ret  = ff_io_thread_write_file(hls->io, temp_filename,
+                                   strcmp(temp_filename, master_name) ? master_name : NULL,
+                                   buf, size);
+    if (ret >= 0)
+        hls->master_pl_written = 1;
+    return ret;
+}
+
+/**
+ * Return a copy of name with each "%v" replaced by the variant index.
+ */
+static char *variant_name(const char *name, int index)
+{
+    AVBPrint bp;
+    const char *p;
+    char *ret;
+
+    av_bprint_init(&bp, 0, AV_BPRINT_SIZE_UNLIMITED);
+    while ((p = strstr(name, "%v"))) {
+        av_bprint_append_data(&bp, name, p - name);
+        av_bprintf(&bp, "%d", index);
+        name = p + 2;
     }
+    av_bprintf(&bp, "%s", name);
+    if (av_bprint_finalize(&bp, &ret) < 0)
+        return NULL;
+    return ret;
+}
 
-    if (hls->has_video > 1)
-        av_log(s, AV_LOG_WARNING,
-               "More than a single video stream present, "
-               "expect issues decoding it.\n");
+static int parse_variant_stream_map(AVFormatContext *s)
+{
+    HLSContext *hls = s->priv_data;
+    VariantStream *vs;
+    char *map, *varstr, *keyval, *saveptr1 = NULL, *saveptr2 = NULL;
+    int i, ret = 0;
 
-    hls->oformat = av_guess_format("mpegts", NULL, NULL);
+    if (!hls->var_stream_map) {
+        hls->var_streams = av_mallocz(sizeof(*hls->var_streams));
+        if (!hls->var_streams)
+            return AVERROR(ENOMEM);
+        hls->nb_varstreams = 1;
+        vs = &hls->var_streams[0];
+        vs->streams = av_malloc_array(s->nb_streams, sizeof(*vs->streams));
+        if (!vs->streams)
+            return AVERROR(ENOMEM);
+        for (i = 0; i < s->nb_streams; i++)
+            vs->streams[vs->nb_streams++] = s->streams[i];
+        return 0;
+    }
 
-    if (!hls->oformat) {
-        ret = AVERROR_MUXER_NOT_FOUND;
+    map = av_strdup(hls->var_stream_map);
+    if (!map)
+        return AVERROR(ENOMEM);
+    /* Variants are separated by spaces, their streams by commas */
+    for (varstr = map; *varstr; varstr++)
+        if (*varstr == ' ' || *varstr == '\t')
+            hls->nb_varstreams++;
+    hls->nb_varstreams++;
+    hls->var_streams = av_mallocz_array(hls->nb_varstreams,
+                                        sizeof(*hls->var_streams));
+    if (!hls->var_streams) {
+        ret = AVERROR(ENOMEM);
         goto fail;
     }
 
-    if(hls->has_subtitle) {
-        hls->vtt_oformat = av_guess_format("webvtt", NULL, NULL);
-        if (!hls->oformat) {
-            ret = AVERROR_MUXER_NOT_FOUND;
+    hls->nb_varstreams = 0;
+    while ((varstr = av_strtok(hls->nb_varstreams ? NULL : map, " \t",
+                               &saveptr1))) {
+        vs = &hls->var_streams[hls->nb_varstreams++];
+        vs->streams = av_malloc_array(s->nb_streams, sizeof(*vs->streams));
+        if (!vs->streams) {
+            ret = AVERROR(ENOMEM);
             goto fail;
         }
+        saveptr2 = NULL;
+        while ((keyval = av_strtok(vs->nb_streams ? NULL : varstr, ",",
+                                   &saveptr2))) {
+            enum AVMediaType type;
+            char *end;
+            long index;
+
+            if (!strncmp(keyval, "v:", 2))
+                type = AVMEDIA_TYPE_VIDEO;
+            else if (!strncmp(keyval, "a:", 2))
+                type = AVMEDIA_TYPE_AUDIO;
+            else
+                goto invalid;
+            index = strtol(keyval + 2, &end, 10);
+            if (end == keyval + 2 || *end || index < 0)
+                goto invalid;
+
+            for (i = 0; i < s->nb_streams; i++)
+                if (s->streams[i]->codec->codec_type == type && !index--)
+                    break;
+            if (i == s->nb_streams) {
+                av_log(s, AV_LOG_ERROR,
+                       "Stream '%s' of variant %d does not exist\n",
+                       keyval, hls->nb_varstreams - 1);
+                ret = AVERROR(EINVAL);
+                goto fail;
+            }
+            if (vs->nb_streams == s->nb_streams)
+                goto invalid;
+            vs->streams[vs->nb_streams++] = s->streams[i];
+        }
     }
 
-    if (hls->segment_filename) {
-        hls->basename = av_strdup(hls->segment_filename);
-        if (!hls->basename) {
-            ret = AVERROR(ENOMEM);
+    if (!hls->nb_varstreams)
+        goto invalid;
+
+    /* Every stream must end up somewhere */
+    for (i = 0; i < s->nb_streams; i++) {
+        int j, k, found = 0;
+        for (j = 0; j < hls->nb_varstreams && !found; j++)
+            for (k = 0; k < hls->var_streams[j].nb_streams; k++)
+                found |= hls->var_streams[j].streams[k] == s->streams[i];
+        if (!found) {
+            av_log(s, AV_LOG_ERROR, "Stream %d is not part of any variant\n", i);
+            ret = AVERROR(EINVAL);
             goto fail;
         }
+    }
+
+    av_free(map);
+    return 0;
+invalid:
+    av_log(s, AV_LOG_ERROR, "Invalid variant stream map '%s'\n",
+           hls->var_stream_map);
+    ret = AVERROR(EINVAL);
+fail:
+    av_free(map);
+    return ret;
+}
+
+static int hls_init_variant_names(AVFormatContext *s, VariantStream *vs, int index)
+{
+    HLSContext *hls = s->priv_data;
+    char *p;
+    const char *pattern = "%d.ts";
+    const char *pattern_localtime_fmt = "-%s.ts";
+    const char *vtt_pattern = "%d.vtt";
+    int basename_size;
+    int vtt_basename_size;
+
+    vs->m3u8_name = variant_name(s->filename, index);
+    if (!vs->m3u8_name)
+        return AVERROR(ENOMEM);
+
+    if (hls->segment_filename) {
+        vs->basename = variant_name(hls->segment_filename, index);
+        if (!vs->basename)
+            return AVERROR(ENOMEM);
     } else {
         if (hls->flags & HLS_SINGLE_FILE)
             pattern = ".ts";
 
         if (hls->use_localtime) {
-            basename_size = strlen(s->filename) + strlen(pattern_localtime_fmt) + 1;
+            basename_size = strlen(vs->m3u8_name) + strlen(pattern_localtime_fmt) + 1;
         } else {
-            basename_size = strlen(s->filename) + strlen(pattern) + 1;
-        }
-        hls->basename = av_malloc(basename_size);
-        if (!hls->basename) {
-            ret = AVERROR(ENOMEM);
-            goto fail;
+            basename_size = strlen(vs->m3u8_name) + strlen(pattern) + 1;
         }
+        vs->basename = av_malloc(basename_size);
+        if (!vs->basename)
+            return AVERROR(ENOMEM);
 
-        av_strlcpy(hls->basename, s->filename, basename_size);
+        av_strlcpy(vs->basename, vs->m3u8_name, basename_size);
 
-        p = strrchr(hls->basename, '.');
+        p = strrchr(vs->basename, '.');
         if (p)
             *p = '\0';
         if (hls->use_localtime) {
-            av_strlcat(hls->basename, pattern_localtime_fmt, basename_size);
+            av_strlcat(vs->basename, pattern_localtime_fmt, basename_size);
         } else {
-            av_strlcat(hls->basename, pattern, basename_size);
+            av_strlcat(vs->basename, pattern, basename_size);
         }
     }
 
-    if(hls->has_subtitle) {
+    if(vs->has_subtitle) {
 
         if (hls->flags & HLS_SINGLE_FILE)
             vtt_pattern = ".vtt";
-        vtt_basename_size = strlen(s->filename) + strlen(vtt_pattern) + 1;
-        hls->vtt_basename = av_malloc(vtt_basename_size);
-        if (!hls->vtt_basename) {
-            ret = AVERROR(ENOMEM);
-            goto fail;
-        }
-        hls->vtt_m3u8_name = av_malloc(vtt_basename_size);
-        if (!hls->vtt_m3u8_name ) {
-            ret = AVERROR(ENOMEM);
-            goto fail;
-        }
-        av_strlcpy(hls->vtt_basename, s->filename, vtt_basename_size);
-        p = strrchr(hls->vtt_basename, '.');
+        vtt_basename_size = strlen(vs->m3u8_name) + strlen(vtt_pattern) + 1;
+        if (hls->subtitle_filename)
+            vtt_basename_size = FFMAX(vtt_basename_size,
+                                      strlen(hls->subtitle_filename) + 1);
+        vs->vtt_basename = av_malloc(vtt_basename_size);
+        if (!vs->vtt_basename)
+            return AVERROR(ENOMEM);
+        vs->vtt_m3u8_name = av_malloc(vtt_basename_size);
+        if (!vs->vtt_m3u8_name )
+            return AVERROR(ENOMEM);
+        av_strlcpy(vs->vtt_basename, vs->m3u8_name, vtt_basename_size);
+        p = strrchr(vs->vtt_basename, '.');
         if (p)
             *p = '\0';
 
         if( hls->subtitle_filename ) {
-            strcpy(hls->vtt_m3u8_name, hls->subtitle_filename);
+            strcpy(vs->vtt_m3u8_name, hls->subtitle_filename);
         } else {
-            strcpy(hls->vtt_m3u8_name, hls->vtt_basename);
-            av_strlcat(hls->vtt_m3u8_name, "_vtt.m3u8", vtt_basename_size);
+            strcpy(vs->vtt_m3u8_name, vs->vtt_basename);
+            av_strlcat(vs->vtt_m3u8_name, "_vtt.m3u8", vtt_basename_size);
         }
-        av_strlcat(hls->vtt_basename, vtt_pattern, vtt_basename_size);
+        av_strlcat(vs->vtt_basename, vtt_pattern, vtt_basename_size);
     }
 
-    if ((ret = hls_mux_init(s)) < 0)
-        goto fail;
+    return 0;
+}
+
+static void hls_free_variant_streams(HLSContext *hls)
+{
+    int i;
+
+    for (i = 0; i < hls->nb_varstreams; i++) {
+        VariantStream *vs = &hls->var_streams[i];
 
-    if ((ret = hls_start(s)) < 0)
+        if (vs->avf) {
+            if (hls->io)
+                ff_io_thread_close(hls->io, &vs->avf->pb);
+            avformat_free_context(vs->avf);
+        }
+        if (vs->vtt_avf) {
+            if (hls->io)
+                ff_io_thread_close(hls->io, &vs->vtt_avf->pb);
+            avformat_free_context(vs->vtt_avf);
+        }
+        hls_free_segments(vs->segments);
+        hls_free_segments(vs->old_segments);
+        av_freep(&vs->m3u8_name);
+        av_freep(&vs->basename);
+        av_freep(&vs->vtt_basename);
+        av_freep(&vs->vtt_m3u8_name);
+        av_freep(&vs->streams);
+    }
+    av_freep(&hls->var_streams);
+    hls->nb_varstreams = 0;
+}
+
+static int hls_write_header(AVFormatContext *s)
+{
+    HLSContext *hls = s->priv_data;
+    VariantStream *vs;
+    int ret, i, j;
+    AVDictionary *options = NULL;
+    int has_subtitle = 0;
+
+    hls->recording_time = hls->time * AV_TIME_BASE;
+    hls->start_pts      = AV_NOPTS_VALUE;
+
+    if (hls->format_options_str) {
+        ret = av_dict_parse_string(&hls->format_options, hls->format_options_str, "=", ":", 0);
+        if (ret < 0) {
+            av_log(s, AV_LOG_ERROR, "Could not parse format options list '%s'\n", hls->format_options_str);
+            goto fail;
+        }
+    }
+
+    if ((ret = parse_variant_stream_map(s)) < 0)
         goto fail;
 
-    av_dict_copy(&options, hls->format_options, 0);
-    ret = avformat_write_header(hls->avf, &options);
-    if (av_dict_count(options)) {
-        av_log(s, AV_LOG_ERROR, "Some of provided format options in '%s' are not recognized\n", hls->format_options_str);
+    if (hls->nb_varstreams > 1 &&
+        (!strstr(s->filename, "%v") ||
+         (hls->segment_filename && !strstr(hls->segment_filename, "%v")))) {
+        av_log(s, AV_LOG_ERROR, "The playlist and segment names must "
+               "contain %%v with more than one variant\n");
         ret = AVERROR(EINVAL);
         goto fail;
     }
-    //av_assert0(s->nb_streams == hls->avf->nb_streams);
+
+    for (i = 0; i < hls->nb_varstreams; i++) {
+        vs = &hls->var_streams[i];
+        vs->sequence = hls->start_sequence;
+        vs->end_pts  = AV_NOPTS_VALUE;
+        for (j = 0; j < vs->nb_streams; j++) {
+            vs->has_video +=
+                vs->streams[j]->codec->codec_type == AVMEDIA_TYPE_VIDEO;
+            vs->has_subtitle +=
+                vs->streams[j]->codec->codec_type == AVMEDIA_TYPE_SUBTITLE;
+        }
+        has_subtitle |= vs->has_subtitle;
+
+        if (vs->has_video > 1)
+            av_log(s, AV_LOG_WARNING,
+                   "More than a single video stream present, "
+                   "expect issues decoding it.\n");
+    }
+
+    hls->oformat = av_guess_format("mpegts", NULL, NULL);
+
+    if (!hls->oformat) {
+        ret = AVERROR_MUXER_NOT_FOUND;
+        goto fail;
+    }
+
+    if(has_subtitle) {
+        hls->vtt_oformat = av_guess_format("webvtt", NULL, NULL);
+        if (!hls->oformat) {
+            ret = AVERROR_MUXER_NOT_FOUND;
+            goto fail;
+        }
+    }
+
+    if ((ret = ff_io_thread_alloc(&hls->io, s, &s->interrupt_callback,
+                                  hls->async_io, hls->io_buffer_size)) < 0)
+        goto fail;
+
+    for (i = 0; i < hls->nb_varstreams; i++) {
+        vs = &hls->var_streams[i];
+
+        if ((ret = hls_init_variant_names(s, vs, i)) < 0)
+            goto fail;
+
+        if ((ret = hls_mux_init(s, vs)) < 0)
+            goto fail;
+
+        if ((ret = hls_start(s, vs)) < 0)
+            goto fail;
+
+        av_dict_copy(&options, hls->format_options, 0);
+        ret = avformat_write_header(vs->avf, &options);
+        if (av_dict_count(options)) {
+            av_log(s, AV_LOG_ERROR, "Some of provided format options in '%s' are not recognized\n", hls->format_options_str);
+            ret = AVERROR(EINVAL);
+            goto fail;
+        }
+        av_dict_free(&options);
+        if (ret < 0)
+            goto fail;
+    }
+
     for (i = 0; i < s->nb_streams; i++) {
-        AVStream *inner_st;
+        AVStream *inner_st = NULL;
         AVStream *outer_st = s->streams[i];
-        if (outer_st->codec->codec_type != AVMEDIA_TYPE_SUBTITLE)
-            inner_st = hls->avf->streams[i];
-        else if (hls->vtt_avf)
-            inner_st = hls->vtt_avf->streams[0];
-        else {
+        int inner_index = 0;
+
+        /* The time bases are the same in every variant holding the stream */
+        for (j = 0; j < hls->nb_varstreams && !inner_st; j++) {
+            vs = &hls->var_streams[j];
+            inner_index = hls_inner_stream_index(vs, outer_st);
+            if (inner_index < 0)
+                continue;
+            if (outer_st->codec->codec_type != AVMEDIA_TYPE_SUBTITLE)
+                inner_st = vs->avf->streams[inner_index];
+            else if (vs->vtt_avf)
+                inner_st = vs->vtt_avf->streams[0];
+        }
+        if (!inner_st) {
             /* We have a subtitle stream, when the user does not want one */
-            inner_st = NULL;
             continue;
         }
         avpriv_set_pts_info(outer_st, inner_st->pts_wrap_bits, inner_st->time_base.num, inner_st->time_base.den);
@@ -702,40 +1017,37 @@ fail:
 
     av_dict_free(&options);
     if (ret < 0) {
-        av_freep(&hls->basename);
-        av_freep(&hls->vtt_basename);
-        if (hls->avf)
-            avformat_free_context(hls->avf);
-        if (hls->vtt_avf)
-            avformat_free_context(hls->vtt_avf);
-
+        hls_free_variant_streams(hls);
+        ff_io_thread_free(&hls->io);
     }
     return ret;
 }
 
-static int hls_write_packet(AVFormatContext *s, AVPacket *pkt)
+static int hls_write_variant_packet(AVFormatContext *s, VariantStream *vs,
+                                    AVPacket *pkt, int stream_index)
 {
     HLSContext *hls = s->priv_data;
     AVFormatContext *oc = NULL;
     AVStream *st = s->streams[pkt->stream_index];
-    int64_t end_pts = hls->recording_time * hls->number;
+    int64_t end_pts = hls->recording_time * vs->number;
     int is_ref_pkt = 1;
     int ret, can_split = 1;
-    int stream_index = 0;
 
     if( st->codec->codec_type == AVMEDIA_TYPE_SUBTITLE ) {
-        oc = hls->vtt_avf;
+        oc = vs->vtt_avf;
         stream_index = 0;
     } else {
-        oc = hls->avf;
-        stream_index = pkt->stream_index;
+        oc = vs->avf;
     }
     if (hls->start_pts == AV_NOPTS_VALUE) {
         hls->start_pts = pkt->pts;
-        hls->end_pts   = pkt->pts;
+        hls->start_tb  = st->time_base;
     }
+    /* Every variant measures its segments from the common start */
+    if (vs->end_pts == AV_NOPTS_VALUE && hls->start_pts != AV_NOPTS_VALUE)
+        vs->end_pts = av_rescale_q(hls->start_pts, hls->start_tb, st->time_base);
 
-    if (hls->has_video) {
+    if (vs->has_video) {
         can_split = st->codec->codec_type == AVMEDIA_TYPE_VIDEO &&
                     pkt->flags & AV_PKT_FLAG_KEY;
         is_ref_pkt = st->codec->codec_type == AVMEDIA_TYPE_VIDEO;
@@ -744,46 +1056,57 @@ static int hls_write_packet(AVFormatContext *s, AVPacket *pkt)
         is_ref_pkt = can_split = 0;
 
     if (is_ref_pkt)
-        hls->duration = (double)(pkt->pts - hls->end_pts)
+        vs->duration = (double)(pkt->pts - vs->end_pts)
                                    * st->time_base.num / st->time_base.den;
 
-    if (can_split && av_compare_ts(pkt->pts - hls->start_pts, st->time_base,
-                                   end_pts, AV_TIME_BASE_Q) >= 0) {
+    if (can_split && av_compare_ts(pkt->pts - av_rescale_q(hls->start_pts, hls->start_tb, st->time_base),
+                                   st->time_base, end_pts, AV_TIME_BASE_Q) >= 0) {
         int64_t new_start_pos;
         av_write_frame(oc, NULL); /* Flush any buffered data */
 
-        new_start_pos = avio_tell(hls->avf->pb);
-        hls->size = new_start_pos - hls->start_pos;
-        ret = hls_append_segment(hls, hls->duration, hls->start_pos, hls->size);
-        hls->start_pos = new_start_pos;
+        new_start_pos = avio_tell(vs->avf->pb);
+        vs->size = new_start_pos - vs->start_pos;
+        ret = hls_append_segment(hls, vs, vs->duration, vs->start_pos, vs->size);
+        vs->start_pos = new_start_pos;
         if (ret < 0)
             return ret;
 
-        hls->end_pts = pkt->pts;
-        hls->duration = 0;
+        vs->end_pts = pkt->pts;
+        vs->duration = 0;
 
         if (hls->flags & HLS_SINGLE_FILE) {
-            if (hls->avf->oformat->priv_class && hls->avf->priv_data)
-                av_opt_set(hls->avf->priv_data, "mpegts_flags", "resend_headers", 0);
-            hls->number++;
+            if (vs->avf->oformat->priv_class && vs->avf->priv_data)
+                av_opt_set(vs->avf->priv_data, "mpegts_flags", "resend_headers", 0);
+            vs->number++;
         } else {
-            avio_closep(&oc->pb);
-            if (hls->vtt_avf)
-                avio_close(hls->vtt_avf->pb);
+            ret = ff_io_thread_close(hls->io, &oc->pb);
+            if (vs->vtt_avf && ret >= 0)
+                ret = ff_io_thread_close(hls->io, &vs->vtt_avf->pb);
 
-            ret = hls_start(s);
+            if (ret >= 0)
+                ret = hls_start(s, vs);
+            vs->start_pos = 0;
         }
 
         if (ret < 0)
             return ret;
 
         if( st->codec->codec_type == AVMEDIA_TYPE_SUBTITLE )
-            oc = hls->vtt_avf;
+            oc = vs->vtt_avf;
         else
-        oc = hls->avf;
+        oc = vs->avf;
 
-        if ((ret = hls_window(s, 0)) < 0)
+        if ((ret = hls_window(s, vs, 0)) < 0)
             return ret;
+
+        if (hls->master_pl_name && !hls->master_pl_written) {
+            int i;
+            for (i = 0; i < hls->nb_varstreams; i++)
+                if (!hls->var_streams[i].segments)
+                    break;
+            if (i == hls->nb_varstreams && (ret = hls_master_playlist(s)) < 0)
+                return ret;
+        }
     }
 
     ret = ff_write_chained(oc, stream_index, pkt, s, 0);
@@ -791,40 +1114,67 @@ static int hls_write_packet(AVFormatContext *s, AVPacket *pkt)
     return ret;
 }
 
-static int hls_write_trailer(struct AVFormatContext *s)
+static int hls_write_packet(AVFormatContext *s, AVPacket *pkt)
 {
     HLSContext *hls = s->priv_data;
-    AVFormatContext *oc = hls->avf;
-    AVFormatContext *vtt_oc = hls->vtt_avf;
+    AVStream *st = s->streams[pkt->stream_index];
+    int i, ret;
 
-    av_write_trailer(oc);
-    if (oc->pb) {
-        hls->size = avio_tell(hls->avf->pb) - hls->start_pos;
-        avio_closep(&oc->pb);
-        hls_append_segment(hls, hls->duration, hls->start_pos, hls->size);
-    }
+    for (i = 0; i < hls->nb_varstreams; i++) {
+        VariantStream *vs = &hls->var_streams[i];
+        int stream_index = hls_inner_stream_index(vs, st);
 
-    if (vtt_oc) {
-        if (vtt_oc->pb)
-            av_write_trailer(vtt_oc);
-        hls->size = avio_tell(hls->vtt_avf->pb) - hls->start_pos;
-        avio_closep(&vtt_oc->pb);
+        if (stream_index < 0)
+            continue;
+        if ((ret = hls_write_variant_packet(s, vs, pkt, stream_index)) < 0)
+            return ret;
     }
-    av_freep(&hls->basename);
-    avformat_free_context(oc);
 
-    if (vtt_oc) {
-        av_freep(&hls->vtt_basename);
-        av_freep(&hls->vtt_m3u8_name);
-        avformat_free_context(vtt_oc);
+    return 0;
+}
+
+static int hls_write_trailer(struct AVFormatContext *s)
+{
+    HLSContext *hls = s->priv_data;
+    int i, ret;
+
+    for (i = 0; i < hls->nb_varstreams; i++) {
+        VariantStream *vs = &hls->var_streams[i];
+        AVFormatContext *oc = vs->avf;
+        AVFormatContext *vtt_oc = vs->vtt_avf;
+
+        av_write_trailer(oc);
+        if (oc->pb) {
+            vs->size = avio_tell(vs->avf->pb) - vs->start_pos;
+            ff_io_thread_close(hls->io, &oc->pb);
+            hls_append_segment(hls, vs, vs->duration, vs->start_pos, vs->size);
+        }
+
+        if (vtt_oc) {
+            if (vtt_oc->pb)
+                av_write_trailer(vtt_oc);
+            vs->size = avio_tell(vs->vtt_avf->pb) - vs->start_pos;
+            ff_io_thread_close(hls->io, &vtt_oc->pb);
+        }
+        av_freep(&vs->basename);
+        avformat_free_context(oc);
+
+        if (vtt_oc) {
+            av_freep(&vs->vtt_basename);
+            avformat_free_context(vtt_oc);
+        }
+
+        vs->avf = NULL;
+        vs->vtt_avf = NULL;
+        hls_window(s, vs, 1);
     }
 
-    hls->avf = NULL;
-    hls_window(s, 1);
+    if (hls->master_pl_name && !hls->master_pl_written)
+        hls_master_playlist(s);
+    ret = ff_io_thread_free(&hls->io);
 
-    hls_free_segments(hls->segments);
-    hls_free_segments(hls->old_segments);
-    return 0;
+    hls_free_variant_streams(hls);
+    return ret;
 }
 
 #define OFFSET(x) offsetof(HLSContext, x)
@@ -848,6 +1198,10 @@ static const AVOption options[] = {
     {"discont_start", "start the playlist with a discontinuity tag", 0, AV_OPT_TYPE_CONST, {.i64 = HLS_DISCONT_START }, 0, UINT_MAX,   E, "flags"},
     {"omit_endlist", "Do not append an endlist when ending stream", 0, AV_OPT_TYPE_CONST, {.i64 = HLS_OMIT_ENDLIST }, 0, UINT_MAX,   E, "flags"},
     { "use_localtime",          "set filename expansion with strftime at segment creation", OFFSET(use_localtime), AV_OPT_TYPE_INT, {.i64 = 0 }, 0, 1, E },
+    { "hls_async_io",   "write segments and playlists from a background thread", OFFSET(async_io), AV_OPT_TYPE_INT, {.i64 = 1 }, 0, 1, E },
+    { "var_stream_map", "variant streams, as \"v:0,a:0 v:1,a:1\"; %v in the names is replaced by the variant index", OFFSET(var_stream_map), AV_OPT_TYPE_STRING, {.str = NULL}, 0, 0, E },
+    { "master_pl_name", "write a master playlist with this name next to the variant playlists", OFFSET(master_pl_name), AV_OPT_TYPE_STRING, {.str = NULL}, 0, 0, E },
+    { "hls_io_buffer_size", "maximum bytes waiting to be written by the background thread", OFFSET(io_buffer_size), AV_OPT_TYPE_INT, {.i64 = 16 * 1024 * 1024 }, 0, INT_MAX, E },
 
     { NULL },
 };
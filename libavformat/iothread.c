@@ -0,0 +1,460 @@
+/*
+ * Background output I/O for segmenting muxers
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+#if HAVE_PTHREADS
+#include <pthread.h>
+#endif
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "libavutil/buffer.h"
+#include "libavutil/dict.h"
+#include "libavutil/fifo.h"
+#include "libavutil/log.h"
+#include "libavutil/mem.h"
+
+#include "avio.h"
+#include "internal.h"
+#include "iothread.h"
+#include "os_support.h"
+
+#define IO_BUFFER_SIZE 32768
+
+enum IOJobType {
+    IO_JOB_OPEN,
+    IO_JOB_WRITE,
+    IO_JOB_FLUSH,
+    IO_JOB_CLOSE,
+    IO_JOB_WRITE_FILE,
+    IO_JOB_RENAME,
+    IO_JOB_DELETE,
+};
+
+/* A file opened through the worker, the output context is only used
+ * by the worker. */
+typedef struct IOFile {
+    FFIOThread *thread;
+    AVIOContext *pb;
+} IOFile;
+
+typedef struct IOJob {
+    enum IOJobType type;
+    IOFile *file;
+    char *url;
+    char *rename_to;
+    AVDictionary *options;
+    AVBufferRef *buf;
+} IOJob;
+
+struct FFIOThread {
+    void *log_ctx;
+    AVIOInterruptCB int_cb;
+    int threaded;
+    int64_t max_buffered;
+    AVBufferPool *pool;
+
+#if HAVE_PTHREADS
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond_worker;
+    pthread_cond_t cond_caller;
+#endif
+    AVFifoBuffer *jobs;
+    int64_t buffered;   ///< bytes of data in the queued jobs
+    int busy;           ///< a job is being performed
+    int quit;
+    int error;
+};
+
+static void free_job(IOJob *job)
+{
+    av_freep(&job->url);
+    av_freep(&job->rename_to);
+    av_dict_free(&job->options);
+    av_buffer_unref(&job->buf);
+}
+
+static int run_job(FFIOThread *t, IOJob *job)
+{
+    AVIOContext *pb = NULL;
+    int ret = 0;
+
+    /* after an error, only release what is still open */
+    if (t->error && job->type != IO_JOB_CLOSE)
+        return 0;
+
+    switch (job->type) {
+    case IO_JOB_OPEN:
+        ret = avio_open2(&job->file->pb, job->url, AVIO_FLAG_WRITE,
+                         &t->int_cb, &job->options);
+        if (ret < 0)
+            av_log(t->log_ctx, AV_LOG_ERROR, "Failed to open %s: %s\n",
+                   job->url, av_err2str(ret));
+        break;
+    case IO_JOB_WRITE:
+        avio_write(job->file->pb, job->buf->data, job->buf->size);
+        ret = job->file->pb->error;
+        break;
+    case IO_JOB_FLUSH:
+        avio_flush(job->file->pb);
+        ret = job->file->pb->error;
+        break;
+    case IO_JOB_CLOSE:
+        if (job->file->pb) {
+            avio_flush(job->file->pb);
+            ret = job->file->pb->error;
+            avio_closep(&job->file->pb);
+        }
+        av_freep(&job->file);
+        break;
+    case IO_JOB_WRITE_FILE:
+        if ((ret = avio_open2(&pb, job->url, AVIO_FLAG_WRITE,
+                              &t->int_cb, NULL)) < 0) {
+            av_log(t->log_ctx, AV_LOG_ERROR, "Failed to open %s: %s\n",
+                   job->url, av_err2str(ret));
+            break;
+        }
+        avio_write(pb, job->buf->data, job->buf->size);
+        avio_flush(pb);
+        ret = pb->error;
+        avio_closep(&pb);
+        if (ret >= 0 && job->rename_to)
+            ret = ff_rename(job->url, job->rename_to, t->log_ctx);
+        break;
+    case IO_JOB_RENAME:
+        ret = ff_rename(job->url, job->rename_to, t->log_ctx);
+        break;
+    case IO_JOB_DELETE:
+        if (unlink(job->url) < 0)
+            av_log(t->log_ctx, AV_LOG_ERROR, "failed to delete %s: %s\n",
+                   job->url, strerror(errno));
+        break;
+    }
+    return ret;
+}
+
+#if HAVE_PTHREADS
+static void *io_worker(void *arg)
+{
+    FFIOThread *t = arg;
+    IOJob job;
+    int ret;
+
+    pthread_mutex_lock(&t->mutex);
+    while (1) {
+        while (!av_fifo_size(t->jobs) && !t->quit)
+            pthread_cond_wait(&t->cond_worker, &t->mutex);
+        if (!av_fifo_size(t->jobs))
+            break;
+        av_fifo_generic_read(t->jobs, &job, sizeof(job), NULL);
+        t->busy = 1;
+        pthread_mutex_unlock(&t->mutex);
+
+        ret = run_job(t, &job);
+
+        pthread_mutex_lock(&t->mutex);
+        if (ret < 0 && !t->error)
+            t->error = ret;
+        if (job.buf)
+            t->buffered -= job.buf->size;
+        t->busy = 0;
+        free_job(&job);
+        pthread_cond_broadcast(&t->cond_caller);
+    }
+    pthread_mutex_unlock(&t->mutex);
+    return NULL;
+}
+#endif
+
+/* Take ownership of the job and queue it, or perform it right away. */
+static int queue_job(FFIOThread *t, IOJob *job)
+{
+    int ret;
+
+    if (!t->threaded) {
+        ret = run_job(t, job);
+        if (ret < 0 && !t->error)
+            t->error = ret;
+        free_job(job);
+        return t->error;
+    }
+
+#if HAVE_PTHREADS
+    pthread_mutex_lock(&t->mutex);
+    while (!t->error && t->buffered > t->max_buffered)
+        pthread_cond_wait(&t->cond_caller, &t->mutex);
+    if (av_fifo_space(t->jobs) < sizeof(*job) &&
+        (ret = av_fifo_grow(t->jobs, av_fifo_size(t->jobs))) < 0) {
+        pthread_mutex_unlock(&t->mutex);
+        /* the file would never be closed otherwise */
+        if (job->type == IO_JOB_CLOSE)
+            run_job(t, job);
+        free_job(job);
+        return ret;
+    }
+    av_fifo_generic_write(t->jobs, job, sizeof(*job), NULL);
+    if (job->buf)
+        t->buffered += job->buf->size;
+    pthread_cond_signal(&t->cond_worker);
+    ret = t->error;
+    pthread_mutex_unlock(&t->mutex);
+#endif
+    return ret;
+}
+
+int ff_io_thread_alloc(FFIOThread **pt, void *log_ctx,
+                       const AVIOInterruptCB *int_cb, int threaded,
+                       int64_t max_buffered)
+{
+    FFIOThread *t = av_mallocz(sizeof(*t));
+#if HAVE_PTHREADS
+    int ret;
+#endif
+
+    if (!t)
+        return AVERROR(ENOMEM);
+    t->log_ctx      = log_ctx;
+    t->max_buffered = max_buffered;
+    if (int_cb)
+        t->int_cb = *int_cb;
+
+#if HAVE_PTHREADS
+    if (threaded) {
+        t->jobs = av_fifo_alloc_array(16, sizeof(IOJob));
+        t->pool = av_buffer_pool_init(IO_BUFFER_SIZE, NULL);
+        if (!t->jobs || !t->pool) {
+            ret = AVERROR(ENOMEM);
+            goto fail;
+        }
+        if ((ret = pthread_mutex_init(&t->mutex, NULL))) {
+            ret = AVERROR(ret);
+            goto fail;
+        }
+        if ((ret = pthread_cond_init(&t->cond_worker, NULL))) {
+            pthread_mutex_destroy(&t->mutex);
+            ret = AVERROR(ret);
+            goto fail;
+        }
+        if ((ret = pthread_cond_init(&t->cond_caller, NULL))) {
+            pthread_cond_destroy(&t->cond_worker);
+            pthread_mutex_destroy(&t->mutex);
+            ret = AVERROR(ret);
+            goto fail;
+        }
+        if ((ret = pthread_create(&t->thread, NULL, io_worker, t))) {
+            pthread_cond_destroy(&t->cond_caller);
+            pthread_cond_destroy(&t->cond_worker);
+            pthread_mutex_destroy(&t->mutex);
+            ret = AVERROR(ret);
+            goto fail;
+        }
+        t->threaded = 1;
+    }
+#endif
+
+    *pt = t;
+    return 0;
+
+#if HAVE_PTHREADS
+fail:
+    av_fifo_freep(&t->jobs);
+    av_buffer_pool_uninit(&t->pool);
+    av_free(t);
+    return ret;
+#endif
+}
+
+int ff_io_thread_sync(FFIOThread *t)
+{
+    int ret = t->error;
+
+#if HAVE_PTHREADS
+    if (t->threaded) {
+        pthread_mutex_lock(&t->mutex);
+        while (av_fifo_size(t->jobs) || t->busy)
+            pthread_cond_wait(&t->cond_caller, &t->mutex);
+        ret = t->error;
+        pthread_mutex_unlock(&t->mutex);
+    }
+#endif
+    return ret;
+}
+
+int ff_io_thread_free(FFIOThread **pt)
+{
+    FFIOThread *t = *pt;
+    int ret;
+
+    if (!t)
+        return 0;
+
+    ret = ff_io_thread_sync(t);
+#if HAVE_PTHREADS
+    if (t->threaded) {
+        pthread_mutex_lock(&t->mutex);
+        t->quit = 1;
+        pthread_cond_signal(&t->cond_worker);
+        pthread_mutex_unlock(&t->mutex);
+        pthread_join(t->thread, NULL);
+        pthread_cond_destroy(&t->cond_caller);
+        pthread_cond_destroy(&t->cond_worker);
+        pthread_mutex_destroy(&t->mutex);
+    }
+#endif
+    av_fifo_freep(&t->jobs);
+    av_buffer_pool_uninit(&t->pool);
+    av_freep(pt);
+    return ret;
+}
+
+static int write_behind_packet(void *opaque, uint8_t *buf, int size)
+{
+    IOFile *file = opaque;
+    IOJob job = { IO_JOB_WRITE, file };
+    int ret;
+
+    if (!(job.buf = av_buffer_pool_get(file->thread->pool)))
+        return AVERROR(ENOMEM);
+    memcpy(job.buf->data, buf, size);
+    job.buf->size = size;
+    if ((ret = queue_job(file->thread, &job)) < 0)
+        return ret;
+    return size;
+}
+
+int ff_io_thread_open(FFIOThread *t, AVIOContext **pb, const char *url,
+                      AVDictionary **options)
+{
+    IOJob job = { IO_JOB_OPEN };
+    uint8_t *buffer;
+    int ret;
+
+    if (!t->threaded) {
+        if (t->error)
+            return t->error;
+        return avio_open2(pb, url, AVIO_FLAG_WRITE, &t->int_cb, options);
+    }
+
+    if (!(job.file = av_mallocz(sizeof(*job.file))))
+        return AVERROR(ENOMEM);
+    job.file->thread = t;
+    if (options)
+        av_dict_copy(&job.options, *options, 0);
+    if (!(job.url = av_strdup(url)) ||
+        !(buffer = av_malloc(IO_BUFFER_SIZE))) {
+        free_job(&job);
+        av_free(job.file);
+        return AVERROR(ENOMEM);
+    }
+    *pb = avio_alloc_context(buffer, IO_BUFFER_SIZE, 1, job.file,
+                             NULL, write_behind_packet, NULL);
+    if (!*pb) {
+        av_free(buffer);
+        free_job(&job);
+        av_free(job.file);
+        return AVERROR(ENOMEM);
+    }
+
+    if ((ret = queue_job(t, &job)) < 0)
+        ff_io_thread_close(t, pb);
+    return ret;
+}
+
+int ff_io_thread_flush(FFIOThread *t, AVIOContext *pb)
+{
+    IOJob job = { IO_JOB_FLUSH };
+    int ret;
+
+    avio_flush(pb);
+    if (!t->threaded)
+        return pb->error;
+    if (pb->error < 0)
+        return pb->error;
+
+    job.file = pb->opaque;
+    if ((ret = queue_job(t, &job)) < 0)
+        return ret;
+    return ff_io_thread_sync(t);
+}
+
+int ff_io_thread_close(FFIOThread *t, AVIOContext **pb)
+{
+    IOJob job = { IO_JOB_CLOSE };
+    int ret, err;
+
+    if (!*pb)
+        return 0;
+    if (!t->threaded)
+        return avio_closep(pb);
+
+    avio_flush(*pb);
+    ret      = (*pb)->error;
+    job.file = (*pb)->opaque;
+    av_freep(&(*pb)->buffer);
+    av_freep(pb);
+
+    /* the close is queued even after an error, to release the file */
+    err = queue_job(t, &job);
+    return ret < 0 ? ret : err;
+}
+
+int ff_io_thread_write_file(FFIOThread *t, const char *url,
+                            const char *rename_to, uint8_t *data, int size)
+{
+    IOJob job = { IO_JOB_WRITE_FILE };
+
+    job.buf = av_buffer_create(data, size, av_buffer_default_free, NULL, 0);
+    if (!job.buf) {
+        av_free(data);
+        return AVERROR(ENOMEM);
+    }
+    if (!(job.url = av_strdup(url)) ||
+        (rename_to && !(job.rename_to = av_strdup(rename_to)))) {
+        free_job(&job);
+        return AVERROR(ENOMEM);
+    }
+    return queue_job(t, &job);
+}
+
+int ff_io_thread_rename(FFIOThread *t, const char *url, const char *rename_to)
+{
+    IOJob job = { IO_JOB_RENAME };
+
+    if (!(job.url = av_strdup(url)) ||
+        !(job.rename_to = av_strdup(rename_to))) {
+        free_job(&job);
+        return AVERROR(ENOMEM);
+    }
+    return queue_job(t, &job);
+}
+
+int ff_io_thread_delete(FFIOThread *t, const char *path)
+{
+    IOJob job = { IO_JOB_DELETE };
+
+    if (!(job.url = av_strdup(path)))
+        return AVERROR(ENOMEM);
+    return queue_job(t, &job);
+}
@@ -0,0 +1,110 @@
+/*
+ * Background output I/O for segmenting muxers
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Background output I/O for segmenting muxers.
+ *
+ * Opening, writing and closing segment files, rewriting playlists and
+ * deleting expired segments are queued to a single worker thread and
+ * performed in order, so that the muxing thread never waits on the file
+ * system at segment boundaries. Segment data is written through
+ * write-behind AVIOContexts whose buffers are handed over to the worker
+ * as they fill up; the amount of data waiting to be written is bounded,
+ * beyond that the muxing thread waits for the worker.
+ *
+ * Errors of the worker are sticky and returned by the following calls.
+ * Without threads, or when disabled, every operation is performed
+ * synchronously by the calling thread.
+ */
+
+#ifndef AVFORMAT_IOTHREAD_H
+#define AVFORMAT_IOTHREAD_H
+
+#include <stdint.h>
+
+#include "avio.h"
+
+typedef struct FFIOThread FFIOThread;
+
+/**
+ * Start an I/O worker.
+ *
+ * @param log_ctx      context for the messages of the worker
+ * @param int_cb       interrupt callback for the opened files, copied
+ * @param threaded     0 to perform every operation synchronously
+ * @param max_buffered bytes that may be waiting to be written
+ */
+int ff_io_thread_alloc(FFIOThread **t, void *log_ctx,
+                       const AVIOInterruptCB *int_cb, int threaded,
+                       int64_t max_buffered);
+
+/**
+ * Write the queued data, stop the worker and free it.
+ *
+ * @return the first error of the worker, 0 if none
+ */
+int ff_io_thread_free(FFIOThread **t);
+
+/**
+ * Wait until the worker has performed every queued operation.
+ *
+ * @return the first error of the worker, 0 if none
+ */
+int ff_io_thread_sync(FFIOThread *t);
+
+/**
+ * Open url for writing, as avio_open2() would. The returned context
+ * buffers the data for the worker and must be closed with
+ * ff_io_thread_close(). options is left untouched.
+ */
+int ff_io_thread_open(FFIOThread *t, AVIOContext **pb, const char *url,
+                      AVDictionary **options);
+
+/**
+ * Write out everything written to a context opened by ff_io_thread_open()
+ * so far, and wait until it has reached the file.
+ */
+int ff_io_thread_flush(FFIOThread *t, AVIOContext *pb);
+
+/**
+ * Close a context opened by ff_io_thread_open() and set it to NULL.
+ */
+int ff_io_thread_close(FFIOThread *t, AVIOContext **pb);
+
+/**
+ * Write size bytes of data to url, then rename url to rename_to if it is
+ * not NULL. Ownership of data, which must have been allocated with
+ * av_malloc(), is transferred.
+ */
+int ff_io_thread_write_file(FFIOThread *t, const char *url,
+                            const char *rename_to, uint8_t *data, int size);
+
+/**
+ * Rename url to rename_to, once the operations queued before are done.
+ */
+int ff_io_thread_rename(FFIOThread *t, const char *url, const char *rename_to);
+
+/**
+ * Delete the file at path.
+ */
+int ff_io_thread_delete(FFIOThread *t, const char *path);
+
+#endif /* AVFORMAT_IOTHREAD_H */
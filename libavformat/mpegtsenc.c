@@ -820,6 +820,18 @@ static int mpegts_write_header(AVFormatContext *s)
         }
     }
 
+    /* Let a protocol that can pace its output, like udp, send the packets
+     * at the mux rate, unless a rate was given to it already. */
+    if (ts->mux_rate > 1 && s->pb) {
+        int64_t bitrate;
+        if (av_opt_get_int(s->pb, "bitrate", AV_OPT_SEARCH_CHILDREN, &bitrate) >= 0 &&
+            !bitrate) {
+            bitrate = ts->m2ts_mode ? av_rescale(ts->mux_rate, 192, 188)
+                                    : ts->mux_rate;
+            av_opt_set_int(s->pb, "bitrate", bitrate, AV_OPT_SEARCH_CHILDREN);
+        }
+    }
+
     return 0;
 
 fail:
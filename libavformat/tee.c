@@ -20,12 +20,34 @@
  */
 
 
+#include "config.h"
+
+#if HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
 #include "libavutil/avutil.h"
 #include "libavutil/avstring.h"
+#include "libavutil/eval.h"
+#include "libavutil/fifo.h"
 #include "libavutil/opt.h"
+#include "libavutil/parseutils.h"
 #include "avformat.h"
 
 #define MAX_SLAVES 16
+#define STATS_SIZE (MAX_SLAVES * 80)
+
+#define DEFAULT_QUEUE_SIZE (4 * 1024 * 1024)
+
+enum TeeOverflow {
+    TEE_OVERFLOW_DROP,  ///< drop packets until the next keyframe
+    TEE_OVERFLOW_BLOCK, ///< wait for the writer thread
+};
+
+typedef struct TeeQueueEntry {
+    AVPacket pkt;
+    int64_t ts;         ///< packet time in AV_TIME_BASE, or AV_NOPTS_VALUE
+} TeeQueueEntry;
 
 typedef struct {
     AVFormatContext *avf;
@@ -34,12 +56,33 @@ typedef struct {
     /** map from input to output streams indexes,
      * disabled output streams are set to -1 */
     int *stream_map;
+
+    /* asynchronous writing */
+    int async;
+    int64_t queue_size;         ///< maximum bytes queued, 0 for no limit
+    int64_t queue_duration;     ///< maximum time span queued, 0 for no limit
+    enum TeeOverflow overflow;
+#if HAVE_PTHREADS
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int thread_started;
+#endif
+    AVFifoBuffer *queue;        ///< TeeQueueEntry, written on the caller thread
+    uint8_t *need_keyframe;     ///< per output stream, set after an overflow
+    int eof;                    ///< no more packets will be queued
+    int error;                  ///< first error of the writer thread
+
+    /* statistics, protected by mutex */
+    int64_t queued_bytes;
+    int64_t packets_dropped;
 } TeeSlave;
 
 typedef struct TeeContext {
     const AVClass *class;
     unsigned nb_slaves;
     TeeSlave slaves[MAX_SLAVES];
+    char *slave_stats;          ///< STATS_SIZE bytes, rewritten in place
 } TeeContext;
 
 static const char *const slave_delim     = "|";
@@ -48,9 +91,17 @@ static const char *const slave_opt_close = "]";
 static const char *const slave_opt_delim = ":]"; /* must have the close too */
 static const char *const slave_bsfs_spec_sep = "/";
 
+#define OFFSET(x) offsetof(TeeContext, x)
+#define E AV_OPT_FLAG_ENCODING_PARAM
+static const AVOption options[] = {
+    { "slave_stats", "queue depth and drops of the asynchronous slaves", OFFSET(slave_stats), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, E | AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
+    { NULL },
+};
+
 static const AVClass tee_muxer_class = {
     .class_name = "Tee muxer",
     .item_name  = av_default_item_name,
+    .option     = options,
     .version    = LIBAVUTIL_VERSION_INT,
 };
 
@@ -132,6 +183,60 @@ end:
     return ret;
 }
 
+static int parse_async_options(void *log, TeeSlave *tee_slave,
+                               const char *async, const char *queue_size,
+                               const char *queue_duration, const char *overflow)
+{
+    char *tail;
+    double size;
+    int64_t duration;
+
+    tee_slave->queue_size = DEFAULT_QUEUE_SIZE;
+    tee_slave->overflow   = TEE_OVERFLOW_DROP;
+
+    if (async) {
+        tee_slave->async = strtol(async, &tail, 10);
+        if (*tail || tee_slave->async < 0 || tee_slave->async > 1) {
+            av_log(log, AV_LOG_ERROR, "Invalid async value '%s'\n", async);
+            return AVERROR(EINVAL);
+        }
+    }
+    if (queue_size) {
+        size = av_strtod(queue_size, &tail);
+        if (*tail || size < 0 || size > INT64_MAX) {
+            av_log(log, AV_LOG_ERROR, "Invalid queue size '%s'\n", queue_size);
+            return AVERROR(EINVAL);
+        }
+        tee_slave->queue_size = size;
+    }
+    if (queue_duration) {
+        if (av_parse_time(&duration, queue_duration, 1) < 0 || duration < 0) {
+            av_log(log, AV_LOG_ERROR, "Invalid queue duration '%s'\n",
+                   queue_duration);
+            return AVERROR(EINVAL);
+        }
+        tee_slave->queue_duration = duration;
+    }
+    if (overflow) {
+        if (!strcmp(overflow, "drop")) {
+            tee_slave->overflow = TEE_OVERFLOW_DROP;
+        } else if (!strcmp(overflow, "block")) {
+            tee_slave->overflow = TEE_OVERFLOW_BLOCK;
+        } else {
+            av_log(log, AV_LOG_ERROR, "Invalid overflow policy '%s', "
+                   "must be 'drop' or 'block'\n", overflow);
+            return AVERROR(EINVAL);
+        }
+    }
+
+    if (tee_slave->async && !HAVE_PTHREADS) {
+        av_log(log, AV_LOG_ERROR,
+               "Asynchronous slaves are not supported without threads\n");
+        return AVERROR(ENOSYS);
+    }
+    return 0;
+}
+
 static int open_slave(AVFormatContext *avf, char *slave, TeeSlave *tee_slave)
 {
     int i, ret;
@@ -139,6 +244,8 @@ static int open_slave(AVFormatContext *avf, char *slave, TeeSlave *tee_slave)
     AVDictionaryEntry *entry;
     char *filename;
     char *format = NULL, *select = NULL;
+    char *async = NULL, *queue_size = NULL, *queue_duration = NULL;
+    char *overflow = NULL;
     AVFormatContext *avf2 = NULL;
     AVStream *st, *st2;
     int stream_count;
@@ -156,6 +263,14 @@ static int open_slave(AVFormatContext *avf, char *slave, TeeSlave *tee_slave)
 
     STEAL_OPTION("f", format);
     STEAL_OPTION("select", select);
+    STEAL_OPTION("async", async);
+    STEAL_OPTION("queue_size", queue_size);
+    STEAL_OPTION("queue_duration", queue_duration);
+    STEAL_OPTION("overflow", overflow);
+
+    if ((ret = parse_async_options(avf, tee_slave, async, queue_size,
+                                   queue_duration, overflow)) < 0)
+        goto end;
 
     ret = avformat_alloc_output_context2(&avf2, NULL, format, filename);
     if (ret < 0)
@@ -281,10 +396,269 @@ static int open_slave(AVFormatContext *avf, char *slave, TeeSlave *tee_slave)
 end:
     av_free(format);
     av_free(select);
+    av_free(async);
+    av_free(queue_size);
+    av_free(queue_duration);
+    av_free(overflow);
     av_dict_free(&options);
     return ret;
 }
 
+static int filter_packet(void *log_ctx, AVPacket *pkt,
+                         AVFormatContext *fmt_ctx, AVBitStreamFilterContext *bsf_ctx)
+{
+    AVCodecContext *enc_ctx = fmt_ctx->streams[pkt->stream_index]->codec;
+    int ret = 0;
+
+    while (bsf_ctx) {
+        AVPacket new_pkt = *pkt;
+        ret = av_bitstream_filter_filter(bsf_ctx, enc_ctx, NULL,
+                                             &new_pkt.data, &new_pkt.size,
+                                             pkt->data, pkt->size,
+                                             pkt->flags & AV_PKT_FLAG_KEY);
+FF_DISABLE_DEPRECATION_WARNINGS
+        if (ret == 0 && new_pkt.data != pkt->data
+#if FF_API_DESTRUCT_PACKET
+            && new_pkt.destruct
+#endif
+            ) {
+FF_ENABLE_DEPRECATION_WARNINGS
+            if ((ret = av_copy_packet(&new_pkt, pkt)) < 0)
+                break;
+            ret = 1;
+        }
+
+        if (ret > 0) {
+            pkt->side_data = NULL;
+            pkt->side_data_elems = 0;
+            av_free_packet(pkt);
+            new_pkt.buf = av_buffer_create(new_pkt.data, new_pkt.size,
+                                           av_buffer_default_free, NULL, 0);
+            if (!new_pkt.buf)
+                break;
+        }
+        if (ret < 0) {
+            av_log(log_ctx, AV_LOG_ERROR,
+                "Failed to filter bitstream with filter %s for stream %d in file '%s' with codec %s\n",
+                bsf_ctx->filter->name, pkt->stream_index, fmt_ctx->filename,
+                avcodec_get_name(enc_ctx->codec_id));
+        }
+        *pkt = new_pkt;
+
+        bsf_ctx = bsf_ctx->next;
+    }
+
+    return ret;
+}
+
+static int write_slave_packet(TeeSlave *slave, AVPacket *pkt)
+{
+    AVFormatContext *avf2 = slave->avf;
+
+    filter_packet(avf2, pkt, avf2, slave->bsfs[pkt->stream_index]);
+    return av_interleaved_write_frame(avf2, pkt);
+}
+
+#if HAVE_PTHREADS
+static void *slave_writer(void *arg)
+{
+    TeeSlave *slave = arg;
+    TeeQueueEntry entry;
+    int ret;
+
+    pthread_mutex_lock(&slave->mutex);
+    while (1) {
+        while (!av_fifo_size(slave->queue) && !slave->eof)
+            pthread_cond_wait(&slave->cond, &slave->mutex);
+        if (!av_fifo_size(slave->queue))
+            break;
+        av_fifo_generic_read(slave->queue, &entry, sizeof(entry), NULL);
+        slave->queued_bytes -= entry.pkt.size;
+        pthread_cond_signal(&slave->cond);
+        pthread_mutex_unlock(&slave->mutex);
+
+        /* keep draining after an error so that a blocked caller resumes */
+        if (slave->error) {
+            av_free_packet(&entry.pkt);
+            ret = 0;
+        } else {
+            ret = write_slave_packet(slave, &entry.pkt);
+        }
+
+        pthread_mutex_lock(&slave->mutex);
+        if (ret < 0)
+            slave->error = ret;
+    }
+    pthread_mutex_unlock(&slave->mutex);
+    return NULL;
+}
+
+static int start_writer(TeeSlave *slave)
+{
+    int ret;
+
+    slave->queue         = av_fifo_alloc_array(16, sizeof(TeeQueueEntry));
+    slave->need_keyframe = av_mallocz(slave->avf->nb_streams);
+    if (!slave->queue || !slave->need_keyframe)
+        return AVERROR(ENOMEM);
+
+    if ((ret = pthread_mutex_init(&slave->mutex, NULL)))
+        return AVERROR(ret);
+    if ((ret = pthread_cond_init(&slave->cond, NULL))) {
+        pthread_mutex_destroy(&slave->mutex);
+        return AVERROR(ret);
+    }
+    if ((ret = pthread_create(&slave->thread, NULL, slave_writer, slave))) {
+        pthread_cond_destroy(&slave->cond);
+        pthread_mutex_destroy(&slave->mutex);
+        return AVERROR(ret);
+    }
+    slave->thread_started = 1;
+    return 0;
+}
+
+/**
+ * Wait for the writer thread to finish, after it has written the queued
+ * packets or, if discard is set, after they have been freed.
+ */
+static int stop_writer(TeeSlave *slave, int discard)
+{
+    TeeQueueEntry entry;
+
+    if (!slave->thread_started)
+        return 0;
+
+    pthread_mutex_lock(&slave->mutex);
+    slave->eof = 1;
+    while (discard && av_fifo_size(slave->queue)) {
+        av_fifo_generic_read(slave->queue, &entry, sizeof(entry), NULL);
+        av_free_packet(&entry.pkt);
+    }
+    pthread_cond_signal(&slave->cond);
+    pthread_mutex_unlock(&slave->mutex);
+
+    pthread_join(slave->thread, NULL);
+    pthread_cond_destroy(&slave->cond);
+    pthread_mutex_destroy(&slave->mutex);
+    slave->thread_started = 0;
+    slave->queued_bytes   = 0;
+    return slave->error;
+}
+
+static int queue_full(TeeSlave *slave, const TeeQueueEntry *entry)
+{
+    TeeQueueEntry head;
+
+    /* a single packet is always accepted, however large */
+    if (!av_fifo_size(slave->queue))
+        return 0;
+    if (slave->queue_size &&
+        slave->queued_bytes + entry->pkt.size > slave->queue_size)
+        return 1;
+    if (slave->queue_duration && entry->ts != AV_NOPTS_VALUE) {
+        av_fifo_generic_peek(slave->queue, &head, sizeof(head), NULL);
+        if (head.ts != AV_NOPTS_VALUE &&
+            entry->ts - head.ts > slave->queue_duration)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * Hand a packet over to the writer thread of the slave, taking ownership
+ * of it. When the queue is full the packet is dropped, and so is every
+ * following packet of the slave up to the next keyframe of its stream, or
+ * the call waits for room, depending on the overflow policy.
+ */
+static int queue_slave_packet(void *log, TeeSlave *slave, TeeQueueEntry *entry)
+{
+    int s2 = entry->pkt.stream_index;
+    int ret = 0;
+    unsigned i;
+
+    pthread_mutex_lock(&slave->mutex);
+    if (slave->error) {
+        ret = slave->error;
+        goto fail;
+    }
+    if (slave->need_keyframe[s2] && !(entry->pkt.flags & AV_PKT_FLAG_KEY))
+        goto drop;
+    while (queue_full(slave, entry)) {
+        if (slave->overflow == TEE_OVERFLOW_DROP) {
+            if (!slave->need_keyframe[s2])
+                av_log(log, AV_LOG_WARNING, "Slave '%s': queue full, dropping "
+                       "packets until the next keyframe\n", slave->avf->filename);
+            for (i = 0; i < slave->avf->nb_streams; i++)
+                slave->need_keyframe[i] = 1;
+            goto drop;
+        }
+        pthread_cond_wait(&slave->cond, &slave->mutex);
+    }
+    slave->need_keyframe[s2] = 0;
+
+    if (av_fifo_space(slave->queue) < sizeof(*entry) &&
+        (ret = av_fifo_grow(slave->queue, av_fifo_size(slave->queue))) < 0)
+        goto fail;
+    av_fifo_generic_write(slave->queue, entry, sizeof(*entry), NULL);
+    slave->queued_bytes += entry->pkt.size;
+    pthread_cond_signal(&slave->cond);
+    pthread_mutex_unlock(&slave->mutex);
+    return 0;
+
+drop:
+    slave->packets_dropped++;
+fail:
+    pthread_mutex_unlock(&slave->mutex);
+    av_free_packet(&entry->pkt);
+    return ret;
+}
+
+static void update_slave_stats(TeeContext *tee)
+{
+    char buf[STATS_SIZE] = "";
+    unsigned i;
+
+    for (i = 0; i < tee->nb_slaves; i++) {
+        TeeSlave *slave = &tee->slaves[i];
+
+        if (!slave->thread_started)
+            continue;
+        pthread_mutex_lock(&slave->mutex);
+        av_strlcatf(buf, sizeof(buf),
+                    "%s%u:packets=%d:bytes=%"PRId64":dropped=%"PRId64,
+                    *buf ? "|" : "", i,
+                    (int)(av_fifo_size(slave->queue) / sizeof(TeeQueueEntry)),
+                    slave->queued_bytes, slave->packets_dropped);
+        pthread_mutex_unlock(&slave->mutex);
+    }
+
+    /* The string may be read from another thread, so it is never
+     * reallocated; its last byte stays 0 whatever is copied. */
+    if (strcmp(buf, tee->slave_stats))
+        av_strlcpy(tee->slave_stats, buf, STATS_SIZE);
+}
+#else
+static int start_writer(TeeSlave *slave)
+{
+    return AVERROR(ENOSYS);
+}
+
+static int stop_writer(TeeSlave *slave, int discard)
+{
+    return 0;
+}
+
+static int queue_slave_packet(void *log, TeeSlave *slave, TeeQueueEntry *entry)
+{
+    av_free_packet(&entry->pkt);
+    return AVERROR(ENOSYS);
+}
+
+static void update_slave_stats(TeeContext *tee)
+{
+}
+#endif
+
 static void close_slaves(AVFormatContext *avf)
 {
     TeeContext *tee = avf->priv_data;
@@ -294,6 +668,10 @@ static void close_slaves(AVFormatContext *avf)
     for (i = 0; i < tee->nb_slaves; i++) {
         avf2 = tee->slaves[i].avf;
 
+        stop_writer(&tee->slaves[i], 1);
+        av_fifo_freep(&tee->slaves[i].queue);
+        av_freep(&tee->slaves[i].need_keyframe);
+
         for (j = 0; j < avf2->nb_streams; j++) {
             AVBitStreamFilterContext *bsf_next, *bsf = tee->slaves[i].bsfs[j];
             while (bsf) {
@@ -316,6 +694,11 @@ static void log_slave(TeeSlave *slave, void *log_ctx, int log_level)
     int i;
     av_log(log_ctx, log_level, "filename:'%s' format:%s\n",
            slave->avf->filename, slave->avf->oformat->name);
+    if (slave->async)
+        av_log(log_ctx, log_level, "    async queue_size:%"PRId64" "
+               "queue_duration:%"PRId64" overflow:%s\n",
+               slave->queue_size, slave->queue_duration,
+               slave->overflow == TEE_OVERFLOW_DROP ? "drop" : "block");
     for (i = 0; i < slave->avf->nb_streams; i++) {
         AVStream *st = slave->avf->streams[i];
         AVBitStreamFilterContext *bsf = slave->bsfs[i];
@@ -367,6 +750,20 @@ static int tee_write_header(AVFormatContext *avf)
 
     tee->nb_slaves = nb_slaves;
 
+    av_freep(&tee->slave_stats);
+    if (!(tee->slave_stats = av_mallocz(STATS_SIZE))) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    for (i = 0; i < nb_slaves; i++) {
+        if (tee->slaves[i].async && (ret = start_writer(&tee->slaves[i])) < 0) {
+            av_log(avf, AV_LOG_ERROR, "Slave '%s': error starting writer "
+                   "thread: %s\n", tee->slaves[i].avf->filename, av_err2str(ret));
+            goto fail;
+        }
+    }
+
     for (i = 0; i < avf->nb_streams; i++) {
         int j, mapped = 0;
         for (j = 0; j < tee->nb_slaves; j++)
@@ -384,53 +781,6 @@ fail:
     return ret;
 }
 
-static int filter_packet(void *log_ctx, AVPacket *pkt,
-                         AVFormatContext *fmt_ctx, AVBitStreamFilterContext *bsf_ctx)
-{
-    AVCodecContext *enc_ctx = fmt_ctx->streams[pkt->stream_index]->codec;
-    int ret = 0;
-
-    while (bsf_ctx) {
-        AVPacket new_pkt = *pkt;
-        ret = av_bitstream_filter_filter(bsf_ctx, enc_ctx, NULL,
-                                             &new_pkt.data, &new_pkt.size,
-                                             pkt->data, pkt->size,
-                                             pkt->flags & AV_PKT_FLAG_KEY);
-FF_DISABLE_DEPRECATION_WARNINGS
-        if (ret == 0 && new_pkt.data != pkt->data
-#if FF_API_DESTRUCT_PACKET
-            && new_pkt.destruct
-#endif
-            ) {
-FF_ENABLE_DEPRECATION_WARNINGS
-            if ((ret = av_copy_packet(&new_pkt, pkt)) < 0)
-                break;
-            ret = 1;
-        }
-
-        if (ret > 0) {
-            pkt->side_data = NULL;
-            pkt->side_data_elems = 0;
-            av_free_packet(pkt);
-            new_pkt.buf = av_buffer_create(new_pkt.data, new_pkt.size,
-                                           av_buffer_default_free, NULL, 0);
-            if (!new_pkt.buf)
-                break;
-        }
-        if (ret < 0) {
-            av_log(log_ctx, AV_LOG_ERROR,
-                "Failed to filter bitstream with filter %s for stream %d in file '%s' with codec %s\n",
-                bsf_ctx->filter->name, pkt->stream_index, fmt_ctx->filename,
-                avcodec_get_name(enc_ctx->codec_id));
-        }
-        *pkt = new_pkt;
-
-        bsf_ctx = bsf_ctx->next;
-    }
-
-    return ret;
-}
-
 static int tee_write_trailer(AVFormatContext *avf)
 {
     TeeContext *tee = avf->priv_data;
@@ -438,6 +788,17 @@ static int tee_write_trailer(AVFormatContext *avf)
     int ret_all = 0, ret;
     unsigned i;
 
+    for (i = 0; i < tee->nb_slaves; i++) {
+        TeeSlave *slave = &tee->slaves[i];
+
+        if ((ret = stop_writer(slave, 0)) < 0)
+            if (!ret_all)
+                ret_all = ret;
+        if (slave->packets_dropped)
+            av_log(avf, AV_LOG_WARNING, "Slave '%s': %"PRId64" packets dropped\n",
+                   slave->avf->filename, slave->packets_dropped);
+    }
+
     for (i = 0; i < tee->nb_slaves; i++) {
         avf2 = tee->slaves[i].avf;
         if ((ret = av_write_trailer(avf2)) < 0)
@@ -458,6 +819,7 @@ static int tee_write_packet(AVFormatContext *avf, AVPacket *pkt)
     TeeContext *tee = avf->priv_data;
     AVFormatContext *avf2;
     AVPacket pkt2;
+    TeeQueueEntry entry;
     int ret_all = 0, ret;
     unsigned i, s;
     int s2;
@@ -483,11 +845,20 @@ static int tee_write_packet(AVFormatContext *avf, AVPacket *pkt)
         pkt2.duration = av_rescale_q(pkt->duration, tb, tb2);
         pkt2.stream_index = s2;
 
-        filter_packet(avf2, &pkt2, avf2, tee->slaves[i].bsfs[s2]);
-        if ((ret = av_interleaved_write_frame(avf2, &pkt2)) < 0)
+        if (tee->slaves[i].async) {
+            entry.pkt = pkt2;
+            entry.ts  = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+            if (entry.ts != AV_NOPTS_VALUE)
+                entry.ts = av_rescale_q(entry.ts, tb, AV_TIME_BASE_Q);
+            ret = queue_slave_packet(avf, &tee->slaves[i], &entry);
+        } else {
+            ret = write_slave_packet(&tee->slaves[i], &pkt2);
+        }
+        if (ret < 0)
             if (!ret_all)
                 ret_all = ret;
     }
+    update_slave_stats(tee);
     return ret_all;
 }
 
@@ -501,3 +872,161 @@ AVOutputFormat ff_tee_muxer = {
     .priv_class        = &tee_muxer_class,
     .flags             = AVFMT_NOFILE,
 };
+
+#ifdef TEST
+
+#include "url.h"
+
+#define NB_PACKETS   40
+#define PACKET_SIZE  100
+#define KEYINT       10
+
+/* Stand-in for a file: the written data is kept in memory, and writes to
+ * "tee-test:slow" stall while the test holds it. */
+typedef struct TestOutput {
+    char data[4096];
+    int size;
+} TestOutput;
+
+static TestOutput outputs[2];
+static pthread_mutex_t test_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  test_cond  = PTHREAD_COND_INITIALIZER;
+static int hold, held;
+
+static int tee_test_open(URLContext *h, const char *arg, int flags)
+{
+    av_strstart(arg, "tee-test:", &arg);
+    h->priv_data = &outputs[!strcmp(arg, "slow")];
+    return 0;
+}
+
+static int tee_test_write(URLContext *h, const unsigned char *buf, int size)
+{
+    TestOutput *out = h->priv_data;
+
+    pthread_mutex_lock(&test_mutex);
+    if (out == &outputs[1]) {
+        held = hold;
+        pthread_cond_broadcast(&test_cond);
+        while (hold)
+            pthread_cond_wait(&test_cond, &test_mutex);
+        held = 0;
+    }
+    pthread_mutex_unlock(&test_mutex);
+
+    size = FFMIN(size, sizeof(out->data) - 1 - out->size);
+    memcpy(out->data + out->size, buf, size);
+    out->size += size;
+    return size;
+}
+
+static int tee_test_close(URLContext *h)
+{
+    h->priv_data = NULL;
+    return 0;
+}
+
+static URLProtocol tee_test_protocol = {
+    .name      = "tee-test",
+    .url_open  = tee_test_open,
+    .url_write = tee_test_write,
+    .url_close = tee_test_close,
+};
+
+static void wait_drained(TeeSlave *slave)
+{
+    pthread_mutex_lock(&slave->mutex);
+    while (av_fifo_size(slave->queue))
+        pthread_cond_wait(&slave->cond, &slave->mutex);
+    pthread_mutex_unlock(&slave->mutex);
+}
+
+static int write_test_packet(AVFormatContext *avf, int n)
+{
+    uint8_t data[PACKET_SIZE];
+    AVPacket pkt;
+
+    memset(data, n, sizeof(data));
+    av_init_packet(&pkt);
+    pkt.data     = data;
+    pkt.size     = sizeof(data);
+    pkt.pts      = pkt.dts = n;
+    pkt.duration = 1;
+    pkt.flags    = n % KEYINT ? 0 : AV_PKT_FLAG_KEY;
+    return av_write_frame(avf, &pkt);
+}
+
+int main(void)
+{
+    static const char *const names[2] = { "fast", "slow" };
+    AVFormatContext *avf = NULL;
+    TeeContext *tee;
+    AVStream *st;
+    uint8_t *stats = NULL;
+    int i, ret;
+
+    av_register_all();
+    ffurl_register_protocol(&tee_test_protocol);
+
+    ret = avformat_alloc_output_context2(&avf, NULL, "tee",
+        "[f=framecrc:fflags=+flush_packets+bitexact:async=1]tee-test:fast|"
+        "[f=framecrc:fflags=+flush_packets+bitexact:async=1:queue_size=400:overflow=drop]tee-test:slow");
+    if (ret < 0)
+        return 1;
+    st = avformat_new_stream(avf, NULL);
+    st->codec->codec_type = AVMEDIA_TYPE_VIDEO;
+    st->codec->codec_id   = AV_CODEC_ID_RAWVIDEO;
+    st->codec->width      = 10;
+    st->codec->height     = 10;
+    st->codec->pix_fmt    = AV_PIX_FMT_GRAY8;
+    st->time_base         = (AVRational){ 1, 25 };
+    if ((ret = avformat_write_header(avf, NULL)) < 0) {
+        printf("write_header: %s\n", av_err2str(ret));
+        return 1;
+    }
+    tee = avf->priv_data;
+
+    /* Stall the slow slave inside the write of the first packet, the fast
+     * slave and the caller must carry on regardless. */
+    pthread_mutex_lock(&test_mutex);
+    hold = 1;
+    pthread_mutex_unlock(&test_mutex);
+    write_test_packet(avf, 0);
+    pthread_mutex_lock(&test_mutex);
+    while (!held)
+        pthread_cond_wait(&test_cond, &test_mutex);
+    pthread_mutex_unlock(&test_mutex);
+
+    for (i = 1; i < NB_PACKETS / 2 + 5; i++)
+        write_test_packet(avf, i);
+
+    av_opt_get(avf->priv_data, "slave_stats", 0, &stats);
+    printf("stalled: %s\n", strchr((char *)stats, '|') + 1);
+    av_freep(&stats);
+
+    /* Let the slow slave catch up, it resumes at the next keyframe. */
+    pthread_mutex_lock(&test_mutex);
+    hold = 0;
+    pthread_cond_broadcast(&test_cond);
+    pthread_mutex_unlock(&test_mutex);
+    wait_drained(&tee->slaves[1]);
+
+    for (; i < NB_PACKETS; i++) {
+        write_test_packet(avf, i);
+        wait_drained(&tee->slaves[1]);
+    }
+    wait_drained(&tee->slaves[0]);
+
+    for (i = 0; i < 2; i++)
+        printf("%s: dropped=%"PRId64"\n", names[i], tee->slaves[i].packets_dropped);
+
+    if ((ret = av_write_trailer(avf)) < 0)
+        printf("write_trailer: %s\n", av_err2str(ret));
+    avformat_free_context(avf);
+
+    for (i = 0; i < 2; i++)
+        printf("%s:\n%s", names[i], outputs[i].data);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,83 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+
+#include "avformat.h"
+#include "url.h"
+
+static const int sizes[] = { 188, 1316, 1472, 1473, 4000, 9000, 32768 };
+
+static uint8_t buf[65536];
+
+/* send datagrams of all sizes over loopback and check what arrives */
+static int test(const char *options)
+{
+    URLContext *in = NULL, *out = NULL;
+    char url[256];
+    int i, j, ret;
+
+    printf("input options '%s'\n", options);
+    snprintf(url, sizeof(url), "udp://127.0.0.1:0?timeout=5000000%s", options);
+    if ((ret = ffurl_open(&in, url, AVIO_FLAG_READ, NULL, NULL)) < 0)
+        goto end;
+    snprintf(url, sizeof(url), "udp://127.0.0.1:%d?pkt_size=65000",
+             ff_udp_get_local_port(in));
+    if ((ret = ffurl_open(&out, url, AVIO_FLAG_WRITE, NULL, NULL)) < 0)
+        goto end;
+
+    for (i = 0; i < FF_ARRAY_ELEMS(sizes); i++) {
+        for (j = 0; j < sizes[i]; j++)
+            buf[j] = i + j * 7;
+        if ((ret = ffurl_write(out, buf, sizes[i])) < 0)
+            goto end;
+    }
+
+    for (i = 0; i < FF_ARRAY_ELEMS(sizes); i++) {
+        memset(buf, 0, sizeof(buf));
+        if ((ret = ffurl_read(in, buf, sizeof(buf))) < 0)
+            goto end;
+        for (j = 0; j < ret; j++)
+            if (buf[j] != (uint8_t)(i + j * 7))
+                break;
+        printf("sent %5d received %5d%s\n", sizes[i], ret,
+               j < ret ? " corrupted" : "");
+    }
+    ret = 0;
+
+end:
+    if (ret < 0)
+        printf("error: %s\n", av_err2str(ret));
+    ffurl_close(out);
+    ffurl_close(in);
+    return ret;
+}
+
+int main(void)
+{
+    int ret = 0;
+
+    av_log_set_level(AV_LOG_ERROR);
+    av_register_all();
+
+    ret |= test("");
+    ret |= test("&fifo_size=0");
+    ret |= test("&pkt_size=2048");
+
+    return ret < 0;
+}
@@ -24,12 +24,14 @@
  * UDP protocol
  */
 
+#define _DEFAULT_SOURCE
 #define _BSD_SOURCE     /* Needed for using struct ip_mreq with recent glibc */
+#define _GNU_SOURCE     /* Needed for recvmmsg() and sendmmsg() */
 
 #include "avformat.h"
 #include "avio_internal.h"
 #include "libavutil/parseutils.h"
-#include "libavutil/fifo.h"
+#include "libavutil/atomic.h"
 #include "libavutil/intreadwrite.h"
 #include "libavutil/avstring.h"
 #include "libavutil/opt.h"
@@ -70,6 +72,26 @@
 #define UDP_TX_BUF_SIZE 32768
 #define UDP_MAX_PKT_SIZE 65536
 #define UDP_HEADER_SIZE 8
+#define UDP_DEFAULT_PKT_SIZE 1472
+
+#if HAVE_RECVMMSG && defined(SO_RXQ_OVFL)
+#define UDP_CMSG_SIZE CMSG_SPACE(sizeof(uint32_t))
+#endif
+
+/* maximum number of datagrams sent at once by the pacing thread */
+#define UDP_TX_BATCH 64
+/* datagrams are handed to the kernel this long before they are due
+ * when they carry their transmit time */
+#define UDP_TXTIME_LEAD 2000
+/* a batch of datagrams is sent once its first one is this old, in
+ * microseconds */
+#define UDP_BATCH_DELAY 1000
+/* data the paced output buffers by default, in microseconds */
+#define UDP_TX_LATENCY 100000
+
+#if HAVE_SENDMMSG && HAVE_CLOCK_GETTIME && defined(SO_TXTIME)
+#define UDP_TXTIME_CMSG_SIZE CMSG_SPACE(sizeof(uint64_t))
+#endif
 
 typedef struct UDPContext {
     const AVClass *class;
@@ -87,17 +109,62 @@ typedef struct UDPContext {
     int dest_addr_len;
     int is_connected;
 
-    /* Circular Buffer variables for use in UDP receive code */
+    /* Circular Buffer variables for use in UDP receive code, and in the
+     * send code when the output is paced */
     int circular_buffer_size;
-    AVFifoBuffer *fifo;
-    int circular_buffer_error;
+    volatile int circular_buffer_error;
 #if HAVE_PTHREAD_CANCEL
     pthread_t circular_buffer_thread;
     pthread_mutex_t mutex;
     pthread_cond_t cond;
-    int thread_started;
+    int thread_started;         ///< receiving thread
+    int tx_started;             ///< pacing thread
+#endif
+    /* The circular buffer is a ring of datagram slots, filled by the
+     * receiving thread and emptied by udp_read() without locking; the
+     * mutex is only used to sleep when it is empty. Paced output uses it
+     * the other way round: udp_write() fills it and the thread sends. */
+    uint8_t *ring;
+    int *ring_sizes;
+    int nb_slots;
+    int slot_size;
+    volatile int ring_head;     ///< datagrams received or written
+    volatile int ring_tail;     ///< datagrams read or sent
+    volatile int ring_waiting;  ///< a side is sleeping on cond
+    int recv_batch;
+#if HAVE_RECVMMSG
+    struct mmsghdr *recv_msgs;
+    struct iovec *recv_iov;
+#ifdef UDP_CMSG_SIZE
+    uint8_t *recv_cmsg;
+#endif
+#endif
+    int64_t overruns;           ///< datagrams dropped because the ring was full
+    int64_t kernel_drops;       ///< datagrams dropped by the kernel
+    int overrunning;
+
+    /* Datagrams waiting to be sent with one call */
+    int send_batch;
+    uint8_t *send_buf;
+    int nb_send;
+    int send_done;              ///< datagrams of the batch already sent
+    int64_t send_first;         ///< time the first datagram was queued
+#if HAVE_SENDMMSG
+    struct mmsghdr *send_msgs;
+    struct iovec *send_iov;
+#ifdef UDP_TXTIME_CMSG_SIZE
+    uint8_t *send_cmsg;
+#endif
 #endif
-    uint8_t tmp[UDP_MAX_PKT_SIZE+4];
+
+    /* Paced output */
+    int64_t bitrate;
+    int64_t burst_bits;
+    int txtime;
+    volatile int close_req;     ///< stop the pacing thread
+    int64_t tx_start;           ///< time at which the pacing clock was at 0 bits
+    int64_t tx_bits;            ///< bits sent since tx_start
+    uint8_t tmp[UDP_MAX_PKT_SIZE];
     int remaining_in_dg;
     char *localaddr;
     int timeout;
@@ -115,14 +182,21 @@ static const AVOption options[] = {
     { "local_port",     "Local port",                                      OFFSET(local_port),     AV_OPT_TYPE_INT,    { .i64 = -1 },    -1, INT_MAX, .flags = D|E },
     { "localaddr",      "Local address",                                   OFFSET(localaddr),      AV_OPT_TYPE_STRING, { .str = NULL },               .flags = D|E },
     { "udplite_coverage", "choose UDPLite head size which should be validated by checksum", OFFSET(udplite_coverage), AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, D|E },
-    { "pkt_size",       "Maximum UDP packet size",                         OFFSET(pkt_size),       AV_OPT_TYPE_INT,    { .i64 = 1472 },  -1, INT_MAX, .flags = D|E },
+    { "pkt_size",       "Maximum UDP packet size",                         OFFSET(pkt_size),       AV_OPT_TYPE_INT,    { .i64 = -1 },    -1, INT_MAX, .flags = D|E },
     { "reuse",          "explicitly allow reusing UDP sockets",            OFFSET(reuse_socket),   AV_OPT_TYPE_INT,    { .i64 = -1 },    -1, 1,       D|E },
     { "reuse_socket",   "explicitly allow reusing UDP sockets",            OFFSET(reuse_socket),   AV_OPT_TYPE_INT,    { .i64 = -1 },    -1, 1,       .flags = D|E },
     { "broadcast", "explicitly allow or disallow broadcast destination",   OFFSET(is_broadcast),   AV_OPT_TYPE_INT,    { .i64 = 0  },     0, 1,       E },
     { "ttl",            "Time to live (multicast only)",                   OFFSET(ttl),            AV_OPT_TYPE_INT,    { .i64 = 16 },     0, INT_MAX, E },
     { "connect",        "set if connect() should be called on socket",     OFFSET(is_connected),   AV_OPT_TYPE_INT,    { .i64 =  0 },     0, 1,       .flags = D|E },
-    { "fifo_size",      "set the UDP receiving circular buffer size, expressed as a number of packets with size of 188 bytes", OFFSET(circular_buffer_size), AV_OPT_TYPE_INT, {.i64 = 7*4096}, 0, INT_MAX, D },
+    { "fifo_size",      "set the UDP receiving or paced sending circular buffer size, expressed as a number of packets with size of 188 bytes", OFFSET(circular_buffer_size), AV_OPT_TYPE_INT, {.i64 = -1}, -1, INT_MAX, D|E },
     { "overrun_nonfatal", "survive in case of UDP receiving circular buffer overrun", OFFSET(overrun_nonfatal), AV_OPT_TYPE_INT, {.i64 = 0}, 0, 1,    D },
+    { "recv_batch",     "maximum number of datagrams received by one system call", OFFSET(recv_batch), AV_OPT_TYPE_INT, { .i64 = 32 },     1, 1024,    D },
+    { "send_batch",     "number of datagrams sent by one system call",     OFFSET(send_batch),     AV_OPT_TYPE_INT,    { .i64 = 1 },      1, 1024,    E },
+    { "bitrate",        "pace the output to this rate in bits per second", OFFSET(bitrate),        AV_OPT_TYPE_INT64,  { .i64 = 0 },      0, INT64_MAX, E },
+    { "burst_bits",     "maximum number of bits sent at once to catch up with the pace", OFFSET(burst_bits), AV_OPT_TYPE_INT64, { .i64 = 0 }, 0, INT64_MAX, E },
+    { "txtime",         "give the kernel the transmit time of each paced datagram", OFFSET(txtime), AV_OPT_TYPE_INT, { .i64 = 0 },     0, 1,       E },
+    { "overruns",       "datagrams dropped because the circular buffer was full", OFFSET(overruns), AV_OPT_TYPE_INT64, { .i64 = 0 }, 0, INT64_MAX, D|AV_OPT_FLAG_EXPORT|AV_OPT_FLAG_READONLY },
+    { "kernel_drops",   "datagrams dropped by the kernel because the socket buffer was full", OFFSET(kernel_drops), AV_OPT_TYPE_INT64, { .i64 = 0 }, 0, INT64_MAX, D|AV_OPT_FLAG_EXPORT|AV_OPT_FLAG_READONLY },
     { "timeout",        "set raise error timeout (only in read mode)",     OFFSET(timeout),        AV_OPT_TYPE_INT,    { .i64 = 0 },      0, INT_MAX, D },
     { "sources",        "Source list",                                     OFFSET(sources),        AV_OPT_TYPE_STRING, { .str = NULL },               .flags = D|E },
     { "block",          "Block list",                                      OFFSET(block),          AV_OPT_TYPE_STRING, { .str = NULL },               .flags = D|E },
@@ -477,6 +551,108 @@ static int udp_get_file_handle(URLContext *h)
 }
 
 #if HAVE_PTHREAD_CANCEL
+/**
+ * Receive up to nb datagrams into the slots following head, blocking until
+ * at least one is available.
+ *
+ * @return the number of datagrams received or a negative error code
+ */
+static int udp_recv_datagrams(URLContext *h, unsigned head, int nb)
+{
+    UDPContext *s = h->priv_data;
+    int old_cancelstate, ret;
+#if HAVE_RECVMMSG
+    struct cmsghdr *cmsg;
+    int i;
+
+    for (i = 0; i < nb; i++) {
+        struct msghdr *msg = &s->recv_msgs[i].msg_hdr;
+        int slot = (head + i) % s->nb_slots;
+
+        s->recv_iov[i].iov_base = s->ring + (size_t)slot * s->slot_size;
+        s->recv_iov[i].iov_len  = s->slot_size;
+        memset(msg, 0, sizeof(*msg));
+        msg->msg_iov    = &s->recv_iov[i];
+        msg->msg_iovlen = 1;
+#ifdef UDP_CMSG_SIZE
+        msg->msg_control    = s->recv_cmsg + i * UDP_CMSG_SIZE;
+        msg->msg_controllen = UDP_CMSG_SIZE;
+#endif
+    }
+
+    /* Blocking operations are always cancellation points;
+       see "General Information" / "Thread Cancelation Overview"
+       in Single Unix. */
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancelstate);
+    ret = recvmmsg(s->udp_fd, s->recv_msgs, nb, MSG_WAITFORONE, NULL);
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancelstate);
+    if (ret <= 0)
+        return ret < 0 ? ff_neterrno() : AVERROR(EAGAIN);
+
+    for (i = 0; i < ret; i++) {
+        int slot = (head + i) % s->nb_slots;
+        if (s->recv_msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+            av_log(h, AV_LOG_WARNING, "Part of datagram lost due to "
+                   "insufficient buffer size, increase pkt_size\n");
+        s->ring_sizes[slot] = FFMIN(s->recv_msgs[i].msg_len, s->slot_size);
+    }
+
+#ifdef UDP_CMSG_SIZE
+    /* The kernel reports the total number of drops of the socket */
+    for (cmsg = CMSG_FIRSTHDR(&s->recv_msgs[ret - 1].msg_hdr); cmsg;
+         cmsg = CMSG_NXTHDR(&s->recv_msgs[ret - 1].msg_hdr, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+            uint32_t drops;
+            memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+            s->kernel_drops = drops;
+        }
+    }
+#endif
+    return ret;
+#else
+    int slot = head % s->nb_slots;
+
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancelstate);
+    ret = recv(s->udp_fd, s->ring + (size_t)slot * s->slot_size, s->slot_size, 0);
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancelstate);
+    if (ret < 0)
+        return ff_neterrno();
+    s->ring_sizes[slot] = ret;
+    return 1;
+#endif
+}
+
+static void udp_ring_wake(UDPContext *s)
+{
+    if (avpriv_atomic_int_get(&s->ring_waiting)) {
+        pthread_mutex_lock(&s->mutex);
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->mutex);
+    }
+}
+
+/**
+ * Sleep until the ring index written by the other side is no longer seen,
+ * an error occurs, the context is being closed, or 100 ms have passed.
+ */
+static void udp_ring_wait(UDPContext *s, volatile int *index, unsigned seen)
+{
+    /* FIXME: using the monotonic clock would be better,
+       but it does not exist on all supported platforms. */
+    int64_t t = av_gettime() + 100000;
+    struct timespec tv = { .tv_sec  =  t / 1000000,
+                           .tv_nsec = (t % 1000000) * 1000 };
+
+    avpriv_atomic_int_add_and_fetch(&s->ring_waiting, 1);
+    pthread_mutex_lock(&s->mutex);
+    if ((unsigned)avpriv_atomic_int_get(index) == seen &&
+        !avpriv_atomic_int_get(&s->circular_buffer_error) &&
+        !avpriv_atomic_int_get(&s->close_req))
+        pthread_cond_timedwait(&s->cond, &s->mutex, &tv);
+    pthread_mutex_unlock(&s->mutex);
+    avpriv_atomic_int_add_and_fetch(&s->ring_waiting, -1);
+}
+
 static void *circular_buffer_task( void *_URLContext)
 {
     URLContext *h = _URLContext;
@@ -484,56 +660,278 @@ static void *circular_buffer_task( void *_URLContext)
     int old_cancelstate;
 
     pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancelstate);
-    pthread_mutex_lock(&s->mutex);
     if (ff_socket_nonblock(s->udp_fd, 0) < 0) {
         av_log(h, AV_LOG_ERROR, "Failed to set blocking mode");
-        s->circular_buffer_error = AVERROR(EIO);
+        avpriv_atomic_int_set(&s->circular_buffer_error, AVERROR(EIO));
         goto end;
     }
     while(1) {
+        unsigned head  = s->ring_head;
+        unsigned space = s->nb_slots -
+                         (head - (unsigned)avpriv_atomic_int_get(&s->ring_tail));
         int len;
 
-        pthread_mutex_unlock(&s->mutex);
-        /* Blocking operations are always cancellation points;
-           see "General Information" / "Thread Cancelation Overview"
-           in Single Unix. */
-        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancelstate);
-        len = recv(s->udp_fd, s->tmp+4, sizeof(s->tmp)-4, 0);
-        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancelstate);
-        pthread_mutex_lock(&s->mutex);
-        if (len < 0) {
-            if (ff_neterrno() != AVERROR(EAGAIN) && ff_neterrno() != AVERROR(EINTR)) {
-                s->circular_buffer_error = ff_neterrno();
-                goto end;
+        if (!space) {
+            /* No Space left, drop the datagram */
+            pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancelstate);
+            len = recv(s->udp_fd, s->tmp, sizeof(s->tmp), 0);
+            pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancelstate);
+            if (len < 0) {
+                if (ff_neterrno() != AVERROR(EAGAIN) && ff_neterrno() != AVERROR(EINTR)) {
+                    avpriv_atomic_int_set(&s->circular_buffer_error, ff_neterrno());
+                    goto end;
+                }
+                continue;
             }
-            continue;
-        }
-        AV_WL32(s->tmp, len);
-
-        if(av_fifo_space(s->fifo) < len + 4) {
-            /* No Space left */
+            s->overruns++;
             if (s->overrun_nonfatal) {
-                av_log(h, AV_LOG_WARNING, "Circular buffer overrun. "
-                        "Surviving due to overrun_nonfatal option\n");
+                if (!s->overrunning)
+                    av_log(h, AV_LOG_WARNING, "Circular buffer overrun. "
+                            "Surviving due to overrun_nonfatal option\n");
+                s->overrunning = 1;
                 continue;
             } else {
                 av_log(h, AV_LOG_ERROR, "Circular buffer overrun. "
                         "To avoid, increase fifo_size URL option. "
                         "To survive in such case, use overrun_nonfatal option\n");
-                s->circular_buffer_error = AVERROR(EIO);
+                avpriv_atomic_int_set(&s->circular_buffer_error, AVERROR(EIO));
                 goto end;
             }
         }
-        av_fifo_generic_write(s->fifo, s->tmp, len+4, NULL);
-        pthread_cond_signal(&s->cond);
+        s->overrunning = 0;
+
+        len = udp_recv_datagrams(h, head, FFMIN(space, s->recv_batch));
+        if (len < 0) {
+            if (len != AVERROR(EAGAIN) && len != AVERROR(EINTR)) {
+                avpriv_atomic_int_set(&s->circular_buffer_error, len);
+                goto end;
+            }
+            continue;
+        }
+        avpriv_atomic_int_set(&s->ring_head, head + len);
+        udp_ring_wake(s);
     }
 
 end:
+    pthread_mutex_lock(&s->mutex);
     pthread_cond_signal(&s->cond);
     pthread_mutex_unlock(&s->mutex);
     return NULL;
 }
+
+/**
+ * Send the nb datagrams following tail, due[i] being the transmit time
+ * of the i-th one.
+ */
+static int udp_send_ring(UDPContext *s, unsigned tail, int nb, const int64_t *due)
+{
+    int i, ret;
+#if HAVE_SENDMMSG
+    int sent = 0;
+
+    for (i = 0; i < nb; i++) {
+        struct msghdr *msg = &s->send_msgs[i].msg_hdr;
+        int slot = (tail + i) % s->nb_slots;
+
+        s->send_iov[i].iov_base = s->ring + (size_t)slot * s->slot_size;
+        s->send_iov[i].iov_len  = s->ring_sizes[slot];
+        msg->msg_iov    = &s->send_iov[i];
+        msg->msg_iovlen = 1;
+        if (!s->is_connected) {
+            msg->msg_name    = &s->dest_addr;
+            msg->msg_namelen = s->dest_addr_len;
+        }
+#ifdef UDP_TXTIME_CMSG_SIZE
+        if (s->txtime) {
+            struct cmsghdr *cmsg;
+            uint64_t txtime = due[i] * 1000;
+
+            msg->msg_control    = s->send_cmsg + i * UDP_TXTIME_CMSG_SIZE;
+            msg->msg_controllen = UDP_TXTIME_CMSG_SIZE;
+            cmsg = CMSG_FIRSTHDR(msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type  = SO_TXTIME;
+            cmsg->cmsg_len   = CMSG_LEN(sizeof(txtime));
+            memcpy(CMSG_DATA(cmsg), &txtime, sizeof(txtime));
+        }
+#endif
+    }
+
+    while (sent < nb) {
+        ret = sendmmsg(s->udp_fd, s->send_msgs + sent, nb - sent, 0);
+        if (ret < 0) {
+            ret = ff_neterrno();
+            if (ret == AVERROR(EINTR))
+                continue;
+            return ret;
+        }
+        sent += ret;
+    }
+#else
+    for (i = 0; i < nb; i++) {
+        int slot = (tail + i) % s->nb_slots;
+        uint8_t *buf = s->ring + (size_t)slot * s->slot_size;
+
+        if (!s->is_connected)
+            ret = sendto(s->udp_fd, buf, s->ring_sizes[slot], 0,
+                         (struct sockaddr *) &s->dest_addr, s->dest_addr_len);
+        else
+            ret = send(s->udp_fd, buf, s->ring_sizes[slot], 0);
+        if (ret < 0) {
+            ret = ff_neterrno();
+            if (ret == AVERROR(EINTR)) {
+                i--;
+                continue;
+            }
+            return ret;
+        }
+    }
 #endif
+    return 0;
+}
+
+/**
+ * Send the datagrams written by udp_write() at the pace set by the
+ * bitrate option, until udp_close() is called.
+ */
+static void *circular_buffer_task_tx(void *_URLContext)
+{
+    URLContext *h = _URLContext;
+    UDPContext *s = h->priv_data;
+    int64_t due[UDP_TX_BATCH];
+    int64_t lead = s->txtime ? UDP_TXTIME_LEAD : 0;
+    /* how late the schedule may run after the ring ran empty before it is
+     * restarted; by default 10 ms of data may be sent at once to catch up */
+    int64_t max_late = s->burst_bits ? av_rescale(s->burst_bits, 1000000, s->bitrate)
+                                     : 10000;
+    int ret = 0, underrun = 0;
+
+    if (ff_socket_nonblock(s->udp_fd, 0) < 0) {
+        av_log(h, AV_LOG_ERROR, "Failed to set blocking mode");
+        ret = AVERROR(EIO);
+        goto end;
+    }
+    s->tx_start = av_gettime_relative();
+    s->tx_bits  = 0;
+    while (1) {
+        unsigned tail  = s->ring_tail;
+        unsigned avail = (unsigned)avpriv_atomic_int_get(&s->ring_head) - tail;
+        int64_t now, next;
+        int nb;
+
+        if (avpriv_atomic_int_get(&s->close_req))
+            break;
+        if (!avail) {
+            udp_ring_wait(s, &s->ring_head, tail);
+            underrun = 1;
+            continue;
+        }
+
+        now  = av_gettime_relative();
+        next = s->tx_start + av_rescale(s->tx_bits, 1000000, s->bitrate);
+        if (underrun && next < now - max_late) {
+            /* the writer fell behind, do not burst to make up for it;
+             * delays of this thread are always made up for, so that the
+             * average rate is exact */
+            s->tx_start = now - max_late;
+            s->tx_bits  = 0;
+            next        = s->tx_start;
+        }
+        underrun = 0;
+        if (next > now + lead) {
+            av_usleep(FFMIN(next - now - lead, 100000));
+            continue;
+        }
+
+        for (nb = 0; nb < FFMIN(avail, UDP_TX_BATCH) && next <= now + lead; nb++) {
+            due[nb] = FFMAX(next, now);
+            s->tx_bits += 8 * s->ring_sizes[(tail + nb) % s->nb_slots];
+            next = s->tx_start + av_rescale(s->tx_bits, 1000000, s->bitrate);
+        }
+        if ((ret = udp_send_ring(s, tail, nb, due)) < 0) {
+            log_net_error(h, AV_LOG_ERROR, "Paced send");
+            goto end;
+        }
+        avpriv_atomic_int_set(&s->ring_tail, tail + nb);
+        udp_ring_wake(s);
+    }
+
+end:
+    if (ret < 0)
+        avpriv_atomic_int_set(&s->circular_buffer_error, ret);
+    pthread_mutex_lock(&s->mutex);
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+    return NULL;
+}
+
+static int udp_alloc_ring(UDPContext *s, int is_output)
+{
+    /* unless told otherwise, take received datagrams of any size */
+    s->slot_size = s->pkt_size > 0 ? s->pkt_size : UDP_MAX_PKT_SIZE;
+    s->slot_size = FFMIN(s->slot_size, UDP_MAX_PKT_SIZE);
+    if (is_output && !s->circular_buffer_size)
+        /* only buffer a bounded time ahead of the wire by default */
+        s->nb_slots = FFMIN(av_rescale(s->bitrate, UDP_TX_LATENCY,
+                                       8000000LL * s->slot_size),
+                            INT_MAX / s->slot_size);
+    else
+        s->nb_slots = s->circular_buffer_size / s->slot_size;
+    s->nb_slots = FFMAX(s->nb_slots, 2);
+
+    s->ring       = av_malloc_array(s->nb_slots, s->slot_size);
+    s->ring_sizes = av_malloc_array(s->nb_slots, sizeof(*s->ring_sizes));
+    if (!s->ring || !s->ring_sizes)
+        return AVERROR(ENOMEM);
+    if (is_output) {
+#if HAVE_SENDMMSG
+        s->send_msgs = av_mallocz_array(UDP_TX_BATCH, sizeof(*s->send_msgs));
+        s->send_iov  = av_malloc_array(UDP_TX_BATCH, sizeof(*s->send_iov));
+        if (!s->send_msgs || !s->send_iov)
+            return AVERROR(ENOMEM);
+#ifdef UDP_TXTIME_CMSG_SIZE
+        s->send_cmsg = av_mallocz_array(UDP_TX_BATCH, UDP_TXTIME_CMSG_SIZE);
+        if (!s->send_cmsg)
+            return AVERROR(ENOMEM);
+#endif
+#endif
+        return 0;
+    }
+#if HAVE_RECVMMSG
+    s->recv_msgs = av_malloc_array(s->recv_batch, sizeof(*s->recv_msgs));
+    s->recv_iov  = av_malloc_array(s->recv_batch, sizeof(*s->recv_iov));
+    if (!s->recv_msgs || !s->recv_iov)
+        return AVERROR(ENOMEM);
+#ifdef UDP_CMSG_SIZE
+    s->recv_cmsg = av_malloc_array(s->recv_batch, UDP_CMSG_SIZE);
+    if (!s->recv_cmsg)
+        return AVERROR(ENOMEM);
+#endif
+#endif
+    return 0;
+}
+#endif
+
+static void udp_free_buffers(UDPContext *s)
+{
+    av_freep(&s->ring);
+    av_freep(&s->ring_sizes);
+#if HAVE_RECVMMSG
+    av_freep(&s->recv_msgs);
+    av_freep(&s->recv_iov);
+#ifdef UDP_CMSG_SIZE
+    av_freep(&s->recv_cmsg);
+#endif
+#endif
+    av_freep(&s->send_buf);
+#if HAVE_SENDMMSG
+    av_freep(&s->send_msgs);
+    av_freep(&s->send_iov);
+#ifdef UDP_TXTIME_CMSG_SIZE
+    av_freep(&s->send_cmsg);
+#endif
+#endif
+}
 
 static int parse_source_list(char *buf, char **sources, int *num_sources,
                              int max_sources)
@@ -641,6 +1039,25 @@ static int udp_open(URLContext *h, const char *uri, int flags)
                        "'circular_buffer_size' option was set but it is not supported "
                        "on this build (pthread support is required)\n");
         }
+        if (av_find_info_tag(buf, sizeof(buf), "recv_batch", p)) {
+            s->recv_batch = av_clip(strtol(buf, NULL, 10), 1, 1024);
+        }
+        if (av_find_info_tag(buf, sizeof(buf), "send_batch", p)) {
+            s->send_batch = av_clip(strtol(buf, NULL, 10), 1, 1024);
+        }
+        if (av_find_info_tag(buf, sizeof(buf), "bitrate", p)) {
+            s->bitrate = FFMAX(strtoll(buf, NULL, 10), 0);
+        }
+        if (av_find_info_tag(buf, sizeof(buf), "burst_bits", p)) {
+            s->burst_bits = FFMAX(strtoll(buf, NULL, 10), 0);
+        }
+        if (av_find_info_tag(buf, sizeof(buf), "txtime", p)) {
+            char *endptr = NULL;
+            s->txtime = strtol(buf, &endptr, 10);
+            /* assume if no digits were found it is a request to enable it */
+            if (buf == endptr)
+                s->txtime = 1;
+        }
         if (av_find_info_tag(buf, sizeof(buf), "localaddr", p)) {
             av_strlcpy(localaddr, buf, sizeof(localaddr));
         }
@@ -660,9 +1077,17 @@ static int udp_open(URLContext *h, const char *uri, int flags)
             s->is_broadcast = strtol(buf, NULL, 10);
     }
     /* handling needed to support options picking from both AVOption and URL */
+    if (s->circular_buffer_size < 0)
+        s->circular_buffer_size = is_output ? 0 : 7*4096;
     s->circular_buffer_size *= 188;
+    if (is_output && s->pkt_size <= 0)
+        s->pkt_size = UDP_DEFAULT_PKT_SIZE;
+    if (is_output && s->bitrate > 0 && !HAVE_PTHREAD_CANCEL)
+        av_log(h, AV_LOG_WARNING,
+               "'bitrate' option was set but it is not supported "
+               "on this build (pthread support is required)\n");
     if (flags & AVIO_FLAG_WRITE) {
-        h->max_packet_size = s->pkt_size;
+        h->max_packet_size = s->pkt_size > 0 ? s->pkt_size : UDP_DEFAULT_PKT_SIZE;
     } else {
         h->max_packet_size = UDP_MAX_PKT_SIZE;
     }
@@ -811,12 +1236,28 @@ static int udp_open(URLContext *h, const char *uri, int flags)
 
     s->udp_fd = udp_fd;
 
+#if HAVE_SENDMMSG
+    if (is_output && s->send_batch > 1 && s->pkt_size > 0) {
+        s->send_buf  = av_malloc_array(s->send_batch, s->pkt_size);
+        s->send_msgs = av_mallocz_array(s->send_batch, sizeof(*s->send_msgs));
+        s->send_iov  = av_malloc_array(s->send_batch, sizeof(*s->send_iov));
+        if (!s->send_buf || !s->send_msgs || !s->send_iov)
+            goto fail;
+    }
+#endif
+
 #if HAVE_PTHREAD_CANCEL
     if (!is_output && s->circular_buffer_size) {
         int ret;
 
+#ifdef UDP_CMSG_SIZE
+        tmp = 1;
+        if (setsockopt(udp_fd, SOL_SOCKET, SO_RXQ_OVFL, &tmp, sizeof(tmp)) < 0)
+            log_net_error(h, AV_LOG_DEBUG, "setsockopt(SO_RXQ_OVFL)");
+#endif
         /* start the task going */
-        s->fifo = av_fifo_alloc(s->circular_buffer_size);
+        if (udp_alloc_ring(s, 0) < 0)
+            goto fail;
         ret = pthread_mutex_init(&s->mutex, NULL);
         if (ret != 0) {
             av_log(h, AV_LOG_ERROR, "pthread_mutex_init failed : %s\n", strerror(ret));
@@ -846,7 +1287,7 @@ static int udp_open(URLContext *h, const char *uri, int flags)
  fail:
     if (udp_fd >= 0)
         closesocket(udp_fd);
-    av_fifo_freep(&s->fifo);
+    udp_free_buffers(s);
     for (i = 0; i < num_include_sources; i++)
         av_freep(&include_sources[i]);
     for (i = 0; i < num_exclude_sources; i++)
@@ -871,42 +1312,28 @@ static int udp_read(URLContext *h, uint8_t *buf, int size)
 #if HAVE_PTHREAD_CANCEL
     int avail, nonblock = h->flags & AVIO_FLAG_NONBLOCK;
 
-    if (s->fifo) {
-        pthread_mutex_lock(&s->mutex);
+    if (s->ring) {
+        unsigned tail = s->ring_tail;
         do {
-            avail = av_fifo_size(s->fifo);
-            if (avail) { // >=size) {
-                uint8_t tmp[4];
+            if ((unsigned)avpriv_atomic_int_get(&s->ring_head) != tail) {
+                int slot = tail % s->nb_slots;
 
-                av_fifo_generic_read(s->fifo, tmp, 4, NULL);
-                avail= AV_RL32(tmp);
+                avail = s->ring_sizes[slot];
                 if(avail > size){
                     av_log(h, AV_LOG_WARNING, "Part of datagram lost due to insufficient buffer size\n");
                     avail= size;
                 }
 
-                av_fifo_generic_read(s->fifo, buf, avail, NULL);
-                av_fifo_drain(s->fifo, AV_RL32(tmp) - avail);
-                pthread_mutex_unlock(&s->mutex);
+                memcpy(buf, s->ring + (size_t)slot * s->slot_size, avail);
+                avpriv_atomic_int_set(&s->ring_tail, tail + 1);
                 return avail;
-            } else if(s->circular_buffer_error){
-                int err = s->circular_buffer_error;
-                pthread_mutex_unlock(&s->mutex);
-                return err;
+            } else if ((ret = avpriv_atomic_int_get(&s->circular_buffer_error))) {
+                return ret;
             } else if(nonblock) {
-                pthread_mutex_unlock(&s->mutex);
                 return AVERROR(EAGAIN);
             }
             else {
-                /* FIXME: using the monotonic clock would be better,
-                   but it does not exist on all supported platforms. */
-                int64_t t = av_gettime() + 100000;
-                struct timespec tv = { .tv_sec  =  t / 1000000,
-                                       .tv_nsec = (t % 1000000) * 1000 };
-                if (pthread_cond_timedwait(&s->cond, &s->mutex, &tv) < 0) {
-                    pthread_mutex_unlock(&s->mutex);
-                    return AVERROR(errno == ETIMEDOUT ? EAGAIN : errno);
-                }
+                udp_ring_wait(s, &s->ring_head, tail);
                 nonblock = 1;
             }
         } while( 1);
@@ -923,11 +1350,209 @@ static int udp_read(URLContext *h, uint8_t *buf, int size)
     return ret < 0 ? ff_neterrno() : ret;
 }
 
+#if HAVE_PTHREAD_CANCEL
+/**
+ * Start the thread sending the datagrams written from now on at the pace
+ * set by the bitrate option.
+ */
+static int udp_start_tx_thread(URLContext *h)
+{
+    UDPContext *s = h->priv_data;
+    int ret;
+
+#if HAVE_SENDMMSG
+    /* the ring replaces the batch of udp_write() */
+    av_freep(&s->send_buf);
+    av_freep(&s->send_msgs);
+    av_freep(&s->send_iov);
+#endif
+    if (udp_alloc_ring(s, 1) < 0) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+#ifdef UDP_TXTIME_CMSG_SIZE
+    if (s->txtime) {
+        /* struct sock_txtime of linux/net_tstamp.h */
+        struct {
+            clockid_t clockid;
+            uint32_t flags;
+        } cfg = { CLOCK_MONOTONIC, 0 };
+
+        if (!av_gettime_relative_is_monotonic() ||
+            setsockopt(s->udp_fd, SOL_SOCKET, SO_TXTIME, &cfg, sizeof(cfg)) < 0) {
+            log_net_error(h, AV_LOG_WARNING, "setsockopt(SO_TXTIME)");
+            s->txtime = 0;
+        }
+    }
+#else
+    if (s->txtime) {
+        av_log(h, AV_LOG_WARNING, "'txtime' option is not supported on this system\n");
+        s->txtime = 0;
+    }
+#endif
+
+    ret = pthread_mutex_init(&s->mutex, NULL);
+    if (ret != 0) {
+        av_log(h, AV_LOG_ERROR, "pthread_mutex_init failed : %s\n", strerror(ret));
+        ret = AVERROR(ret);
+        goto fail;
+    }
+    ret = pthread_cond_init(&s->cond, NULL);
+    if (ret != 0) {
+        av_log(h, AV_LOG_ERROR, "pthread_cond_init failed : %s\n", strerror(ret));
+        ret = AVERROR(ret);
+        goto cond_fail;
+    }
+    ret = pthread_create(&s->circular_buffer_thread, NULL, circular_buffer_task_tx, h);
+    if (ret != 0) {
+        av_log(h, AV_LOG_ERROR, "pthread_create failed : %s\n", strerror(ret));
+        ret = AVERROR(ret);
+        goto thread_fail;
+    }
+    s->tx_started = 1;
+    return 0;
+
+ thread_fail:
+    pthread_cond_destroy(&s->cond);
+ cond_fail:
+    pthread_mutex_destroy(&s->mutex);
+ fail:
+    udp_free_buffers(s);
+    return ret;
+}
+
+/**
+ * Queue a datagram for the pacing thread, waiting while the ring is full.
+ */
+static int udp_write_paced(URLContext *h, const uint8_t *buf, int size)
+{
+    UDPContext *s = h->priv_data;
+    unsigned head = s->ring_head;
+    int slot, ret;
+
+    while (1) {
+        unsigned tail = avpriv_atomic_int_get(&s->ring_tail);
+
+        if ((ret = avpriv_atomic_int_get(&s->circular_buffer_error)))
+            return ret;
+        if (head - tail < s->nb_slots)
+            break;
+        if (h->flags & AVIO_FLAG_NONBLOCK)
+            return AVERROR(EAGAIN);
+        udp_ring_wait(s, &s->ring_tail, tail);
+    }
+
+    slot = head % s->nb_slots;
+    size = FFMIN(size, s->slot_size);
+    memcpy(s->ring + (size_t)slot * s->slot_size, buf, size);
+    s->ring_sizes[slot] = size;
+    avpriv_atomic_int_set(&s->ring_head, head + 1);
+    udp_ring_wake(s);
+    return size;
+}
+#endif
+
+#if HAVE_SENDMMSG
+/**
+ * Send the datagrams collected by udp_write().
+ *
+ * @return 0 once the batch is sent, AVERROR(EAGAIN) if the socket is not
+ *         ready, in which case the rest of the batch is kept for the
+ *         next call
+ */
+static int udp_send_batch(URLContext *h)
+{
+    UDPContext *s = h->priv_data;
+    int i, ret;
+
+    for (i = s->send_done; i < s->nb_send; i++) {
+        struct msghdr *msg = &s->send_msgs[i].msg_hdr;
+        msg->msg_iov    = &s->send_iov[i];
+        msg->msg_iovlen = 1;
+        if (!s->is_connected) {
+            msg->msg_name    = &s->dest_addr;
+            msg->msg_namelen = s->dest_addr_len;
+        }
+    }
+
+    while (s->send_done < s->nb_send) {
+        if (!(h->flags & AVIO_FLAG_NONBLOCK)) {
+            ret = ff_network_wait_fd(s->udp_fd, 1);
+            if (ret < 0)
+                return ret;
+        }
+        ret = sendmmsg(s->udp_fd, s->send_msgs + s->send_done,
+                       s->nb_send - s->send_done, 0);
+        if (ret < 0) {
+            ret = ff_neterrno();
+            if (ret == AVERROR(EINTR))
+                continue;
+            if (ret == AVERROR(EAGAIN))
+                return ret;
+            /* the datagrams are lost, like with a single send */
+            s->nb_send = s->send_done = 0;
+            return ret;
+        }
+        s->send_done += ret;
+    }
+    s->nb_send = s->send_done = 0;
+    return 0;
+}
+#endif
+
 static int udp_write(URLContext *h, const uint8_t *buf, int size)
 {
     UDPContext *s = h->priv_data;
     int ret;
 
+#if HAVE_PTHREAD_CANCEL
+    /* a socket also opened for reading may have the receiving thread */
+    if (s->bitrate > 0 && !(h->flags & AVIO_FLAG_READ)) {
+        if (!s->tx_started) {
+#if HAVE_SENDMMSG
+            if (s->nb_send && (ret = udp_send_batch(h)) < 0)
+                return ret;
+#endif
+            if ((ret = udp_start_tx_thread(h)) < 0)
+                return ret;
+        }
+        return udp_write_paced(h, buf, size);
+    }
+#endif
+
+#if HAVE_SENDMMSG
+    if (s->send_buf) {
+        uint8_t *dst;
+        int64_t now;
+
+        /* the datagram is not taken while the batch is still full */
+        if (s->nb_send == s->send_batch && (ret = udp_send_batch(h)) < 0)
+            return ret;
+
+        now = av_gettime_relative();
+        if (!s->nb_send)
+            s->send_first = now;
+        dst  = s->send_buf + (size_t)s->nb_send * s->pkt_size;
+        size = FFMIN(size, s->pkt_size);
+        memcpy(dst, buf, size);
+        s->send_iov[s->nb_send].iov_base = dst;
+        s->send_iov[s->nb_send].iov_len  = size;
+        s->nb_send++;
+
+        /* Send when the batch is full, on a short datagram, which is what
+         * avio_flush() produces, or when the first datagram has waited
+         * long enough. Unsent datagrams are retried on the next write. */
+        if (s->nb_send == s->send_batch || size < s->pkt_size ||
+            now - s->send_first >= UDP_BATCH_DELAY) {
+            ret = udp_send_batch(h);
+            if (ret < 0 && ret != AVERROR(EAGAIN))
+                return ret;
+        }
+        return size;
+    }
+#endif
+
     if (!(h->flags & AVIO_FLAG_NONBLOCK)) {
         ret = ff_network_wait_fd(s->udp_fd, 1);
         if (ret < 0)
@@ -948,22 +1573,59 @@ static int udp_close(URLContext *h)
 {
     UDPContext *s = h->priv_data;
 
+    int ret = 0;
+
+#if HAVE_SENDMMSG
+    while (s->nb_send && (ret = udp_send_batch(h)) == AVERROR(EAGAIN)) {
+        if (ff_check_interrupt(&h->interrupt_callback)) {
+            ret = AVERROR_EXIT;
+            break;
+        }
+        if (h->flags & AVIO_FLAG_NONBLOCK)
+            ff_network_wait_fd(s->udp_fd, 1);
+    }
+#endif
+#if HAVE_PTHREAD_CANCEL
+    if (s->tx_started) {
+        unsigned tail;
+        int err;
+
+        /* let the pacing thread send what is left, unless interrupted */
+        while ((tail = avpriv_atomic_int_get(&s->ring_tail)) != s->ring_head &&
+               !avpriv_atomic_int_get(&s->circular_buffer_error) &&
+               !ff_check_interrupt(&h->interrupt_callback))
+            udp_ring_wait(s, &s->ring_tail, tail);
+        pthread_mutex_lock(&s->mutex);
+        avpriv_atomic_int_set(&s->close_req, 1);
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->mutex);
+        err = pthread_join(s->circular_buffer_thread, NULL);
+        if (err != 0)
+            av_log(h, AV_LOG_ERROR, "pthread_join(): %s\n", strerror(err));
+        if (tail != s->ring_head)
+            ret = AVERROR_EXIT;
+        if ((err = avpriv_atomic_int_get(&s->circular_buffer_error)))
+            ret = err;
+    }
+#endif
     if (s->is_multicast && (h->flags & AVIO_FLAG_READ))
         udp_leave_multicast_group(s->udp_fd, (struct sockaddr *)&s->dest_addr,(struct sockaddr *)&s->local_addr_storage);
     closesocket(s->udp_fd);
 #if HAVE_PTHREAD_CANCEL
     if (s->thread_started) {
-        int ret;
+        int err;
         pthread_cancel(s->circular_buffer_thread);
-        ret = pthread_join(s->circular_buffer_thread, NULL);
-        if (ret != 0)
-            av_log(h, AV_LOG_ERROR, "pthread_join(): %s\n", strerror(ret));
+        err = pthread_join(s->circular_buffer_thread, NULL);
+        if (err != 0)
+            av_log(h, AV_LOG_ERROR, "pthread_join(): %s\n", strerror(err));
+    }
+    if (s->thread_started || s->tx_started) {
         pthread_mutex_destroy(&s->mutex);
         pthread_cond_destroy(&s->cond);
     }
 #endif
-    av_fifo_freep(&s->fifo);
-    return 0;
+    udp_free_buffers(s);
+    return ret;
 }
 
 URLProtocol ff_udp_protocol = {
@@ -45,6 +45,12 @@ static inline int atomic_int_add_and_fetch_suncc(volatile int *ptr, int inc)
     return atomic_add_int_nv(ptr, inc);
 }
 
+#define avpriv_atomic_int_cas atomic_int_cas_suncc
+static inline int atomic_int_cas_suncc(volatile int *ptr, int oldval, int newval)
+{
+    return atomic_cas_uint((volatile uint_t *)ptr, oldval, newval);
+}
+
 #define avpriv_atomic_ptr_cas atomic_ptr_cas_suncc
 static inline void *atomic_ptr_cas_suncc(void * volatile *ptr,
                                          void *oldval, void *newval)
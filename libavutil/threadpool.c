@@ -0,0 +1,272 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with FFmpeg; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config.h"
+
+#if HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#include "atomic.h"
+#include "common.h"
+#include "cpu.h"
+#include "error.h"
+#include "mem.h"
+#include "threadpool_internal.h"
+
+#if HAVE_PTHREADS
+
+/**
+ * The jobs of one execute call. It lives on the stack of the caller, which
+ * unlinks it and waits until no worker uses it before returning.
+ */
+typedef struct ThreadPoolBatch {
+    avpriv_thread_pool_func *func;
+    void *ctx;
+    void *arg;
+    int *rets;
+    int nb_rets;
+    int nb_jobs;
+    volatile int next_job;
+    int priority;
+    int nb_users;               ///< workers running jobs, guarded by lock
+    int max_users;
+    struct ThreadPoolBatch *next;
+} ThreadPoolBatch;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  work_cond;
+static pthread_cond_t  done_cond;
+static pthread_t      *workers;
+static int             nb_workers;
+static int             quit;
+static ThreadPoolBatch *batches;    ///< highest priority first
+static int priorities[AV_THREAD_POOL_NB_USERS] = {
+    [AV_THREAD_POOL_DECODER] = 0,
+    [AV_THREAD_POOL_FILTER]  = 1,
+    [AV_THREAD_POOL_ENCODER] = 2,
+};
+
+static void run_batch(ThreadPoolBatch *b)
+{
+    int job;
+
+    while ((job = avpriv_atomic_int_add_and_fetch(&b->next_job, 1) - 1) < b->nb_jobs)
+        b->rets[job % b->nb_rets] = b->func(b->ctx, b->arg, job, b->nb_jobs);
+}
+
+static ThreadPoolBatch *pick_batch(void)
+{
+    ThreadPoolBatch *b;
+
+    for (b = batches; b; b = b->next)
+        if (b->nb_users < b->max_users &&
+            avpriv_atomic_int_get(&b->next_job) < b->nb_jobs)
+            return b;
+    return NULL;
+}
+
+static void *worker(void *arg)
+{
+    ThreadPoolBatch *b;
+
+    pthread_mutex_lock(&lock);
+    while (1) {
+        while (!quit && !(b = pick_batch()))
+            pthread_cond_wait(&work_cond, &lock);
+        if (quit)
+            break;
+        b->nb_users++;
+        pthread_mutex_unlock(&lock);
+
+        run_batch(b);
+
+        pthread_mutex_lock(&lock);
+        if (!--b->nb_users)
+            pthread_cond_broadcast(&done_cond);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+int av_thread_pool_init(int n)
+{
+    int i, ret = 0;
+
+    if (n < 0)
+        return AVERROR(EINVAL);
+    if (!n)
+        n = av_cpu_count();
+
+    pthread_mutex_lock(&lock);
+    if (workers) {
+        ret = AVERROR(EEXIST);
+        goto end;
+    }
+    workers = av_mallocz_array(n, sizeof(*workers));
+    if (!workers) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    pthread_cond_init(&work_cond, NULL);
+    pthread_cond_init(&done_cond, NULL);
+    quit = 0;
+
+    for (i = 0; i < n; i++) {
+        ret = pthread_create(&workers[i], NULL, worker, NULL);
+        if (ret) {
+            ret = AVERROR(ret);
+            break;
+        }
+    }
+    nb_workers = i;
+end:
+    pthread_mutex_unlock(&lock);
+    if (ret < 0 && workers)
+        av_thread_pool_uninit();
+    return ret;
+}
+
+void av_thread_pool_uninit(void)
+{
+    int i;
+
+    pthread_mutex_lock(&lock);
+    if (!workers) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    quit = 1;
+    pthread_cond_broadcast(&work_cond);
+    pthread_mutex_unlock(&lock);
+
+    for (i = 0; i < nb_workers; i++)
+        pthread_join(workers[i], NULL);
+
+    pthread_mutex_lock(&lock);
+    pthread_cond_destroy(&work_cond);
+    pthread_cond_destroy(&done_cond);
+    av_freep(&workers);
+    nb_workers = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+int av_thread_pool_get_size(void)
+{
+    int n;
+
+    pthread_mutex_lock(&lock);
+    n = nb_workers;
+    pthread_mutex_unlock(&lock);
+    return n;
+}
+
+void av_thread_pool_set_priority(enum AVThreadPoolUser user, int priority)
+{
+    if ((unsigned)user >= AV_THREAD_POOL_NB_USERS)
+        return;
+    pthread_mutex_lock(&lock);
+    priorities[user] = priority;
+    pthread_mutex_unlock(&lock);
+}
+
+int avpriv_thread_pool_execute(enum AVThreadPoolUser user,
+                               avpriv_thread_pool_func *func, void *ctx,
+                               void *arg, int *ret, int nb_jobs,
+                               int max_threads)
+{
+    ThreadPoolBatch b = { 0 }, **p;
+    int dummy_ret, i;
+
+    if (nb_jobs <= 0)
+        return 0;
+
+    b.func      = func;
+    b.ctx       = ctx;
+    b.arg       = arg;
+    b.nb_jobs   = nb_jobs;
+    b.max_users = FFMIN(max_threads, nb_jobs) - 1;
+    if (ret) {
+        b.rets    = ret;
+        b.nb_rets = nb_jobs;
+    } else {
+        b.rets    = &dummy_ret;
+        b.nb_rets = 1;
+    }
+
+    pthread_mutex_lock(&lock);
+    if (!nb_workers || b.max_users <= 0) {
+        pthread_mutex_unlock(&lock);
+        run_batch(&b);
+        return 0;
+    }
+    b.priority = priorities[user];
+    for (p = &batches; *p && (*p)->priority >= b.priority; p = &(*p)->next);
+    b.next = *p;
+    *p     = &b;
+    for (i = 0; i < b.max_users; i++)
+        pthread_cond_signal(&work_cond);
+    pthread_mutex_unlock(&lock);
+
+    run_batch(&b);
+
+    pthread_mutex_lock(&lock);
+    for (p = &batches; *p != &b; p = &(*p)->next);
+    *p = b.next;
+    while (b.nb_users)
+        pthread_cond_wait(&done_cond, &lock);
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+#else
+
+int av_thread_pool_init(int nb_workers)
+{
+    return AVERROR(ENOSYS);
+}
+
+void av_thread_pool_uninit(void)
+{
+}
+
+int av_thread_pool_get_size(void)
+{
+    return 0;
+}
+
+void av_thread_pool_set_priority(enum AVThreadPoolUser user, int priority)
+{
+}
+
+int avpriv_thread_pool_execute(enum AVThreadPoolUser user,
+                               avpriv_thread_pool_func *func, void *ctx,
+                               void *arg, int *ret, int nb_jobs,
+                               int max_threads)
+{
+    int i;
+
+    for (i = 0; i < nb_jobs; i++) {
+        int r = func(ctx, arg, i, nb_jobs);
+        if (ret)
+            ret[i] = r;
+    }
+    return 0;
+}
+
+#endif /* HAVE_PTHREADS */
@@ -0,0 +1,74 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with FFmpeg; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVUTIL_THREADPOOL_H
+#define AVUTIL_THREADPOOL_H
+
+/**
+ * @file
+ * Process-wide pool of worker threads.
+ *
+ * Once the pool is started, slice threading in libavcodec and libavfilter
+ * runs its jobs on the threads of the pool instead of starting threads for
+ * each codec context and filter graph, so the number of busy threads in the
+ * process stays bounded. Frame threading in libavcodec still uses threads of
+ * its own, as its threads block waiting for each other.
+ */
+
+/**
+ * Users of the pool, each with its own priority.
+ */
+enum AVThreadPoolUser {
+    AV_THREAD_POOL_DECODER,
+    AV_THREAD_POOL_FILTER,
+    AV_THREAD_POOL_ENCODER,
+    AV_THREAD_POOL_NB_USERS,    ///< Not part of ABI
+};
+
+/**
+ * Start the pool.
+ *
+ * Must be called before opening the codecs and filter graphs which should
+ * use it, those opened earlier keep their own threads.
+ *
+ * @param nb_workers number of worker threads, 0 for the number of CPUs
+ * @return >= 0 on success, a negative AVERROR code on failure, in particular
+ *         AVERROR(EEXIST) if the pool was already started and
+ *         AVERROR(ENOSYS) if lavu was built without pthreads
+ */
+int av_thread_pool_init(int nb_workers);
+
+/**
+ * Stop the pool. The codecs and filter graphs using it must be closed.
+ */
+void av_thread_pool_uninit(void);
+
+/**
+ * @return the number of worker threads of the pool, 0 if it is not started
+ */
+int av_thread_pool_get_size(void);
+
+/**
+ * Set the priority of the jobs of a user of the pool. Idle threads take the
+ * jobs of the highest priority first. By default encoders come first, then
+ * filters, then decoders, so frames in flight leave the process before more
+ * are decoded.
+ */
+void av_thread_pool_set_priority(enum AVThreadPoolUser user, int priority);
+
+#endif /* AVUTIL_THREADPOOL_H */
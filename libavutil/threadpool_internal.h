@@ -0,0 +1,40 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with FFmpeg; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVUTIL_THREADPOOL_INTERNAL_H
+#define AVUTIL_THREADPOOL_INTERNAL_H
+
+#include "threadpool.h"
+
+typedef int (avpriv_thread_pool_func)(void *ctx, void *arg, int jobnr, int nb_jobs);
+
+/**
+ * Run nb_jobs calls of func on the pool and the calling thread, and return
+ * when all of them are done. The jobs must not wait for each other, as they
+ * may run one after the other.
+ *
+ * @param ret         if not NULL, ret[jobnr] receives the return value of job jobnr
+ * @param max_threads maximum number of threads, including the calling one,
+ *                    running the jobs at the same time
+ */
+int avpriv_thread_pool_execute(enum AVThreadPoolUser user,
+                               avpriv_thread_pool_func *func, void *ctx,
+                               void *arg, int *ret, int nb_jobs,
+                               int max_threads);
+
+#endif /* AVUTIL_THREADPOOL_INTERNAL_H */
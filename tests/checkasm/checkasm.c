@@ -60,11 +60,17 @@ static const struct {
 #if CONFIG_BSWAPDSP
     { "bswapdsp", checkasm_check_bswapdsp },
 #endif
+#if CONFIG_AVDEVICE
+    { "decklink_unpack", checkasm_check_decklink_unpack },
+#endif
 #if CONFIG_H264PRED
     { "h264pred", checkasm_check_h264pred },
 #endif
 #if CONFIG_H264QPEL
     { "h264qpel", checkasm_check_h264qpel },
+#endif
+#if CONFIG_VRREMAP
+    { "vr_remap", checkasm_check_vr_remap },
 #endif
     { NULL }
 };
@@ -30,8 +30,10 @@
 #include "libavutil/timer.h"
 
 void checkasm_check_bswapdsp(void);
+void checkasm_check_decklink_unpack(void);
 void checkasm_check_h264pred(void);
 void checkasm_check_h264qpel(void);
+void checkasm_check_vr_remap(void);
 
 void *checkasm_check_func(void *func, const char *name, ...) av_printf_format(2, 3);
 int checkasm_bench_func(void);
@@ -0,0 +1,112 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with FFmpeg; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+#include "checkasm.h"
+#include "libavdevice/decklink_unpack.h"
+#include "libavutil/common.h"
+#include "libavutil/internal.h"
+#include "libavutil/intreadwrite.h"
+
+#define MAX_WIDTH 200
+#define SRC_SIZE  (MAX_WIDTH * 4)
+#define DST_SIZE  (MAX_WIDTH * 2)
+
+/* Every line and plane gets the whole buffer, so that writes past the
+ * width are caught as well. */
+#define randomize_buffers()                                               \
+    do {                                                                  \
+        int i;                                                            \
+        for (i = 0; i < SRC_SIZE; i += 4) {                               \
+            AV_WN32A(src0 + i, rnd());                                    \
+            AV_WN32A(src1 + i, rnd());                                    \
+        }                                                                 \
+        for (i = 0; i < 4 * DST_SIZE; i += 4) {                           \
+            uint32_t r = rnd();                                           \
+            AV_WN32A(dst0 + i, r);                                        \
+            AV_WN32A(dst1 + i, r);                                        \
+        }                                                                 \
+    } while (0)
+
+#define PLANE(buf, n, type) ((type *)((buf) + (n) * DST_SIZE))
+
+#define check_422(type)                                                   \
+    do {                                                                  \
+        int w;                                                            \
+        declare_func(void, type *y, type *u, type *v,                     \
+                     const uint8_t *src, int width);                      \
+                                                                          \
+        for (w = 2; w <= MAX_WIDTH; w += 2) {                             \
+            randomize_buffers();                                          \
+            call_ref(PLANE(dst0, 0, type), PLANE(dst0, 2, type),          \
+                     PLANE(dst0, 3, type), src0, w);                      \
+            call_new(PLANE(dst1, 0, type), PLANE(dst1, 2, type),          \
+                     PLANE(dst1, 3, type), src0, w);                      \
+            if (memcmp(dst0, dst1, 4 * DST_SIZE))                         \
+                fail();                                                   \
+        }                                                                 \
+        bench_new(PLANE(dst1, 0, type), PLANE(dst1, 2, type),             \
+                  PLANE(dst1, 3, type), src0, MAX_WIDTH);                 \
+    } while (0)
+
+#define check_420(type)                                                   \
+    do {                                                                  \
+        int w;                                                            \
+        declare_func(void, type *y0, type *y1, type *u, type *v,          \
+                     const uint8_t *src0, const uint8_t *src1, int width); \
+                                                                          \
+        for (w = 2; w <= MAX_WIDTH; w += 2) {                             \
+            randomize_buffers();                                          \
+            call_ref(PLANE(dst0, 0, type), PLANE(dst0, 1, type),          \
+                     PLANE(dst0, 2, type), PLANE(dst0, 3, type),          \
+                     src0, src1, w);                                      \
+            call_new(PLANE(dst1, 0, type), PLANE(dst1, 1, type),          \
+                     PLANE(dst1, 2, type), PLANE(dst1, 3, type),          \
+                     src0, src1, w);                                      \
+            if (memcmp(dst0, dst1, 4 * DST_SIZE))                         \
+                fail();                                                   \
+        }                                                                 \
+        bench_new(PLANE(dst1, 0, type), PLANE(dst1, 1, type),             \
+                  PLANE(dst1, 2, type), PLANE(dst1, 3, type),             \
+                  src0, src1, MAX_WIDTH);                                 \
+    } while (0)
+
+void checkasm_check_decklink_unpack(void)
+{
+    LOCAL_ALIGNED_16(uint8_t, src0, [SRC_SIZE]);
+    LOCAL_ALIGNED_16(uint8_t, src1, [SRC_SIZE]);
+    LOCAL_ALIGNED_16(uint8_t, dst0, [4 * DST_SIZE]);
+    LOCAL_ALIGNED_16(uint8_t, dst1, [4 * DST_SIZE]);
+    DecklinkUnpackDSPContext h;
+
+    ff_decklink_unpack_dsp_init(&h);
+
+    if (check_func(h.uyvy_to_yuv422p, "uyvy_to_yuv422p"))
+        check_422(uint8_t);
+    if (check_func(h.uyvy_to_yuv420p, "uyvy_to_yuv420p"))
+        check_420(uint8_t);
+
+    report("uyvy");
+
+    if (check_func(h.v210_to_yuv422p10, "v210_to_yuv422p10"))
+        check_422(uint16_t);
+    if (check_func(h.v210_to_yuv420p10, "v210_to_yuv420p10"))
+        check_420(uint16_t);
+
+    report("v210");
+}
@@ -0,0 +1,118 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with FFmpeg; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+#include "checkasm.h"
+#include "libavfilter/vr_remap.h"
+#include "libavutil/common.h"
+#include "libavutil/internal.h"
+#include "libavutil/intreadwrite.h"
+
+#define SRC_W 67
+#define SRC_H 37
+#define MAX_LEN 128
+
+#define randomize_buffers()                                               \
+    do {                                                                  \
+        int i;                                                            \
+        for (i = 0; i < SRC_W * SRC_H; i++)                               \
+            src[i] = rnd();                                               \
+        for (i = 0; i < MAX_LEN; i++) {                                   \
+            xy[i]   = rnd() % (SRC_W - 1) | (rnd() % (SRC_H - 1)) << 16;  \
+            frac[i] = rnd();                                              \
+        }                                                                 \
+        for (i = 0; i < MAX_LEN; i += 4) {                                \
+            uint32_t r = rnd();                                           \
+            AV_WN32A(dst0 + i, r);                                        \
+            AV_WN32A(dst1 + i, r);                                        \
+        }                                                                 \
+    } while (0)
+
+void checkasm_check_vr_remap(void)
+{
+    LOCAL_ALIGNED_16(uint8_t, src, [SRC_W * SRC_H]);
+    LOCAL_ALIGNED_16(uint32_t, xy, [MAX_LEN]);
+    LOCAL_ALIGNED_16(uint16_t, frac, [MAX_LEN]);
+    LOCAL_ALIGNED_16(uint8_t, dst0, [MAX_LEN]);
+    LOCAL_ALIGNED_16(uint8_t, dst1, [MAX_LEN]);
+    LOCAL_ALIGNED_16(uint8_t, weight, [MAX_LEN]);
+    LOCAL_ALIGNED_16(int16_t, band0, [MAX_LEN]);
+    LOCAL_ALIGNED_16(int16_t, band1, [MAX_LEN]);
+    LOCAL_ALIGNED_16(int16_t, band2, [MAX_LEN]);
+    LOCAL_ALIGNED_16(int16_t, mask, [MAX_LEN]);
+    VRRemapDSPContext h;
+
+    ff_vr_remap_dsp_init(&h, 1, 8);
+
+    if (check_func(h.remap_line, "vr_remap_line")) {
+        int len;
+        declare_func(void, uint8_t *dst, const uint8_t *src, ptrdiff_t linesize,
+                     const uint32_t *xy, const uint16_t *frac, int len);
+
+        for (len = 1; len <= MAX_LEN; len++) {
+            randomize_buffers();
+            call_ref(dst0, src, SRC_W, xy, frac, len);
+            call_new(dst1, src, SRC_W, xy, frac, len);
+            if (memcmp(dst0, dst1, MAX_LEN))
+                fail();
+        }
+        bench_new(dst1, src, SRC_W, xy, frac, MAX_LEN);
+    }
+
+    report("remap_line");
+
+    if (check_func(h.blend_line, "vr_blend_line")) {
+        int len, i;
+        declare_func(void, uint8_t *dst, const uint8_t *src, const uint8_t *w, int len);
+
+        for (len = 1; len <= MAX_LEN; len++) {
+            for (i = 0; i < MAX_LEN; i++) {
+                dst0[i] = dst1[i] = rnd();
+                src[i]    = rnd();
+                weight[i] = rnd();
+            }
+            call_ref(dst0, src, weight, len);
+            call_new(dst1, src, weight, len);
+            if (memcmp(dst0, dst1, MAX_LEN))
+                fail();
+        }
+        bench_new(dst1, src, weight, MAX_LEN);
+    }
+
+    report("blend_line");
+
+    if (check_func(h.blend_bands, "vr_blend_bands")) {
+        int len, i;
+        declare_func(void, int16_t *a, const int16_t *b, const int16_t *m, int len);
+
+        for (len = 1; len <= MAX_LEN; len++) {
+            for (i = 0; i < MAX_LEN; i++) {
+                band0[i] = band1[i] = (int)(rnd() % 1021) - 510;
+                band2[i] = (int)(rnd() % 1021) - 510;
+                mask[i]  = rnd() % 257;
+            }
+            call_ref(band0, band2, mask, len);
+            call_new(band1, band2, mask, len);
+            if (memcmp(band0, band1, MAX_LEN * sizeof(*band0)))
+                fail();
+        }
+        bench_new(band1, band2, mask, MAX_LEN);
+    }
+
+    report("blend_bands");
+}
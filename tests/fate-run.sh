@@ -244,6 +244,54 @@ gapless(){
     do_md5sum $decfile3
 }
 
+hls(){
+    async=$1
+    shift
+    hlsdir="${outdir}/${test}.hls"
+    mkdir -p "$hlsdir"
+    for seg in $(grep -v '^#' $hlsdir/out.m3u8 2>/dev/null); do
+        rm -f $hlsdir/$seg
+    done
+    ffmpeg "$@" -flags +bitexact -fflags +bitexact -hls_async_io $async \
+        -hls_list_size 0 -f hls -y $(target_path $hlsdir)/out.m3u8 || return
+    cat $hlsdir/out.m3u8
+    for seg in $(grep -v '^#' $hlsdir/out.m3u8); do
+        (cd $hlsdir && do_md5sum $seg)
+        cleanfiles="$cleanfiles $hlsdir/$seg"
+    done
+    cleanfiles="$cleanfiles $hlsdir/out.m3u8"
+}
+
+hls_variants(){
+    hlsdir="${outdir}/${test}.hls"
+    mkdir -p "$hlsdir"
+    # not through ffmpeg(), which would split the spaces of -var_stream_map
+    run ffmpeg -nostdin -nostats -cpuflags $cpuflags "$@" \
+        -flags +bitexact -fflags +bitexact -hls_list_size 0 \
+        -hls_segment_filename $(target_path $hlsdir)/out_%v_%d.ts \
+        -master_pl_name master.m3u8 -f hls -y $(target_path $hlsdir)/out_%v.m3u8 || return
+    cat $hlsdir/master.m3u8
+    hls_starts0=
+    for pl in $(grep -v '^#' $hlsdir/master.m3u8); do
+        cat $hlsdir/$pl
+        hls_starts=
+        for seg in $(grep -v '^#' $hlsdir/$pl); do
+            hls_starts="$hls_starts $(run ffprobe -v 0 -select_streams v \
+                                      -show_entries stream=start_time -of csv=p=0 \
+                                      $(target_path $hlsdir/$seg) | head -n 1)"
+            cleanfiles="$cleanfiles $hlsdir/$seg"
+        done
+        cleanfiles="$cleanfiles $hlsdir/$pl"
+        echo "segment starts:$hls_starts"
+        test -n "$hls_starts0" || hls_starts0=$hls_starts
+        if [ "$hls_starts" != "$hls_starts0" ]; then
+            echo "segments of $pl not aligned with the first variant"
+            return 1
+        fi
+    done
+    cleanfiles="$cleanfiles $hlsdir/master.m3u8"
+}
+
 mkdir -p "$outdir"
 
 # Disable globbing: command arguments may contain globbing characters and
@@ -168,6 +168,25 @@ fate-filter-overlay_yuv444: CMD = framecrc -c:v pgmyuv -i $(SRC) -filter_complex
 FATE_FILTER_VSYNTH-$(CONFIG_PHASE_FILTER) += fate-filter-phase
 fate-filter-phase: CMD = framecrc -c:v pgmyuv -i $(SRC) -vf phase
 
+# pipelined graphs must output the same frames in the same order as without
+FATE_PIPELINE += fate-filter-pipeline
+fate-filter-pipeline: CMD = framecrc -c:v pgmyuv -i $(SRC) -vf pipeline,hflip,pipeline=queue=1,unsharp=5:5:1,pipeline
+
+FATE_PIPELINE += fate-filter-pipeline-off
+fate-filter-pipeline-off: CMD = framecrc -c:v pgmyuv -i $(SRC) -vf hflip,unsharp=5:5:1
+fate-filter-pipeline-off: REF = $(SRC_PATH)/tests/ref/fate/filter-pipeline
+
+FATE_FILTER_VSYNTH-$(call ALLYES, PIPELINE_FILTER HFLIP_FILTER UNSHARP_FILTER) += $(FATE_PIPELINE)
+
+FATE_PIPELINE_SPLIT += fate-filter-pipeline-split
+fate-filter-pipeline-split: CMD = framecrc -c:v pgmyuv -i $(SRC) -filter_complex "pipeline,split[a][b]\;[a]hflip[a1]\;[b]vflip,setpts=PTS+2/(25*TB)[b1]\;[a1][b1]hstack,pipeline=queue=1"
+
+FATE_PIPELINE_SPLIT += fate-filter-pipeline-split-off
+fate-filter-pipeline-split-off: CMD = framecrc -c:v pgmyuv -i $(SRC) -filter_complex "split[a][b]\;[a]hflip[a1]\;[b]vflip,setpts=PTS+2/(25*TB)[b1]\;[a1][b1]hstack"
+fate-filter-pipeline-split-off: REF = $(SRC_PATH)/tests/ref/fate/filter-pipeline-split
+
+FATE_FILTER_VSYNTH-$(call ALLYES, PIPELINE_FILTER SPLIT_FILTER HFLIP_FILTER VFLIP_FILTER SETPTS_FILTER HSTACK_FILTER) += $(FATE_PIPELINE_SPLIT)
+
 FATE_REMOVEGRAIN += fate-filter-removegrain-mode-00
 fate-filter-removegrain-mode-00: CMD = framecrc -c:v pgmyuv -i $(SRC) -vframes 1 -vf removegrain=0:0:0
 
@@ -291,6 +310,12 @@ FATE_FILTER_VSYNTH-$(CONFIG_TRIM_FILTER) += $(FATE_TRIM)
 FATE_FILTER_VSYNTH-$(CONFIG_UNSHARP_FILTER) += fate-filter-unsharp
 fate-filter-unsharp: CMD = framecrc -c:v pgmyuv -i $(SRC) -vf unsharp=11:11:-1.5:11:11:-1.5
 
+FATE_FILTER_VSYNTH-$(call ALLYES, CROP_FILTER VR_PROJECT_FILTER) += fate-filter-vr_project-c3x2-e
+fate-filter-vr_project-c3x2-e: CMD = framecrc -c:v pgmyuv -i $(SRC) -vf crop=348:288,vr_project=input=c3x2:output=e
+
+FATE_FILTER_VSYNTH-$(call ALLYES, FORMAT_FILTER VR_PROJECT_FILTER) += fate-filter-vr_project-e-eac-422
+fate-filter-vr_project-e-eac-422: CMD = framecrc -c:v pgmyuv -i $(SRC) -vf format=yuv422p,vr_project=output=eac
+
 FATE_FILTER-$(call ALLYES, SMJPEG_DEMUXER MJPEG_DECODER PERMS_FILTER HQDN3D_FILTER) += fate-filter-hqdn3d-sample
 fate-filter-hqdn3d-sample: tests/data/filtergraphs/hqdn3d
 fate-filter-hqdn3d-sample: CMD = framecrc -idct simple -i $(TARGET_SAMPLES)/smjpeg/scenwin.mjpg -filter_complex_script $(TARGET_PATH)/tests/data/filtergraphs/hqdn3d -an
@@ -0,0 +1,28 @@
+# The segments and playlists written from the background thread must be
+# the same as when they are written synchronously.
+FATE_HLSENC += fate-hls-async
+fate-hls-async: tests/data/asynth-44100-2.wav
+fate-hls-async: CMD = hls 1 -i $(TARGET_PATH)/tests/data/asynth-44100-2.wav -c:a mp2 -hls_time 1
+
+FATE_HLSENC += fate-hls-sync
+fate-hls-sync: tests/data/asynth-44100-2.wav
+fate-hls-sync: CMD = hls 0 -i $(TARGET_PATH)/tests/data/asynth-44100-2.wav -c:a mp2 -hls_time 1
+fate-hls-sync: REF = $(SRC_PATH)/tests/ref/fate/hls-async
+
+FATE_FFMPEG-$(call ALLYES, WAV_DEMUXER PCM_S16LE_DECODER MP2_ENCODER HLS_MUXER MPEGTS_MUXER) += $(FATE_HLSENC)
+
+# Two video variants sharing the audio stream, with a master playlist. Both
+# are cut on the same keyframes, so the video of their segments must start
+# at the same timestamps.
+FATE_HLSENC_VARIANTS += fate-hls-variants
+fate-hls-variants: ffprobe$(PROGSSUF)$(EXESUF)
+fate-hls-variants: CMD = hls_variants -f lavfi -i testsrc=d=5:s=176x144:r=25 -f lavfi -i sine=d=5 \
+    -map 0:v -map 0:v -map 1:a -c:v mpeg2video -g 12 -s:v:1 88x72 -b:v:0 400k -b:v:1 100k \
+    -c:a mp2 -b:a 64k -hls_time 1 -var_stream_map "v:0,a:0 v:1,a:0"
+
+FATE_FFMPEG-$(call ALLYES, LAVFI_INDEV TESTSRC_FILTER SINE_FILTER SCALE_FILTER   \
+                           MPEG2VIDEO_ENCODER MP2_ENCODER HLS_MUXER MPEGTS_MUXER \
+                           MPEGTS_DEMUXER MPEG2VIDEO_DECODER MP2_DECODER FFPROBE) \
+                           += $(FATE_HLSENC_VARIANTS)
+
+fate-hlsenc: $(FATE_HLSENC) $(FATE_HLSENC_VARIANTS)
@@ -2,5 +2,9 @@ FATE_LIBAVDEVICE-yes += fate-timefilter
 fate-timefilter: libavdevice/timefilter-test$(EXESUF)
 fate-timefilter: CMD = run libavdevice/timefilter-test
 
+FATE_LIBAVDEVICE-$(HAVE_PTHREADS) += fate-decklink-queue
+fate-decklink-queue: libavdevice/decklink_queue-test$(EXESUF)
+fate-decklink-queue: CMD = run libavdevice/decklink_queue-test
+
 FATE-$(CONFIG_AVDEVICE) += $(FATE_LIBAVDEVICE-yes)
 fate-libavdevice: $(FATE_LIBAVDEVICE-yes)
@@ -14,6 +14,16 @@ FATE_LIBAVFORMAT-yes += fate-srtp
 fate-srtp: libavformat/srtp-test$(EXESUF)
 fate-srtp: CMD = run libavformat/srtp-test
 
+ifdef HAVE_PTHREADS
+FATE_LIBAVFORMAT-$(call ALLYES, TEE_MUXER FRAMECRC_MUXER) += fate-tee
+endif
+fate-tee: libavformat/tee-test$(EXESUF)
+fate-tee: CMD = run libavformat/tee-test
+
+FATE_LIBAVFORMAT-$(CONFIG_UDP_PROTOCOL) += fate-udp
+fate-udp: libavformat/udp-test$(EXESUF)
+fate-udp: CMD = run libavformat/udp-test
+
 FATE_LIBAVFORMAT-yes += fate-url
 fate-url: libavformat/url-test$(EXESUF)
 fate-url: CMD = run libavformat/url-test
@@ -0,0 +1,201 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Loopback benchmark of the UDP protocol receive path.
+ *
+ * Datagrams are sent to a udp:// input opened on 127.0.0.1 at rates
+ * doubling from -r packets per second, while another thread reads them.
+ * For every rate the received rate, the circular buffer overruns and the
+ * kernel drops are printed; the highest rate without loss is reported as
+ * the sustainable packet rate.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#include "libavutil/intreadwrite.h"
+#include "libavutil/opt.h"
+#include "libavutil/time.h"
+#include "libavformat/avformat.h"
+
+#if HAVE_PTHREADS
+typedef struct Reader {
+    AVIOContext *in;
+    int size;
+    volatile int quit;
+    volatile int64_t bytes;
+} Reader;
+
+static void *reader_thread(void *arg)
+{
+    Reader *r = arg;
+    uint8_t buf[65536];
+
+    while (!r->quit) {
+        int ret = avio_read(r->in, buf, r->size);
+        if (ret > 0)
+            r->bytes += ret;
+        else if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF)
+            break;
+    }
+    return NULL;
+}
+
+static int64_t get_counter(AVIOContext *in, const char *name)
+{
+    int64_t val = 0;
+    av_opt_get_int(in, name, AV_OPT_SEARCH_CHILDREN, &val);
+    return val;
+}
+#endif
+
+static int usage(const char *argv0, int ret)
+{
+    fprintf(stderr, "%s [-p port] [-s size] [-r start_rate] [-m max_rate] "
+            "[-d seconds] [-o input_options] [-w output_options]\n", argv0);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    int port = 12345, size = 1316, i;
+    double duration = 2;
+    int64_t start_rate = 20000, max_rate = 4000000;
+    const char *in_opts = "fifo_size=50000&overrun_nonfatal=1";
+    const char *out_opts = "send_batch=32";
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            size = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            start_rate = strtoll(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+            max_rate = strtoll(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+            duration = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            in_opts = argv[++i];
+        } else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+            out_opts = argv[++i];
+        } else {
+            return usage(argv[0], 1);
+        }
+    }
+    if (size <= 0 || size > 65507 || start_rate <= 0 || duration <= 0)
+        return usage(argv[0], 1);
+
+#if HAVE_PTHREADS
+    {
+    char in_url[1024], out_url[1024];
+    AVIOContext *out;
+    Reader r = { 0 };
+    pthread_t thread;
+    uint8_t *buf;
+    int64_t rate, sustained = 0;
+    int ret;
+
+    av_register_all();
+    avformat_network_init();
+
+    r.size = size;
+    snprintf(in_url, sizeof(in_url), "udp://127.0.0.1:%d?%s", port, in_opts);
+    snprintf(out_url, sizeof(out_url), "udp://127.0.0.1:%d?pkt_size=%d&%s",
+             port, size, out_opts);
+    if ((ret = avio_open2(&r.in, in_url, AVIO_FLAG_READ, NULL, NULL)) < 0) {
+        fprintf(stderr, "Unable to open %s: %s\n", in_url, av_err2str(ret));
+        return 1;
+    }
+    if ((ret = avio_open2(&out, out_url, AVIO_FLAG_WRITE, NULL, NULL)) < 0) {
+        fprintf(stderr, "Unable to open %s: %s\n", out_url, av_err2str(ret));
+        avio_closep(&r.in);
+        return 1;
+    }
+    if (!(buf = av_mallocz(size)) ||
+        pthread_create(&thread, NULL, reader_thread, &r)) {
+        fprintf(stderr, "Unable to start the reader\n");
+        return 1;
+    }
+
+    printf("%10s %12s %12s %10s %12s\n",
+           "rate", "received/s", "lost", "overruns", "kernel_drops");
+    for (rate = start_rate; rate <= max_rate; rate *= 2) {
+        /* a multiple of any send_batch, so that nothing stays queued */
+        int64_t sent = 0, total = FFALIGN((int64_t)(rate * duration), 1024);
+        int64_t bytes    = r.bytes;
+        int64_t overruns = get_counter(r.in, "overruns");
+        int64_t drops    = get_counter(r.in, "kernel_drops");
+        int64_t start    = av_gettime_relative(), elapsed, received;
+
+        /* send in 1 ms slices, sleeping until each one is due */
+        while (sent < total) {
+            int64_t due = av_rescale(sent, 1000000, rate) + start;
+            int64_t now = av_gettime_relative();
+            if (due > now) {
+                av_usleep(due - now);
+                continue;
+            }
+            for (i = 0; i < FFMAX(rate / 1000, 1) && sent < total; i++, sent++) {
+                AV_WB64(buf, sent);
+                avio_write(out, buf, size);
+            }
+            avio_flush(out);
+        }
+        elapsed = av_gettime_relative() - start;
+        /* let the reader catch up */
+        av_usleep(200000);
+
+        received = (r.bytes - bytes) / size;
+        printf("%10"PRId64" %12"PRId64" %12"PRId64" %10"PRId64" %12"PRId64"\n",
+               rate, received * 1000000 / FFMAX(elapsed, 1), total - received,
+               get_counter(r.in, "overruns") - overruns,
+               get_counter(r.in, "kernel_drops") - drops);
+        fflush(stdout);
+        if (received < total)
+            break;
+        if (elapsed > duration * 1050000) {
+            printf("the sender cannot keep up with %"PRId64" packets/s\n", rate);
+            break;
+        }
+        sustained = rate;
+    }
+    printf("sustainable rate: %"PRId64" packets/s of %d bytes\n", sustained, size);
+
+    r.quit = 1;
+    /* wake the reader if it is waiting for data */
+    avio_write(out, buf, size);
+    avio_closep(&out);
+    pthread_join(thread, NULL);
+    avio_closep(&r.in);
+    av_free(buf);
+    avformat_network_deinit();
+    return 0;
+    }
+#else
+    fprintf(stderr, "%s requires threads\n", argv[0]);
+    return 1;
+#endif
+}
@@ -0,0 +1,258 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Arrival jitter of a UDP stream, typically MPEG-TS sent by the udp
+ * protocol with or without the bitrate option.
+ *
+ * Datagrams are received on a port and timestamped on arrival, by the
+ * kernel when possible. Printed are the inter-arrival times, the delay
+ * variation against a constant bitrate schedule (the buffer a receiver
+ * needs to absorb the bursts) and, for MPEG-TS, the variation of the
+ * arrival times against the PCRs of the first PCR PID.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "libavutil/common.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/mathematics.h"
+#include "libavutil/time.h"
+
+#define TS_PACKET_SIZE 188
+#define PCR_WRAP       (300LL << 33)
+
+#if defined(SO_TIMESTAMP) && !defined(SCM_TIMESTAMP)
+#define SCM_TIMESTAMP SO_TIMESTAMP
+#endif
+
+typedef struct Stats {
+    int64_t nb, min, max;
+    double sum, sum2;
+} Stats;
+
+static void stats_add(Stats *st, int64_t v)
+{
+    if (!st->nb || v < st->min)
+        st->min = v;
+    if (!st->nb || v > st->max)
+        st->max = v;
+    st->sum  += v;
+    st->sum2 += (double)v * v;
+    st->nb++;
+}
+
+static void stats_print(const char *name, const Stats *st)
+{
+    double mean = st->sum / st->nb;
+    printf("%-24s min %8"PRId64" mean %10.1f max %8"PRId64" stddev %10.1f us\n",
+           name, st->min, mean, st->max,
+           sqrt(FFMAX(st->sum2 / st->nb - mean * mean, 0)));
+}
+
+/* Arrival time of the last datagram received, in microseconds. */
+static int64_t arrival_time(struct msghdr *msg)
+{
+#ifdef SO_TIMESTAMP
+    struct cmsghdr *cmsg;
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMP) {
+            struct timeval tv;
+            memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+            return tv.tv_sec * 1000000LL + tv.tv_usec;
+        }
+    }
+#endif
+    return av_gettime();
+}
+
+/* PCR of a TS packet in 27 MHz units, or -1 if it has none. */
+static int64_t get_pcr(const uint8_t *p, int *pid)
+{
+    if (p[0] != 0x47 || !(p[3] & 0x20) || p[4] < 7 || !(p[5] & 0x10))
+        return -1;
+    *pid = AV_RB16(p + 1) & 0x1fff;
+    return (AV_RB32(p + 6) * 2LL + (p[10] >> 7)) * 300 +
+           (AV_RB16(p + 10) & 0x1ff);
+}
+
+static int usage(const char *argv0, int ret)
+{
+    fprintf(stderr, "%s [-p port] [-d seconds] [-b bitrate] [-s rcvbuf]\n"
+            "  -b  bitrate of the constant bitrate schedule, the average by default\n",
+            argv0);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    int port = 12345, rcvbuf = 4000000, fd, i;
+    int pcr_pid = -1;
+    double duration = 10;
+    int64_t bitrate = 0;
+    int64_t *arrivals = NULL, *bits = NULL;
+    int nb = 0, nb_alloc = 0;
+    int64_t first_pcr = -1, pcr_base = 0, last_pcr = -1, bytes = 0;
+    Stats iat = { 0 }, pcr_offset = { 0 };
+    struct sockaddr_in addr = { 0 };
+    struct timeval timeout = { 1, 0 };
+    uint8_t buf[65536];
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+            duration = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+            bitrate = strtoll(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            rcvbuf = atoi(argv[++i]);
+        } else {
+            return usage(argv[0], 1);
+        }
+    }
+    if (duration <= 0 || bitrate < 0)
+        return usage(argv[0], 1);
+
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        perror("socket");
+        return 1;
+    }
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        return 1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+#ifdef SO_TIMESTAMP
+    {
+        int on = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on)) < 0)
+            perror("setsockopt(SO_TIMESTAMP)");
+    }
+#endif
+
+    fprintf(stderr, "Waiting for datagrams on port %d\n", port);
+    while (1) {
+        uint8_t control[256];
+        struct iovec iov = { buf, sizeof(buf) };
+        struct msghdr msg = { 0 };
+        int64_t t;
+        int len;
+
+        msg.msg_iov        = &iov;
+        msg.msg_iovlen     = 1;
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+        len = recvmsg(fd, &msg, 0);
+        if (len < 0) {
+            /* stop once the stream has ended */
+            if (nb)
+                break;
+            continue;
+        }
+        t = arrival_time(&msg);
+        if (nb && t - arrivals[0] > duration * 1000000)
+            break;
+
+        if (nb == nb_alloc) {
+            nb_alloc = FFMAX(2 * nb_alloc, 1024);
+            arrivals = realloc(arrivals, nb_alloc * sizeof(*arrivals));
+            bits     = realloc(bits,     nb_alloc * sizeof(*bits));
+            if (!arrivals || !bits) {
+                fprintf(stderr, "Out of memory\n");
+                return 1;
+            }
+        }
+        if (nb)
+            stats_add(&iat, t - arrivals[nb - 1]);
+        arrivals[nb] = t;
+        bits[nb]     = bytes * 8;
+        bytes       += len;
+        nb++;
+
+        for (i = 0; i + TS_PACKET_SIZE <= len; i += TS_PACKET_SIZE) {
+            int pid;
+            int64_t pcr = get_pcr(buf + i, &pid);
+
+            if (pcr < 0 || (pcr_pid >= 0 && pid != pcr_pid))
+                continue;
+            pcr_pid = pid;
+            /* unwrap, assuming no discontinuity */
+            if (last_pcr >= 0 && pcr + pcr_base < last_pcr - PCR_WRAP / 2)
+                pcr_base += PCR_WRAP;
+            last_pcr = pcr + pcr_base;
+            if (first_pcr < 0)
+                first_pcr = last_pcr;
+            stats_add(&pcr_offset,
+                      t - arrivals[0] - (last_pcr - first_pcr) / 27);
+        }
+    }
+    close(fd);
+
+    if (nb < 2) {
+        fprintf(stderr, "Not enough datagrams received\n");
+        return 1;
+    }
+
+    {
+        int64_t span = arrivals[nb - 1] - arrivals[0];
+        /* the bits of the last datagram are not part of the span */
+        int64_t avg  = av_rescale(bits[nb - 1], 1000000, FFMAX(span, 1));
+        int64_t min_delay = 0, max_delay = 0;
+
+        if (!bitrate)
+            bitrate = avg;
+        for (i = 0; i < nb; i++) {
+            int64_t d = arrivals[i] - arrivals[0] -
+                        av_rescale(bits[i], 1000000, bitrate);
+            min_delay = FFMIN(min_delay, d);
+            max_delay = FFMAX(max_delay, d);
+        }
+
+        printf("datagrams %d, bytes %"PRId64", duration %.3f s, average %"PRId64" bits/s\n",
+               nb, bytes, span / 1000000.0, avg);
+        stats_print("inter-arrival", &iat);
+        printf("%-24s %8"PRId64" us at %"PRId64" bits/s, %"PRId64" bytes of buffer\n",
+               "delay variation", max_delay - min_delay, bitrate,
+               av_rescale(max_delay - min_delay, bitrate, 8000000));
+        if (pcr_offset.nb) {
+            printf("%-24s %8"PRId64" us over %"PRId64" PCRs of PID 0x%x\n",
+                   "PCR arrival jitter", pcr_offset.max - pcr_offset.min,
+                   pcr_offset.nb, pcr_pid);
+        }
+    }
+
+    free(arrivals);
+    free(bits);
+    return 0;
+}